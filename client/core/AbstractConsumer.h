@@ -15,6 +15,7 @@ public:
 	virtual ~AbstractConsumer();
 
 	virtual void consume(const QString &channel, const QString &cmd, const QJsonObject &data) = 0;
+	/// Called after reconnecting if the core was unable to resume our session, anything that was fetched before should be fetched again
 	virtual void connectionEstablished() {}
 
 	QStringList channels() const { return m_channels; }
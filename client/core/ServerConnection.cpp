@@ -1,18 +1,40 @@
 #include "ServerConnection.h"
 
 #include <QTcpSocket>
+#include <QLocalSocket>
 
 #include "common/Json.h"
+#include "common/JsonWriter.h"
 #include "common/TcpUtils.h"
+#ifdef TALKTALK_CLIENT_SHM
+# include "common/ShmChannel.h"
+#endif
 #include "AbstractConsumer.h"
 
 ServerConnection::ServerConnection(const QString &host, const quint16 port, QObject *parent)
 	: QObject(parent), m_host(host), m_port(port)
 {
-	m_socket = new QTcpSocket(this);
-	connect(m_socket, &QTcpSocket::stateChanged, this, &ServerConnection::socketChangedState);
-	connect(m_socket, static_cast<void(QTcpSocket::*)(QAbstractSocket::SocketError)>(&QTcpSocket::error), this, &ServerConnection::socketError);
-	connect(m_socket, &QTcpSocket::readyRead, this, &ServerConnection::socketDataReady);
+	if (m_host.startsWith("shm:"))
+	{
+		// the channel gets created when connecting
+		m_socket = nullptr;
+		return;
+	}
+	else if (m_host.startsWith("unix:"))
+	{
+		m_localSocket = new QLocalSocket(this);
+		connect(m_localSocket, &QLocalSocket::stateChanged, this, &ServerConnection::localSocketChangedState);
+		connect(m_localSocket, static_cast<void(QLocalSocket::*)(QLocalSocket::LocalSocketError)>(&QLocalSocket::error), this, &ServerConnection::socketError);
+		m_socket = m_localSocket;
+	}
+	else
+	{
+		m_tcpSocket = new QTcpSocket(this);
+		connect(m_tcpSocket, &QTcpSocket::stateChanged, this, &ServerConnection::socketChangedState);
+		connect(m_tcpSocket, static_cast<void(QTcpSocket::*)(QAbstractSocket::SocketError)>(&QTcpSocket::error), this, &ServerConnection::socketError);
+		m_socket = m_tcpSocket;
+	}
+	connect(m_socket, &QIODevice::readyRead, this, &ServerConnection::socketDataReady);
 }
 
 ServerConnection::~ServerConnection()
@@ -43,11 +65,52 @@ void ServerConnection::unregisterConsumer(AbstractConsumer *consumer)
 
 void ServerConnection::connectToHost()
 {
-	m_socket->connectToHost(m_host, m_port);
+	if (m_host.startsWith("shm:"))
+	{
+#ifdef TALKTALK_CLIENT_SHM
+		emit message(tr("Connecting to host..."));
+		try
+		{
+			m_shmChannel = ShmChannel::connectTo(m_host.mid(4), this);
+		}
+		catch (Exception &e)
+		{
+			emit message(tr("Socket error: %1").arg(e.message()));
+			emit message(tr("Lost connection to host"));
+			emit disconnected();
+			return;
+		}
+		connect(m_shmChannel, &ShmChannel::readyRead, this, &ServerConnection::shmDataReady);
+		connect(m_shmChannel, &ShmChannel::disconnected, this, &ServerConnection::shmDisconnected);
+		connectionEstablished();
+#else
+		emit message(tr("Shared memory connections are not supported on this platform"));
+		emit disconnected();
+#endif
+	}
+	else if (m_localSocket)
+	{
+		m_localSocket->connectToServer(m_host.mid(5));
+	}
+	else
+	{
+		m_tcpSocket->connectToHost(m_host, m_port);
+	}
 }
 void ServerConnection::disconnectFromHost()
 {
-	m_socket->disconnectFromHost();
+	if (m_shmChannel)
+	{
+		shmDisconnected();
+	}
+	else if (m_localSocket)
+	{
+		m_localSocket->disconnectFromServer();
+	}
+	else if (m_tcpSocket)
+	{
+		m_tcpSocket->disconnectFromHost();
+	}
 }
 
 void ServerConnection::subscribeConsumerTo(AbstractConsumer *consumer, const QString &channel)
@@ -60,7 +123,7 @@ void ServerConnection::subscribeConsumerTo(AbstractConsumer *consumer, const QSt
 		}
 		else
 		{
-			sendFromConsumer(channel, "subscribe", {}, QUuid());
+			queueSubscription(channel, true);
 		}
 	}
 	m_subscriptions[channel].append(consumer);
@@ -76,36 +139,116 @@ void ServerConnection::unsubscribeConsumerFrom(AbstractConsumer *consumer, const
 		}
 		else
 		{
-			sendFromConsumer(channel, "unsubscribe", {}, QUuid());
+			queueSubscription(channel, false);
 		}
 		m_subscriptions.remove(channel);
 	}
 }
 void ServerConnection::sendFromConsumer(const QString &channel, const QString &cmd, const QJsonObject &data, const QUuid &replyTo)
 {
-	QJsonObject obj = data;
-	obj["channel"] = channel;
-	obj["cmd"] = cmd;
-	obj["msgId"] = Json::toJson(QUuid::createUuid());
-	if (!replyTo.isNull())
+	flushSubscriptions();
+	send(channel, cmd, data, replyTo);
+}
+void ServerConnection::send(const QString &channel, const QString &cmd, const QJsonObject &data, const QUuid &replyTo)
+{
+	QByteArray packet;
+	Json::encodeMessage(packet, channel, cmd, data, QUuid::createUuid(), replyTo);
+
+	qDebug() << "sending" << packet;
+	if (isConnected())
+	{
+		writePacket(packet);
+	}
+	else
+	{
+		m_messageQueue.append(packet);
+	}
+}
+
+void ServerConnection::queueSubscription(const QString &channel, const bool subscribe)
+{
+	QStringList &same = subscribe ? m_pendingSubscribes : m_pendingUnsubscribes;
+	QStringList &opposite = subscribe ? m_pendingUnsubscribes : m_pendingSubscribes;
+	// subscribing and unsubscribing within the same tick cancel each other out
+	if (!opposite.removeOne(channel))
+	{
+		same.append(channel);
+	}
+	if (!m_flushScheduled)
 	{
-		obj["replyTo"] = Json::toJson(replyTo);
+		m_flushScheduled = true;
+		QMetaObject::invokeMethod(this, "flushSubscriptions", Qt::QueuedConnection);
 	}
+}
+void ServerConnection::flushSubscriptions()
+{
+	m_flushScheduled = false;
+	if (!m_pendingUnsubscribes.isEmpty())
+	{
+		send("", "unsubscribe", {{"channels", QJsonArray::fromStringList(m_pendingUnsubscribes)}}, QUuid());
+		m_pendingUnsubscribes.clear();
+	}
+	if (!m_pendingSubscribes.isEmpty())
+	{
+		send("", "subscribe", {{"channels", QJsonArray::fromStringList(m_pendingSubscribes)}}, QUuid());
+		m_pendingSubscribes.clear();
+	}
+}
 
-	qDebug() << "sending" << obj;
-	if (m_socket->state() == QTcpSocket::ConnectedState)
+bool ServerConnection::isConnected() const
+{
+	if (m_host.startsWith("shm:"))
 	{
-		TcpUtils::writePacket(m_socket, Json::toBinary(obj));
+		// only exists while connected
+		return m_shmChannel;
+	}
+	else if (m_localSocket)
+	{
+		return m_localSocket->state() == QLocalSocket::ConnectedState;
 	}
 	else
 	{
-		m_messageQueue.append(Json::toBinary(obj));
+		return m_tcpSocket->state() == QTcpSocket::ConnectedState;
+	}
+}
+void ServerConnection::connectionEstablished()
+{
+	emit message(tr("Connected!"));
+	emit connected();
+	if (!m_sessionToken.isNull())
+	{
+		// has to go out before anything else, so that the core knows who we are
+		QJsonObject resume{{"token", Json::toJson(m_sessionToken)}};
+		if (!m_lastMsgId.isNull())
+		{
+			resume.insert("lastMsgId", Json::toJson(m_lastMsgId));
+		}
+		send("", "resume", resume, QUuid());
+	}
+	for (const QByteArray &msg : m_messageQueue)
+	{
+		writePacket(msg);
+	}
+	m_messageQueue.clear();
+}
+void ServerConnection::writePacket(const QByteArray &packet)
+{
+#ifdef TALKTALK_CLIENT_SHM
+	if (m_shmChannel)
+	{
+		m_shmChannel->send(packet);
+		return;
+	}
+#endif
+	if (m_socket)
+	{
+		TcpUtils::writePacket(m_socket, packet);
 	}
 }
 
 void ServerConnection::socketChangedState()
 {
-	switch (m_socket->state())
+	switch (m_tcpSocket->state())
 	{
 	case QAbstractSocket::UnconnectedState:
 		emit message(tr("Lost connection to host"));
@@ -118,12 +261,7 @@ void ServerConnection::socketChangedState()
 		emit message(tr("Connecting to host..."));
 		break;
 	case QAbstractSocket::ConnectedState:
-		emit message(tr("Connected!"));
-		emit connected();
-		for (const QByteArray &msg : m_messageQueue)
-		{
-			TcpUtils::writePacket(m_socket, msg);
-		}
+		connectionEstablished();
 		break;
 	case QAbstractSocket::BoundState:
 		break;
@@ -133,43 +271,148 @@ void ServerConnection::socketChangedState()
 		break;
 	}
 }
+void ServerConnection::localSocketChangedState()
+{
+	switch (m_localSocket->state())
+	{
+	case QLocalSocket::UnconnectedState:
+		emit message(tr("Lost connection to host"));
+		emit disconnected();
+		break;
+	case QLocalSocket::ConnectingState:
+		emit message(tr("Connecting to host..."));
+		break;
+	case QLocalSocket::ConnectedState:
+		connectionEstablished();
+		break;
+	case QLocalSocket::ClosingState:
+		break;
+	}
+}
 void ServerConnection::socketError()
 {
-	emit message(tr("Socket error: %1").arg(m_socket->errorString()));
+	if (m_socket)
+	{
+		emit message(tr("Socket error: %1").arg(m_socket->errorString()));
+	}
 }
 void ServerConnection::socketDataReady()
 {
-	using namespace Json;
+	while (m_socket && m_socket->bytesAvailable() > 0)
+	{
+		handlePacket(TcpUtils::readPacket(m_socket));
+	}
+}
+void ServerConnection::shmDataReady()
+{
+#ifdef TALKTALK_CLIENT_SHM
+	QByteArray packet;
+	try
+	{
+		while (m_shmChannel && m_shmChannel->receive(&packet))
+		{
+			handlePacket(packet);
+		}
+	}
+	catch (ShmException &e)
+	{
+		emit message(tr("Socket error: %1").arg(e.message()));
+		shmDisconnected();
+	}
+#endif
+}
+void ServerConnection::shmDisconnected()
+{
+	if (m_shmChannel)
+	{
+#ifdef TALKTALK_CLIENT_SHM
+		// we might be inside one of its signals
+		m_shmChannel->deleteLater();
+#endif
+		m_shmChannel = nullptr;
+	}
+	emit message(tr("Lost connection to host"));
+	emit disconnected();
+}
 
-	while (m_socket->bytesAvailable() > 0)
+void ServerConnection::sessionLost()
+{
+	// the core has no idea what we're interested in, so start over
+	for (const QString &channel : m_subscriptions.keys())
 	{
-		QString channel;
-		QUuid messageId;
-		try
+		if (channel == "*")
+		{
+			send("general", "monitor", {{"value", true}}, QUuid());
+		}
+		else
 		{
-			const QJsonObject obj = ensureObject(ensureDocument(TcpUtils::readPacket(m_socket)));
-			channel = ensureString(obj, "channel");
-			messageId = ensureUuid(obj, "msgId");
-			const QString cmd = ensureString(obj, "cmd");
-			qDebug() << "Got" << cmd << "on" << channel << ":" << obj;
+			queueSubscription(channel, true);
+		}
+	}
+	flushSubscriptions();
+	for (AbstractConsumer *consumer : m_consumers)
+	{
+		consumer->connectionEstablished();
+	}
+}
 
-			QList<AbstractConsumer *> notifiedConsumers;
-			for (AbstractConsumer *consumer : m_subscriptions[channel])
-			{
-				consumer->consume(channel, cmd, obj);
-				notifiedConsumers += consumer;
-			}
-			for (AbstractConsumer *consumer : m_subscriptions["*"])
+void ServerConnection::handlePacket(const QByteArray &packet)
+{
+	using namespace Json;
+
+	QString channel;
+	QUuid messageId;
+	try
+	{
+		const QJsonObject obj = ensureObject(ensureDocument(packet));
+		channel = ensureString(obj, "channel");
+		const QString cmd = ensureString(obj, "cmd");
+		if (cmd == "ping" && channel.isEmpty())
+		{
+			// heartbeat from the core, which drops us if we don't answer
+			send("", "pong", {{"timestamp", obj.value("timestamp")}}, QUuid());
+			return;
+		}
+		else if (channel.isEmpty() && (cmd == "session" || cmd == "resume" || cmd == "resume:error"))
+		{
+			// a fresh session is announced on every new connection, the answer to a resume comes after that
+			m_sessionToken = ensureUuid(obj, "token", QUuid());
+			if (cmd == "resume:error")
 			{
-				if (!notifiedConsumers.contains(consumer))
-				{
-					consumer->consume(channel, cmd, obj);
-				}
+				emit message(tr("Unable to resume session: %1").arg(ensureString(obj, "error", QString())));
+				sessionLost();
 			}
+			return;
 		}
-		catch (Exception &e)
+		messageId = ensureUuid(obj, "msgId");
+		if (m_recentMsgIds.contains(messageId))
+		{
+			return;
+		}
+		m_recentMsgIds.append(messageId);
+		if (m_recentMsgIds.size() > 256)
+		{
+			m_recentMsgIds.removeFirst();
+		}
+		m_lastMsgId = messageId;
+		qDebug() << "Got" << cmd << "on" << channel << ":" << obj;
+
+		QList<AbstractConsumer *> notifiedConsumers;
+		for (AbstractConsumer *consumer : m_subscriptions[channel])
+		{
+			consumer->consume(channel, cmd, obj);
+			notifiedConsumers += consumer;
+		}
+		for (AbstractConsumer *consumer : m_subscriptions["*"])
 		{
-			sendFromConsumer(channel, "error", {{"error", e.message()}}, messageId);
+			if (!notifiedConsumers.contains(consumer))
+			{
+				consumer->consume(channel, cmd, obj);
+			}
 		}
 	}
+	catch (Exception &e)
+	{
+		sendFromConsumer(channel, "error", {{"error", e.message()}}, messageId);
+	}
 }
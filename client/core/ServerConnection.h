@@ -3,8 +3,13 @@
 #include <QObject>
 #include <QHash>
 #include <QVector>
+#include <QStringList>
+#include <QUuid>
 
+class QIODevice;
 class QTcpSocket;
+class QLocalSocket;
+class ShmChannel;
 class QHostAddress;
 class AbstractConsumer;
 
@@ -12,6 +17,8 @@ class ServerConnection : public QObject
 {
 	Q_OBJECT
 public:
+	/// Connects over TCP, through a local socket if host is given as unix:<name or path>, or through shared memory
+	/// if given as shm:<name or path> of the rendezvous socket (port is ignored for the latter two)
 	explicit ServerConnection(const QString &host, const quint16 port, QObject *parent);
 	~ServerConnection();
 
@@ -32,9 +39,23 @@ private:
 	void subscribeConsumerTo(AbstractConsumer *consumer, const QString &channel);
 	void unsubscribeConsumerFrom(AbstractConsumer *consumer, const QString &channel);
 	void sendFromConsumer(const QString &channel, const QString &cmd, const QJsonObject &data, const QUuid &replyTo);
+	void send(const QString &channel, const QString &cmd, const QJsonObject &data, const QUuid &replyTo);
+
+	/// (Un)subscriptions are collected until control returns to the event loop, and then sent in one message each
+	void queueSubscription(const QString &channel, const bool subscribe);
+
+	bool isConnected() const;
+	void connectionEstablished();
+	void writePacket(const QByteArray &packet);
+	void handlePacket(const QByteArray &packet);
 
 private slots:
+	/// Also called before anything else is sent, so that replies don't arrive on channels we're not subscribed to yet
+	void flushSubscriptions();
 	void socketChangedState();
+	void localSocketChangedState();
+	void shmDataReady();
+	void shmDisconnected();
 	void socketError();
 	void socketDataReady();
 
@@ -42,7 +63,18 @@ private:
 	QList<QByteArray> m_messageQueue;
 	QString m_host;
 	quint16 m_port;
-	QTcpSocket *m_socket;
+	QIODevice *m_socket;
+	QTcpSocket *m_tcpSocket = nullptr;
+	QLocalSocket *m_localSocket = nullptr;
+	ShmChannel *m_shmChannel = nullptr;
 	QHash<QString, QVector<AbstractConsumer *>> m_subscriptions;
+	QStringList m_pendingSubscribes;
+	QStringList m_pendingUnsubscribes;
+	bool m_flushScheduled = false;
+
+	QUuid m_sessionToken;
+	QUuid m_lastMsgId; ///< Of the last message received, to let the core know where to resume from
+	QList<QUuid> m_recentMsgIds; ///< After resuming the core might send a message twice
+	void sessionLost();
 	QList<AbstractConsumer *> m_consumers;
 };
@@ -34,6 +34,7 @@ signals:
 
 private:
 	void consume(const QString &channel, const QString &cmd, const QJsonObject &data) override;
+	void connectionEstablished() override { refetch(); }
 	QString m_channel;
 	QString m_cmdPrefix;
 	QString m_indexProperty;
@@ -164,18 +164,24 @@ void FS::chunkedTransfer(QIODevice *from, QIODevice *to)
 {
 	Q_ASSERT(from->isReadable() && to->isWritable());
 
-	static constexpr qint64 bufferSize = 1024 * 1024;
-	qint64 remaining = from->bytesAvailable();
-	char buffer[bufferSize];
-	while (remaining > 0)
-	{
-		const qint64 currentChunkSize = std::min(bufferSize, remaining);
-		const qint64 actualSize = from->read(buffer, currentChunkSize);
-		Q_ASSERT(currentChunkSize == actualSize);
-		if (currentChunkSize != to->write(buffer, currentChunkSize))
+	// on the heap, a megabyte is more than some threads have for their whole stack
+	static constexpr int bufferSize = 64 * 1024;
+	QByteArray buffer(bufferSize, Qt::Uninitialized);
+	// until there is nothing left rather than for bytesAvailable(), which not every device knows up front
+	while (true)
+	{
+		const qint64 size = from->read(buffer.data(), bufferSize);
+		if (size < 0)
+		{
+			throw FileSystemException(QString("Error during chunked transfer: %1").arg(from->errorString()));
+		}
+		if (size == 0)
+		{
+			break;
+		}
+		if (size != to->write(buffer.constData(), size))
 		{
 			throw FileSystemException(QString("Error during chunked transfer: %1").arg(to->errorString()));
 		}
-		remaining -= currentChunkSize;
 	}
 }
@@ -37,10 +37,10 @@ QByteArray Json::toText(const QJsonArray &array)
 	return QJsonDocument(array).toJson(QJsonDocument::Compact);
 }
 
-static bool isBinaryJson(const QByteArray &data)
+bool Json::isBinaryJson(const QByteArray &data)
 {
 	decltype(QJsonDocument::BinaryFormatTag) tag = QJsonDocument::BinaryFormatTag;
-	return memcmp(data.constData(), &tag, sizeof(QJsonDocument::BinaryFormatTag)) == 0;
+	return data.size() >= int(sizeof(tag)) && memcmp(data.constData(), &tag, sizeof(QJsonDocument::BinaryFormatTag)) == 0;
 }
 QJsonDocument Json::ensureDocument(const QByteArray &data)
 {
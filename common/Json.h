@@ -29,6 +29,7 @@ QByteArray toBinary(const QJsonArray &array);
 QByteArray toText(const QJsonObject &obj);
 QByteArray toText(const QJsonArray &array);
 
+bool isBinaryJson(const QByteArray &data);
 QJsonDocument ensureDocument(const QByteArray &data);
 QJsonDocument ensureDocument(const QString &filename);
 QJsonObject ensureObject(const QJsonDocument &doc, const QString &what = "Document");
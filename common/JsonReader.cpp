@@ -0,0 +1,539 @@
+// Licensed under the Apache-2.0 license. See README.md for details.
+
+#include "JsonReader.h"
+
+#include <QJsonDocument>
+#include <QJsonArray>
+#include <QtAlgorithms>
+#include <string.h>
+
+#ifdef __SSE2__
+#include <emmintrin.h>
+#endif
+
+#include "Json.h"
+
+static constexpr int blockSize = 16;
+
+struct BlockMasks
+{
+	quint32 quotes;
+	quint32 backslashes;
+	quint32 structurals;
+};
+
+/// One bit per byte of block for each of the characters that matter for finding the structure
+static inline BlockMasks classify(const char *block)
+{
+	BlockMasks masks;
+#ifdef __SSE2__
+	const __m128i chunk = _mm_loadu_si128(reinterpret_cast<const __m128i *>(block));
+	masks.quotes = _mm_movemask_epi8(_mm_cmpeq_epi8(chunk, _mm_set1_epi8('"')));
+	masks.backslashes = _mm_movemask_epi8(_mm_cmpeq_epi8(chunk, _mm_set1_epi8('\\')));
+	// '[' and ']' only differ from '{' and '}' by 0x20
+	const __m128i folded = _mm_or_si128(chunk, _mm_set1_epi8(0x20));
+	const __m128i brackets = _mm_or_si128(_mm_cmpeq_epi8(folded, _mm_set1_epi8('{')), _mm_cmpeq_epi8(folded, _mm_set1_epi8('}')));
+	const __m128i separators = _mm_or_si128(_mm_cmpeq_epi8(chunk, _mm_set1_epi8(',')), _mm_cmpeq_epi8(chunk, _mm_set1_epi8(':')));
+	masks.structurals = _mm_movemask_epi8(_mm_or_si128(brackets, separators));
+#else
+	masks.quotes = masks.backslashes = masks.structurals = 0;
+	for (int i = 0; i < blockSize; ++i)
+	{
+		const quint32 bit = 1u << i;
+		switch (block[i])
+		{
+		case '"': masks.quotes |= bit; break;
+		case '\\': masks.backslashes |= bit; break;
+		case '{': case '}': case '[': case ']': case ',': case ':': masks.structurals |= bit; break;
+		}
+	}
+#endif
+	return masks;
+}
+
+/// Sets every bit that has an odd number of set bits at or below it, which for quote bits gives the bytes inside strings
+static inline quint32 prefixXor(quint32 bits)
+{
+	bits ^= bits << 1;
+	bits ^= bits << 2;
+	bits ^= bits << 4;
+	bits ^= bits << 8;
+	return bits & 0xffff;
+}
+
+/**
+ * Appends the positions of all unescaped quotes, and of all structural characters outside of strings, to index.
+ *
+ * Returns false if data ends inside a string.
+ */
+static bool buildIndex(const char *data, const int size, QVector<int> &index)
+{
+	bool inString = false;
+	bool escapeNext = false;
+	char padded[blockSize];
+	for (int offset = 0; offset < size; offset += blockSize)
+	{
+		const char *block = data + offset;
+		const int length = qMin(blockSize, size - offset);
+		if (length < blockSize)
+		{
+			memset(padded, ' ', blockSize);
+			memcpy(padded, block, length);
+			block = padded;
+		}
+		const BlockMasks masks = classify(block);
+
+		// escape sequences are rare, so resolving them bit by bit is fine
+		quint32 escaped = 0;
+		if (masks.backslashes || escapeNext)
+		{
+			for (int i = 0; i < blockSize; ++i)
+			{
+				if (escapeNext)
+				{
+					escaped |= 1u << i;
+					escapeNext = false;
+				}
+				else if (masks.backslashes & (1u << i))
+				{
+					escapeNext = true;
+				}
+			}
+		}
+
+		const quint32 quotes = masks.quotes & ~escaped;
+		const quint32 strings = prefixXor(quotes) ^ (inString ? 0xffff : 0);
+		inString = strings & 0x8000;
+
+		quint32 tokens = (masks.structurals & ~strings) | quotes;
+		while (tokens)
+		{
+			index.append(offset + qCountTrailingZeroBits(tokens));
+			tokens &= tokens - 1;
+		}
+	}
+	return !inString;
+}
+
+Q_NORETURN static void malformed()
+{
+	throw Json::JsonException("Error parsing JSON: malformed object");
+}
+
+static inline bool isSpace(const char c)
+{
+	return c == ' ' || c == '\t' || c == '\n' || c == '\r';
+}
+
+static uint readHex4(const char *&it, const char *end)
+{
+	if (end - it < 4)
+	{
+		malformed();
+	}
+	uint value = 0;
+	for (int i = 0; i < 4; ++i)
+	{
+		const char c = *it++;
+		value <<= 4;
+		if (c >= '0' && c <= '9')
+		{
+			value |= c - '0';
+		}
+		else if (c >= 'a' && c <= 'f')
+		{
+			value |= c - 'a' + 10;
+		}
+		else if (c >= 'A' && c <= 'F')
+		{
+			value |= c - 'A' + 10;
+		}
+		else
+		{
+			malformed();
+		}
+	}
+	return value;
+}
+
+bool Json::isValidUtf8(const char *data, const int size)
+{
+	const uchar *it = reinterpret_cast<const uchar *>(data);
+	const uchar *end = it + size;
+	while (it != end)
+	{
+#ifdef __SSE2__
+		// skip over plain ASCII a block at a time
+		while (end - it >= blockSize && _mm_movemask_epi8(_mm_loadu_si128(reinterpret_cast<const __m128i *>(it))) == 0)
+		{
+			it += blockSize;
+		}
+		if (it == end)
+		{
+			break;
+		}
+#endif
+		const uchar c = *it;
+		if (c < 0x80)
+		{
+			++it;
+			continue;
+		}
+
+		int length;
+		uint codepoint;
+		uint minimum;
+		if ((c & 0xe0) == 0xc0)
+		{
+			length = 2;
+			codepoint = c & 0x1f;
+			minimum = 0x80;
+		}
+		else if ((c & 0xf0) == 0xe0)
+		{
+			length = 3;
+			codepoint = c & 0x0f;
+			minimum = 0x800;
+		}
+		else if ((c & 0xf8) == 0xf0)
+		{
+			length = 4;
+			codepoint = c & 0x07;
+			minimum = 0x10000;
+		}
+		else
+		{
+			return false;
+		}
+		if (end - it < length)
+		{
+			return false;
+		}
+		for (int i = 1; i < length; ++i)
+		{
+			if ((it[i] & 0xc0) != 0x80)
+			{
+				return false;
+			}
+			codepoint = (codepoint << 6) | (it[i] & 0x3f);
+		}
+		if (codepoint < minimum || codepoint > 0x10ffff || (codepoint >= 0xd800 && codepoint <= 0xdfff))
+		{
+			return false;
+		}
+		it += length;
+	}
+	return true;
+}
+
+Json::LazyObject::LazyObject(const QByteArray &data)
+	: m_data(data)
+{
+	if (isBinaryJson(data))
+	{
+		object();
+	}
+	else
+	{
+		index();
+	}
+}
+Json::LazyObject::LazyObject(const QJsonObject &object)
+	: m_object(object), m_parsed(true)
+{
+}
+
+bool Json::LazyObject::contains(const QLatin1String &key) const
+{
+	if (m_parsed)
+	{
+		return m_object.contains(key);
+	}
+	return find(key) != nullptr;
+}
+
+QJsonValue Json::LazyObject::value(const QLatin1String &key) const
+{
+	if (m_parsed)
+	{
+		return m_object.value(key);
+	}
+	const Member *member = find(key);
+	if (!member)
+	{
+		return QJsonValue(QJsonValue::Undefined);
+	}
+
+	const char *start = m_data.constData() + member->valueStart;
+	const int length = member->valueEnd - member->valueStart;
+	switch (*start)
+	{
+	case '"':
+		if (length < 2 || start[length - 1] != '"')
+		{
+			malformed();
+		}
+		return decodeString(member->valueStart + 1, member->valueEnd - 1);
+	case 't':
+		if (length == 4 && memcmp(start, "true", 4) == 0)
+		{
+			return true;
+		}
+		break;
+	case 'f':
+		if (length == 5 && memcmp(start, "false", 5) == 0)
+		{
+			return false;
+		}
+		break;
+	case 'n':
+		if (length == 4 && memcmp(start, "null", 4) == 0)
+		{
+			return QJsonValue(QJsonValue::Null);
+		}
+		break;
+	case '{':
+	case '[':
+	{
+		// nested values aren't part of the envelope, so there's no point in doing anything fancy
+		QJsonParseError error;
+		const QJsonDocument doc = QJsonDocument::fromJson(QByteArray::fromRawData(start, length), &error);
+		if (error.error != QJsonParseError::NoError)
+		{
+			throw JsonException("Error parsing JSON: " + error.errorString());
+		}
+		return doc.isObject() ? QJsonValue(doc.object()) : QJsonValue(doc.array());
+	}
+	default:
+		if (*start == '-' || (*start >= '0' && *start <= '9'))
+		{
+			bool ok = false;
+			const double number = QByteArray::fromRawData(start, length).toDouble(&ok);
+			if (ok)
+			{
+				return number;
+			}
+		}
+	}
+	malformed();
+}
+
+QJsonObject Json::LazyObject::object() const
+{
+	if (!m_parsed)
+	{
+		m_object = ensureObject(ensureDocument(m_data));
+		m_parsed = true;
+	}
+	return m_object;
+}
+
+void Json::LazyObject::index()
+{
+	const char *data = m_data.constData();
+	const int size = m_data.size();
+	if (!isValidUtf8(data, size))
+	{
+		throw JsonException("Error parsing JSON: invalid UTF-8");
+	}
+
+	QVector<int> tokens;
+	tokens.reserve(size / 8 + 8);
+	if (!buildIndex(data, size, tokens))
+	{
+		throw JsonException("Error parsing JSON: unterminated string");
+	}
+	const int count = tokens.size();
+
+	auto skipSpace = [data, size](int from)
+	{
+		while (from < size && isSpace(data[from]))
+		{
+			++from;
+		}
+		return from;
+	};
+	auto trimSpace = [data](int to)
+	{
+		while (to > 0 && isSpace(data[to - 1]))
+		{
+			--to;
+		}
+		return to;
+	};
+
+	if (count < 2 || data[tokens[0]] != '{' || skipSpace(0) != tokens[0])
+	{
+		throw JsonException("Error parsing JSON: not an object");
+	}
+
+	int t = 1;
+	if (data[tokens[t]] == '}')
+	{
+		if (skipSpace(tokens[0] + 1) != tokens[t])
+		{
+			malformed();
+		}
+	}
+	else
+	{
+		while (true)
+		{
+			// nothing is indexed inside of strings, so the token after an opening quote is always the closing one
+			if (t + 2 >= count || data[tokens[t]] != '"' || skipSpace(tokens[t - 1] + 1) != tokens[t]
+					|| data[tokens[t + 2]] != ':' || skipSpace(tokens[t + 1] + 1) != tokens[t + 2])
+			{
+				malformed();
+			}
+			Member member;
+			member.keyStart = tokens[t] + 1;
+			member.keyEnd = tokens[t + 1];
+			member.valueStart = skipSpace(tokens[t + 2] + 1);
+			t += 3;
+
+			// the value ends at the first ',' or '}' that isn't nested inside of it
+			int depth = 0;
+			for (; t < count; ++t)
+			{
+				const char c = data[tokens[t]];
+				if (c == '{' || c == '[')
+				{
+					++depth;
+				}
+				else if ((c == '}' || c == ']') && depth > 0)
+				{
+					--depth;
+				}
+				else if (depth == 0 && (c == ',' || c == '}' || c == ']'))
+				{
+					break;
+				}
+			}
+			if (t >= count)
+			{
+				malformed();
+			}
+			member.valueEnd = trimSpace(tokens[t]);
+			if (member.valueEnd <= member.valueStart)
+			{
+				malformed();
+			}
+			m_members.append(member);
+
+			if (data[tokens[t]] == ',')
+			{
+				++t;
+			}
+			else if (data[tokens[t]] == '}')
+			{
+				break;
+			}
+			else
+			{
+				malformed();
+			}
+		}
+	}
+
+	if (t != count - 1 || skipSpace(tokens[t] + 1) != size)
+	{
+		malformed();
+	}
+}
+
+const Json::LazyObject::Member *Json::LazyObject::find(const QLatin1String &key) const
+{
+	// the last one wins if a key is duplicated
+	for (int i = m_members.size() - 1; i >= 0; --i)
+	{
+		const Member &member = m_members.at(i);
+		const char *raw = m_data.constData() + member.keyStart;
+		const int length = member.keyEnd - member.keyStart;
+		if (length == key.size() && memcmp(raw, key.data(), length) == 0)
+		{
+			return &member;
+		}
+		else if (memchr(raw, '\\', length) && decodeString(member.keyStart, member.keyEnd) == key)
+		{
+			return &member;
+		}
+	}
+	return nullptr;
+}
+
+QString Json::LazyObject::decodeString(const int start, const int end) const
+{
+	const char *it = m_data.constData() + start;
+	const char *stop = m_data.constData() + end;
+
+	QString out;
+	const char *run = it;
+	while (it != stop)
+	{
+		const char c = *it;
+		if (c == '"' || uchar(c) < 0x20)
+		{
+			malformed();
+		}
+		else if (c != '\\')
+		{
+			++it;
+			continue;
+		}
+
+		out.append(QString::fromUtf8(run, it - run));
+		if (++it == stop)
+		{
+			malformed();
+		}
+		switch (*it++)
+		{
+		case '"': out.append(QLatin1Char('"')); break;
+		case '\\': out.append(QLatin1Char('\\')); break;
+		case '/': out.append(QLatin1Char('/')); break;
+		case 'b': out.append(QLatin1Char('\b')); break;
+		case 'f': out.append(QLatin1Char('\f')); break;
+		case 'n': out.append(QLatin1Char('\n')); break;
+		case 'r': out.append(QLatin1Char('\r')); break;
+		case 't': out.append(QLatin1Char('\t')); break;
+		case 'u':
+		{
+			const uint unit = readHex4(it, stop);
+			if (QChar::isHighSurrogate(unit))
+			{
+				if (stop - it < 2 || it[0] != '\\' || it[1] != 'u')
+				{
+					malformed();
+				}
+				it += 2;
+				const uint low = readHex4(it, stop);
+				if (!QChar::isLowSurrogate(low))
+				{
+					malformed();
+				}
+				out.append(QChar(ushort(unit)));
+				out.append(QChar(ushort(low)));
+			}
+			else if (QChar::isLowSurrogate(unit))
+			{
+				malformed();
+			}
+			else
+			{
+				out.append(QChar(ushort(unit)));
+			}
+			break;
+		}
+		default:
+			malformed();
+		}
+		run = it;
+	}
+	if (run == m_data.constData() + start)
+	{
+		// the common case, no escape sequences at all
+		return QString::fromUtf8(run, stop - run);
+	}
+	out.append(QString::fromUtf8(run, stop - run));
+	return out;
+}
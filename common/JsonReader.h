@@ -0,0 +1,57 @@
+// Licensed under the Apache-2.0 license. See README.md for details.
+
+#pragma once
+
+#include <QByteArray>
+#include <QVector>
+#include <QJsonObject>
+#include <QJsonValue>
+
+namespace Json
+{
+/// Returns true if data is valid UTF-8 (rejecting overlong forms, surrogates and anything above U+10FFFF)
+bool isValidUtf8(const char *data, const int size);
+
+/**
+ * A JSON object of which only the top level is indexed up front.
+ *
+ * Constructing one validates the encoding and finds the position of every top level member, using
+ * a structural index built 16 bytes at a time (SSE2 if available). Single members can then be decoded
+ * on their own through value(), which is all that is needed to look at the envelope of a message.
+ * The complete object is only parsed once object() is called.
+ */
+class LazyObject
+{
+public:
+	/// Throws JsonException if data is not valid UTF-8 or does not contain an object. Binary JSON is parsed right away
+	explicit LazyObject(const QByteArray &data);
+	/// For messages that already have been parsed
+	explicit LazyObject(const QJsonObject &object);
+
+	bool contains(const QLatin1String &key) const;
+	bool contains(const char *key) const { return contains(QLatin1String(key)); }
+	/// Decodes the top level member key, without parsing the rest of the object. Returns an undefined value if there is no such member
+	QJsonValue value(const QLatin1String &key) const;
+	QJsonValue value(const char *key) const { return value(QLatin1String(key)); }
+	/// Parses the complete object on first use
+	QJsonObject object() const;
+
+private:
+	struct Member
+	{
+		int keyStart; ///< Position after the opening quote
+		int keyEnd; ///< Position of the closing quote
+		int valueStart;
+		int valueEnd; ///< Position after the last character of the value
+	};
+
+	QByteArray m_data;
+	QVector<Member> m_members;
+	mutable QJsonObject m_object;
+	mutable bool m_parsed = false;
+
+	void index();
+	const Member *find(const QLatin1String &key) const;
+	QString decodeString(const int start, const int end) const;
+};
+}
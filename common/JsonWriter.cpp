@@ -0,0 +1,332 @@
+// Licensed under the Apache-2.0 license. See README.md for details.
+
+#include "JsonWriter.h"
+
+#include <QString>
+#include <QUuid>
+#include <QJsonValue>
+#include <QJsonObject>
+#include <QJsonArray>
+#include <QLocale>
+#include <cmath>
+#include <algorithm>
+
+static const char hexDigits[] = "0123456789abcdef";
+
+static inline void appendEscaped(QByteArray &out, const ushort c)
+{
+	switch (c)
+	{
+	case '"': out.append("\\\"", 2); break;
+	case '\\': out.append("\\\\", 2); break;
+	case '\b': out.append("\\b", 2); break;
+	case '\f': out.append("\\f", 2); break;
+	case '\n': out.append("\\n", 2); break;
+	case '\r': out.append("\\r", 2); break;
+	case '\t': out.append("\\t", 2); break;
+	default:
+	{
+		const char escaped[] = {'\\', 'u', '0', '0', hexDigits[(c >> 4) & 0xf], hexDigits[c & 0xf]};
+		out.append(escaped, sizeof(escaped));
+	}
+	}
+}
+
+/// Appends string as a quoted JSON string, converting from UTF-16 to UTF-8 on the way
+static void appendString(QByteArray &out, const QString &string)
+{
+	const ushort *it = string.utf16();
+	const ushort *end = it + string.size();
+	out.reserve(out.size() + string.size() + 2);
+	out.append('"');
+	while (it != end)
+	{
+		// find a run of characters that can be copied as they are
+		const ushort *run = it;
+		while (it != end && *it >= 0x20 && *it < 0x80 && *it != '"' && *it != '\\')
+		{
+			++it;
+		}
+		if (it != run)
+		{
+			const int size = it - run;
+			const int offset = out.size();
+			out.resize(offset + size);
+			char *dest = out.data() + offset;
+			for (int i = 0; i < size; ++i)
+			{
+				dest[i] = char(run[i]);
+			}
+		}
+		if (it == end)
+		{
+			break;
+		}
+
+		uint c = *it++;
+		if (c < 0x80)
+		{
+			appendEscaped(out, c);
+			continue;
+		}
+		if (QChar::isHighSurrogate(c) && it != end && QChar::isLowSurrogate(*it))
+		{
+			c = QChar::surrogateToUcs4(c, *it++);
+		}
+		else if (QChar::isSurrogate(c))
+		{
+			c = QChar::ReplacementCharacter;
+		}
+
+		if (c < 0x800)
+		{
+			const char bytes[] = {char(0xc0 | (c >> 6)), char(0x80 | (c & 0x3f))};
+			out.append(bytes, sizeof(bytes));
+		}
+		else if (c < 0x10000)
+		{
+			const char bytes[] = {char(0xe0 | (c >> 12)), char(0x80 | ((c >> 6) & 0x3f)), char(0x80 | (c & 0x3f))};
+			out.append(bytes, sizeof(bytes));
+		}
+		else
+		{
+			const char bytes[] = {char(0xf0 | (c >> 18)), char(0x80 | ((c >> 12) & 0x3f)), char(0x80 | ((c >> 6) & 0x3f)), char(0x80 | (c & 0x3f))};
+			out.append(bytes, sizeof(bytes));
+		}
+	}
+	out.append('"');
+}
+
+Json::Key::Key(const char *key)
+	: Key(QString::fromUtf8(key))
+{
+}
+Json::Key::Key(const QString &key)
+{
+	appendString(m_encoded, key);
+	m_encoded.append(':');
+}
+
+Json::Writer::Writer(QByteArray &buffer)
+	: m_buffer(buffer)
+{
+}
+
+Json::Writer &Json::Writer::beginObject()
+{
+	separator();
+	m_buffer.append('{');
+	m_needsSeparator.append(false);
+	return *this;
+}
+Json::Writer &Json::Writer::beginObject(const Key &key)
+{
+	this->key(key);
+	m_buffer.append('{');
+	m_needsSeparator.append(false);
+	return *this;
+}
+Json::Writer &Json::Writer::endObject()
+{
+	Q_ASSERT(!m_needsSeparator.isEmpty());
+	m_needsSeparator.removeLast();
+	m_buffer.append('}');
+	return *this;
+}
+Json::Writer &Json::Writer::beginArray()
+{
+	separator();
+	m_buffer.append('[');
+	m_needsSeparator.append(false);
+	return *this;
+}
+Json::Writer &Json::Writer::beginArray(const Key &key)
+{
+	this->key(key);
+	m_buffer.append('[');
+	m_needsSeparator.append(false);
+	return *this;
+}
+Json::Writer &Json::Writer::endArray()
+{
+	Q_ASSERT(!m_needsSeparator.isEmpty());
+	m_needsSeparator.removeLast();
+	m_buffer.append(']');
+	return *this;
+}
+
+Json::Writer &Json::Writer::value(const Key &key, const QString &value)
+{
+	this->key(key);
+	string(value);
+	return *this;
+}
+Json::Writer &Json::Writer::value(const Key &key, const char *value)
+{
+	return this->value(key, QString::fromUtf8(value));
+}
+Json::Writer &Json::Writer::value(const Key &key, const QUuid &value)
+{
+	// same as Json::toJson<QUuid>, and never in need of escaping
+	this->key(key);
+	m_buffer.append('"');
+	m_buffer.append(value.toByteArray());
+	m_buffer.append('"');
+	return *this;
+}
+Json::Writer &Json::Writer::value(const Key &key, const qint64 value)
+{
+	this->key(key);
+	m_buffer.append(QByteArray::number(value));
+	return *this;
+}
+Json::Writer &Json::Writer::value(const Key &key, const double value)
+{
+	this->key(key);
+	number(value);
+	return *this;
+}
+Json::Writer &Json::Writer::value(const Key &key, const bool value)
+{
+	this->key(key);
+	m_buffer.append(value ? "true" : "false");
+	return *this;
+}
+Json::Writer &Json::Writer::value(const Key &key, const QJsonValue &value)
+{
+	this->key(key);
+	jsonValue(value);
+	return *this;
+}
+Json::Writer &Json::Writer::value(const QString &value)
+{
+	separator();
+	string(value);
+	return *this;
+}
+Json::Writer &Json::Writer::value(const QJsonValue &value)
+{
+	separator();
+	jsonValue(value);
+	return *this;
+}
+
+Json::Writer &Json::Writer::members(const QJsonObject &object, std::initializer_list<const char *> skip)
+{
+	for (auto it = object.constBegin(); it != object.constEnd(); ++it)
+	{
+		const QString key = it.key();
+		if (std::any_of(skip.begin(), skip.end(), [key](const char *s) { return key == QLatin1String(s); }))
+		{
+			continue;
+		}
+		separator();
+		string(key);
+		m_buffer.append(':');
+		jsonValue(it.value());
+	}
+	return *this;
+}
+
+void Json::Writer::separator()
+{
+	if (m_needsSeparator.isEmpty())
+	{
+		return;
+	}
+	if (m_needsSeparator.last())
+	{
+		m_buffer.append(',');
+	}
+	else
+	{
+		m_needsSeparator.last() = true;
+	}
+}
+void Json::Writer::key(const Key &key)
+{
+	separator();
+	m_buffer.append(key.encoded());
+}
+void Json::Writer::string(const QString &string)
+{
+	appendString(m_buffer, string);
+}
+void Json::Writer::number(const double number)
+{
+	if (!std::isfinite(number))
+	{
+		// same as QJsonDocument
+		m_buffer.append("null");
+	}
+	else if (std::floor(number) == number && std::fabs(number) < (qint64(1) << 53))
+	{
+		m_buffer.append(QByteArray::number(qint64(number)));
+	}
+	else
+	{
+		m_buffer.append(QByteArray::number(number, 'g', QLocale::FloatingPointShortest));
+	}
+}
+void Json::Writer::jsonValue(const QJsonValue &value)
+{
+	switch (value.type())
+	{
+	case QJsonValue::Null:
+	case QJsonValue::Undefined:
+		m_buffer.append("null");
+		break;
+	case QJsonValue::Bool:
+		m_buffer.append(value.toBool() ? "true" : "false");
+		break;
+	case QJsonValue::Double:
+		number(value.toDouble());
+		break;
+	case QJsonValue::String:
+		string(value.toString());
+		break;
+	// the separator in front of value has been written already, so these can't go through beginArray/beginObject
+	case QJsonValue::Array:
+	{
+		m_buffer.append('[');
+		m_needsSeparator.append(false);
+		for (const QJsonValue &item : value.toArray())
+		{
+			this->value(item);
+		}
+		endArray();
+		break;
+	}
+	case QJsonValue::Object:
+		m_buffer.append('{');
+		m_needsSeparator.append(false);
+		members(value.toObject());
+		endObject();
+		break;
+	}
+}
+
+void Json::encodeMessage(QByteArray &buffer, const QString &channel, const QString &cmd, const QJsonObject &data, const QUuid &msgId, const QUuid &replyTo)
+{
+	static const Key channelKey("channel");
+	static const Key cmdKey("cmd");
+	static const Key msgIdKey("msgId");
+	static const Key replyToKey("replyTo");
+
+	Writer writer(buffer);
+	writer.beginObject()
+			.value(channelKey, channel)
+			.value(cmdKey, cmd)
+			.value(msgIdKey, msgId);
+	// data is often what a client sent, so it might already contain an envelope of its own
+	if (replyTo.isNull())
+	{
+		writer.members(data, {"channel", "cmd", "msgId"});
+	}
+	else
+	{
+		writer.value(replyToKey, replyTo)
+				.members(data, {"channel", "cmd", "msgId", "replyTo"});
+	}
+	writer.endObject();
+}
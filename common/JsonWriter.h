@@ -0,0 +1,77 @@
+// Licensed under the Apache-2.0 license. See README.md for details.
+
+#pragma once
+
+#include <QByteArray>
+#include <QVarLengthArray>
+#include <initializer_list>
+
+class QString;
+class QUuid;
+class QJsonValue;
+class QJsonObject;
+class QJsonArray;
+
+namespace Json
+{
+/// An object key that is quoted, escaped and suffixed with ':' once, so that writing it is a plain append
+class Key
+{
+public:
+	Key(const char *key);
+	explicit Key(const QString &key);
+
+	const QByteArray &encoded() const { return m_encoded; }
+
+private:
+	QByteArray m_encoded;
+};
+
+/**
+ * Writes compact JSON text straight into a buffer, without building a QJsonObject/QJsonDocument first.
+ *
+ * The output is the same as QJsonDocument::toJson(QJsonDocument::Compact) would give, except that keys
+ * appear in the order they are written in.
+ */
+class Writer
+{
+public:
+	explicit Writer(QByteArray &buffer);
+
+	Writer &beginObject();
+	Writer &beginObject(const Key &key);
+	Writer &endObject();
+	Writer &beginArray();
+	Writer &beginArray(const Key &key);
+	Writer &endArray();
+
+	Writer &value(const Key &key, const QString &value);
+	Writer &value(const Key &key, const char *value);
+	Writer &value(const Key &key, const QUuid &value);
+	Writer &value(const Key &key, const qint64 value);
+	Writer &value(const Key &key, const int value) { return this->value(key, qint64(value)); }
+	Writer &value(const Key &key, const double value);
+	Writer &value(const Key &key, const bool value);
+	Writer &value(const Key &key, const QJsonValue &value);
+	/// For array elements
+	Writer &value(const QString &value);
+	Writer &value(const QJsonValue &value);
+
+	/// Writes all members of object into the current object, except for the given keys
+	Writer &members(const QJsonObject &object, std::initializer_list<const char *> skip = {});
+
+private:
+	QByteArray &m_buffer;
+	/// One entry per open object/array, true if the next member needs a separator
+	QVarLengthArray<bool, 8> m_needsSeparator;
+
+	void separator();
+	void key(const Key &key);
+	void string(const QString &string);
+	void number(const double number);
+	void jsonValue(const QJsonValue &value);
+};
+
+/// Appends a message as sent between clients and the core, data merged with the envelope, as JSON text to buffer
+void encodeMessage(QByteArray &buffer, const QString &channel, const QString &cmd, const QJsonObject &data, const QUuid &msgId, const QUuid &replyTo);
+}
@@ -0,0 +1,386 @@
+// Licensed under the Apache-2.0 license. See README.md for details.
+
+#include "ShmChannel.h"
+
+#include <QSocketNotifier>
+#include <QDir>
+#include <QFile>
+#include <QDebug>
+
+#include <atomic>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/eventfd.h>
+#include <sys/un.h>
+#include <unistd.h>
+#include <errno.h>
+#include <string.h>
+
+static constexpr quint32 segmentMagic = 0x54544b53; // "TTKS"
+static constexpr quint32 segmentVersion = 1;
+static constexpr quint32 packetHeaderSize = sizeof(quint32);
+static constexpr size_t pageSize = 4096;
+
+struct ShmChannel::Ring
+{
+	alignas(64) std::atomic<quint64> head; ///< Only written by the producer
+	alignas(64) std::atomic<quint64> tail; ///< Only written by the consumer
+	alignas(64) std::atomic<quint32> producerWaiting; ///< Set by the producer if it's waiting for the consumer to make room
+};
+struct ShmChannel::Segment
+{
+	quint32 magic;
+	quint32 version;
+	quint32 ringSize;
+	Ring rings[2]; ///< 0 is server to client, 1 is client to server
+};
+/// The ring data starts at the first page after the segment header
+static constexpr size_t dataOffset = pageSize;
+
+static void copyIn(char *ring, const quint32 mask, const quint64 position, const char *source, const quint32 size)
+{
+	const quint32 start = position & mask;
+	const quint32 first = qMin(size, mask + 1 - start);
+	memcpy(ring + start, source, first);
+	memcpy(ring, source + first, size - first);
+}
+static void copyOut(char *destination, const char *ring, const quint32 mask, const quint64 position, const quint32 size)
+{
+	const quint32 start = position & mask;
+	const quint32 first = qMin(size, mask + 1 - start);
+	memcpy(destination, ring + start, first);
+	memcpy(destination + first, ring, size - first);
+}
+
+ShmChannel::ShmChannel(const bool isServer, int socket, int memory, int serverWake, int clientWake, QObject *parent)
+	: QObject(parent), m_isServer(isServer), m_socket(socket), m_memory(memory),
+	  m_ownWake(isServer ? serverWake : clientWake), m_peerWake(isServer ? clientWake : serverWake)
+{
+	m_wakeNotifier = new QSocketNotifier(m_ownWake, QSocketNotifier::Read, this);
+	connect(m_wakeNotifier, &QSocketNotifier::activated, this, &ShmChannel::wakeup);
+	m_socketNotifier = new QSocketNotifier(m_socket, QSocketNotifier::Read, this);
+	connect(m_socketNotifier, &QSocketNotifier::activated, this, &ShmChannel::socketActivity);
+}
+ShmChannel::~ShmChannel()
+{
+	if (m_segment)
+	{
+		munmap(m_segment, m_segmentSize);
+	}
+	for (const int fd : {m_socket, m_memory, m_ownWake, m_peerWake})
+	{
+		if (fd != -1)
+		{
+			::close(fd);
+		}
+	}
+}
+
+ShmChannel *ShmChannel::accept(int socket, const quint32 ringSize, QObject *parent)
+{
+	quint32 size = pageSize;
+	while (size < ringSize)
+	{
+		size <<= 1;
+	}
+
+	const int memory = memfd_create("talktalk-shm", MFD_CLOEXEC);
+	const int serverWake = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+	const int clientWake = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+	if (memory == -1 || serverWake == -1 || clientWake == -1)
+	{
+		const QString error = strerror(errno);
+		for (const int fd : {socket, memory, serverWake, clientWake})
+		{
+			if (fd != -1)
+			{
+				::close(fd);
+			}
+		}
+		throw ShmException("Unable to create shared memory segment: " + error);
+	}
+
+	// from here on the channel owns all descriptors and closes them if anything goes wrong
+	ShmChannel *channel = new ShmChannel(true, socket, memory, serverWake, clientWake, parent);
+	try
+	{
+		if (ftruncate(memory, dataOffset + 2 * size_t(size)) != 0)
+		{
+			throw ShmException(QString("Unable to size shared memory segment: %1").arg(strerror(errno)));
+		}
+		// a freshly truncated memfd is zeroed, so only the constants need to be written
+		Segment *segment = static_cast<Segment *>(mmap(nullptr, sizeof(Segment), PROT_READ | PROT_WRITE, MAP_SHARED, memory, 0));
+		if (segment == MAP_FAILED)
+		{
+			throw ShmException(QString("Unable to map shared memory segment: %1").arg(strerror(errno)));
+		}
+		segment->magic = segmentMagic;
+		segment->version = segmentVersion;
+		segment->ringSize = size;
+		munmap(segment, sizeof(Segment));
+		channel->map();
+
+		const int fds[] = {memory, serverWake, clientWake};
+		char byte = 0;
+		iovec iov;
+		iov.iov_base = &byte;
+		iov.iov_len = 1;
+		char control[CMSG_SPACE(sizeof(fds))];
+		memset(control, 0, sizeof(control));
+		msghdr message;
+		memset(&message, 0, sizeof(message));
+		message.msg_iov = &iov;
+		message.msg_iovlen = 1;
+		message.msg_control = control;
+		message.msg_controllen = sizeof(control);
+		cmsghdr *header = CMSG_FIRSTHDR(&message);
+		header->cmsg_level = SOL_SOCKET;
+		header->cmsg_type = SCM_RIGHTS;
+		header->cmsg_len = CMSG_LEN(sizeof(fds));
+		memcpy(CMSG_DATA(header), fds, sizeof(fds));
+		if (sendmsg(socket, &message, MSG_NOSIGNAL) != 1)
+		{
+			throw ShmException(QString("Unable to hand shared memory segment to peer: %1").arg(strerror(errno)));
+		}
+	}
+	catch (...)
+	{
+		delete channel;
+		throw;
+	}
+	return channel;
+}
+ShmChannel *ShmChannel::connectTo(const QString &path, QObject *parent)
+{
+	const QByteArray nativePath = QFile::encodeName(socketPath(path));
+	sockaddr_un address;
+	memset(&address, 0, sizeof(address));
+	address.sun_family = AF_UNIX;
+	if (size_t(nativePath.size()) >= sizeof(address.sun_path))
+	{
+		throw ShmException("Socket path is too long: " + path);
+	}
+	memcpy(address.sun_path, nativePath.constData(), nativePath.size());
+
+	const int socket = ::socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+	if (socket == -1 || ::connect(socket, reinterpret_cast<sockaddr *>(&address), sizeof(address)) != 0)
+	{
+		const QString error = strerror(errno);
+		if (socket != -1)
+		{
+			::close(socket);
+		}
+		throw ShmException(QString("Unable to connect to %1: %2").arg(path, error));
+	}
+
+	// the server hands out the segment right away, don't wait forever if it doesn't
+	timeval timeout;
+	timeout.tv_sec = 5;
+	timeout.tv_usec = 0;
+	setsockopt(socket, SOL_SOCKET, SO_RCVTIMEO, &timeout, sizeof(timeout));
+
+	int fds[3] = {-1, -1, -1};
+	char byte;
+	iovec iov;
+	iov.iov_base = &byte;
+	iov.iov_len = 1;
+	char control[CMSG_SPACE(sizeof(fds))];
+	msghdr message;
+	memset(&message, 0, sizeof(message));
+	message.msg_iov = &iov;
+	message.msg_iovlen = 1;
+	message.msg_control = control;
+	message.msg_controllen = sizeof(control);
+	const ssize_t received = recvmsg(socket, &message, MSG_CMSG_CLOEXEC);
+	cmsghdr *header = received == 1 ? CMSG_FIRSTHDR(&message) : nullptr;
+	if (header && header->cmsg_level == SOL_SOCKET && header->cmsg_type == SCM_RIGHTS && header->cmsg_len == CMSG_LEN(sizeof(fds)))
+	{
+		memcpy(fds, CMSG_DATA(header), sizeof(fds));
+	}
+
+	if (fds[0] == -1 || fds[1] == -1 || fds[2] == -1)
+	{
+		::close(socket);
+		throw ShmException("The server did not hand out a shared memory segment");
+	}
+
+	ShmChannel *channel = new ShmChannel(false, socket, fds[0], fds[1], fds[2], parent);
+	try
+	{
+		channel->map();
+	}
+	catch (...)
+	{
+		delete channel;
+		throw;
+	}
+	return channel;
+}
+
+void ShmChannel::map()
+{
+	static_assert(sizeof(Segment) <= dataOffset, "The segment header has to fit in front of the ring data");
+
+	struct stat info;
+	if (fstat(m_memory, &info) != 0 || size_t(info.st_size) < dataOffset)
+	{
+		throw ShmException("Invalid shared memory segment");
+	}
+	void *address = mmap(nullptr, info.st_size, PROT_READ | PROT_WRITE, MAP_SHARED, m_memory, 0);
+	if (address == MAP_FAILED)
+	{
+		throw ShmException(QString("Unable to map shared memory segment: %1").arg(strerror(errno)));
+	}
+	m_segment = static_cast<Segment *>(address);
+	m_segmentSize = info.st_size;
+	const quint32 ringSize = m_segment->ringSize;
+	if (m_segment->magic != segmentMagic || m_segment->version != segmentVersion || ringSize < pageSize ||
+			dataOffset + 2 * size_t(ringSize) != m_segmentSize || (ringSize & (ringSize - 1)) != 0)
+	{
+		throw ShmException("Unknown shared memory segment layout");
+	}
+	m_ringSize = ringSize;
+	m_out = &m_segment->rings[m_isServer ? 0 : 1];
+	m_in = &m_segment->rings[m_isServer ? 1 : 0];
+}
+
+void ShmChannel::send(const QByteArray &data)
+{
+	if (!m_pending.isEmpty() || !write(data))
+	{
+		m_pending.append(data);
+		return;
+	}
+	notifyPeer();
+}
+bool ShmChannel::receive(QByteArray *data)
+{
+	const quint32 mask = m_ringSize - 1;
+	const char *ring = reinterpret_cast<const char *>(m_segment) + dataOffset + (m_isServer ? m_ringSize : 0);
+	const quint64 tail = m_in->tail.load(std::memory_order_relaxed);
+	const quint64 head = m_in->head.load(std::memory_order_acquire);
+	// both are written by the peer as well, so nothing is trusted that would point outside of the ring
+	if (head - tail > m_ringSize)
+	{
+		throw ShmException("Corrupt shared memory ring");
+	}
+	if (head - tail < packetHeaderSize)
+	{
+		return false;
+	}
+	quint32 size;
+	copyOut(reinterpret_cast<char *>(&size), ring, mask, tail, packetHeaderSize);
+	if (size > m_ringSize - packetHeaderSize || size > head - tail - packetHeaderSize)
+	{
+		throw ShmException("Corrupt packet in shared memory ring");
+	}
+	data->resize(size);
+	copyOut(data->data(), ring, mask, tail + packetHeaderSize, size);
+	m_in->tail.store(tail + packetHeaderSize + size);
+	if (m_in->producerWaiting.exchange(0))
+	{
+		notifyPeer();
+	}
+	return true;
+}
+
+bool ShmChannel::write(const QByteArray &data)
+{
+	const quint32 ringSize = m_ringSize;
+	const quint64 needed = packetHeaderSize + data.size();
+	if (needed > ringSize)
+	{
+		throw ShmException(QString("Packet of %1 bytes does not fit into the shared memory ring").arg(data.size()));
+	}
+	char *ring = reinterpret_cast<char *>(m_segment) + dataOffset + (m_isServer ? 0 : ringSize);
+	const quint64 head = m_out->head.load(std::memory_order_relaxed);
+	quint64 used = head - m_out->tail.load(std::memory_order_acquire);
+	if (used > ringSize)
+	{
+		throw ShmException("Corrupt shared memory ring");
+	}
+	if (ringSize - used < needed)
+	{
+		// tell the consumer to wake us up, then check again in case it drained the ring in the meantime
+		m_out->producerWaiting.store(1);
+		used = head - m_out->tail.load();
+		if (used > ringSize)
+		{
+			throw ShmException("Corrupt shared memory ring");
+		}
+		if (ringSize - used < needed)
+		{
+			return false;
+		}
+	}
+	const quint32 size = data.size();
+	copyIn(ring, ringSize - 1, head, reinterpret_cast<const char *>(&size), packetHeaderSize);
+	copyIn(ring, ringSize - 1, head + packetHeaderSize, data.constData(), size);
+	m_out->head.store(head + needed, std::memory_order_release);
+	return true;
+}
+void ShmChannel::flushPending()
+{
+	bool written = false;
+	while (!m_pending.isEmpty() && write(m_pending.first()))
+	{
+		m_pending.removeFirst();
+		written = true;
+	}
+	if (written)
+	{
+		notifyPeer();
+	}
+}
+void ShmChannel::notifyPeer()
+{
+	const quint64 one = 1;
+	if (::write(m_peerWake, &one, sizeof(one)) != sizeof(one) && errno != EAGAIN)
+	{
+		qWarning() << "Unable to wake up shared memory peer:" << strerror(errno);
+	}
+}
+
+void ShmChannel::wakeup()
+{
+	quint64 counter;
+	if (::read(m_ownWake, &counter, sizeof(counter)) == -1 && errno != EAGAIN)
+	{
+		qWarning() << "Unable to read shared memory wakeup:" << strerror(errno);
+	}
+	try
+	{
+		flushPending();
+	}
+	catch (ShmException &e)
+	{
+		// the ring has been messed with, there is no telling what the peer reads
+		qWarning() << "Closing shared memory channel:" << e.message();
+		m_wakeNotifier->setEnabled(false);
+		m_socketNotifier->setEnabled(false);
+		emit disconnected();
+		return;
+	}
+	emit readyRead();
+}
+void ShmChannel::socketActivity()
+{
+	char byte;
+	const ssize_t received = recv(m_socket, &byte, 1, MSG_DONTWAIT);
+	if (received == 0 || (received == -1 && errno != EAGAIN && errno != EWOULDBLOCK && errno != EINTR))
+	{
+		m_wakeNotifier->setEnabled(false);
+		m_socketNotifier->setEnabled(false);
+		emit disconnected();
+	}
+}
+
+QString ShmChannel::socketPath(const QString &name)
+{
+	if (name.startsWith('/'))
+	{
+		return name;
+	}
+	return QDir::tempPath() + '/' + name;
+}
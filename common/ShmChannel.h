@@ -0,0 +1,74 @@
+// Licensed under the Apache-2.0 license. See README.md for details.
+
+#pragma once
+
+#include <QObject>
+#include <QList>
+
+#include "Exception.h"
+
+class QSocketNotifier;
+
+DECLARE_EXCEPTION(Shm);
+
+/**
+ * A bidirectional packet channel for processes on the same host.
+ *
+ * Both directions are single-producer/single-consumer ring buffers in one memfd segment, and each
+ * side has an eventfd it gets woken up through. The segment and the eventfds are handed from the
+ * server to the client over a unix socket (SCM_RIGHTS), which is then kept open only to notice when
+ * the other side goes away.
+ */
+class ShmChannel : public QObject
+{
+	Q_OBJECT
+public:
+	~ShmChannel();
+
+	/// Creates a new segment and hands it to the peer connected to socket. Takes ownership of socket
+	static ShmChannel *accept(int socket, const quint32 ringSize, QObject *parent = nullptr);
+	/// Connects to the rendezvous socket at path and maps the segment handed out by the server
+	static ShmChannel *connectTo(const QString &path, QObject *parent = nullptr);
+
+	/// Never blocks; if the ring is full the packet is kept until the peer has made room for it
+	void send(const QByteArray &data);
+	/// Takes the next packet sent by the peer, returns false if there is none
+	bool receive(QByteArray *data);
+
+	/// Resolves a name the same way QLocalServer/QLocalSocket do
+	static QString socketPath(const QString &name);
+
+signals:
+	void readyRead();
+	void disconnected();
+
+private slots:
+	void wakeup();
+	void socketActivity();
+
+private:
+	explicit ShmChannel(const bool isServer, int socket, int memory, int serverWake, int clientWake, QObject *parent);
+
+	struct Segment;
+	struct Ring;
+
+	bool m_isServer;
+	int m_socket;
+	int m_memory;
+	int m_ownWake;
+	int m_peerWake;
+	Segment *m_segment = nullptr;
+	size_t m_segmentSize = 0;
+	/// Validated once in map(), the segment itself is writable by the peer and never read from again for this
+	quint32 m_ringSize = 0;
+	Ring *m_in = nullptr;
+	Ring *m_out = nullptr;
+	QList<QByteArray> m_pending;
+	QSocketNotifier *m_wakeNotifier;
+	QSocketNotifier *m_socketNotifier;
+
+	void map();
+	bool write(const QByteArray &data);
+	void flushPending();
+	void notifyPeer();
+};
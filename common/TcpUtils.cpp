@@ -1,15 +1,17 @@
 #include "TcpUtils.h"
 
-#include <QTcpSocket>
+#include <QIODevice>
+#include <QDataStream>
+#include <QtEndian>
 
-void TcpUtils::writePacket(QTcpSocket *socket, const QByteArray &data)
+void TcpUtils::writePacket(QIODevice *socket, const QByteArray &data)
 {
 	QDataStream str(socket);
 	str.setByteOrder(QDataStream::LittleEndian);
 	str << (quint32) data.size();
 	socket->write(data);
 }
-QByteArray TcpUtils::readPacket(QTcpSocket *socket)
+QByteArray TcpUtils::readPacket(QIODevice *socket)
 {
 	while (socket->bytesAvailable() < sizeof(quint32))
 	{
@@ -28,3 +30,33 @@ QByteArray TcpUtils::readPacket(QTcpSocket *socket)
 
 	return socket->read(size);
 }
+
+void TcpUtils::appendPacket(QByteArray &buffer, const QByteArray &data)
+{
+	const quint32 size = qToLittleEndian<quint32>(data.size());
+	buffer.append(reinterpret_cast<const char *>(&size), headerSize);
+	buffer.append(data);
+}
+int TcpUtils::beginPacket(QByteArray &buffer)
+{
+	const int offset = buffer.size();
+	buffer.resize(offset + headerSize);
+	return offset;
+}
+void TcpUtils::endPacket(QByteArray &buffer, const int offset)
+{
+	qToLittleEndian<quint32>(buffer.size() - offset - headerSize, reinterpret_cast<uchar *>(buffer.data() + offset));
+}
+qint64 TcpUtils::completePacketSize(const char *data, const qint64 available)
+{
+	const qint64 size = announcedPacketSize(data, available);
+	return size != -1 && available - headerSize >= size ? size : -1;
+}
+qint64 TcpUtils::announcedPacketSize(const char *data, const qint64 available)
+{
+	if (available < headerSize)
+	{
+		return -1;
+	}
+	return qFromLittleEndian<quint32>(reinterpret_cast<const uchar *>(data));
+}
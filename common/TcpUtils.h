@@ -1,10 +1,25 @@
 #pragma once
 
-class QTcpSocket;
+#include <QtGlobal>
+
+class QIODevice;
 class QByteArray;
 
 namespace TcpUtils
 {
-void writePacket(QTcpSocket *socket, const QByteArray &data);
-QByteArray readPacket(QTcpSocket *socket);
+static constexpr int headerSize = sizeof(quint32);
+
+void writePacket(QIODevice *socket, const QByteArray &data);
+QByteArray readPacket(QIODevice *socket);
+
+/// Appends data to buffer, framed the same way as writePacket
+void appendPacket(QByteArray &buffer, const QByteArray &data);
+/// For writing a packet straight into buffer; returns the offset to pass to endPacket once the payload has been appended
+int beginPacket(QByteArray &buffer);
+/// Fills in the header of the packet started at offset
+void endPacket(QByteArray &buffer, const int offset);
+/// Returns the payload size of the packet at the start of data, or -1 if it has not been received completely yet
+qint64 completePacketSize(const char *data, const qint64 available);
+/// Returns the payload size the packet at the start of data announces, or -1 if not even its header has been received yet
+qint64 announcedPacketSize(const char *data, const qint64 available);
 }
@@ -1,67 +1,434 @@
 #include "AbstractClientConnection.h"
 
 #include "common/Json.h"
+#include "common/JsonReader.h"
+
+#include <QDateTime>
+#include <limits>
+
+#include "Session.h"
+
+Q_LOGGING_CATEGORY(Connection, "core.connection")
+
+static int idleTimeout = 0;
+static int heartbeatInterval = 0;
+
+// live messages are held back for at most this long while waiting for history, in case nobody answers
+static constexpr const int HISTORY_TIMEOUT = 5000;
 
 AbstractClientConnection::AbstractClientConnection(QObject *parent)
 	: QObject(parent)
 {
+	connect(this, &AbstractClientConnection::broadcast, this, [this](const QString &channel, const QString &cmd, const QJsonObject &data, const QUuid &replyTo)
+	{
+		emit route(Message(channel, cmd, data, replyTo));
+	});
+}
+AbstractClientConnection::~AbstractClientConnection()
+{
+	if (m_wheel && m_keepaliveTimer)
+	{
+		m_wheel->cancel(m_keepaliveTimer);
+	}
+	for (const PendingHistory &pending : m_pendingHistory)
+	{
+		if (m_wheel && pending.timeout)
+		{
+			m_wheel->cancel(pending.timeout);
+		}
+	}
+	if (m_session)
+	{
+		m_session->release(this);
+	}
 }
 
-void AbstractClientConnection::receive(const QString &channel, const QString &cmd, const QJsonObject &data, const QUuid &replyTo)
+void AbstractClientConnection::setKeepalive(const int idle, const int heartbeat)
+{
+	idleTimeout = idle;
+	heartbeatInterval = heartbeat;
+}
+
+void AbstractClientConnection::deliver(const Message &message)
 {
-	if (!m_channels.contains(channel) && !m_monitor)
+	if (!m_pendingHistory.isEmpty())
+	{
+		for (auto it = m_pendingHistory.constBegin(); it != m_pendingHistory.constEnd(); ++it)
+		{
+			if (it.value().replyChannel == message.channel())
+			{
+				finishHistory(it.key(), message.data());
+				return;
+			}
+		}
+		const auto pending = m_pendingHistory.find(message.channel());
+		if (pending != m_pendingHistory.end())
+		{
+			pending.value().held.append(message);
+			return;
+		}
+	}
+	if (!m_channels.contains(message.channel()) && !m_monitor)
 	{
 		return;
 	}
-	QJsonObject obj = data;
-	obj["channel"] = channel;
-	obj["cmd"] = cmd;
-	obj["msgId"] = Json::toJson(QUuid::createUuid());
-	if (!replyTo.isNull())
+	if (m_resuming)
 	{
-		obj["replyTo"] = Json::toJson(replyTo);
+		m_heldForResume.append(message);
+		return;
 	}
-	toClient(obj);
+	send(message);
+}
+void AbstractClientConnection::send(const Message &message)
+{
+	if (m_session)
+	{
+		// recorded before it's sent, anything that gets lost in transit can then be replayed
+		m_session->record(message);
+	}
+	if (m_detached)
+	{
+		return;
+	}
+	// queued from other threads, so what the message makes us throw isn't caught by the fromClient of whoever sent it
+	try
+	{
+		messageToClient(message);
+	}
+	catch (Exception &e)
+	{
+		qCWarning(Connection) << "Unable to handle" << message.cmd() << "on" << message.channel() << ":" << e.message();
+		if (!message.cmd().endsWith(":error"))
+		{
+			emit broadcast(message.channel(), message.cmd() + ":error", {{"error", e.message()}}, message.msgId());
+		}
+	}
+}
+void AbstractClientConnection::receive(const QString &channel, const QString &cmd, const QJsonObject &data, const QUuid &replyTo)
+{
+	deliver(Message(channel, cmd, data, replyTo));
+}
+
+void AbstractClientConnection::messageToClient(const Message &message)
+{
+	toClient(message.toObject());
 }
 
 void AbstractClientConnection::fromClient(const QJsonObject &obj)
+{
+	fromClient(Json::LazyObject(obj));
+}
+void AbstractClientConnection::fromClient(const Json::LazyObject &message)
 {
 	using namespace Json;
 
-	const QString channel = ensureString(obj, "channel", "");
-	const QString cmd = ensureString(obj, "cmd");
+	if (m_wheel)
+	{
+		m_lastActivity = m_wheel->now();
+	}
+
+	const QString channel = ensureString(message.value("channel"), QString(""), "'channel'");
+	const QString cmd = ensureString(message.value("cmd"), Required, "'cmd'");
 
 	if (cmd == "ping")
 	{
-		toClient({{"cmd", "pong"}, {"channel", ""}, {"timestamp", ensureInteger(obj, "timestamp")}});
+		toClient({{"cmd", "pong"}, {"channel", ""}, {"timestamp", ensureInteger(message.value("timestamp"), Required, "'timestamp'")}});
 	}
-	else if (cmd == "subscribe")
+	else if (cmd == "resume")
 	{
-		subscribeTo(channel);
+		resume(ensureUuid(message.value("token"), Required, "'token'"), ensureUuid(message.value("lastMsgId"), QUuid(), "'lastMsgId'"));
 	}
-	else if (cmd == "unsubscribe")
+	else if (cmd == "pong")
 	{
-		unsubscribeFrom(channel);
+		// answer to our heartbeat, noting the activity above is all that's needed
+	}
+	else if (cmd == "stats" && channel.isEmpty())
+	{
+		// other channels have stats of their own, such as "backlog"
+		const double hits = Message::cacheHits();
+		const double misses = Message::cacheMisses();
+		toClient({{"cmd", "stats"}, {"channel", ""}, {"encodeCache", QJsonObject({
+						{"hits", hits},
+						{"misses", misses},
+						{"hitRate", hits + misses > 0 ? hits / (hits + misses) : 0.0}
+					})}});
+	}
+	else if (cmd == "subscribe" || cmd == "unsubscribe")
+	{
+		// clients can (un)subscribe many channels at once, which is what they do on startup
+		const QJsonValue channels = message.value("channels");
+		const QList<QString> affected = channels.isUndefined() ? QList<QString>({channel}) : ensureIsArrayOf<QString>(channels, Required, "'channels'");
+		const int historyLines = ensureInteger(message.value("historyLines"), 0, "'historyLines'");
+		const QString since = ensureString(message.value("since"), QString(), "'since'");
+		for (const QString &c : affected)
+		{
+			if (cmd == "subscribe")
+			{
+				subscribeTo(c);
+				if ((historyLines > 0 || !since.isEmpty()) && c.startsWith("chat:channel:"))
+				{
+					requestHistory(c, historyLines, since, ensureUuid(message.value("msgId"), QUuid(), "'msgId'"));
+				}
+			}
+			else
+			{
+				unsubscribeFrom(c);
+			}
+		}
 	}
 	else if (cmd == "monitor")
 	{
-		setMonitor(ensureBoolean(obj, QStringLiteral("value")));
+		setMonitor(ensureBoolean(message.value("value"), Required, "'value'"));
 	}
 	else
 	{
-		emit broadcast(channel, cmd, obj);
+		emit broadcast(channel, cmd, message.object());
 	}
 }
 
 void AbstractClientConnection::subscribeTo(const QString &channel)
 {
-	m_channels.append(channel);
+	m_channels.insert(channel);
+	if (m_session)
+	{
+		m_session->setSubscriptions(m_channels, m_monitor);
+	}
 }
 void AbstractClientConnection::unsubscribeFrom(const QString &channel)
 {
-	m_channels.removeAll(channel);
+	m_channels.remove(channel);
+	const auto pending = m_pendingHistory.constFind(channel);
+	if (pending != m_pendingHistory.constEnd())
+	{
+		m_wheel->cancel(pending.value().timeout);
+		m_pendingHistory.erase(pending);
+	}
+	if (m_session)
+	{
+		m_session->setSubscriptions(m_channels, m_monitor);
+	}
 }
 void AbstractClientConnection::setMonitor(const bool monitor)
 {
 	m_monitor = monitor;
+	if (m_session)
+	{
+		m_session->setSubscriptions(m_channels, m_monitor);
+	}
+}
+
+void AbstractClientConnection::requestHistory(const QString &channel, const int lines, const QString &since, const QUuid &replyTo)
+{
+	if (m_pendingHistory.contains(channel))
+	{
+		return;
+	}
+	// a channel only we listen on, so that the history doesn't go to everyone who is subscribed
+	const QString replyChannel = "backlog:history:" + QUuid::createUuid().toString();
+	if (!m_wheel)
+	{
+		m_wheel = TimerWheel::forCurrentThread();
+	}
+	const TimerWheel::Id timeout = m_wheel->schedule(HISTORY_TIMEOUT, [this, channel, replyChannel]()
+	{
+		const auto it = m_pendingHistory.find(channel);
+		if (it != m_pendingHistory.end() && it.value().replyChannel == replyChannel)
+		{
+			qCDebug(Connection) << "No history for" << channel << "arrived in time";
+			it.value().timeout = 0;
+			finishHistory(channel, QJsonObject());
+		}
+	});
+	m_pendingHistory.insert(channel, {replyChannel, replyTo, {}, timeout});
+	QJsonObject request{{"channel", channel}, {"replyChannel", replyChannel}, {"historyLines", lines}};
+	if (!since.isEmpty())
+	{
+		request.insert("since", since);
+	}
+	emit broadcast("backlog", "history", request);
+}
+void AbstractClientConnection::finishHistory(const QString &channel, const QJsonObject &history)
+{
+	const PendingHistory pending = m_pendingHistory.take(channel);
+	if (pending.timeout)
+	{
+		m_wheel->cancel(pending.timeout);
+	}
+	int start = 0;
+	if (!history.isEmpty())
+	{
+		send(Message(channel, "history", history, pending.replyTo));
+		// the backlog has seen everything up to lastMsgId and put it into the history, so what we got of that live is dropped.
+		// messages are held in the order the backlog got them in, anything before lastMsgId we got before subscribing
+		const QUuid last(history.value("lastMsgId").toString());
+		for (int i = 0; i < pending.held.size() && !last.isNull(); ++i)
+		{
+			if (pending.held.at(i).msgId() == last)
+			{
+				start = i + 1;
+				break;
+			}
+		}
+	}
+	for (int i = start; i < pending.held.size(); ++i)
+	{
+		send(pending.held.at(i));
+	}
+}
+
+void AbstractClientConnection::enableKeepalive()
+{
+	if (idleTimeout <= 0 && heartbeatInterval <= 0)
+	{
+		return;
+	}
+	m_wheel = TimerWheel::forCurrentThread();
+	m_lastActivity = m_lastPing = m_wheel->now();
+	keepaliveCheck();
+}
+void AbstractClientConnection::keepaliveCheck()
+{
+	m_keepaliveTimer = 0;
+	const qint64 now = m_wheel->now();
+	const qint64 idle = now - m_lastActivity;
+	if (idleTimeout > 0 && idle >= idleTimeout)
+	{
+		qCDebug(Connection) << "No activity from client for" << idle << "ms, disconnecting";
+		disconnectClient();
+		return;
+	}
+
+	qint64 next = idleTimeout > 0 ? m_lastActivity + idleTimeout : std::numeric_limits<qint64>::max();
+	if (heartbeatInterval > 0)
+	{
+		if (idle >= heartbeatInterval && now - m_lastPing >= heartbeatInterval)
+		{
+			toClient({{"cmd", "ping"}, {"channel", ""}, {"timestamp", QDateTime::currentMSecsSinceEpoch()}});
+			m_lastPing = now;
+		}
+		next = qMin(next, qMax(m_lastActivity, m_lastPing) + heartbeatInterval);
+	}
+	m_keepaliveTimer = m_wheel->schedule(next - now, [this]() { keepaliveCheck(); });
+}
+
+void AbstractClientConnection::enableSessions()
+{
+	if (!Session::isEnabled())
+	{
+		return;
+	}
+	m_session = Session::create(this);
+	m_session->setSubscriptions(m_channels, m_monitor);
+	toClient({{"cmd", "session"}, {"channel", ""}, {"token", Json::toJson(m_session->token())}});
+}
+void AbstractClientConnection::detach()
+{
+	// the transport is gone, so nothing may go out anymore until we're deleted, not even a keepalive ping
+	m_detached = true;
+	if (m_wheel && m_keepaliveTimer)
+	{
+		m_wheel->cancel(m_keepaliveTimer);
+		m_keepaliveTimer = 0;
+	}
+	if (!m_session)
+	{
+		deleteLater();
+		return;
+	}
+
+	if (!m_wheel)
+	{
+		m_wheel = TimerWheel::forCurrentThread();
+	}
+	// the keepalive timer isn't needed anymore, so it's reused to expire the session
+	m_keepaliveTimer = m_wheel->schedule(Session::maxAge(), [this]()
+	{
+		m_keepaliveTimer = 0;
+		qCDebug(Connection) << "Session" << m_session->token() << "expired";
+		m_session->release(this);
+		m_session.clear();
+		deleteLater();
+	});
+}
+void AbstractClientConnection::sessionTakenOver()
+{
+	// everything we got until now has been recorded, the new owner can take it from here
+	for (const Message &message : m_heldForResume)
+	{
+		m_session->record(message);
+	}
+	m_heldForResume.clear();
+	m_resuming = false;
+	m_session->handOver();
+	m_session.clear();
+	if (m_detached)
+	{
+		deleteLater();
+	}
+	else
+	{
+		// the client has given up on this connection before we noticed
+		disconnectClient();
+	}
+}
+void AbstractClientConnection::resume(const QUuid &token, const QUuid &lastReceived)
+{
+	const QSharedPointer<Session> session = m_session ? Session::find(token) : QSharedPointer<Session>();
+	if (!session || session == m_session)
+	{
+		QJsonObject reply{{"cmd", "resume:error"}, {"channel", ""}, {"error", "Unknown or expired session"}};
+		if (m_session)
+		{
+			reply.insert("token", Json::toJson(m_session->token()));
+		}
+		toClient(reply);
+		return;
+	}
+
+	// subscribe right away, and have the previous owner record until it has noticed us. Anything we dropped before
+	// it got recorded by it then, and anything it doesn't record anymore gets held back by us until it is replayed
+	m_session->release(this);
+	m_session = session;
+	m_channels = session->channels();
+	m_monitor = session->monitor();
+	m_resuming = true;
+	m_resumeFrom = lastReceived;
+	if (!session->takeOver(this))
+	{
+		sessionHandedOver();
+	}
+}
+void AbstractClientConnection::sessionHandedOver()
+{
+	if (!m_resuming)
+	{
+		return;
+	}
+	m_resuming = false;
+	const QList<Message> held = m_heldForResume;
+	m_heldForResume.clear();
+
+	QList<Message> missed;
+	if (!m_session->since(m_resumeFrom, &missed))
+	{
+		toClient({{"cmd", "resume:error"}, {"channel", ""}, {"error", "Missed messages are no longer available"},
+				  {"token", Json::toJson(m_session->token())}});
+	}
+	else
+	{
+		qCDebug(Connection) << "Resumed session" << m_session->token() << "replaying" << missed.size() << "messages";
+		toClient({{"cmd", "resume"}, {"channel", ""}, {"token", Json::toJson(m_session->token())}, {"replayed", missed.size()}});
+		for (const Message &message : missed)
+		{
+			messageToClient(message);
+		}
+	}
+	for (const Message &message : held)
+	{
+		// the previous owner might have recorded it as well, in which case it has just been replayed
+		if (m_session->record(message) && !m_detached)
+		{
+			messageToClient(message);
+		}
+	}
 }
@@ -1,26 +1,48 @@
 ﻿#pragma once
 
 #include <QObject>
-#include <QStringList>
+#include <QPointer>
+#include <QSharedPointer>
+#include <QSet>
+#include <QHash>
 #include <QUuid>
 #include <QJsonObject>
 #include <QLoggingCategory>
 
+#include "Message.h"
+#include "TimerWheel.h"
+
+class Session;
+
+Q_DECLARE_LOGGING_CATEGORY(Connection)
+
+namespace Json
+{
+class LazyObject;
+}
+
 class AbstractClientConnection : public QObject
 {
 	Q_OBJECT
 public:
-	virtual ~AbstractClientConnection() {}
+	virtual ~AbstractClientConnection();
+
+	/// Applies to connections that use enableKeepalive, in milliseconds. 0 disables the respective check
+	static void setKeepalive(const int idle, const int heartbeat);
 
 	Q_INVOKABLE virtual void ready() {}
 
 public slots:
-	/// This gets called by ConnectionManager, and formats the message before sending it out using toClient
+	/// This gets called by ConnectionManager, and sends the message out using messageToClient if it is subscribed to its channel
+	void deliver(const Message &message);
+	/// Delivers a message that only this connection gets
 	void receive(const QString &channel, const QString &cmd, const QJsonObject &data = QJsonObject(), const QUuid &replyTo = QUuid());
 
 signals:
-	/// This gets emitted by subclasses of AbstractClientConnection, and is routed to other's AbstractClientConnection::receive through ConnectionManager
+	/// This gets emitted by subclasses of AbstractClientConnection. Every broadcast becomes one Message, emitted through route
 	void broadcast(const QString &channel, const QString &cmd, const QJsonObject &data = QJsonObject(), const QUuid &replyTo = QUuid());
+	/// Routed to other's AbstractClientConnection::deliver through ConnectionManager
+	void route(const Message &message);
 
 	/// Emit this if this AbstractClientConnection has produced a new AbstractClientConnection
 	void newConnection(AbstractClientConnection *client);
@@ -30,14 +52,81 @@ protected:
 
 	/// This should be called by the client when it receives data. Emits broadcast.
 	void fromClient(const QJsonObject &obj);
-	/// This should be reimplemented by the client to send data out. Called by receive.
+	/// Same as above, but the envelope is read without parsing the whole message, which is only done if it needs to be broadcast
+	void fromClient(const Json::LazyObject &message);
+	/// This should be reimplemented by the client to send data out. Called by messageToClient.
 	virtual void toClient(const QJsonObject &obj) = 0;
+	/**
+	 * Called by deliver. The default implementation merges envelope and data and calls toClient.
+	 *
+	 * Clients that send JSON text should reimplement this and send Message::encoded, which is shared with all other
+	 * connections that get the same message.
+	 */
+	virtual void messageToClient(const Message &message);
 
 	void subscribeTo(const QString &channel);
 	void unsubscribeFrom(const QString &channel);
 	void setMonitor(const bool monitor);
 
+	/**
+	 * For connections to remote clients. They get pinged once they have been quiet for the heartbeat interval,
+	 * and are dropped using disconnectClient after the idle timeout. Has to be called on the thread the connection lives on.
+	 */
+	void enableKeepalive();
+	/// Should tear down the connection to the client. Only called if enableKeepalive or enableSessions is used
+	virtual void disconnectClient() {}
+
+	/// For connections to remote clients. Issues a session token to the client, see Session
+	void enableSessions();
+	/**
+	 * Should be called instead of deleteLater once the connection to the client is gone. If the client has a session
+	 * the connection is kept around, detached, so that the session keeps recording until it is resumed or expires.
+	 */
+	void detach();
+
+private slots:
+	/// Called through Session::takeOver when the client has resumed our session on a new connection
+	void sessionTakenOver();
+	/// Called through Session::handOver once the previous owner of the session we took over has stopped recording
+	void sessionHandedOver();
+
 private:
-	QStringList m_channels;
+	QSet<QString> m_channels;
 	bool m_monitor = false; ///< If true, receives messages on all channels
+	/// Sends message to the client, and records it if there is a session
+	void send(const Message &message);
+
+	/**
+	 * Clients can ask for the recent history of a channel when subscribing to it. Until it arrives (on a channel of its
+	 * own) live messages of the channel are held back, so that the client gets them after the history and without what
+	 * the history already has.
+	 */
+	struct PendingHistory
+	{
+		QString replyChannel;
+		QUuid replyTo;
+		QList<Message> held;
+		TimerWheel::Id timeout;
+	};
+	QHash<QString, PendingHistory> m_pendingHistory;
+	void requestHistory(const QString &channel, const int lines, const QString &since, const QUuid &replyTo);
+	/// history is what the backlog replied, or empty if it didn't in time
+	void finishHistory(const QString &channel, const QJsonObject &history);
+
+	QPointer<TimerWheel> m_wheel; ///< Goes away with the thread, which might be before we do
+	TimerWheel::Id m_keepaliveTimer = 0;
+	qint64 m_lastActivity = 0; ///< Only updated on input, the timer is rescheduled lazily once it fires
+	qint64 m_lastPing = 0;
+	void keepaliveCheck();
+
+	QSharedPointer<Session> m_session;
+	bool m_detached = false;
+	/**
+	 * While resuming, the previous owner of the session might still record what it gets. Until it has handed the
+	 * session over, live messages are held back here, and replaying starts after lastReceived
+	 */
+	bool m_resuming = false;
+	QUuid m_resumeFrom;
+	QList<Message> m_heldForResume;
+	void resume(const QUuid &token, const QUuid &lastReceived);
 };
@@ -5,6 +5,7 @@
 ConnectionManager::ConnectionManager(QObject *parent)
 	: QObject(parent)
 {
+	qRegisterMetaType<Message>();
 }
 
 void ConnectionManager::newConnection(AbstractClientConnection *connection)
@@ -13,8 +14,8 @@ void ConnectionManager::newConnection(AbstractClientConnection *connection)
 	connect(connection, &AbstractClientConnection::newConnection, this, &ConnectionManager::newConnection);
 	for (auto other : m_connections)
 	{
-		connect(connection, &AbstractClientConnection::broadcast, other, &AbstractClientConnection::receive);
-		connect(other, &AbstractClientConnection::broadcast, connection, &AbstractClientConnection::receive);
+		connect(connection, &AbstractClientConnection::route, other, &AbstractClientConnection::deliver);
+		connect(other, &AbstractClientConnection::route, connection, &AbstractClientConnection::deliver);
 	}
 	m_connections.append(connection);
 	QMetaObject::invokeMethod(connection, "ready", Qt::QueuedConnection);
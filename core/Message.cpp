@@ -0,0 +1,146 @@
+#include "Message.h"
+
+#include <QJsonDocument>
+
+#include "common/Json.h"
+#include "common/JsonWriter.h"
+#include "common/TcpUtils.h"
+
+static QAtomicInteger<quint64> cacheHitCount;
+static QAtomicInteger<quint64> cacheMissCount;
+
+Message::Data::~Data()
+{
+	for (int i = 0; i < FormatCount; ++i)
+	{
+		delete encoded[i].load();
+	}
+	delete parsed.load();
+}
+
+Message::Message()
+	: d(new Data)
+{
+}
+Message::Message(const QString &channel, const QString &cmd, const QJsonObject &data, const QUuid &replyTo)
+	: d(new Data)
+{
+	d->channel = channel;
+	d->cmd = cmd;
+	d->data = data;
+	d->msgId = QUuid::createUuid();
+	d->replyTo = replyTo;
+}
+
+Message Message::encode(const QString &channel, const QString &cmd, const std::function<void(Json::Writer &)> &members, const QUuid &replyTo)
+{
+	static const Json::Key channelKey("channel");
+	static const Json::Key cmdKey("cmd");
+	static const Json::Key msgIdKey("msgId");
+	static const Json::Key replyToKey("replyTo");
+
+	Message message;
+	message.d->channel = channel;
+	message.d->cmd = cmd;
+	message.d->msgId = QUuid::createUuid();
+	message.d->replyTo = replyTo;
+	message.d->fromText = true;
+
+	// the same as encodeMessage writes
+	QByteArray *text = new QByteArray;
+	Json::Writer writer(*text);
+	writer.beginObject()
+			.value(channelKey, channel)
+			.value(cmdKey, cmd)
+			.value(msgIdKey, message.d->msgId);
+	if (!replyTo.isNull())
+	{
+		writer.value(replyToKey, replyTo);
+	}
+	members(writer);
+	writer.endObject();
+	message.d->encoded[Text].storeRelease(text);
+	return message;
+}
+
+QJsonObject Message::data() const
+{
+	if (!d->fromText)
+	{
+		return d->data;
+	}
+	if (QJsonObject *existing = d->parsed.loadAcquire())
+	{
+		return *existing;
+	}
+	QJsonObject *obj = new QJsonObject(QJsonDocument::fromJson(*d->encoded[Text].loadAcquire()).object());
+	for (const char *key : {"channel", "cmd", "msgId", "replyTo"})
+	{
+		obj->remove(key);
+	}
+	if (!d->parsed.testAndSetOrdered(nullptr, obj))
+	{
+		delete obj;
+		return *d->parsed.loadAcquire();
+	}
+	return *obj;
+}
+
+QJsonObject Message::toObject() const
+{
+	QJsonObject obj = data();
+	obj["channel"] = d->channel;
+	obj["cmd"] = d->cmd;
+	obj["msgId"] = Json::toJson(d->msgId);
+	if (!d->replyTo.isNull())
+	{
+		obj["replyTo"] = Json::toJson(d->replyTo);
+	}
+	return obj;
+}
+
+QByteArray Message::encoded(const Format format) const
+{
+	QAtomicPointer<QByteArray> &slot = d->encoded[format];
+	if (QByteArray *existing = slot.loadAcquire())
+	{
+		cacheHitCount.fetchAndAddRelaxed(1);
+		return *existing;
+	}
+
+	cacheMissCount.fetchAndAddRelaxed(1);
+	QByteArray *buffer = new QByteArray;
+	if (format == Packet && d->fromText)
+	{
+		const int offset = TcpUtils::beginPacket(*buffer);
+		buffer->append(*d->encoded[Text].loadAcquire());
+		TcpUtils::endPacket(*buffer, offset);
+	}
+	else if (format == Packet)
+	{
+		const int offset = TcpUtils::beginPacket(*buffer);
+		Json::encodeMessage(*buffer, d->channel, d->cmd, d->data, d->msgId, d->replyTo);
+		TcpUtils::endPacket(*buffer, offset);
+	}
+	else
+	{
+		Json::encodeMessage(*buffer, d->channel, d->cmd, d->data, d->msgId, d->replyTo);
+	}
+
+	// another thread might have been quicker, in which case we use its result so that the buffer is shared
+	if (!slot.testAndSetOrdered(nullptr, buffer))
+	{
+		delete buffer;
+		return *slot.loadAcquire();
+	}
+	return *buffer;
+}
+
+quint64 Message::cacheHits()
+{
+	return cacheHitCount.load();
+}
+quint64 Message::cacheMisses()
+{
+	return cacheMissCount.load();
+}
@@ -0,0 +1,69 @@
+#pragma once
+
+#include <QSharedData>
+#include <QJsonObject>
+#include <QUuid>
+#include <QMetaType>
+#include <functional>
+
+namespace Json
+{
+class Writer;
+}
+
+/**
+ * A message as it gets routed between connections.
+ *
+ * A message is created once per broadcast, and all copies (one per receiving connection) share the
+ * envelope, the payload and any encoding of them. A message is never modified after it has been created.
+ */
+class Message
+{
+public:
+	enum Format
+	{
+		Text, ///< Compact JSON text
+		Packet, ///< JSON text framed as done by TcpUtils
+		FormatCount
+	};
+
+	Message();
+	explicit Message(const QString &channel, const QString &cmd, const QJsonObject &data = QJsonObject(), const QUuid &replyTo = QUuid());
+	/**
+	 * For busy producers: members writes the data straight into the encoding of the message, so that no QJsonObject
+	 * has to be built. data() is only parsed back out of the encoding for receivers that ask for it.
+	 */
+	static Message encode(const QString &channel, const QString &cmd, const std::function<void(Json::Writer &)> &members, const QUuid &replyTo = QUuid());
+
+	QString channel() const { return d->channel; }
+	QString cmd() const { return d->cmd; }
+	QJsonObject data() const;
+	QUuid msgId() const { return d->msgId; }
+	QUuid replyTo() const { return d->replyTo; }
+
+	/// The data with the envelope merged into it
+	QJsonObject toObject() const;
+	/// Encodes the message the first time a format is asked for, after that the same buffer is shared by all connections. Thread safe
+	QByteArray encoded(const Format format) const;
+
+	static quint64 cacheHits();
+	static quint64 cacheMisses();
+
+private:
+	struct Data : public QSharedData
+	{
+		~Data();
+
+		QString channel;
+		QString cmd;
+		QJsonObject data;
+		QUuid msgId;
+		QUuid replyTo;
+		QAtomicPointer<QByteArray> encoded[FormatCount];
+		bool fromText = false; ///< Created by encode, data is empty and parsed from the encoding instead
+		QAtomicPointer<QJsonObject> parsed;
+	};
+	// never detached, so no copy of Data ever gets made
+	QExplicitlySharedDataPointer<Data> d;
+};
+Q_DECLARE_METATYPE(Message)
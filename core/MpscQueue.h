@@ -0,0 +1,66 @@
+#pragma once
+
+#include <QAtomicPointer>
+#include <utility>
+
+/**
+ * An unbounded lock-free queue that any number of threads can push to, but only one thread may pop from.
+ *
+ * Pushing is a single atomic exchange, so producers never wait for each other or for the consumer. A push that is
+ * still in progress can make pop return false even though later pushes have completed already, so consumers
+ * shouldn't take an empty pop as proof that nobody is pushing.
+ */
+template<typename T>
+class MpscQueue
+{
+public:
+	MpscQueue()
+		: m_head(new Node), m_tail(m_head.load())
+	{
+	}
+	~MpscQueue()
+	{
+		T value;
+		while (pop(&value))
+		{
+		}
+		delete m_tail;
+	}
+	MpscQueue(const MpscQueue &) = delete;
+	MpscQueue &operator=(const MpscQueue &) = delete;
+
+	/// Thread safe
+	void push(T &&value)
+	{
+		Node *node = new Node(std::move(value));
+		Node *previous = m_head.fetchAndStoreOrdered(node);
+		previous->next.storeRelease(node);
+	}
+	/// May only be called by the consumer
+	bool pop(T *value)
+	{
+		Node *next = m_tail->next.loadAcquire();
+		if (!next)
+		{
+			return false;
+		}
+		*value = std::move(next->value);
+		// the popped node becomes the new (empty) tail
+		delete m_tail;
+		m_tail = next;
+		return true;
+	}
+
+private:
+	struct Node
+	{
+		Node() : next(nullptr) {}
+		explicit Node(T &&value) : next(nullptr), value(std::move(value)) {}
+
+		QAtomicPointer<Node> next;
+		T value;
+	};
+
+	QAtomicPointer<Node> m_head; ///< The most recently pushed node, where producers append
+	Node *m_tail; ///< Already consumed, its next node is the next to pop
+};
@@ -10,6 +10,7 @@ public:
 	virtual ~Plugin() {}
 
 	virtual QList<QCommandLineOption> cliOptions() const = 0;
-	virtual bool handleArguments(const QCommandLineParser &parser) const = 0;
+	/// Returns false if the core shouldn't start, in which case it exits with exitCode (1 unless the plugin sets it)
+	virtual bool handleArguments(const QCommandLineParser &parser, int *exitCode) const = 0;
 	virtual QList<AbstractClientConnection *> clients(const QCommandLineParser &parser) const = 0;
 };
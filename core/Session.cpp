@@ -0,0 +1,160 @@
+#include "Session.h"
+
+#include <QHash>
+#include <QElapsedTimer>
+
+#include "AbstractClientConnection.h"
+
+namespace
+{
+struct Registry
+{
+	Registry() { clock.start(); }
+
+	QMutex mutex;
+	QHash<QUuid, QSharedPointer<Session>> sessions;
+	QElapsedTimer clock;
+};
+}
+Q_GLOBAL_STATIC(Registry, registry)
+
+static qint64 maxBufferBytes = 1024 * 1024;
+static int maxBufferAge = 0;
+
+Session::Session(AbstractClientConnection *connection)
+	: m_token(QUuid::createUuid()), m_owner(connection)
+{
+}
+
+QSharedPointer<Session> Session::create(AbstractClientConnection *connection)
+{
+	QSharedPointer<Session> session(new Session(connection));
+	QMutexLocker locker(&registry->mutex);
+	registry->sessions.insert(session->token(), session);
+	return session;
+}
+QSharedPointer<Session> Session::find(const QUuid &token)
+{
+	QMutexLocker locker(&registry->mutex);
+	return registry->sessions.value(token);
+}
+
+void Session::setLimits(const qint64 maxBytes, const int maxAge)
+{
+	maxBufferBytes = maxBytes;
+	maxBufferAge = maxAge;
+}
+bool Session::isEnabled()
+{
+	return maxBufferAge > 0;
+}
+int Session::maxAge()
+{
+	return maxBufferAge;
+}
+
+bool Session::record(const Message &message)
+{
+	const qint64 now = registry->clock.elapsed();
+	// the text encoding is shared with all other connections, so this usually doesn't cost an encode
+	const int size = message.encoded(Message::Text).size();
+
+	QMutexLocker locker(&m_mutex);
+	if (m_recorded.contains(message.msgId()))
+	{
+		return false;
+	}
+	m_buffer.append({message, now, size});
+	m_recorded.insert(message.msgId());
+	m_bytes += size;
+	trim(now);
+	return true;
+}
+bool Session::since(const QUuid &lastReceived, QList<Message> *messages) const
+{
+	QMutexLocker locker(&m_mutex);
+	int start = 0;
+	if (!lastReceived.isNull())
+	{
+		if (!m_recorded.contains(lastReceived))
+		{
+			return false;
+		}
+		while (m_buffer.at(start).message.msgId() != lastReceived)
+		{
+			++start;
+		}
+		++start;
+	}
+	else if (m_trimmed)
+	{
+		return false;
+	}
+	for (int i = start; i < m_buffer.size(); ++i)
+	{
+		messages->append(m_buffer.at(i).message);
+	}
+	return true;
+}
+
+void Session::setSubscriptions(const QSet<QString> &channels, const bool monitor)
+{
+	QMutexLocker locker(&m_mutex);
+	m_channels = channels;
+	m_monitor = monitor;
+}
+QSet<QString> Session::channels() const
+{
+	QMutexLocker locker(&m_mutex);
+	return m_channels;
+}
+bool Session::monitor() const
+{
+	QMutexLocker locker(&m_mutex);
+	return m_monitor;
+}
+
+bool Session::takeOver(AbstractClientConnection *connection)
+{
+	QMutexLocker locker(&m_mutex);
+	const bool previous = m_owner && m_owner != connection;
+	if (previous)
+	{
+		// posted while locked, so the previous owner can't go away in between (it calls release when it does)
+		QMetaObject::invokeMethod(m_owner, "sessionTakenOver", Qt::QueuedConnection);
+	}
+	m_owner = connection;
+	return previous;
+}
+void Session::handOver()
+{
+	QMutexLocker locker(&m_mutex);
+	if (m_owner)
+	{
+		QMetaObject::invokeMethod(m_owner, "sessionHandedOver", Qt::QueuedConnection);
+	}
+}
+void Session::release(AbstractClientConnection *connection)
+{
+	{
+		QMutexLocker locker(&m_mutex);
+		if (m_owner != connection)
+		{
+			return;
+		}
+		m_owner = nullptr;
+	}
+	QMutexLocker locker(&registry->mutex);
+	registry->sessions.remove(m_token);
+}
+
+void Session::trim(const qint64 now)
+{
+	while (!m_buffer.isEmpty() && (m_bytes > maxBufferBytes || now - m_buffer.first().time > maxBufferAge))
+	{
+		const Entry entry = m_buffer.takeFirst();
+		m_recorded.remove(entry.message.msgId());
+		m_bytes -= entry.size;
+		m_trimmed = true;
+	}
+}
@@ -0,0 +1,76 @@
+#pragma once
+
+#include <QSharedPointer>
+#include <QMutex>
+#include <QSet>
+#include <QList>
+#include <QUuid>
+
+#include "Message.h"
+
+class AbstractClientConnection;
+
+/**
+ * The state of a remote client that outlives its connection, so that the client can pick up where it left off
+ * after reconnecting.
+ *
+ * Everything that is sent to the client is recorded in a replay buffer that is bounded by size and age. A
+ * client that comes back with the token of its session gets its subscriptions back together with the messages
+ * it missed. All functions are thread safe.
+ */
+class Session
+{
+public:
+	/// Creates a session owned by connection, and registers it so that it can be found by its token
+	static QSharedPointer<Session> create(AbstractClientConnection *connection);
+	static QSharedPointer<Session> find(const QUuid &token);
+
+	/// Sessions are disabled if maxAge is 0
+	static void setLimits(const qint64 maxBytes, const int maxAge);
+	static bool isEnabled();
+	/// How long the buffer keeps messages, and also how long a session waits for its client to come back
+	static int maxAge();
+
+	QUuid token() const { return m_token; }
+
+	/// Records a message sent to the client. Returns false if it has been recorded already
+	bool record(const Message &message);
+	/// The messages recorded after lastReceived (all if it is null), or false if some of them have been dropped already
+	bool since(const QUuid &lastReceived, QList<Message> *messages) const;
+
+	void setSubscriptions(const QSet<QString> &channels, const bool monitor);
+	QSet<QString> channels() const;
+	bool monitor() const;
+
+	/**
+	 * Makes connection the owner of the session. The previous owner gets told through AbstractClientConnection::sessionTakenOver.
+	 * Returns false if there is none, otherwise it keeps recording until it calls handOver
+	 */
+	bool takeOver(AbstractClientConnection *connection);
+	/// Called by the previous owner once it has stopped recording. The owner gets told through AbstractClientConnection::sessionHandedOver
+	void handOver();
+	/// Unregisters the session if connection still owns it, called once connection goes away for good
+	void release(AbstractClientConnection *connection);
+
+private:
+	explicit Session(AbstractClientConnection *connection);
+
+	struct Entry
+	{
+		Message message;
+		qint64 time;
+		int size;
+	};
+
+	const QUuid m_token;
+	mutable QMutex m_mutex;
+	AbstractClientConnection *m_owner;
+	QList<Entry> m_buffer;
+	QSet<QUuid> m_recorded;
+	qint64 m_bytes = 0;
+	bool m_trimmed = false; ///< If anything has been dropped from the buffer
+	QSet<QString> m_channels;
+	bool m_monitor = false;
+
+	void trim(const qint64 now);
+};
@@ -3,6 +3,7 @@
 #include <QMetaMethod>
 
 #include "common/Json.h"
+#include "common/JsonWriter.h"
 
 inline static QJsonValue toJson(const QVariant &v)
 {
@@ -125,6 +126,24 @@ QString BaseSyncableList::command(const QString &cmd) const
 		return m_cmdPrefix + ':' + cmd;
 	}
 }
+void BaseSyncableList::broadcastValues(const QString &cmd, const QVariantMap &values, const QUuid &origin)
+{
+	emit route(Message::encode(m_channel, cmd, [&values](Json::Writer &writer)
+	{
+		for (auto it = values.constBegin(); it != values.constEnd(); ++it)
+		{
+			writer.value(Json::Key(it.key()), toJson(it.value()));
+		}
+	}, origin));
+}
+void BaseSyncableList::broadcastChange(const QVariant &index, const QString &property, const QVariant &value, const QUuid &origin)
+{
+	emit route(Message::encode(m_channel, command("changed"), [&](Json::Writer &writer)
+	{
+		writer.value(Json::Key(m_indexProperty), toJson(index))
+				.value(Json::Key(property), toJson(value));
+	}, origin));
+}
 
 SyncableList::SyncableList(const QString &channel, const QString &cmdPrefix, const QString &indexProperty, const Flags &flags, QObject *parent)
 	:BaseSyncableList(channel, cmdPrefix, indexProperty, flags, parent)
@@ -139,8 +158,7 @@ void SyncableList::set(const int index, const QString &property, const QVariant
 	}
 	Q_ASSERT(index >= 0 && index < m_rows.size());
 	m_rows[index].insert(property, value);
-	emit broadcast(m_channel, command("changed"), {{m_indexProperty, toJson(m_rows.at(index).value(m_indexProperty))},
-												  {property, toJson(value)}}, origin);
+	broadcastChange(m_rows.at(index).value(m_indexProperty), property, value, origin);
 	emit changed(index, property);
 }
 QVariant SyncableList::get(const int index, const QString &property) const
@@ -178,7 +196,7 @@ void SyncableList::add(const QMap<QString, QVariant> &values, const QUuid &origi
 		}
 	}
 	m_rows.append(values);
-	emit broadcast(m_channel, command("added"), QJsonObject::fromVariantMap(values), origin);
+	broadcastValues(command("added"), values, origin);
 }
 void SyncableList::remove(const int index, const QUuid &origin)
 {
@@ -187,7 +205,7 @@ void SyncableList::remove(const int index, const QUuid &origin)
 		return;
 	}
 	const QMap<QString, QVariant> values = m_rows.takeAt(index);
-	emit broadcast(m_channel, command("removed"), {{m_indexProperty, toJson(values.value(m_indexProperty))}}, origin);
+	broadcastValues(command("removed"), {{m_indexProperty, values.value(m_indexProperty)}}, origin);
 }
 int SyncableList::findIndex(const QVariant &index) const
 {
@@ -231,7 +249,7 @@ void SyncableQObjectList::add(QObject *obj)
 	m_objects.append(obj);
 	m_mapping.insert(indexValue(obj), obj);
 	subscribeTo(m_channel + ':' + indexValue(obj).toString());
-	emit broadcast(m_channel, command("added"), QJsonObject::fromVariantMap(objToExt(obj)));
+	broadcastValues(command("added"), objToExt(obj));
 
 	const QMetaObject *mo = obj->metaObject();
 	for (const QString &property : m_objPropToExtProp.keys())
@@ -316,7 +334,7 @@ void SyncableQObjectList::add(const QMap<QString, QVariant> &values, const QUuid
 void SyncableQObjectList::remove(const int index, const QUuid &origin)
 {
 	QObject *obj = m_objects.takeAt(index);
-	emit broadcast(m_channel, command("removed"), {{m_indexProperty, toJson(obj->property(m_extPropToObjProp[m_indexProperty].toUtf8().constData()))}}, origin);
+	broadcastValues(command("removed"), {{m_indexProperty, obj->property(m_extPropToObjProp[m_indexProperty].toUtf8().constData())}}, origin);
 	delete obj;
 }
 
@@ -400,8 +418,7 @@ void SyncableQObjectList::propertyChanged()
 	QObject *obj = sender();
 	for (const QString &property : m_signalToProperty.value(obj->metaObject()->method(senderSignalIndex())))
 	{
-		emit broadcast(m_channel, command("changed"), {{m_indexProperty, toJson(indexValue(obj))},
-													  {property, toJson(get(m_objects.indexOf(obj), property))}});
+		broadcastChange(indexValue(obj), property, get(m_objects.indexOf(obj), property));
 		emit changed(m_objects.indexOf(obj), property);
 	}
 }
@@ -410,8 +427,7 @@ void SyncableQObjectList::wrappedPropertyChanged()
 	QObject *obj = m_wrappedToWrapper[sender()];
 	for (const QString &property : m_signalToProperty.value(obj->metaObject()->method(senderSignalIndex())))
 	{
-		emit broadcast(m_channel, command("changed"), {{m_indexProperty, toJson(indexValue(obj))},
-					   {property, toJson(get(m_objects.indexOf(obj), property))}});
+		broadcastChange(indexValue(obj), property, get(m_objects.indexOf(obj), property));
 		emit changed(m_objects.indexOf(sender()), property);
 	}
 }
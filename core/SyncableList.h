@@ -63,6 +63,10 @@ protected:
 	void ready() override;
 
 	QString command(const QString &command) const;
+	/// Broadcasts cmd with values as its data, written straight into the encoding of the message
+	void broadcastValues(const QString &cmd, const QVariantMap &values, const QUuid &origin = QUuid());
+	/// Broadcasts that property of the item with index has changed to value
+	void broadcastChange(const QVariant &index, const QString &property, const QVariant &value, const QUuid &origin = QUuid());
 };
 Q_DECLARE_OPERATORS_FOR_FLAGS(BaseSyncableList::Flags)
 
@@ -0,0 +1,120 @@
+#include "TimerWheel.h"
+
+#include <QThreadStorage>
+
+Q_GLOBAL_STATIC(QThreadStorage<TimerWheel *>, wheels)
+
+TimerWheel::TimerWheel()
+	: QObject(nullptr)
+{
+	m_clock.start();
+	m_timer.setInterval(tickInterval);
+	connect(&m_timer, &QTimer::timeout, this, &TimerWheel::tick);
+}
+
+TimerWheel *TimerWheel::forCurrentThread()
+{
+	if (!wheels->hasLocalData())
+	{
+		wheels->setLocalData(new TimerWheel);
+	}
+	return wheels->localData();
+}
+
+TimerWheel::Id TimerWheel::schedule(const qint64 msecs, const std::function<void()> &callback)
+{
+	if (m_active.isEmpty())
+	{
+		// nothing has been ticking, so catch up with the clock without walking all the slots
+		m_now = m_clock.elapsed() / tickInterval;
+		m_timer.start();
+	}
+
+	const Id id = m_nextId++;
+	// rounded up, and always at least one tick into the future
+	const quint64 ticks = qMax<qint64>(1, (m_clock.elapsed() + qMax<qint64>(0, msecs) + tickInterval - 1) / tickInterval - m_now);
+	insert({id, m_now + ticks, callback});
+	m_active.insert(id);
+	return id;
+}
+void TimerWheel::cancel(const Id id)
+{
+	m_active.remove(id);
+	if (m_active.isEmpty())
+	{
+		m_timer.stop();
+	}
+}
+
+void TimerWheel::tick()
+{
+	const quint64 target = m_clock.elapsed() / tickInterval;
+	while (m_now < target && !m_active.isEmpty())
+	{
+		advance();
+	}
+	if (m_active.isEmpty())
+	{
+		m_timer.stop();
+	}
+}
+
+void TimerWheel::insert(Entry &&entry)
+{
+	const quint64 delta = entry.expires > m_now ? entry.expires - m_now : 0;
+	for (int level = 0; level < levels; ++level)
+	{
+		const int shift = level * slotBits;
+		if (delta < (quint64(slotsPerLevel) << shift) || level == levels - 1)
+		{
+			// anything further away than the outermost level can hold gets cascaded down again until it fits
+			const quint64 expires = level == levels - 1 ? qMin(entry.expires, m_now + (quint64(slotsPerLevel - 1) << shift)) : entry.expires;
+			m_slots[level][(expires >> shift) & (slotsPerLevel - 1)].append(std::move(entry));
+			return;
+		}
+	}
+}
+
+void TimerWheel::advance()
+{
+	++m_now;
+
+	// when a level wraps around, the next slot of the level above gets spread out over the levels below it
+	for (int level = 1; level < levels; ++level)
+	{
+		const int shift = level * slotBits;
+		if ((m_now & ((quint64(1) << shift) - 1)) != 0)
+		{
+			break;
+		}
+		QVector<Entry> cascading;
+		cascading.swap(m_slots[level][(m_now >> shift) & (slotsPerLevel - 1)]);
+		for (Entry &entry : cascading)
+		{
+			if (m_active.contains(entry.id))
+			{
+				insert(std::move(entry));
+			}
+		}
+	}
+
+	QVector<Entry> due;
+	due.swap(m_slots[0][m_now & (slotsPerLevel - 1)]);
+	for (Entry &entry : due)
+	{
+		// checked right before calling, an earlier callback might have cancelled it
+		if (!m_active.contains(entry.id))
+		{
+			continue;
+		}
+		else if (entry.expires > m_now)
+		{
+			// clamped by insert, not due yet
+			insert(std::move(entry));
+			continue;
+		}
+		m_active.remove(entry.id);
+		// the callback may schedule or cancel entries, which is fine since it's no longer part of any slot
+		entry.callback();
+	}
+}
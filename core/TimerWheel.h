@@ -0,0 +1,63 @@
+#pragma once
+
+#include <QObject>
+#include <QElapsedTimer>
+#include <QTimer>
+#include <QSet>
+#include <QVector>
+#include <functional>
+
+/**
+ * A hierarchical timer wheel, one per thread, for timeouts that many objects on the same thread need.
+ *
+ * Scheduling and cancelling are O(1) and a single QTimer, driven by the event loop of the thread, runs all entries. It
+ * only ticks while there is something scheduled. Connections that share a worker thread share its wheel, and nothing
+ * is shared between threads, so there is no locking. Timeouts are rounded up to the next tick, so this is meant for
+ * things like idle detection, not for precise timing.
+ */
+class TimerWheel : public QObject
+{
+	Q_OBJECT
+public:
+	using Id = quint64;
+
+	/// The wheel of the calling thread, created on first use and destroyed when the thread finishes
+	static TimerWheel *forCurrentThread();
+
+	/// Calls callback once after msecs, on the thread of the wheel. Only to be used from that thread
+	Id schedule(const qint64 msecs, const std::function<void()> &callback);
+	/// Once this returns the callback won't be called anymore
+	void cancel(const Id id);
+
+	/// Monotonic milliseconds, the clock that timeouts are measured against
+	qint64 now() const { return m_clock.elapsed(); }
+
+	static constexpr int tickInterval = 100;
+
+private slots:
+	void tick();
+
+private:
+	explicit TimerWheel();
+
+	static constexpr int levels = 4;
+	static constexpr int slotBits = 6;
+	static constexpr int slotsPerLevel = 1 << slotBits;
+
+	struct Entry
+	{
+		Id id;
+		quint64 expires; ///< In ticks
+		std::function<void()> callback;
+	};
+
+	QElapsedTimer m_clock;
+	QTimer m_timer;
+	quint64 m_now = 0; ///< The last tick that has been processed
+	Id m_nextId = 1;
+	QSet<Id> m_active; ///< Cancelled entries stay in their slot until it comes up
+	QVector<Entry> m_slots[levels][slotsPerLevel];
+
+	void insert(Entry &&entry);
+	void advance();
+};
@@ -0,0 +1,54 @@
+#include "WorkerPool.h"
+
+#include <QThread>
+
+WorkerPool::WorkerPool(const QString &name, const int size, QObject *parent)
+	: QObject(parent)
+{
+	for (int i = 0; i < qMax(1, size); ++i)
+	{
+		Worker *worker = new Worker;
+		worker->thread = new QThread;
+		worker->thread->setObjectName(QString("%1-%2").arg(name).arg(i));
+		worker->thread->start();
+		m_workers.append(worker);
+	}
+}
+WorkerPool::~WorkerPool()
+{
+	for (Worker *worker : m_workers)
+	{
+		worker->thread->quit();
+		worker->thread->wait();
+		delete worker->thread;
+		delete worker;
+	}
+}
+
+int WorkerPool::assign(QObject *object)
+{
+	int best = 0;
+	for (int i = 1; i < m_workers.size(); ++i)
+	{
+		if (m_workers.at(i)->load.load() < m_workers.at(best)->load.load())
+		{
+			best = i;
+		}
+	}
+
+	Worker *worker = m_workers.at(best);
+	worker->load.ref();
+	// direct connection, the counter is atomic and the object is destroyed on the worker thread
+	connect(object, &QObject::destroyed, [worker]() { worker->load.deref(); });
+	object->moveToThread(worker->thread);
+	return best;
+}
+
+QThread *WorkerPool::thread(const int worker) const
+{
+	return m_workers.at(worker)->thread;
+}
+int WorkerPool::load(const int worker) const
+{
+	return m_workers.at(worker)->load.load();
+}
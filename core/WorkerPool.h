@@ -0,0 +1,31 @@
+#pragma once
+
+#include <QObject>
+#include <QVector>
+#include <QAtomicInt>
+
+class QThread;
+
+/// A fixed set of threads, each running its own event loop, that objects can be distributed across
+class WorkerPool : public QObject
+{
+	Q_OBJECT
+public:
+	explicit WorkerPool(const QString &name, const int size, QObject *parent = nullptr);
+	~WorkerPool();
+
+	/// Moves object to the least loaded worker and returns the index of that worker. The load is decreased again once the object is destroyed
+	int assign(QObject *object);
+
+	int size() const { return m_workers.size(); }
+	QThread *thread(const int worker) const;
+	int load(const int worker) const;
+
+private:
+	struct Worker
+	{
+		QThread *thread;
+		QAtomicInt load;
+	};
+	QVector<Worker *> m_workers;
+};
@@ -0,0 +1,229 @@
+#include "BacklogBenchmark.h"
+
+#include <QSqlDatabase>
+#include <QSqlDriver>
+#include <QSqlError>
+#include <QTemporaryDir>
+#include <QElapsedTimer>
+#include <QVector>
+#include <random>
+
+#include "BacklogClientConnection.h"
+#include "BacklogPartitions.h"
+#include "LogStore.h"
+#include "SqlHelpers.h"
+
+// the defaults of --backlog-batch-size and what clients ask for by default
+static constexpr const int BATCH_SIZE = 200;
+static constexpr const int ROWS_PER_INSERT = 150;
+static constexpr const int PAGE_SIZE = 20;
+static constexpr const int CHANNELS = 10;
+static constexpr const int PAGES = 1000;
+
+namespace
+{
+struct Message
+{
+	int channel;
+	int source; ///< As interned by BacklogNames
+	BacklogRing::Line line;
+};
+struct Cursor
+{
+	int channel;
+	qint64 max;
+	qint64 beforeId;
+};
+struct Result
+{
+	qint64 writeTime;
+	qint64 readTime;
+	QVector<QVector<qint64>> pages; ///< The ids of every page, for checking that both agree
+};
+}
+
+static QString channelName(const int channel)
+{
+	return "benchmark-" + QString::number(channel);
+}
+
+static bool runSql(QSqlDatabase db, const QVector<Message> &messages, const QVector<Cursor> &cursors, Result *result)
+{
+	if (!db.open())
+	{
+		qCWarning(Backlog) << "Unable to open" << db.databaseName() << ":" << db.lastError().text();
+		return false;
+	}
+	BacklogPartitions::createTable(db, "chat_messages");
+
+	QElapsedTimer timer;
+	timer.start();
+	for (int batch = 0; batch < messages.size(); batch += BATCH_SIZE)
+	{
+		db.transaction();
+		for (int start = batch; start < qMin(batch + BATCH_SIZE, messages.size()); start += ROWS_PER_INSERT)
+		{
+			auto insert = Sql::INSERT().INTO("chat_messages").COLUMNS("id", "channel", "source", "type", "content", "timestamp");
+			for (int i = start; i < qMin(start + ROWS_PER_INSERT, qMin(batch + BATCH_SIZE, messages.size())); ++i)
+			{
+				const Message &m = messages.at(i);
+				insert = insert.VALUES(QVariantList{m.line.id, m.channel, m.source, 1, m.line.content, m.line.timestamp});
+			}
+			if (insert.exec(db).lastError().isValid())
+			{
+				db.rollback();
+				return false;
+			}
+		}
+		db.commit();
+	}
+	result->writeTime = timer.nsecsElapsed();
+
+	timer.restart();
+	for (const Cursor &cursor : cursors)
+	{
+		// the same query as BacklogClientConnection::sendPage
+		QSqlQuery q = Sql::SELECT("id", "source", "type", "content", "timestamp").FROM("chat_messages").WHERE("channel", "=", cursor.channel)
+				.WHERE("timestamp", "<=", cursor.max).WHERE_ANY({{"timestamp", "<", cursor.max}, {"id", "<", cursor.beforeId}})
+				.ORDER_BY("timestamp", Sql::DESC).ORDER_BY("id", Sql::DESC).LIMIT(PAGE_SIZE).exec(db);
+		QVector<qint64> ids;
+		while (q.next())
+		{
+			// decoded like sendPage does, so that both do the same amount of work
+			const BacklogRing::Line line{q.value(0).toLongLong(), q.value(4).toLongLong(), "user" + q.value(1).toString(), "message", q.value(3).toString()};
+			ids.append(line.id);
+		}
+		result->pages.append(ids);
+	}
+	result->readTime = timer.nsecsElapsed();
+	return true;
+}
+
+static bool runLog(const QString &directory, const QVector<Message> &messages, const QVector<Cursor> &cursors, Result *result)
+{
+	LogStore store(directory);
+	if (!store.open())
+	{
+		return false;
+	}
+
+	QElapsedTimer timer;
+	timer.start();
+	for (int i = 0; i < messages.size(); ++i)
+	{
+		store.append(channelName(messages.at(i).channel), messages.at(i).line);
+		if ((i + 1) % BATCH_SIZE == 0)
+		{
+			store.flush();
+		}
+	}
+	store.flush();
+	result->writeTime = timer.nsecsElapsed();
+
+	timer.restart();
+	for (const Cursor &cursor : cursors)
+	{
+		QVector<BacklogRing::Line> lines;
+		if (!store.page(channelName(cursor.channel), 0, cursor.max, cursor.beforeId, PAGE_SIZE, &lines))
+		{
+			return false;
+		}
+		QVector<qint64> ids;
+		for (const BacklogRing::Line &line : lines)
+		{
+			ids.append(line.id);
+		}
+		result->pages.append(ids);
+	}
+	result->readTime = timer.nsecsElapsed();
+	return true;
+}
+
+static void report(const char *name, const int messages, const Result &result)
+{
+	qCDebug(Backlog).nospace() << name << ": wrote " << messages << " messages in " << result.writeTime / 1000000 << "ms ("
+							   << qint64(messages * 1e9 / qMax<qint64>(1, result.writeTime)) << " messages/s), read " << PAGES << " pages in "
+							   << result.readTime / 1000000 << "ms (" << result.readTime / PAGES / 1000 << "us per page)";
+}
+
+bool BacklogBenchmark::run(QSqlDriver *sqliteDriver, const int messages)
+{
+	QTemporaryDir directory;
+	if (!directory.isValid())
+	{
+		qCWarning(Backlog) << "Unable to create a temporary directory";
+		delete sqliteDriver;
+		return false;
+	}
+
+	// fixed seeds, so that every run does the same
+	std::mt19937 random(42);
+	static const QStringList words = {"lorem", "ipsum", "dolor", "sit", "amet", "consectetur", "adipiscing", "elit", "sed", "do", "eiusmod", "tempor"};
+	QVector<Message> generated;
+	QVector<QVector<Cursor>> positions(CHANNELS);
+	const qint64 start = 1500000000000;
+	for (int i = 0; i < messages; ++i)
+	{
+		QStringList content;
+		for (int w = 0; w < 4 + int(random() % 12); ++w)
+		{
+			content.append(words.at(int(random() % words.size())));
+		}
+		const int channel = int(random() % CHANNELS);
+		// some share a timestamp, so that ties are covered as well
+		const qint64 timestamp = start + i * 500 - (i % 7 == 0 ? 500 : 0);
+		const int source = int(random() % 50) + 1;
+		generated.append({channel, source, {i + 1, timestamp, "user" + QString::number(source), "message", content.join(' ')}});
+		positions[channel].append({channel, timestamp, i + 1});
+	}
+	QVector<Cursor> cursors;
+	for (int i = 0; i < PAGES; ++i)
+	{
+		const QVector<Cursor> &channel = positions.at(int(random() % CHANNELS));
+		if (!channel.isEmpty())
+		{
+			cursors.append(channel.at(int(random() % channel.size())));
+		}
+	}
+	qCDebug(Backlog) << "Benchmarking with" << messages << "messages in" << CHANNELS << "channels, in" << directory.path();
+
+	Result sql;
+	bool ok;
+	{
+		QSqlDatabase db = QSqlDatabase::addDatabase(sqliteDriver, "backlog-benchmark");
+		db.setDatabaseName(directory.path() + "/backlog.sqlite");
+		ok = runSql(db, generated, cursors, &sql);
+		Sql::forgetStatements(db);
+		db.close();
+	}
+	QSqlDatabase::removeDatabase("backlog-benchmark");
+	if (!ok)
+	{
+		qCWarning(Backlog) << "The QSQLITE benchmark failed";
+		return false;
+	}
+	report("QSQLITE", messages, sql);
+
+	Result log;
+	if (!runLog(directory.path() + "/log", generated, cursors, &log))
+	{
+		qCWarning(Backlog) << "The log benchmark failed";
+		return false;
+	}
+	report("log", messages, log);
+
+	int mismatches = 0;
+	for (int i = 0; i < cursors.size(); ++i)
+	{
+		if (sql.pages.at(i) != log.pages.at(i))
+		{
+			++mismatches;
+		}
+	}
+	if (mismatches > 0)
+	{
+		qCWarning(Backlog) << mismatches << "pages differ between QSQLITE and log";
+		return false;
+	}
+	return true;
+}
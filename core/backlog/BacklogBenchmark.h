@@ -0,0 +1,13 @@
+#pragma once
+
+class QSqlDriver;
+
+/**
+ * Compares the "log" engine (LogStore) to the database, using SQLite, by writing messages to both in batches the way
+ * BacklogClientConnection does and then requesting random pages of history from each.
+ */
+namespace BacklogBenchmark
+{
+/// Takes ownership of sqliteDriver. Returns false if either of them couldn't be set up, or if they disagree about a page
+bool run(QSqlDriver *sqliteDriver, const int messages);
+}
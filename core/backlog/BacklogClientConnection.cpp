@@ -1,33 +1,111 @@
 #include "BacklogClientConnection.h"
 
+#include <QCoreApplication>
 #include <QSqlDatabase>
+#include <QSqlDriver>
 #include <QSqlError>
 #include <QThread>
+#include <QTimer>
+#include <QDateTime>
 
 #include "common/Json.h"
+#include "BacklogWriter.h"
+#include "BacklogReader.h"
+#include "LogStore.h"
+#include "BacklogCompression.h"
+#include "BacklogMigration.h"
+#include "BacklogNames.h"
 #include "SqlHelpers.h"
 
 Q_LOGGING_CATEGORY(Backlog, "core.backlog")
 
-static constexpr const int LATEST_SCHEMA_VERSION = 1;
+static constexpr const int LATEST_SCHEMA_VERSION = 7;
+static constexpr const int MAX_PAGE_SIZE = 1000;
+static constexpr const int MAX_SEARCH_RESULTS = 100;
+static constexpr const int MAINTENANCE_INTERVAL = 60 * 60 * 1000;
+static constexpr const int CHANNEL_NAMES_DELAY = 1000;
 
 BacklogClientConnection::BacklogClientConnection(const Options &options, QObject *parent)
-	: AbstractClientConnection(parent)
+	: AbstractClientConnection(parent), m_driver(options.driver), m_database(options.database), m_channelNamesTimer(new QTimer(this)),
+	  m_writerThread(new QThread), m_writer(new BacklogWriter(options.writerDriver, options.database, options.batchSize, options.batchBytes, options.batchLatency)),
+	  m_ring(options.hotLines), m_logBatchBytes(options.batchBytes), m_retention(qint64(options.retentionDays) * 24 * 60 * 60 * 1000),
+	  m_maintenanceTimer(new QTimer(this)), m_compression(options.compression)
 {
 	subscribeTo("chat:channels");
+	subscribeTo("backlog");
 
-	QSqlDatabase db = QSqlDatabase::addDatabase(options.driver, "backlog");
-	db.setHostName(options.host);
-	db.setPort(options.port);
-	db.setDatabaseName(options.dbName);
-	db.setUserName(options.userName);
-	db.setPassword(options.password);
-	db.setConnectOptions(options.connectionOptions);
+	// connections belong to the thread of their driver, and we're not on ours yet
+	m_driver->setParent(this);
+
+	m_writerThread->setObjectName("BacklogWriter");
+	m_writer->moveToThread(m_writerThread);
+	options.writerDriver->moveToThread(m_writerThread);
+	// the writer flushes what is left when it gets destroyed
+	connect(m_writerThread, &QThread::finished, m_writer, &BacklogWriter::deleteLater);
+	// readers have to know about them to find what is written there
+	connect(m_writer, &BacklogWriter::partitionCreated, this, [this](const QString &table, const qint64 start, const qint64 end)
+	{
+		m_partitions.add({table, start, end, false});
+	});
+	m_writerThread->start();
+
+	for (int i = 0; i < options.readerDrivers.size(); ++i)
+	{
+		QThread *thread = new QThread;
+		thread->setObjectName(QString("BacklogReader%1").arg(i));
+		BacklogReader *reader = new BacklogReader(options.readerDrivers.at(i), options.database, i);
+		reader->moveToThread(thread);
+		options.readerDrivers.at(i)->moveToThread(thread);
+		connect(thread, &QThread::finished, reader, &BacklogReader::deleteLater);
+		// replies go out as if they were ours
+		connect(reader, &BacklogReader::reply, this, &BacklogClientConnection::broadcast);
+		thread->start();
+		m_readerThreads.append(thread);
+		m_readers.append(reader);
+	}
+
+	m_channelNamesTimer->setSingleShot(true);
+	m_channelNamesTimer->setInterval(CHANNEL_NAMES_DELAY);
+	connect(m_channelNamesTimer, &QTimer::timeout, this, &BacklogClientConnection::flushChannelNames);
+
+	m_maintenanceTimer->setInterval(MAINTENANCE_INTERVAL);
+	connect(m_maintenanceTimer, &QTimer::timeout, this, &BacklogClientConnection::maintainPartitions);
+
+	if (options.engine == "log")
+	{
+		m_log = new LogStore(options.logDirectory);
+		m_logFlushTimer = new QTimer(this);
+		m_logFlushTimer->setSingleShot(true);
+		m_logFlushTimer->setInterval(options.batchLatency);
+		connect(m_logFlushTimer, &QTimer::timeout, this, [this]() { m_log->flush(); });
+		// connections don't get destroyed when quitting, so the destructor can't be relied upon for this
+		connect(qApp, &QCoreApplication::aboutToQuit, this, [this]()
+		{
+			m_logFlushTimer->stop();
+			m_log->flush();
+		}, Qt::BlockingQueuedConnection);
+	}
+}
+BacklogClientConnection::~BacklogClientConnection()
+{
+	m_writerThread->quit();
+	m_writerThread->wait();
+	delete m_writerThread;
+	for (QThread *thread : m_readerThreads)
+	{
+		thread->quit();
+		thread->wait();
+		delete thread;
+	}
+	// flushes what is left
+	delete m_log;
 }
 
 void BacklogClientConnection::ready()
 {
-	QSqlDatabase db = getDB();
+	// owned by the connection from now on
+	m_driver->setParent(nullptr);
+	QSqlDatabase db = m_database.addDatabase(m_driver, "backlog");
 	if (!db.open())
 	{
 		qCWarning(Backlog) << "Unable to connect to database:" << db.lastError().text();
@@ -38,14 +116,78 @@ void BacklogClientConnection::ready()
 		qCDebug(Backlog) << "Successfully connected to" << (db.hostName() + ':' + QString::number(db.port())) << "(DB" << db.databaseName() << ")";
 	}
 
-	createTables();
-	migrateDatabase();
+	if (!prepareDatabase())
+	{
+		thread()->exit(1);
+		return;
+	}
+	m_searchEngine = BacklogSearch::engineFromName(
+				Sql::SELECT("value").FROM("settings").WHERE("category", "=", "backlog").AND("key", "=", "search_engine").execAndNext(db).value(0).toString());
+	qCDebug(Backlog) << "Using" << BacklogSearch::engineName(m_searchEngine) << "for full-text search";
+	if (m_compression && m_searchEngine != BacklogSearch::Terms && m_searchEngine != BacklogSearch::None)
+	{
+		// native full-text indices are built from the content column, which is empty for compressed messages. The
+		// embedded one is filled by the writer, before compressing
+		qCDebug(Backlog) << "Switching from" << BacklogSearch::engineName(m_searchEngine) << "to terms full-text search for compression...";
+		db.transaction();
+		if (BacklogSearch::switchToTerms(db, m_searchEngine, BacklogPartitions::allTables(db)))
+		{
+			Sql::UPDATE("settings").SET("value", BacklogSearch::engineName(BacklogSearch::Terms))
+					.WHERE("category", "=", "backlog").AND("key", "=", "search_engine").exec(db);
+			BacklogMigration::scheduleIndexing(db);
+			db.commit();
+			m_searchEngine = BacklogSearch::Terms;
+		}
+		else
+		{
+			db.rollback();
+			qCWarning(Backlog) << "Unable to switch to terms full-text search, disabling compression";
+			m_compression = false;
+		}
+	}
+	m_partitions.load(db, m_searchEngine);
+	if (Sql::dialect(db) == "QSQLITE")
+	{
+		// readers don't block the writer and the writer doesn't block readers. Sticks to the database file
+		QSqlQuery q(db);
+		if (!q.exec("PRAGMA journal_mode=WAL"))
+		{
+			qCWarning(Backlog) << "Unable to switch to write-ahead logging:" << q.lastError().text();
+		}
+	}
+	// only now that the tables exist
+	QMetaObject::invokeMethod(m_writer, "open", Qt::QueuedConnection, Q_ARG(int, m_searchEngine));
+	QMetaObject::invokeMethod(m_writer, "startMigrations", Qt::QueuedConnection, Q_ARG(int, m_searchEngine));
+	for (BacklogReader *reader : m_readers)
+	{
+		QMetaObject::invokeMethod(reader, "open", Qt::QueuedConnection);
+	}
+	if (m_compression)
+	{
+		QMetaObject::invokeMethod(m_writer, "loadDictionaries", Qt::QueuedConnection);
+	}
 
-	QSqlQuery q = Sql::SELECT("id", "uuid").FROM("chat_channels").exec(db);
+	QSqlQuery q = Sql::SELECT("id", "uuid", "name").FROM("chat_channels").exec(db);
 	while (q.next())
 	{
 		m_channelMapping.insert(q.value(1).toString(), q.value(0).toInt());
+		m_channelNames.insert(q.value(1).toString(), q.value(2).toString());
+	}
+	for (const QString &table : m_partitions.tables())
+	{
+		m_lastMessageId = qMax(m_lastMessageId, Sql::SELECT("MAX(id)").FROM(table).execAndNext(db).value(0).toLongLong());
+	}
+	if (m_log)
+	{
+		if (!m_log->open())
+		{
+			thread()->exit(1);
+			return;
+		}
+		m_lastMessageId = qMax(m_lastMessageId, m_log->lastId());
 	}
+	maintainPartitions();
+	m_maintenanceTimer->start();
 
 	emit broadcast("chat:channels", "list");
 }
@@ -57,39 +199,13 @@ void BacklogClientConnection::toClient(const QJsonObject &obj)
 	const QString cmd = ensureString(obj, "cmd");
 	const QString msgId = ensureString(obj, "msgId");
 
-	QSqlDatabase db = getDB();
-
-	// ensure that we have the channel in the database, potentially setting/updating the name
-	auto check = [db, this](const QJsonObject &data)
-	{
-		const QString id = ensureString(data, "id");
-		QSqlQuery query = Sql::SELECT("id").FROM("chat_channels").WHERE("uuid", "=", id).exec(db);
-		if (!query.isValid())
-		{
-			const QString id = ensureString(data, "id");
-			Sql::INSERT().INTO("chat_channels").COLUMNS("uuid").VALUES(id).exec(db);
-			QSqlQuery q = Sql::SELECT("id").FROM("chat_channels").WHERE("uuid", "=", id).execAndNext(db);
-			m_channelMapping.insert(id, q.value(0).toInt());
-			subscribeTo("chat:channel:" + id);
-
-			if (!data.contains("name"))
-			{
-				emit broadcast("chat:channels", "get", {{"id", id}});
-			}
-		}
-		if (data.contains("name"))
-		{
-			Sql::UPDATE("chat_channels").SET("name", ensureString(data, "name")).WHERE("uuid", "=", id);
-		}
-	};
-
 	if (channel == "chat:channels")
 	{
 		if (cmd == "items")
 		{
 			for (const QJsonObject &item : ensureIsArrayOf<QJsonObject>(obj, "items"))
 			{
-				check(item);
+				checkChannel(item);
 			}
 		}
 		else if (cmd == "added" || cmd == "removed" || cmd == "changed" || cmd == "item")
@@ -97,48 +213,358 @@ void BacklogClientConnection::toClient(const QJsonObject &obj)
 			const QString id = ensureString(obj, "id");
 			if (cmd == "added")
 			{
-				check(obj);
+				checkChannel(obj);
 			}
 			else if (cmd == "removed")
 			{
-				// do nothing
+				// the messages stay, but there won't be any new ones
 				unsubscribeFrom("chat:channel:" + id);
+				m_subscribedChannels.remove(id);
 			}
 			else if (cmd == "changed")
 			{
 				if (obj.contains("name"))
 				{
-					check(obj);
+					checkChannel(obj);
 				}
 			}
 			else if (cmd == "item")
 			{
-				check(obj);
+				checkChannel(obj);
 			}
 		}
 	}
+	else if (channel == "backlog")
+	{
+		if (cmd == "stats")
+		{
+			emit broadcast("backlog", "stats", m_writer->stats(), ensureUuid(obj, "msgId"));
+		}
+		else if (cmd == "search")
+		{
+			sendSearchResults(channel, QUuid(msgId), -1, obj);
+		}
+		else if (cmd == "history")
+		{
+			sendHistory(obj);
+		}
+	}
 	else if (channel.startsWith("chat:channel:"))
 	{
 		const QString id = QString(channel).remove("chat:channel:");
 		if (cmd == "message")
 		{
-			check({{"id", id}});
-			Sql::INSERT().INTO("chat_messages").COLUMNS("channel", "source", "type", "content", "timestamp")
-					.VALUES(m_channelMapping[id],
-							ensureString(obj, "from"),
-							ensureString(obj, "type"),
-							ensureString(obj, "content"),
-							ensureString(obj, "timestamp").toULongLong())
-					.exec(db);
+			// known channels are answered from memory, only new ones need the database
+			auto mapping = m_channelMapping.constFind(id);
+			if (mapping == m_channelMapping.constEnd())
+			{
+				checkChannel({{"id", id}});
+				mapping = m_channelMapping.constFind(id);
+			}
+			const int channelId = mapping.value();
+			const QString source = ensureString(obj, "from");
+			const QString type = ensureString(obj, "type");
+			const QString content = ensureString(obj, "content");
+			const qint64 timestamp = ensureString(obj, "timestamp").toLongLong();
+			if (m_retention > 0 && timestamp < QDateTime::currentMSecsSinceEpoch() - m_retention)
+			{
+				// would be dropped right away, and might even go into a partition that is being dropped
+				return;
+			}
+			const qint64 messageId = ++m_lastMessageId;
+			m_lastMsgIds.insert(id, msgId);
+			if (m_log)
+			{
+				appendToLog(id, {messageId, timestamp, source, type, content});
+			}
+			else
+			{
+				const int size = content.size() * int(sizeof(QChar)) + 3 * int(sizeof(int)) + 2 * int(sizeof(qint64));
+				// names and partitions are up to the writer, nothing here waits for the database
+				m_writer->enqueue({messageId, channelId, source, type, content, timestamp}, size);
+			}
+			if (m_ring.capacity() > 0)
+			{
+				ensureRing(channelId, id);
+				m_ring.append(channelId, {messageId, timestamp, source, type, content});
+			}
 		}
 		else if (cmd == "more")
 		{
-			const unsigned long long max = ensureString(obj, "max", "0").toULongLong();
-			const unsigned long long min = ensureString(obj, "min", "0").toULongLong();
-			const int amount = ensureInteger(obj, "amount", 20);
+			const qint64 max = ensureString(obj, "max", "0").toLongLong();
+			const qint64 min = ensureString(obj, "min", "0").toLongLong();
+			const qint64 beforeId = ensureDouble(obj, "beforeId", 0);
+			const int amount = qBound(1, ensureInteger(obj, "amount", 20), MAX_PAGE_SIZE);
 			qCDebug(Backlog) << "Got a request for" << amount << "lines of backlog from" << min << "to" << max;
+			sendPage(channel, QUuid(msgId), m_channelMapping.value(id, -1), id, min, max, beforeId, amount);
+		}
+		else if (cmd == "search")
+		{
+			// ids start at 1, so an unknown channel has nothing to be found rather than everything
+			sendSearchResults(channel, QUuid(msgId), m_channelMapping.value(id, 0), obj);
+		}
+	}
+}
+
+void BacklogClientConnection::checkChannel(const QJsonObject &data)
+{
+	using namespace Json;
+	const QString id = ensureString(data, "id");
+	if (!m_channelMapping.contains(id))
+	{
+		Sql::INSERT().INTO("chat_channels").COLUMNS("uuid").VALUES(id).exec(getDB());
+		QSqlQuery q = Sql::SELECT("id").FROM("chat_channels").WHERE("uuid", "=", id).execAndNext(getDB());
+		m_channelMapping.insert(id, q.value(0).toInt());
+		m_channelNames.insert(id, QString());
+
+		if (!data.contains("name"))
+		{
+			emit broadcast("chat:channels", "get", {{"id", id}});
+		}
+	}
+	if (!m_subscribedChannels.contains(id))
+	{
+		subscribeTo("chat:channel:" + id);
+		m_subscribedChannels.insert(id);
+	}
+	if (data.contains("name"))
+	{
+		const QString name = ensureString(data, "name");
+		if (m_channelNames.value(id) != name)
+		{
+			m_channelNames.insert(id, name);
+			m_pendingChannelNames.insert(id, name);
+			if (!m_channelNamesTimer->isActive())
+			{
+				m_channelNamesTimer->start();
+			}
+		}
+	}
+}
+
+void BacklogClientConnection::flushChannelNames()
+{
+	// every "list" after a restart brings all names, so they are gathered up and written in one go
+	QSqlDatabase db = getDB();
+	db.transaction();
+	for (auto it = m_pendingChannelNames.constBegin(); it != m_pendingChannelNames.constEnd(); ++it)
+	{
+		Sql::UPDATE("chat_channels").SET("name", it.value()).WHERE("uuid", "=", it.key()).exec(db);
+	}
+	db.commit();
+	m_pendingChannelNames.clear();
+}
+
+void BacklogClientConnection::ensureRing(const int channelId, const QString &uuid)
+{
+	if (!m_ring.contains(channelId))
+	{
+		// everything that is in the database by now is older than what the ring is going to get
+		qint64 floor = m_log ? m_log->newestTimestamp(uuid) : -1;
+		for (const QString &table : m_log ? QStringList() : m_partitions.tables())
+		{
+			QSqlQuery q = Sql::SELECT("MAX(timestamp)").FROM(table).WHERE("channel", "=", channelId).execAndNext(getDB());
+			if (!q.value(0).isNull())
+			{
+				floor = BacklogPartitions::shape(getDB(), table).timestamp(q.value(0));
+				break;
+			}
+		}
+		m_ring.create(channelId, floor);
+	}
+}
+
+void BacklogClientConnection::appendToLog(const QString &uuid, const BacklogRing::Line &line)
+{
+	m_log->append(uuid, line);
+	if (m_log->pendingBytes() >= m_logBatchBytes)
+	{
+		m_logFlushTimer->stop();
+		m_log->flush();
+	}
+	else if (!m_logFlushTimer->isActive())
+	{
+		m_logFlushTimer->start();
+	}
+}
+
+void BacklogClientConnection::sendPage(const QString &channel, const QUuid &replyTo, const int channelId, const QString &uuid,
+									   const qint64 min, const qint64 max, const qint64 beforeId, const int amount)
+{
+	QVector<BacklogRing::Line> lines;
+	if (m_ring.capacity() > 0 && channelId >= 0)
+	{
+		ensureRing(channelId, uuid);
+	}
+	if (m_ring.page(channelId, min, max, beforeId, amount, &lines))
+	{
+		// answered from memory
+	}
+	else if (m_log)
+	{
+		if (!m_log->page(uuid, min, max, beforeId, amount, &lines))
+		{
+			qCWarning(Backlog) << "Unable to read the backlog of" << uuid;
+		}
+	}
+	else
+	{
+		BacklogReader::Request request;
+		request.kind = BacklogReader::Request::Page;
+		request.channel = channel;
+		request.replyTo = replyTo;
+		request.tables = m_partitions.tables(min, max > 0 ? max + 1 : 0);
+		request.channelId = channelId;
+		request.min = min;
+		request.max = max;
+		request.beforeId = beforeId;
+		request.amount = amount;
+		nextReader()->enqueue(std::move(request));
+		return;
+	}
+
+	for (const QJsonObject &reply : BacklogReader::pageReplies(lines, amount))
+	{
+		emit broadcast(channel, "more", reply, replyTo);
+	}
+}
+
+void BacklogClientConnection::sendHistory(const QJsonObject &request)
+{
+	using namespace Json;
+	const QString channel = ensureString(request, "channel");
+	const QString replyChannel = ensureString(request, "replyChannel");
+	const int historyLines = ensureInteger(request, "historyLines", 0);
+	const qint64 since = ensureString(request, "since", "0").toLongLong();
+	const QString id = QString(channel).remove("chat:channel:");
+	const int channelId = m_channelMapping.value(id, -1);
+	const int amount = historyLines > 0 ? qMin(historyLines, MAX_PAGE_SIZE) : MAX_PAGE_SIZE;
+	const QJsonObject extra{{"channel", channel}, {"lastMsgId", m_lastMsgIds.value(id)}};
+
+	// the history has to include everything up to lastMsgId, even what hasn't been written yet
+	QVector<BacklogRing::Line> lines;
+	if (m_ring.capacity() > 0 && channelId >= 0)
+	{
+		ensureRing(channelId, id);
+	}
+	if (channelId < 0 || m_ring.page(channelId, since, 0, 0, amount, &lines))
+	{
+		// nothing there or answered from memory
+	}
+	else if (m_log)
+	{
+		m_logFlushTimer->stop();
+		m_log->flush();
+		if (!m_log->page(id, since, 0, 0, amount, &lines))
+		{
+			qCWarning(Backlog) << "Unable to read the backlog of" << id;
+		}
+	}
+	else
+	{
+		BacklogReader::Request history;
+		history.kind = BacklogReader::Request::History;
+		history.channel = replyChannel;
+		history.tables = m_partitions.tables(since);
+		history.channelId = channelId;
+		history.min = since;
+		history.amount = amount;
+		// the writer commits what arrives meanwhile as well, which clients get live after lastMsgId
+		history.maxId = m_lastMessageId;
+		history.extra = extra;
+		// only once everything we have given the writer is committed. It does that on its thread, so that we can go on
+		// taking in messages meanwhile
+		BacklogWriter *writer = m_writer;
+		BacklogReader *reader = nextReader();
+		QTimer::singleShot(0, m_writer, [writer, reader, history]() mutable
+		{
+			writer->flush();
+			reader->enqueue(std::move(history));
+		});
+		return;
+	}
+
+	QJsonObject reply = BacklogReader::historyReply(lines, amount);
+	for (auto it = extra.constBegin(); it != extra.constEnd(); ++it)
+	{
+		reply.insert(it.key(), it.value());
+	}
+	emit broadcast(replyChannel, "history", reply);
+}
+
+void BacklogClientConnection::sendSearchResults(const QString &channel, const QUuid &replyTo, const int channelId, const QJsonObject &request)
+{
+	using namespace Json;
+	const QString query = ensureString(request, "query");
+	const qint64 min = ensureString(request, "min", "0").toLongLong();
+	const qint64 max = ensureString(request, "max", "0").toLongLong();
+	const int offset = qMax(0, ensureInteger(request, "offset", 0));
+	const int amount = qBound(1, ensureInteger(request, "amount", 20), MAX_SEARCH_RESULTS);
+
+	if (m_log)
+	{
+		emit broadcast(channel, "search:error", {{"error", "Searching isn't supported by the log engine"}}, replyTo);
+		return;
+	}
+
+	BacklogReader::Request search;
+	search.kind = BacklogReader::Request::Search;
+	search.channel = channel;
+	search.replyTo = replyTo;
+	search.tables = m_partitions.tables(min, max);
+	search.channelId = channelId;
+	search.min = min;
+	search.max = max;
+	search.offset = offset;
+	search.amount = amount;
+	search.query = query;
+	search.engine = m_searchEngine;
+	for (auto it = m_channelMapping.constBegin(); it != m_channelMapping.constEnd(); ++it)
+	{
+		search.uuids.insert(it.value(), it.key());
+	}
+	nextReader()->enqueue(std::move(search));
+}
+
+BacklogReader *BacklogClientConnection::nextReader()
+{
+	BacklogReader *reader = m_readers.at(m_nextReader);
+	m_nextReader = (m_nextReader + 1) % m_readers.size();
+	return reader;
+}
+
+void BacklogClientConnection::maintainPartitions()
+{
+	const qint64 now = QDateTime::currentMSecsSinceEpoch();
+	if (m_retention > 0)
+	{
+		const QStringList expired = m_partitions.takeOlderThan(now - m_retention);
+		if (!expired.isEmpty())
+		{
+			// the writer might still have rows for them
+			QMetaObject::invokeMethod(m_writer, "dropPartitions", Qt::QueuedConnection, Q_ARG(QStringList, expired), Q_ARG(int, m_searchEngine));
+		}
+		if (m_log)
+		{
+			m_log->dropOlderThan(now - m_retention);
 		}
 	}
+	if (m_compression)
+	{
+		QMetaObject::invokeMethod(m_writer, "trainDictionaries", Qt::QueuedConnection, Q_ARG(QStringList, m_partitions.tables()));
+	}
+	// one at a time, the writer can't write while it's compacting
+	const QString table = m_partitions.nextToCompact(now);
+	if (!table.isEmpty())
+	{
+		QMetaObject::invokeMethod(m_writer, "compact", Qt::QueuedConnection, Q_ARG(QString, table), Q_ARG(int, m_searchEngine));
+	}
+}
+
+bool BacklogClientConnection::prepareDatabase()
+{
+	createTables();
+	return migrateDatabase();
 }
 
 void BacklogClientConnection::createTables()
@@ -157,33 +583,89 @@ void BacklogClientConnection::createTables()
 				.COLUMN("name", Sql::VARCHAR(128))
 				.COLUMN("uuid", Sql::UUID).NOT_NULL()
 				.exec(db);
-		Sql::CREATE_TABLE("chat_messages")
-				.COLUMN("id", Sql::INTEGER).PRIMARY_KEY().NOT_NULL()
-				.COLUMN("channel", Sql::INTEGER).NOT_NULL().foreignReference("chat_channels", "id")
-				.COLUMN("source", Sql::VARCHAR(128)).NOT_NULL()
-				.COLUMN("type", Sql::VARCHAR(32)).NOT_NULL()
-				.COLUMN("content", Sql::VARCHAR(512)).NOT_NULL()
-				.COLUMN("timestamp", Sql::TIMESTAMP).NOT_NULL()
-				.exec(db);
+		BacklogNames::createTables(db);
+		BacklogCompression::createTable(db);
+		BacklogPartitions::createTable(db, "chat_messages");
+		createSearchIndex();
+		BacklogPartitions::createRegistry(db);
 		Sql::INSERT().INTO("settings").COLUMNS("category", "key", "value").VALUES("backlog", "schema_version", LATEST_SCHEMA_VERSION).exec(db);
 		qCDebug(Backlog) << "Done";
 	}
 }
-void BacklogClientConnection::migrateDatabase()
+bool BacklogClientConnection::migrateDatabase()
 {
 	QSqlDatabase db = getDB();
 	QSqlQuery q = Sql::SELECT("value").FROM("settings").WHERE("category", "=", "backlog").AND("key", "=", "schema_version").execAndNext(db);
 	int current = q.value(0).toInt();
-	while (current != LATEST_SCHEMA_VERSION)
+	while (current < LATEST_SCHEMA_VERSION)
 	{
 		const int from = current;
 		const int to = current + 1;
 		qCDebug(Backlog) << "Migrating database from" << from << "to" << to;
-		// do migrations here
+		db.transaction();
+		switch (to)
+		{
+		case 2:
+			createMessageIndex();
+			break;
+		case 3:
+			createSearchIndex();
+			break;
+		case 4:
+			BacklogPartitions::createRegistry(db);
+			break;
+		case 5:
+			// rewrites every table in the background, meanwhile the rest of the backlog deals with both shapes (see BacklogPartitions::Shape)
+			BacklogNames::createTables(db);
+			BacklogMigration::schedule(db, "normalized_names");
+			break;
+		case 6:
+			addCompression();
+			break;
+		case 7:
+			// rewrites every table, which is left to the writer to do in the background. INTEGER is 64 bits in SQLite already
+			if (!Sql::dialect(db).contains("SQLITE"))
+			{
+				BacklogMigration::schedule(db, "bigint_ids");
+			}
+			break;
+		}
+		Sql::UPDATE("settings").SET("value", to).WHERE("category", "=", "backlog").AND("key", "=", "schema_version").exec(db);
+		db.commit();
+		// there is no event loop in between steps, and what has been prepared or looked up might not fit the new schema
+		Sql::finishStatements();
+		Sql::invalidateStatements();
+		current = to;
+	}
+	return true;
+}
+
+void BacklogClientConnection::createMessageIndex()
+{
+	// for paging through the backlog of a channel, see sendPage
+	Sql::CREATE_INDEX("chat_messages_channel_timestamp").ON("chat_messages", "channel", "timestamp", "id").exec(getDB());
+}
+
+void BacklogClientConnection::createSearchIndex()
+{
+	const BacklogSearch::Engine engine = BacklogSearch::create(getDB());
+	Sql::INSERT().INTO("settings").COLUMNS("category", "key", "value").VALUES("backlog", "search_engine", BacklogSearch::engineName(engine)).exec(getDB());
+	if (engine == BacklogSearch::Terms)
+	{
+		BacklogMigration::scheduleIndexing(getDB());
+	}
+}
+
+void BacklogClientConnection::addCompression()
+{
+	BacklogCompression::createTable(getDB());
+	for (const QString &table : BacklogPartitions::allTables(getDB()))
+	{
+		BacklogCompression::addColumns(getDB(), table);
 	}
 }
 
-QSqlDatabase BacklogClientConnection::getDB() const
+QSqlDatabase BacklogClientConnection::getDB()
 {
 	return QSqlDatabase::database(QStringLiteral("backlog"), false);
 }
@@ -1,9 +1,20 @@
 #pragma once
 
+#include <QSet>
+
 #include "core/AbstractClientConnection.h"
+#include "BacklogRing.h"
+#include "BacklogSearch.h"
+#include "BacklogPartitions.h"
+#include "SqlHelpers.h"
 
 class QSqlDatabase;
 class QSqlDriver;
+class QThread;
+class QTimer;
+class BacklogWriter;
+class BacklogReader;
+class LogStore;
 
 class BacklogClientConnection : public AbstractClientConnection
 {
@@ -12,26 +23,108 @@ public:
 	struct Options
 	{
 		QSqlDriver *driver;
-		QString host;
-		int port;
-		QString dbName;
-		QString userName;
-		QString password;
-		QString connectionOptions;
+		QSqlDriver *writerDriver; ///< A second instance, for the connection of the BacklogWriter
+		QList<QSqlDriver *> readerDrivers; ///< One more instance per BacklogReader, at least one
+		Sql::ConnectionSettings database;
+
+		/// Messages are written in batches, whichever of these limits is hit first
+		int batchSize;
+		int batchBytes;
+		int batchLatency; ///< In milliseconds
+
+		int hotLines; ///< Per channel, kept in memory to answer recent history requests. 0 disables
+
+		int retentionDays; ///< 0 keeps everything
+
+		/// Where messages are stored, "sql" for the database or "log" for a LogStore in logDirectory. Channels are
+		/// always kept in the database
+		QString engine;
+		QString logDirectory;
+
+		bool compression; ///< Of message contents in the database, see BacklogCompression
 	};
 
 	explicit BacklogClientConnection(const Options &options, QObject *parent = nullptr);
+	~BacklogClientConnection();
 
 	void ready() override;
 
+	/// Creates the tables of the "backlog" connection, or brings them up to date with the latest schema. Returns false if a migration failed
+	static bool prepareDatabase();
+
+private slots:
+	/// Drops partitions past retention and has the writer compact old ones
+	void maintainPartitions();
+	/// Writes the names that have changed since the last time
+	void flushChannelNames();
+
 private:
 	void toClient(const QJsonObject &obj) override;
 
+	/// Connected as "backlog" once we're on our thread, which it moves to along with us until then
+	QSqlDriver *m_driver;
+	const Sql::ConnectionSettings m_database;
+
+	/// Loaded in ready() and kept up to date, so that the database only needs to be asked about channels it doesn't have
 	QMap<QString, int> m_channelMapping;
+	QHash<QString, QString> m_channelNames;
+	QSet<QString> m_subscribedChannels;
+	QHash<QString, QString> m_pendingChannelNames;
+	QTimer *m_channelNamesTimer;
+	/// Of the last message of each channel, see sendHistory
+	QHash<QString, QString> m_lastMsgIds;
+	/// Makes sure that the channel is in the database and subscribed to, and has its name updated if data has one
+	void checkChannel(const QJsonObject &data);
+
+	QThread *m_writerThread;
+	BacklogWriter *m_writer;
+
+	/// History and search requests are handed to these in turn
+	QList<QThread *> m_readerThreads;
+	QList<BacklogReader *> m_readers;
+	int m_nextReader = 0;
+	BacklogReader *nextReader();
+
+	/// Ids are assigned here rather than by the database, so that the ring knows them without waiting for the writer
+	qint64 m_lastMessageId = 0;
+	BacklogRing m_ring;
+	void ensureRing(const int channelId, const QString &uuid);
+
+	/// Used instead of the database for messages with the "log" engine, nullptr otherwise
+	LogStore *m_log = nullptr;
+	QTimer *m_logFlushTimer = nullptr;
+	const int m_logBatchBytes;
+	void appendToLog(const QString &uuid, const BacklogRing::Line &line);
+
+	/// Answers a "more" request with up to amount messages older than (max, beforeId), from m_ring if possible and
+	/// through a BacklogReader otherwise
+	void sendPage(const QString &channel, const QUuid &replyTo, const int channelId, const QString &uuid,
+				  const qint64 min, const qint64 max, const qint64 beforeId, const int amount);
+
+	/**
+	 * Answers the history request of a client that has just subscribed to a channel, on the channel the client is
+	 * waiting on. The reply says which message it is complete up to, so that the client can drop what it got live in
+	 * the meantime and already is part of the history
+	 */
+	void sendHistory(const QJsonObject &request);
+
+	BacklogPartitions m_partitions;
+	const qint64 m_retention; ///< In milliseconds
+	QTimer *m_maintenanceTimer;
+
+	bool m_compression;
+
+	BacklogSearch::Engine m_searchEngine = BacklogSearch::None;
+	/// Has a BacklogReader answer a "search" request. channelId -1 searches all channels
+	void sendSearchResults(const QString &channel, const QUuid &replyTo, const int channelId, const QJsonObject &request);
 
-	void createTables();
-	void migrateDatabase();
-	QSqlDatabase getDB() const;
+	static void createTables();
+	/// Stops at the first step that fails, leaving the schema version at the last one that succeeded
+	static bool migrateDatabase();
+	static void createMessageIndex();
+	static void createSearchIndex();
+	static void addCompression();
+	static QSqlDatabase getDB();
 };
 
 Q_DECLARE_LOGGING_CATEGORY(Backlog)
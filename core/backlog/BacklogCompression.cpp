@@ -0,0 +1,213 @@
+#include "BacklogCompression.h"
+
+#include <QSqlDatabase>
+#include <QSqlQuery>
+#include <QSqlError>
+#include <QSqlRecord>
+#include <QRegularExpression>
+#include <QHash>
+#include <QVector>
+#include <QtEndian>
+#include <algorithm>
+
+#ifdef TALKTALK_CORE_BACKLOG_ZLIB
+# include <zlib.h>
+#endif
+
+#include "BacklogClientConnection.h"
+#include "SqlHelpers.h"
+
+// the largest window raw deflate has, anything beyond that can't be referred to
+static constexpr const int MAX_DICTIONARY_SIZE = 32 * 1024;
+static constexpr const int MIN_FRAGMENT_LENGTH = 3;
+
+bool BacklogCompression::available()
+{
+#ifdef TALKTALK_CORE_BACKLOG_ZLIB
+	return true;
+#else
+	return false;
+#endif
+}
+
+void BacklogCompression::createTable(const QSqlDatabase &db)
+{
+	Sql::CREATE_TABLE("chat_dictionaries")
+			.COLUMN("channel", Sql::INTEGER).NOT_NULL().foreignReference("chat_channels", "id")
+			.COLUMN("version", Sql::INTEGER).NOT_NULL()
+			.COLUMN("dictionary", Sql::BLOB).NOT_NULL()
+			.COLUMN("created", Sql::BIGINT).NOT_NULL()
+			.exec(db);
+	Sql::CREATE_INDEX("chat_dictionaries_channel_version").UNIQUE().ON("chat_dictionaries", "channel", "version").exec(db);
+}
+
+void BacklogCompression::addColumns(const QSqlDatabase &db, const QString &table)
+{
+	if (db.record(table).contains("dictionary"))
+	{
+		// created by BacklogPartitions::createTable after it got them
+		return;
+	}
+	// PostgreSQL calls it differently, see CreateTableQueryBuilder
+	const QString blob = Sql::dialect(db).contains("PSQL") ? "BYTEA" : Sql::type(Sql::BLOB);
+	QSqlQuery q(db);
+	for (const QString &column : {"dictionary " + Sql::type(Sql::INTEGER), "compressed " + blob})
+	{
+		if (!q.exec(QString("ALTER TABLE %1 ADD COLUMN %2").arg(table, column)))
+		{
+			qCWarning(Backlog) << "Unable to add" << column << "to" << table << ":" << q.lastError().text();
+		}
+	}
+}
+
+QByteArray BacklogCompression::train(const QStringList &samples, const int size)
+{
+	// markup, words with the space after them, and runs of punctuation
+	static const QRegularExpression fragments("<[^>]*>|\\w+\\s?|[^\\w\\s<]+\\s?", QRegularExpression::UseUnicodePropertiesOption);
+	QHash<QString, int> counts;
+	for (const QString &sample : samples)
+	{
+		QRegularExpressionMatchIterator it = fragments.globalMatch(sample);
+		while (it.hasNext())
+		{
+			const QString fragment = it.next().captured();
+			if (fragment.size() >= MIN_FRAGMENT_LENGTH)
+			{
+				++counts[fragment];
+			}
+		}
+	}
+
+	// what saves the most is worth the most. Fragments that only appear once don't save anything
+	QVector<QPair<int, QByteArray>> scored;
+	for (auto it = counts.constBegin(); it != counts.constEnd(); ++it)
+	{
+		if (it.value() > 1)
+		{
+			const QByteArray fragment = it.key().toUtf8();
+			scored.append(qMakePair(it.value() * fragment.size(), fragment));
+		}
+	}
+	std::sort(scored.begin(), scored.end(), [](const QPair<int, QByteArray> &a, const QPair<int, QByteArray> &b)
+	{
+		return a.first > b.first;
+	});
+
+	// deflate encodes closer matches with fewer bits, so the best fragments go last
+	const int limit = qBound(0, size, MAX_DICTIONARY_SIZE);
+	QList<QByteArray> picked;
+	int total = 0;
+	for (const auto &fragment : scored)
+	{
+		if (total + fragment.second.size() > limit)
+		{
+			continue;
+		}
+		picked.prepend(fragment.second);
+		total += fragment.second.size();
+	}
+	QByteArray dictionary;
+	dictionary.reserve(total);
+	for (const QByteArray &fragment : picked)
+	{
+		dictionary.append(fragment);
+	}
+	return dictionary;
+}
+
+QByteArray BacklogCompression::compress(const QByteArray &dictionary, const QString &content)
+{
+#ifdef TALKTALK_CORE_BACKLOG_ZLIB
+	const QByteArray in = content.toUtf8();
+	z_stream stream;
+	stream.zalloc = Z_NULL;
+	stream.zfree = Z_NULL;
+	stream.opaque = Z_NULL;
+	if (deflateInit2(&stream, Z_BEST_COMPRESSION, Z_DEFLATED, -15, 8, Z_DEFAULT_STRATEGY) != Z_OK)
+	{
+		return QByteArray();
+	}
+	deflateSetDictionary(&stream, reinterpret_cast<const Bytef *>(dictionary.constData()), uInt(dictionary.size()));
+
+	// the uncompressed size goes first, so that decompress knows how much room it needs
+	QByteArray out(4 + int(deflateBound(&stream, uLong(in.size()))), Qt::Uninitialized);
+	qToLittleEndian<quint32>(quint32(in.size()), reinterpret_cast<uchar *>(out.data()));
+	stream.next_in = reinterpret_cast<Bytef *>(const_cast<char *>(in.constData()));
+	stream.avail_in = uInt(in.size());
+	stream.next_out = reinterpret_cast<Bytef *>(out.data() + 4);
+	stream.avail_out = uInt(out.size() - 4);
+	const bool ok = deflate(&stream, Z_FINISH) == Z_STREAM_END;
+	out.resize(4 + int(stream.total_out));
+	deflateEnd(&stream);
+	return ok && out.size() < in.size() ? out : QByteArray();
+#else
+	Q_UNUSED(dictionary)
+	Q_UNUSED(content)
+	return QByteArray();
+#endif
+}
+
+QString BacklogCompression::decompress(const QByteArray &dictionary, const QByteArray &data)
+{
+#ifdef TALKTALK_CORE_BACKLOG_ZLIB
+	if (data.size() < 4)
+	{
+		return QString();
+	}
+	z_stream stream;
+	stream.zalloc = Z_NULL;
+	stream.zfree = Z_NULL;
+	stream.opaque = Z_NULL;
+	stream.next_in = reinterpret_cast<Bytef *>(const_cast<char *>(data.constData() + 4));
+	stream.avail_in = uInt(data.size() - 4);
+	if (inflateInit2(&stream, -15) != Z_OK)
+	{
+		return QString();
+	}
+	// raw streams don't say which dictionary they need, it has to be set up front
+	inflateSetDictionary(&stream, reinterpret_cast<const Bytef *>(dictionary.constData()), uInt(dictionary.size()));
+
+	QByteArray out(int(qFromLittleEndian<quint32>(reinterpret_cast<const uchar *>(data.constData()))), Qt::Uninitialized);
+	stream.next_out = reinterpret_cast<Bytef *>(out.data());
+	stream.avail_out = uInt(out.size());
+	const bool ok = inflate(&stream, Z_FINISH) == Z_STREAM_END && stream.total_out == uLong(out.size());
+	inflateEnd(&stream);
+	return ok ? QString::fromUtf8(out) : QString();
+#else
+	Q_UNUSED(dictionary)
+	Q_UNUSED(data)
+	return QString();
+#endif
+}
+
+void BacklogCompression::DictionaryCache::insert(const int channel, const int version, const QByteArray &dictionary)
+{
+	m_dictionaries.insert(qMakePair(channel, version), dictionary);
+}
+
+QByteArray BacklogCompression::DictionaryCache::get(const QSqlDatabase &db, const int channel, const int version)
+{
+	const QPair<int, int> key(channel, version);
+	auto it = m_dictionaries.find(key);
+	if (it == m_dictionaries.end())
+	{
+		QSqlQuery q = Sql::SELECT("dictionary").FROM("chat_dictionaries").WHERE("channel", "=", channel).AND("version", "=", version).execAndNext(db);
+		it = m_dictionaries.insert(key, q.value(0).toByteArray());
+	}
+	return it.value();
+}
+
+QString BacklogCompression::DictionaryCache::content(const QSqlDatabase &db, const int channel, const QString &content, const int dictionary,
+													 const QByteArray &compressed)
+{
+	if (dictionary <= 0)
+	{
+		return content;
+	}
+	const QString out = decompress(get(db, channel, dictionary), compressed);
+	if (out.isNull())
+	{
+		qCWarning(Backlog) << "Unable to decompress a message of channel" << channel << "with dictionary version" << dictionary;
+	}
+	return out;
+}
@@ -0,0 +1,50 @@
+#pragma once
+
+#include <QString>
+#include <QStringList>
+#include <QByteArray>
+#include <QHash>
+#include <QPair>
+
+class QSqlDatabase;
+
+/**
+ * Optional compression of message contents, with a preset dictionary per channel.
+ *
+ * Single messages are too short to compress well on their own, so every channel gets a dictionary of the fragments
+ * (words, nicks, formatting markup) that are common in it, trained from its recent messages. Dictionaries are kept in
+ * chat_dictionaries by channel and version, so that a channel can get a new one without having to recompress what
+ * has been written with the old one. Messages refer to theirs through their dictionary column, 0 or NULL meaning the
+ * content isn't compressed.
+ *
+ * Uses raw deflate from zlib, and is only available if the core has been built with it.
+ */
+namespace BacklogCompression
+{
+bool available();
+
+/// Creates chat_dictionaries
+void createTable(const QSqlDatabase &db);
+/// Adds the dictionary and compressed columns to a table of messages that was created without them
+void addColumns(const QSqlDatabase &db, const QString &table);
+
+/// A dictionary of up to size bytes for compressing messages like samples
+QByteArray train(const QStringList &samples, const int size);
+/// content compressed with dictionary, or an empty array if that wouldn't make it any smaller
+QByteArray compress(const QByteArray &dictionary, const QString &content);
+/// What compress has compressed, or a null string if data is corrupt or was compressed using another dictionary
+QString decompress(const QByteArray &dictionary, const QByteArray &data);
+
+/// Dictionaries by channel and version, loaded from chat_dictionaries when they are first needed. One per connection
+class DictionaryCache
+{
+public:
+	void insert(const int channel, const int version, const QByteArray &dictionary);
+	QByteArray get(const QSqlDatabase &db, const int channel, const int version);
+	/// content as it is stored in a message row, decompressed if dictionary is > 0
+	QString content(const QSqlDatabase &db, const int channel, const QString &content, const int dictionary, const QByteArray &compressed);
+
+private:
+	QHash<QPair<int, int>, QByteArray> m_dictionaries;
+};
+}
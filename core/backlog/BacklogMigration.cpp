@@ -0,0 +1,446 @@
+#include "BacklogMigration.h"
+
+#include <QSqlDatabase>
+#include <QSqlError>
+#include <QSqlRecord>
+#include <QSqlField>
+#include <QTimer>
+
+#include "BacklogClientConnection.h"
+#include "BacklogPartitions.h"
+#include "BacklogSearch.h"
+#include "SqlHelpers.h"
+
+static constexpr const int BATCH_SIZE = 5000;
+// between batches, so that the database has room for everything else
+static constexpr const int BATCH_PAUSE = 10;
+static constexpr const int RETRY_DELAY = 60 * 1000;
+static const QString SHADOW_SUFFIX = QStringLiteral("_shadow");
+static const QString COLUMNS = QStringLiteral("id, channel, source, type, content, timestamp, dictionary, compressed");
+static const QString TERMS_INDEX = QStringLiteral("terms_index");
+static const QString TERMS_INDEX_UNTIL = QStringLiteral("terms_index_until");
+
+static QString readSetting(const QSqlDatabase &db, const QString &key)
+{
+	return Sql::SELECT("value").FROM("settings").WHERE("category", "=", "backlog_migration").AND("key", "=", key).execAndNext(db).value(0).toString();
+}
+static void writeSetting(const QSqlDatabase &db, const QString &key, const QString &value)
+{
+	if (Sql::UPDATE("settings").SET("value", value).WHERE("category", "=", "backlog_migration").AND("key", "=", key).exec(db).numRowsAffected() <= 0)
+	{
+		Sql::INSERT().INTO("settings").COLUMNS("category", "key", "value").VALUES("backlog_migration", key, value).exec(db);
+	}
+}
+
+BacklogMigration::BacklogMigration(const QString &connection, const int engine, QObject *parent)
+	: QObject(parent), m_connection(connection), m_engine(engine), m_timer(new QTimer(this))
+{
+	m_timer->setSingleShot(true);
+	connect(m_timer, &QTimer::timeout, this, &BacklogMigration::step);
+}
+
+void BacklogMigration::schedule(const QSqlDatabase &db, const QString &name)
+{
+	if (readSetting(db, name).isEmpty())
+	{
+		writeSetting(db, name, "pending");
+	}
+}
+void BacklogMigration::scheduleIndexing(const QSqlDatabase &db)
+{
+	// everything after the newest message there is now gets indexed by the writer
+	qint64 until = 0;
+	for (const QString &table : BacklogPartitions::allTables(db))
+	{
+		until = qMax(until, Sql::SELECT("MAX(id)").FROM(table).execAndNext(db).value(0).toLongLong());
+	}
+	writeSetting(db, TERMS_INDEX_UNTIL, QString::number(until));
+	writeSetting(db, TERMS_INDEX, "pending");
+}
+
+void BacklogMigration::start()
+{
+	const QSqlDatabase db = database();
+	const QString indexing = readSetting(db, TERMS_INDEX);
+	if (!indexing.isEmpty() && indexing != "done")
+	{
+		qCDebug(Backlog) << "Indexing existing messages for full-text search in the background";
+		m_indexUntil = readSetting(db, TERMS_INDEX_UNTIL).toLongLong();
+		// in order, so that the tables before the one that was being indexed when we got interrupted can be skipped
+		m_tables = BacklogPartitions::allTables(db);
+		m_tables.sort();
+		const QString current = indexing.section(' ', 0, 0);
+		while (indexing != "pending" && !m_tables.isEmpty() && m_tables.first() < current)
+		{
+			m_tables.removeFirst();
+		}
+	}
+
+	m_pending.clear();
+	for (const Rewrite &rewrite : rewrites())
+	{
+		const QString state = readSetting(db, rewrite.name);
+		if (!state.isEmpty() && state != "done")
+		{
+			m_pending.append(rewrite);
+		}
+	}
+	if (m_indexUntil < 0 && m_pending.isEmpty())
+	{
+		emit finished();
+		return;
+	}
+	if (m_indexUntil < 0)
+	{
+		qCDebug(Backlog) << "Migrating" << m_pending.first().name << "in the background";
+		m_tables = BacklogPartitions::allTables(db);
+	}
+	m_clock.start();
+	m_timer->start(BATCH_PAUSE);
+}
+
+void BacklogMigration::step()
+{
+	const bool ok = advance();
+	if (m_indexUntil >= 0 || !m_pending.isEmpty())
+	{
+		m_timer->start(ok ? BATCH_PAUSE : RETRY_DELAY);
+	}
+	else
+	{
+		emit finished();
+	}
+}
+
+bool BacklogMigration::advance()
+{
+	return m_indexUntil >= 0 ? advanceIndexing() : advanceRewrite();
+}
+
+bool BacklogMigration::advanceIndexing()
+{
+	QSqlDatabase db = database();
+	while (m_table.isEmpty() && !m_tables.isEmpty())
+	{
+		const QString table = m_tables.takeFirst();
+		if (db.tables().contains(table))
+		{
+			const QStringList saved = readSetting(db, TERMS_INDEX).split(' ');
+			m_table = table;
+			m_lastId = saved.size() == 2 && saved.first() == table ? saved.last().toLongLong() : 0;
+		}
+	}
+	if (m_table.isEmpty())
+	{
+		qCDebug(Backlog) << "Done indexing existing messages";
+		setProgress(TERMS_INDEX, "done");
+		m_indexUntil = -1;
+		if (!m_pending.isEmpty())
+		{
+			qCDebug(Backlog) << "Migrating" << m_pending.first().name << "in the background";
+			m_tables = BacklogPartitions::allTables(db);
+		}
+		return true;
+	}
+
+	db.transaction();
+	QList<QPair<qint64, QString>> messages;
+	QSqlQuery q(db);
+	q.prepare(QString("SELECT id, content FROM %1 WHERE id > ? AND id <= ? ORDER BY id LIMIT %2").arg(m_table).arg(BATCH_SIZE));
+	q.addBindValue(m_lastId);
+	q.addBindValue(m_indexUntil);
+	bool ok = q.exec();
+	while (ok && q.next())
+	{
+		messages.append(qMakePair(q.value(0).toLongLong(), q.value(1).toString()));
+	}
+	if (!ok || !BacklogSearch::index(db, messages))
+	{
+		db.rollback();
+		if (!db.tables().contains(m_table))
+		{
+			// dropped because of retention in the meantime
+			m_table.clear();
+			return true;
+		}
+		qCWarning(Backlog) << "Unable to index" << m_table << ":" << (ok ? db.lastError().text() : q.lastError().text());
+		return false;
+	}
+	if (!messages.isEmpty())
+	{
+		m_lastId = messages.last().first;
+	}
+	setProgress(TERMS_INDEX, m_table + ' ' + QString::number(m_lastId));
+	db.commit();
+	if (messages.size() < BATCH_SIZE)
+	{
+		m_table.clear();
+	}
+	return true;
+}
+
+bool BacklogMigration::advanceRewrite()
+{
+	const Rewrite rewrite = m_pending.first();
+	QSqlDatabase db = database();
+
+	while (m_table.isEmpty() && !m_tables.isEmpty())
+	{
+		const QString table = m_tables.takeFirst();
+		if (db.tables().contains(table) && rewrite.needed(db, table))
+		{
+			beginTable(table);
+		}
+	}
+	if (m_table.isEmpty())
+	{
+		qCDebug(Backlog) << "Done migrating" << rewrite.name;
+		setProgress(rewrite.name, "done");
+		m_pending.removeFirst();
+		if (!m_pending.isEmpty())
+		{
+			qCDebug(Backlog) << "Migrating" << m_pending.first().name << "in the background";
+			m_tables = BacklogPartitions::allTables(db);
+		}
+		return true;
+	}
+
+	db.transaction();
+	const int copied = copyBatch();
+	if (copied < 0)
+	{
+		db.rollback();
+		if (!db.tables().contains(m_table))
+		{
+			// dropped because of retention in the meantime, so there is nothing left to rewrite
+			qCDebug(Backlog) << m_table << "is gone, not migrating it any further";
+			Sql::DROP_TABLE(m_table + SHADOW_SUFFIX).exec(db);
+			m_table.clear();
+			return true;
+		}
+		qCWarning(Backlog) << "Unable to migrate" << m_table << ":" << db.lastError().text();
+		return false;
+	}
+	setProgress(rewrite.name, m_table + ' ' + QString::number(m_lastId));
+	db.commit();
+
+	// caught up with what is being written, the shadow table can take over
+	if (copied < BATCH_SIZE)
+	{
+		if (!cutOver())
+		{
+			return false;
+		}
+		m_table.clear();
+	}
+	return true;
+}
+
+const QList<BacklogMigration::Rewrite> &BacklogMigration::rewrites()
+{
+	static const QList<Rewrite> list{
+		// sources and types used to be stored with every message, now they are interned by BacklogNames
+		{
+			"normalized_names",
+			[](const QSqlDatabase &db, const QString &table)
+			{
+				return BacklogPartitions::shape(db, table).names;
+			},
+			[](const QSqlDatabase &db, const QString &table)
+			{
+				BacklogPartitions::createTable(db, table);
+			},
+			[](const QSqlDatabase &db, const QString &from, const QString &to, const int limit)
+			{
+				const QString batch = QString("(SELECT %3 FROM %1 WHERE id > ? ORDER BY id LIMIT %2) b").arg(from).arg(limit);
+				// timestamps used to be declared as TIMESTAMP, which only SQLite took milliseconds for
+				QString timestamp = "m.timestamp";
+				if (BacklogPartitions::shape(db, from).dateTimes)
+				{
+					const QString dialect = Sql::dialect(db);
+					timestamp = dialect.contains("PSQL") ? "CAST(EXTRACT(EPOCH FROM m.timestamp) * 1000 AS BIGINT)"
+							  : dialect.contains("MYSQL") ? "CAST(UNIX_TIMESTAMP(m.timestamp) * 1000 AS SIGNED)" : timestamp;
+				}
+				// the writer compresses what it writes while this is going on (see BacklogCompression)
+				const bool compressed = db.record(from).contains("compressed");
+				// the names of the batch first, so that none of its rows get lost in the join
+				return QStringList()
+						<< QString("INSERT INTO chat_sources (name) SELECT DISTINCT b.source FROM %1 WHERE b.source NOT IN (SELECT name FROM chat_sources)").arg(batch.arg("source"))
+						<< QString("INSERT INTO chat_types (name) SELECT DISTINCT b.type FROM %1 WHERE b.type NOT IN (SELECT name FROM chat_types)").arg(batch.arg("type"))
+						<< QString("INSERT INTO %2 (id, channel, source, type, content, timestamp%5) "
+								   "SELECT m.id, m.channel, s.id, ty.id, m.content, %4%6 FROM %1 m "
+								   "JOIN chat_sources s ON s.name = m.source JOIN chat_types ty ON ty.name = m.type "
+								   "WHERE m.id > ? ORDER BY m.id LIMIT %3").arg(from, to).arg(limit)
+								   .arg(timestamp, compressed ? QStringLiteral(", dictionary, compressed") : QString(), compressed ? QStringLiteral(", m.dictionary, m.compressed") : QString());
+			}
+		},
+		// ids used to be INTEGER, which is only 32 bits outside of SQLite
+		{
+			"bigint_ids",
+			[](const QSqlDatabase &db, const QString &table)
+			{
+				return !Sql::dialect(db).contains("SQLITE") && db.record(table).field("id").type() != QVariant::LongLong;
+			},
+			[](const QSqlDatabase &db, const QString &table)
+			{
+				BacklogPartitions::createTable(db, table);
+			},
+			[](const QSqlDatabase &, const QString &from, const QString &to, const int limit)
+			{
+				return QStringList(QString("INSERT INTO %1 (%3) SELECT %3 FROM %2 WHERE id > ? ORDER BY id LIMIT %4").arg(to, from, COLUMNS).arg(limit));
+			}
+		}
+	};
+	return list;
+}
+
+QSqlDatabase BacklogMigration::database() const
+{
+	return QSqlDatabase::database(m_connection, false);
+}
+
+void BacklogMigration::setProgress(const QString &name, const QString &value)
+{
+	writeSetting(database(), name, value);
+}
+
+void BacklogMigration::beginTable(const QString &table)
+{
+	const QSqlDatabase db = database();
+	const Rewrite &rewrite = m_pending.first();
+	const QString shadow = table + SHADOW_SUFFIX;
+	m_table = table;
+	m_copied = 0;
+	m_clock.restart();
+
+	const QStringList saved = readSetting(db, rewrite.name).split(' ');
+	if (saved.size() == 2 && saved.first() == table && db.tables().contains(shadow))
+	{
+		m_lastId = saved.last().toLongLong();
+		qCDebug(Backlog) << "Continuing to migrate" << table << "after id" << m_lastId;
+		return;
+	}
+
+	qCDebug(Backlog) << "Migrating" << table;
+	if (db.tables().contains(shadow))
+	{
+		// left over from before the last time progress was recorded
+		Sql::DROP_TABLE(shadow).exec(db);
+	}
+	rewrite.create(db, shadow);
+	// an embedded full-text index refers to its table by name, so it can only be set up again once the shadow has taken over
+	if (m_engine != BacklogSearch::Fts5)
+	{
+		BacklogSearch::addTable(db, BacklogSearch::Engine(m_engine), shadow);
+	}
+	m_lastId = 0;
+	setProgress(rewrite.name, table + " 0");
+}
+
+int BacklogMigration::copyBatch()
+{
+	const QSqlDatabase db = database();
+	const QString shadow = m_table + SHADOW_SUFFIX;
+	QSqlQuery q(db);
+	for (const QString &statement : m_pending.first().copy(db, m_table, shadow, BATCH_SIZE))
+	{
+		q = QSqlQuery(db);
+		q.prepare(statement);
+		for (int i = 0; i < statement.count('?'); ++i)
+		{
+			q.addBindValue(m_lastId);
+		}
+		if (!q.exec())
+		{
+			qCDebug(Backlog) << "Unable to copy rows of" << m_table << ":" << q.lastError().text();
+			return -1;
+		}
+	}
+	const int copied = q.numRowsAffected();
+	if (copied > 0)
+	{
+		m_lastId = Sql::SELECT("MAX(id)").FROM(shadow).execAndNext(db).value(0).toLongLong();
+		m_copied += quint64(copied);
+	}
+	return copied;
+}
+
+bool BacklogMigration::cutOver()
+{
+	QSqlDatabase db = database();
+	const QString shadow = m_table + SHADOW_SUFFIX;
+	const BacklogSearch::Engine engine = BacklogSearch::Engine(m_engine);
+	const QString dialect = Sql::dialect(db);
+
+	db.transaction();
+	// whatever has been written since the last batch. We're on the thread of the writer, so nothing more can come
+	int copied = BATCH_SIZE;
+	while (copied == BATCH_SIZE)
+	{
+		copied = copyBatch();
+	}
+	if (copied < 0)
+	{
+		qCWarning(Backlog) << "Unable to migrate" << m_table << ":" << db.lastError().text();
+		db.rollback();
+		return false;
+	}
+
+	QStringList statements;
+	if (dialect.contains("MYSQL"))
+	{
+		// DDL commits right away in MySQL, but renaming both tables in one go is atomic. Index names are per table
+		statements << QString("RENAME TABLE %1 TO %1_old, %2 TO %1").arg(m_table, shadow) << QString("DROP TABLE %1_old").arg(m_table)
+				   << QString("ALTER TABLE %1 RENAME INDEX %2_channel_timestamp TO %1_channel_timestamp").arg(m_table, shadow);
+		if (engine == BacklogSearch::MySqlFullText)
+		{
+			statements << QString("ALTER TABLE %1 RENAME INDEX %2_content TO %1_content").arg(m_table, shadow);
+		}
+	}
+	else
+	{
+		if (engine == BacklogSearch::Fts5)
+		{
+			BacklogSearch::dropTable(db, engine, m_table);
+		}
+		statements << "DROP TABLE " + m_table << QString("ALTER TABLE %1 RENAME TO %2").arg(shadow, m_table);
+		if (dialect.contains("PSQL"))
+		{
+			// index names are per schema, and other code refers to them
+			for (const QString &suffix : {"_pkey", "_channel_timestamp", "_content"})
+			{
+				statements << QString("ALTER INDEX IF EXISTS %1%3 RENAME TO %2%3").arg(shadow, m_table, suffix);
+			}
+		}
+		else
+		{
+			// SQLite can't rename indices, so it gets a new one
+			statements << QString("DROP INDEX IF EXISTS %1_channel_timestamp").arg(shadow);
+		}
+	}
+	for (const QString &statement : statements)
+	{
+		QSqlQuery q(db);
+		if (!q.exec(statement))
+		{
+			qCWarning(Backlog) << "Unable to replace" << m_table << "with its migrated version:" << q.lastError().text();
+			db.rollback();
+			return false;
+		}
+	}
+	if (!dialect.contains("MYSQL") && !dialect.contains("PSQL"))
+	{
+		BacklogPartitions::createIndex(db, m_table);
+	}
+	if (engine == BacklogSearch::Fts5)
+	{
+		BacklogSearch::addTable(db, engine, m_table);
+	}
+	db.commit();
+	// the statements readers have prepared for the old table might not fit the new one
+	Sql::invalidateStatements();
+
+	qCDebug(Backlog) << "Migrated" << m_table << "," << m_copied << "rows in" << m_clock.elapsed() << "ms ("
+					 << (m_copied * 1000.0 / qMax(qint64(1), m_clock.elapsed())) << "rows/s)";
+	return true;
+}
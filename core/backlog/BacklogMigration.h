@@ -0,0 +1,85 @@
+#pragma once
+
+#include <QObject>
+#include <QStringList>
+#include <QElapsedTimer>
+
+class QSqlDatabase;
+class QTimer;
+
+/**
+ * Schema changes that go through every table of messages, done in batches that each commit on their own.
+ *
+ * BacklogClientConnection::migrateDatabase only schedules most of them (see schedule), which is quick, and the schema
+ * version moves on right away. The rewrite itself is done by BacklogWriter, one table at a time: a shadow table in the
+ * new shape gets the rows copied over in batches by id, one batch per turn of the writer's event loop, so that new
+ * messages keep getting written in between. They keep going into the old table, and since ids only ever grow, later
+ * batches pick them up. Once a batch comes up short the shadow table replaces the old one, along with the last few
+ * rows, in one transaction. Since only the writer writes messages, nothing can get lost in between. Until then the rest
+ * of the backlog has to be able to deal with both shapes, see BacklogPartitions::Shape.
+ *
+ * Messages that were there before the Terms full-text engine was set up are indexed the same way (see
+ * scheduleIndexing). Searches only find them once that is done.
+ *
+ * Progress is recorded in settings (category "backlog_migration") with every batch, so that a migration that got
+ * interrupted continues where it left off.
+ */
+class BacklogMigration : public QObject
+{
+	Q_OBJECT
+public:
+	/// connection is the name of the database connection to use, which has to belong to the thread we live on. engine is a BacklogSearch::Engine
+	explicit BacklogMigration(const QString &connection, const int engine, QObject *parent = nullptr);
+
+	/// Has the rewrite called name done the next time migrations are started
+	static void schedule(const QSqlDatabase &db, const QString &name);
+	/// Has the messages that are there now indexed for BacklogSearch::Terms the next time migrations are started. Later ones are indexed by BacklogWriter
+	static void scheduleIndexing(const QSqlDatabase &db);
+
+public slots:
+	/// Continues in the background with what has been scheduled and isn't done yet
+	void start();
+
+signals:
+	/// After start, once everything is done
+	void finished();
+
+private slots:
+	void step();
+
+private:
+	struct Rewrite
+	{
+		QString name;
+		/// Whether table still has the old shape
+		bool (*needed)(const QSqlDatabase &db, const QString &table);
+		/// Creates table in the new shape, with all indices
+		void (*create)(const QSqlDatabase &db, const QString &table);
+		/// Statements that copy up to limit rows of from, by id after the one bound to every ?, into to. The last one does the copying
+		QStringList (*copy)(const QSqlDatabase &db, const QString &from, const QString &to, const int limit);
+	};
+	static const QList<Rewrite> &rewrites();
+
+	const QString m_connection;
+	const int m_engine;
+	QTimer *m_timer;
+
+	qint64 m_indexUntil = -1; ///< While indexing, the newest message that the writer didn't index itself
+	QList<Rewrite> m_pending;
+	QStringList m_tables; ///< Still to be looked at by the current rewrite or indexing
+	QString m_table; ///< Being copied or indexed, or empty
+	qint64 m_lastId = 0; ///< The last one that has been copied or indexed
+	quint64 m_copied = 0;
+	QElapsedTimer m_clock;
+
+	QSqlDatabase database() const;
+	void setProgress(const QString &name, const QString &value);
+	/// Does the next batch. Returns false on errors, after which it can be tried again
+	bool advance();
+	bool advanceIndexing();
+	bool advanceRewrite();
+	void beginTable(const QString &table);
+	/// Copies the next batch of rows into the shadow table. Returns the number of rows, or -1 on errors
+	int copyBatch();
+	bool cutOver();
+};
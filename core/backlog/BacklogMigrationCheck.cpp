@@ -0,0 +1,422 @@
+#include "BacklogMigrationCheck.h"
+
+#include <QSqlDatabase>
+#include <QSqlDriver>
+#include <QSqlError>
+#include <QSqlRecord>
+#include <QSqlField>
+#include <QTemporaryDir>
+#include <QElapsedTimer>
+#include <QEventLoop>
+#include <QDateTime>
+#include <QTimer>
+#include <QUuid>
+#include <QVector>
+#include <QSet>
+#include <algorithm>
+#include <random>
+
+#include "BacklogClientConnection.h"
+#include "BacklogMigration.h"
+#include "BacklogNames.h"
+#include "BacklogPartitions.h"
+#include "BacklogSearch.h"
+
+// a few batches of BacklogMigration, the last one short
+static constexpr const int MESSAGES = 12345;
+// written while the background migrations run
+static constexpr const int LIVE_MESSAGES = 500;
+static constexpr const int ROWS_PER_INSERT = 100;
+static constexpr const int CHANNELS = 3;
+static constexpr const int TIMEOUT = 10 * 60 * 1000;
+
+namespace
+{
+struct Message
+{
+	qint64 id;
+	int channel;
+	QString source;
+	QString type;
+	QString content;
+	qint64 timestamp;
+};
+}
+
+static const QStringList &words()
+{
+	static const QStringList list = {"lorem", "ipsum", "dolor", "sit", "amet", "consectetur", "adipiscing", "elit", "sed", "do", "eiusmod", "tempor"};
+	return list;
+}
+
+static QVector<Message> generate(std::mt19937 &random, const qint64 firstId, const int amount)
+{
+	static const QStringList types = {"message", "action", "notice"};
+	QVector<Message> messages;
+	for (int i = 0; i < amount; ++i)
+	{
+		QStringList content;
+		for (int w = 0; w < 2 + int(random() % 8); ++w)
+		{
+			content.append(words().at(int(random() % words().size())));
+		}
+		const qint64 id = firstId + i;
+		messages.append({id, int(random() % CHANNELS) + 1, "user" + QString::number(random() % 20), types.at(int(random() % types.size())),
+						 content.join(' '), 1500000000000 + id * 1000});
+	}
+	return messages;
+}
+
+static bool exec(const QSqlDatabase &db, const QString &statement)
+{
+	QSqlQuery q(db);
+	if (!q.exec(statement))
+	{
+		qCWarning(Backlog) << "Unable to run" << statement << ":" << q.lastError().text();
+		return false;
+	}
+	return true;
+}
+
+/// The tables of the first schema, as the first version of BacklogClientConnection created them
+static bool createFirstSchema(QSqlDatabase db, const QVector<Message> &messages)
+{
+	const bool sqlite = Sql::dialect(db).contains("SQLITE");
+	Sql::CREATE_TABLE("settings")
+			.COLUMN("category", Sql::VARCHAR(64)).NOT_NULL()
+			.COLUMN("key", Sql::VARCHAR(64)).NOT_NULL()
+			.COLUMN("value", Sql::VARCHAR(256))
+			.exec(db);
+	Sql::CREATE_TABLE("chat_channels")
+			.COLUMN("id", Sql::INTEGER).PRIMARY_KEY().NOT_NULL()
+			.COLUMN("name", Sql::VARCHAR(128))
+			.COLUMN("uuid", Sql::UUID).NOT_NULL()
+			.exec(db);
+	Sql::CREATE_TABLE("chat_messages")
+			.COLUMN("id", Sql::INTEGER).PRIMARY_KEY().NOT_NULL()
+			.COLUMN("channel", Sql::INTEGER).NOT_NULL().foreignReference("chat_channels", "id")
+			.COLUMN("source", Sql::VARCHAR(128)).NOT_NULL()
+			.COLUMN("type", Sql::VARCHAR(32)).NOT_NULL()
+			.COLUMN("content", Sql::VARCHAR(512)).NOT_NULL()
+			.COLUMN("timestamp", Sql::TIMESTAMP).NOT_NULL()
+			.exec(db);
+	if (!db.tables().contains("chat_messages"))
+	{
+		qCWarning(Backlog) << "Unable to create the first schema:" << db.lastError().text();
+		return false;
+	}
+
+	db.transaction();
+	Sql::INSERT().INTO("settings").COLUMNS("category", "key", "value").VALUES("backlog", "schema_version", 1).exec(db);
+	for (int channel = 1; channel <= CHANNELS; ++channel)
+	{
+		Sql::INSERT().INTO("chat_channels").COLUMNS("id", "name", "uuid").VALUES(channel, "check-" + QString::number(channel), QUuid::createUuid().toString()).exec(db);
+	}
+	for (int start = 0; start < messages.size(); start += ROWS_PER_INSERT)
+	{
+		auto insert = Sql::INSERT().INTO("chat_messages").COLUMNS("id", "channel", "source", "type", "content", "timestamp");
+		for (int i = start; i < qMin(start + ROWS_PER_INSERT, messages.size()); ++i)
+		{
+			const Message &m = messages.at(i);
+			// only SQLite took milliseconds for a TIMESTAMP
+			const QVariant timestamp = sqlite ? QVariant(m.timestamp) : QVariant(QDateTime::fromMSecsSinceEpoch(m.timestamp, Qt::UTC));
+			insert = insert.VALUES(QVariantList{m.id, m.channel, m.source, m.type, m.content, timestamp});
+		}
+		if (insert.exec(db).lastError().isValid())
+		{
+			qCWarning(Backlog) << "Unable to fill the first schema:" << db.lastError().text();
+			db.rollback();
+			return false;
+		}
+	}
+	return db.commit();
+}
+
+/// Lets BacklogMigration do its part, while messages keep getting written the way BacklogWriter does
+static bool migrateInBackground(QSqlDatabase db, const QVector<Message> &live)
+{
+	BacklogNames names;
+	names.load(db);
+	int written = 0;
+	bool ok = true;
+	const auto writeNext = [&]()
+	{
+		const Message &m = live.at(written++);
+		// chat_messages keeps its first shape until normalized_names cuts over
+		const BacklogPartitions::Shape shape = BacklogPartitions::shape(db, "chat_messages");
+		const QVariant source = shape.names ? QVariant(m.source) : QVariant(names.source(db, m.source));
+		const QVariant type = shape.names ? QVariant(m.type) : QVariant(names.type(db, m.type));
+		db.transaction();
+		ok = ok && !Sql::INSERT().INTO("chat_messages").COLUMNS("id", "channel", "source", "type", "content", "timestamp")
+				.VALUES(m.id, m.channel, source, type, m.content, shape.timestamp(m.timestamp)).exec(db).lastError().isValid()
+				&& BacklogSearch::index(db, {qMakePair(m.id, m.content)});
+		db.commit();
+	};
+
+	BacklogMigration migration(QStringLiteral("backlog"), BacklogSearch::Terms);
+	QEventLoop loop;
+	QTimer writer;
+	writer.setInterval(1);
+	QObject::connect(&writer, &QTimer::timeout, [&]()
+	{
+		if (written < live.size())
+		{
+			writeNext();
+		}
+	});
+	QObject::connect(&migration, &BacklogMigration::finished, &loop, &QEventLoop::quit);
+	QTimer::singleShot(TIMEOUT, &loop, [&loop]() { loop.exit(1); });
+	QTimer::singleShot(0, &migration, &BacklogMigration::start);
+	writer.start();
+	if (loop.exec() != 0)
+	{
+		qCWarning(Backlog) << "Migrating in the background didn't finish in time";
+		return false;
+	}
+	writer.stop();
+	while (written < live.size())
+	{
+		writeNext();
+	}
+	if (!ok)
+	{
+		qCWarning(Backlog) << "Unable to write messages while migrating:" << db.lastError().text();
+	}
+	return ok;
+}
+
+static bool verify(const QSqlDatabase &db, const QVector<Message> &messages, const qint64 newestBefore)
+{
+	const bool sqlite = Sql::dialect(db).contains("SQLITE");
+	for (const QString &key : {"normalized_names", "bigint_ids", "terms_index"})
+	{
+		const QString state = Sql::SELECT("value").FROM("settings").WHERE("category", "=", "backlog_migration").AND("key", "=", key).execAndNext(db).value(0).toString();
+		// ids are 64 bits in SQLite already
+		const QString expected = sqlite && key == "bigint_ids" ? QString() : QStringLiteral("done");
+		if (state != expected)
+		{
+			qCWarning(Backlog) << key << "is" << state << "instead of" << expected;
+			return false;
+		}
+	}
+	if (!sqlite && db.record("chat_messages").field("id").type() != QVariant::LongLong)
+	{
+		qCWarning(Backlog) << "Ids of chat_messages are still" << QVariant::typeToName(db.record("chat_messages").field("id").type());
+		return false;
+	}
+	const qint64 end = Sql::SELECT("end_time").FROM("chat_partitions").WHERE("name", "=", "chat_messages").execAndNext(db).value(0).toLongLong();
+	if (end <= newestBefore)
+	{
+		qCWarning(Backlog) << "chat_messages is registered until" << end << "but has messages from" << newestBefore;
+		return false;
+	}
+
+	QSqlQuery q(db);
+	if (!q.exec("SELECT m.id, m.channel, s.name, ty.name, m.content, m.timestamp FROM chat_messages m "
+				"JOIN chat_sources s ON s.id = m.source JOIN chat_types ty ON ty.id = m.type ORDER BY m.id"))
+	{
+		qCWarning(Backlog) << "Unable to read the migrated messages:" << q.lastError().text();
+		return false;
+	}
+	int i = 0;
+	while (q.next())
+	{
+		if (i == messages.size())
+		{
+			qCWarning(Backlog) << "There are more messages than have been written";
+			return false;
+		}
+		const Message found{q.value(0).toLongLong(), q.value(1).toInt(), q.value(2).toString(), q.value(3).toString(), q.value(4).toString(),
+							q.value(5).toLongLong()};
+		const Message &expected = messages.at(i++);
+		if (found.id != expected.id || found.channel != expected.channel || found.source != expected.source
+				|| found.type != expected.type || found.content != expected.content || found.timestamp != expected.timestamp)
+		{
+			qCWarning(Backlog) << "Message" << found.id << "isn't what has been written, expected" << expected.id;
+			return false;
+		}
+	}
+	if (i != messages.size())
+	{
+		qCWarning(Backlog) << i << "messages are left of" << messages.size();
+		return false;
+	}
+
+	for (const QString &query : {"lorem", "tempor", "dolor amet"})
+	{
+		const QStringList words = BacklogSearch::terms(query);
+		QSet<qint64> expected;
+		for (const Message &m : messages)
+		{
+			const QStringList terms = BacklogSearch::terms(m.content);
+			if (std::all_of(words.cbegin(), words.cend(), [&terms](const QString &word) { return terms.contains(word); }))
+			{
+				expected.insert(m.id);
+			}
+		}
+		QVector<BacklogSearch::Result> results;
+		if (!BacklogSearch::search(db, BacklogSearch::Terms, BacklogPartitions::allTables(db), query, -1, 0, 0, 0, messages.size(), &results))
+		{
+			qCWarning(Backlog) << "Unable to search for" << query << ":" << db.lastError().text();
+			return false;
+		}
+		QSet<qint64> found;
+		for (const BacklogSearch::Result &result : results)
+		{
+			found.insert(result.id);
+		}
+		if (found != expected || results.size() != expected.size())
+		{
+			qCWarning(Backlog) << "Searching for" << query << "found" << results.size() << "messages," << found.size() << "different ones, instead of" << expected.size();
+			return false;
+		}
+	}
+	return true;
+}
+
+static bool check(QSqlDatabase db)
+{
+	// the first schema stored timestamps as TIMESTAMP, which BacklogMigration takes as UTC
+	const QString dialect = Sql::dialect(db);
+	if ((dialect.contains("PSQL") && !exec(db, "SET TIME ZONE 'UTC'")) || (dialect.contains("MYSQL") && !exec(db, "SET time_zone = '+00:00'")))
+	{
+		return false;
+	}
+
+	// a fixed seed, so that every run does the same
+	std::mt19937 random(42);
+	QVector<Message> messages = generate(random, 1, MESSAGES);
+	const QVector<Message> live = generate(random, MESSAGES + 1, LIVE_MESSAGES);
+	if (!createFirstSchema(db, messages))
+	{
+		return false;
+	}
+
+	// cached by SqlHelpers the way readers do, so that it has to be prepared again once a table got replaced. Readers
+	// deal with both shapes, by the timestamp too
+	const qint64 first = messages.first().timestamp;
+	const auto probe = [&db, first](const char *when)
+	{
+		const BacklogPartitions::Shape shape = BacklogPartitions::shape(db, "chat_messages");
+		QSqlQuery q = Sql::SELECT("id", "timestamp").FROM("chat_messages").WHERE("id", "=", 1).AND("timestamp", "=", shape.timestamp(first)).execAndNext(db);
+		if (q.lastError().isValid() || q.value(0).toLongLong() != 1 || shape.timestamp(q.value(1)) != first)
+		{
+			qCWarning(Backlog) << "Reading a message" << when << "failed:" << q.lastError().text();
+			return false;
+		}
+		return true;
+	};
+	if (!probe("before migrating"))
+	{
+		return false;
+	}
+
+	QElapsedTimer timer;
+	timer.start();
+	if (!BacklogClientConnection::prepareDatabase())
+	{
+		qCWarning(Backlog) << "Migrating to the latest schema failed";
+		return false;
+	}
+	qCDebug(Backlog) << "Migrated to the latest schema in" << timer.elapsed() << "ms";
+	if (!probe("after migrating to the latest schema"))
+	{
+		return false;
+	}
+
+	// what BacklogClientConnection does for compression, so that indexing in the background is covered everywhere
+	const BacklogSearch::Engine engine = BacklogSearch::engineFromName(
+				Sql::SELECT("value").FROM("settings").WHERE("category", "=", "backlog").AND("key", "=", "search_engine").execAndNext(db).value(0).toString());
+	if (engine != BacklogSearch::Terms)
+	{
+		db.transaction();
+		if (!BacklogSearch::switchToTerms(db, engine, BacklogPartitions::allTables(db)))
+		{
+			qCWarning(Backlog) << "Unable to switch from" << BacklogSearch::engineName(engine) << "to terms";
+			db.rollback();
+			return false;
+		}
+		BacklogMigration::scheduleIndexing(db);
+		db.commit();
+	}
+
+	timer.restart();
+	if (!migrateInBackground(db, live))
+	{
+		return false;
+	}
+	qCDebug(Backlog) << "Migrated in the background in" << timer.elapsed() << "ms";
+	if (!probe("after migrating in the background"))
+	{
+		return false;
+	}
+
+	const qint64 newestBefore = messages.last().timestamp;
+	messages += live;
+	return verify(db, messages, newestBefore);
+}
+
+/// Messages refer to channels and names, so those go last
+static void dropAll(const QSqlDatabase &db)
+{
+	QStringList tables = db.tables();
+	for (const QString &table : {"chat_sources", "chat_types", "chat_channels"})
+	{
+		if (tables.removeAll(table) > 0)
+		{
+			tables.append(table);
+		}
+	}
+	for (const QString &table : tables)
+	{
+		Sql::DROP_TABLE(table).exec(db);
+	}
+}
+
+bool BacklogMigrationCheck::run(QSqlDriver *driver, const Sql::ConnectionSettings &settings)
+{
+	const bool sqlite = driver->dbmsType() == QSqlDriver::SQLite;
+	QTemporaryDir directory;
+	Sql::ConnectionSettings connection = settings;
+	if (sqlite)
+	{
+		if (!directory.isValid())
+		{
+			qCWarning(Backlog) << "Unable to create a temporary directory";
+			delete driver;
+			return false;
+		}
+		connection.dbName = directory.path() + "/backlog.sqlite";
+	}
+
+	// the name BacklogClientConnection::prepareDatabase uses
+	bool ok = false;
+	{
+		QSqlDatabase db = connection.addDatabase(driver, "backlog");
+		if (!db.open())
+		{
+			qCWarning(Backlog) << "Unable to open" << db.databaseName() << ":" << db.lastError().text();
+		}
+		else if (!db.tables().isEmpty())
+		{
+			qCWarning(Backlog) << db.databaseName() << "isn't empty, not checking migrations on it";
+		}
+		else
+		{
+			qCDebug(Backlog) << "Checking migrations with" << MESSAGES << "messages on" << Sql::dialect(db);
+			ok = check(db);
+			if (!sqlite)
+			{
+				dropAll(db);
+			}
+		}
+		Sql::forgetStatements(db);
+		db.close();
+	}
+	QSqlDatabase::removeDatabase("backlog");
+	if (ok)
+	{
+		qCDebug(Backlog) << "Migrations are fine";
+	}
+	return ok;
+}
@@ -0,0 +1,18 @@
+#pragma once
+
+#include "SqlHelpers.h"
+
+class QSqlDriver;
+
+/**
+ * Checks BacklogClientConnection::migrateDatabase and BacklogMigration against a real database: a backlog in the first
+ * schema gets migrated to the latest one, with rows being written in between background batches the way BacklogWriter
+ * does, after which every message has to be there exactly once, with what it had before, and be found by search.
+ *
+ * SQLite runs in a temporary directory. Other databases have to be empty, and are emptied again afterwards.
+ */
+namespace BacklogMigrationCheck
+{
+/// Takes ownership of driver, which gets connected with settings. Returns false if anything went wrong or got lost
+bool run(QSqlDriver *driver, const Sql::ConnectionSettings &settings);
+}
@@ -0,0 +1,62 @@
+#include "BacklogNames.h"
+
+#include <QSqlDatabase>
+
+#include "BacklogClientConnection.h"
+#include "SqlHelpers.h"
+
+void BacklogNames::createTables(const QSqlDatabase &db)
+{
+	// only for their names and lengths
+	BacklogNames names;
+	createTable(db, names.m_sources);
+	createTable(db, names.m_types);
+}
+
+void BacklogNames::load(const QSqlDatabase &db)
+{
+	load(db, m_sources);
+	load(db, m_types);
+	qCDebug(Backlog) << "Loaded" << m_sources.ids.size() << "sources and" << m_types.ids.size() << "types";
+}
+
+void BacklogNames::createTable(const QSqlDatabase &db, const Table &table)
+{
+	Sql::CREATE_TABLE(table.table)
+			.COLUMN("id", Sql::INTEGER).PRIMARY_KEY().NOT_NULL()
+			.COLUMN("name", Sql::VARCHAR(table.maxLength)).NOT_NULL()
+			.exec(db);
+	Sql::CREATE_INDEX(table.table + "_name").UNIQUE().ON(table.table, "name").exec(db);
+}
+
+void BacklogNames::load(const QSqlDatabase &db, Table &table)
+{
+	table.ids.clear();
+	table.names.clear();
+	QSqlQuery q = Sql::SELECT("id", "name").FROM(table.table).exec(db);
+	while (q.next())
+	{
+		table.ids.insert(q.value(1).toString(), q.value(0).toInt());
+		table.names.insert(q.value(0).toInt(), q.value(1).toString());
+	}
+}
+
+int BacklogNames::intern(const QSqlDatabase &db, Table &table, const QString &name)
+{
+	// cut the same way the database would, so that the cache has what the database has
+	const QString key = name.left(table.maxLength);
+	const auto it = table.ids.constFind(key);
+	if (it != table.ids.constEnd())
+	{
+		return it.value();
+	}
+
+	Sql::INSERT().INTO(table.table).COLUMNS("name").VALUES(key).exec(db);
+	const int id = Sql::SELECT("id").FROM(table.table).WHERE("name", "=", key).execAndNext(db).value(0).toInt();
+	if (id > 0)
+	{
+		table.ids.insert(key, id);
+		table.names.insert(id, key);
+	}
+	return id;
+}
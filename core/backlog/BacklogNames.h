@@ -0,0 +1,43 @@
+#pragma once
+
+#include <QHash>
+#include <QString>
+
+class QSqlDatabase;
+
+/**
+ * The lookup tables chat_sources and chat_types, which messages refer to by id instead of repeating the same few
+ * nicks and types in every row.
+ *
+ * Both are cached entirely in memory, they only ever grow and stay small. New names are added to the database the
+ * first time they are interned. Not thread safe, every thread that needs names has its own.
+ */
+class BacklogNames
+{
+public:
+	static void createTables(const QSqlDatabase &db);
+
+	void load(const QSqlDatabase &db);
+
+	/// The id of name, which gets added if it's new. 0 if adding it fails, which is tried again the next time
+	int source(const QSqlDatabase &db, const QString &name) { return intern(db, m_sources, name); }
+	int type(const QSqlDatabase &db, const QString &name) { return intern(db, m_types, name); }
+
+	QString sourceName(const int id) const { return m_sources.names.value(id); }
+	QString typeName(const int id) const { return m_types.names.value(id); }
+
+private:
+	struct Table
+	{
+		QString table;
+		int maxLength;
+		QHash<QString, int> ids;
+		QHash<int, QString> names;
+	};
+	Table m_sources{"chat_sources", 128, {}, {}};
+	Table m_types{"chat_types", 32, {}, {}};
+
+	static void createTable(const QSqlDatabase &db, const Table &table);
+	static void load(const QSqlDatabase &db, Table &table);
+	static int intern(const QSqlDatabase &db, Table &table, const QString &name);
+};
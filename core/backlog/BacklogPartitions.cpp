@@ -0,0 +1,238 @@
+#include "BacklogPartitions.h"
+
+#include <QSqlDatabase>
+#include <QSqlError>
+#include <QSqlRecord>
+#include <QSqlField>
+#include <QDateTime>
+
+#include "BacklogClientConnection.h"
+#include "SqlHelpers.h"
+
+// messages can arrive late, so a partition is only compacted once it has been over for a while
+static constexpr const qint64 COMPACTION_GRACE = 24 * 60 * 60 * 1000;
+
+void BacklogPartitions::createRegistry(const QSqlDatabase &db)
+{
+	Sql::CREATE_TABLE("chat_partitions")
+			.COLUMN("name", Sql::VARCHAR(64)).NOT_NULL()
+			.COLUMN("start_time", Sql::BIGINT).NOT_NULL()
+			.COLUMN("end_time", Sql::BIGINT).NOT_NULL()
+			.COLUMN("compacted", Sql::SMALLINT).NOT_NULL()
+			.exec(db);
+
+	// whatever is there already stays where it is, new messages go into partitions
+	QSqlQuery q = Sql::SELECT("MAX(timestamp)").FROM("chat_messages").execAndNext(db);
+	if (!q.value(0).isNull())
+	{
+		const qint64 newest = shape(db, "chat_messages").timestamp(q.value(0));
+		Sql::INSERT().INTO("chat_partitions").COLUMNS("name", "start_time", "end_time", "compacted")
+				.VALUES("chat_messages", 0, newest + 1, 0).exec(db);
+	}
+}
+
+void BacklogPartitions::createTable(const QSqlDatabase &db, const QString &table, const bool withIndex)
+{
+	// ids are assigned by BacklogClientConnection, so they are unique across all partitions. Sources and types are
+	// interned by BacklogNames, timestamps are milliseconds since the epoch. INTEGER is 64 bits in SQLite, where only an
+	// INTEGER PRIMARY KEY is the rowid (which the embedded full-text index relies on)
+	const Sql::Type id = Sql::dialect(db).contains("SQLITE") ? Sql::INTEGER : Sql::BIGINT;
+	Sql::CREATE_TABLE(table)
+			.COLUMN("id", id).PRIMARY_KEY(false).NOT_NULL()
+			.COLUMN("channel", Sql::INTEGER).NOT_NULL().foreignReference("chat_channels", "id")
+			.COLUMN("source", Sql::INTEGER).NOT_NULL().foreignReference("chat_sources", "id")
+			.COLUMN("type", Sql::INTEGER).NOT_NULL().foreignReference("chat_types", "id")
+			.COLUMN("content", Sql::VARCHAR(512)).NOT_NULL()
+			.COLUMN("timestamp", Sql::BIGINT).NOT_NULL()
+			// see BacklogCompression. content is empty if it's compressed
+			.COLUMN("dictionary", Sql::INTEGER)
+			.COLUMN("compressed", Sql::BLOB)
+			.exec(db);
+	if (withIndex)
+	{
+		createIndex(db, table);
+	}
+}
+void BacklogPartitions::createIndex(const QSqlDatabase &db, const QString &table)
+{
+	// for paging through the backlog of a channel, see BacklogClientConnection::sendPage
+	Sql::CREATE_INDEX(table + "_channel_timestamp").ON(table, "channel", "timestamp", "id").exec(db);
+}
+
+QVariant BacklogPartitions::Shape::timestamp(const qint64 msecs) const
+{
+	return dateTimes ? QVariant(QDateTime::fromMSecsSinceEpoch(msecs, Qt::UTC)) : QVariant(msecs);
+}
+qint64 BacklogPartitions::Shape::timestamp(const QVariant &value) const
+{
+	if (!dateTimes)
+	{
+		return value.toLongLong();
+	}
+	// the same as BacklogMigration converts them
+	QDateTime time = value.toDateTime();
+	time.setTimeSpec(Qt::UTC);
+	return time.toMSecsSinceEpoch();
+}
+BacklogPartitions::Shape BacklogPartitions::shape(const QSqlDatabase &db, const QString &table)
+{
+	const QSqlRecord record = Sql::record(db, table);
+	return {record.field("source").type() == QVariant::String, record.field("timestamp").type() == QVariant::DateTime};
+}
+
+QStringList BacklogPartitions::allTables(const QSqlDatabase &db)
+{
+	// chat_messages isn't registered as a partition if it was empty. Before migrating to the registry it is all there is
+	QStringList tables{"chat_messages"};
+	if (!db.tables().contains("chat_partitions"))
+	{
+		return tables;
+	}
+	QSqlQuery q = Sql::SELECT("name").FROM("chat_partitions").exec(db);
+	while (q.next())
+	{
+		if (!tables.contains(q.value(0).toString()))
+		{
+			tables.append(q.value(0).toString());
+		}
+	}
+	return tables;
+}
+
+void BacklogPartitions::load(const QSqlDatabase &db, const BacklogSearch::Engine engine)
+{
+	m_engine = engine;
+	m_partitions.clear();
+	QSqlQuery q = Sql::SELECT("name", "start_time", "end_time", "compacted").FROM("chat_partitions").ORDER_BY("start_time").exec(db);
+	while (q.next())
+	{
+		m_partitions.append({q.value(0).toString(), q.value(1).toLongLong(), q.value(2).toLongLong(), q.value(3).toBool()});
+	}
+}
+
+QString BacklogPartitions::tableFor(const QSqlDatabase &db, const qint64 timestamp, Partition *created)
+{
+	int index = 0;
+	for (; index < m_partitions.size() && m_partitions.at(index).start <= timestamp; ++index)
+	{
+		if (timestamp < m_partitions.at(index).end)
+		{
+			return m_partitions.at(index).table;
+		}
+	}
+
+	// a new month, which is cut short where it would overlap with its neighbours (only chat_messages doesn't end on a month boundary)
+	const QDate date = QDateTime::fromMSecsSinceEpoch(timestamp, Qt::UTC).date();
+	const QDate month(date.year(), date.month(), 1);
+	Partition partition;
+	partition.table = "chat_messages_" + month.toString("yyyyMM");
+	partition.start = QDateTime(month, QTime(0, 0), Qt::UTC).toMSecsSinceEpoch();
+	partition.end = QDateTime(month.addMonths(1), QTime(0, 0), Qt::UTC).toMSecsSinceEpoch();
+	partition.compacted = false;
+	if (index > 0)
+	{
+		partition.start = qMax(partition.start, m_partitions.at(index - 1).end);
+	}
+	if (index < m_partitions.size())
+	{
+		partition.end = qMin(partition.end, m_partitions.at(index).start);
+	}
+
+	qCDebug(Backlog) << "Creating partition" << partition.table;
+	createTable(db, partition.table);
+	BacklogSearch::addTable(db, m_engine, partition.table);
+	// only known once it's registered, otherwise it's tried again with the next message (the table and index are created if not exists)
+	if (Sql::INSERT().INTO("chat_partitions").COLUMNS("name", "start_time", "end_time", "compacted")
+			.VALUES(partition.table, partition.start, partition.end, 0).exec(db).lastError().isValid())
+	{
+		return QString();
+	}
+	m_partitions.insert(index, partition);
+	if (created)
+	{
+		*created = partition;
+	}
+	return partition.table;
+}
+void BacklogPartitions::add(const Partition &partition)
+{
+	int index = 0;
+	for (; index < m_partitions.size() && m_partitions.at(index).start <= partition.start; ++index)
+	{
+		if (m_partitions.at(index).table == partition.table)
+		{
+			return;
+		}
+	}
+	m_partitions.insert(index, partition);
+}
+
+QStringList BacklogPartitions::tables(const qint64 min, const qint64 max) const
+{
+	QStringList out;
+	for (int i = m_partitions.size() - 1; i >= 0; --i)
+	{
+		const Partition &partition = m_partitions.at(i);
+		if ((max <= 0 || partition.start < max) && (min <= 0 || partition.end > min))
+		{
+			out.append(partition.table);
+		}
+	}
+	return out;
+}
+
+QStringList BacklogPartitions::takeOlderThan(const qint64 cutoff)
+{
+	QStringList tables;
+	while (!m_partitions.isEmpty() && m_partitions.first().end <= cutoff)
+	{
+		tables.append(m_partitions.takeFirst().table);
+	}
+	return tables;
+}
+
+void BacklogPartitions::drop(const QSqlDatabase &db, const BacklogSearch::Engine engine, const QString &table)
+{
+	qCDebug(Backlog) << "Dropping partition" << table;
+	if (table == "chat_messages")
+	{
+		// the original table stays, the full-text index gets emptied along with it by its triggers
+		if (engine == BacklogSearch::Terms)
+		{
+			BacklogSearch::dropTable(db, engine, table);
+		}
+		Sql::DELETE_FROM(table).exec(db);
+	}
+	else
+	{
+		BacklogSearch::dropTable(db, engine, table);
+		Sql::DROP_TABLE(table).exec(db);
+	}
+	Sql::DELETE_FROM("chat_partitions").WHERE("name", "=", table).exec(db);
+}
+
+void BacklogPartitions::remove(const QString &table)
+{
+	for (int i = 0; i < m_partitions.size(); ++i)
+	{
+		if (m_partitions.at(i).table == table)
+		{
+			m_partitions.removeAt(i);
+			return;
+		}
+	}
+}
+
+QString BacklogPartitions::nextToCompact(const qint64 now)
+{
+	for (Partition &partition : m_partitions)
+	{
+		if (!partition.compacted && partition.end + COMPACTION_GRACE <= now)
+		{
+			// BacklogWriter marks it in chat_partitions once it's done
+			partition.compacted = true;
+			return partition.table;
+		}
+	}
+	return QString();
+}
@@ -0,0 +1,82 @@
+#pragma once
+
+#include <QString>
+#include <QStringList>
+#include <QList>
+#include <QVariant>
+
+#include "BacklogSearch.h"
+
+class QSqlDatabase;
+
+/**
+ * chat_messages split up by time, one table per month (chat_messages_YYYYMM), so that old messages can be dropped a
+ * whole table at a time instead of being deleted row by row.
+ *
+ * The partitions are listed in chat_partitions, each covering [start_time, end_time) of message timestamps. The
+ * original chat_messages table stays around as the partition for everything from before partitioning was introduced.
+ * Not thread safe. BacklogWriter creates partitions as messages need them and tells BacklogClientConnection about them,
+ * which keeps its own list of them for reading.
+ */
+class BacklogPartitions
+{
+public:
+	struct Partition
+	{
+		QString table;
+		qint64 start;
+		qint64 end;
+		bool compacted;
+	};
+
+	/**
+	 * How the messages of a table are stored. Tables from before the normalized_names migration (see BacklogMigration)
+	 * have sources and types by name, and timestamps declared as TIMESTAMP, which only SQLite took milliseconds for.
+	 * They are read and written that way until the migration has replaced them
+	 */
+	struct Shape
+	{
+		bool names; ///< Sources and types by name instead of by id
+		bool dateTimes; ///< Timestamps as date and time, taken as UTC
+
+		/// What to write to or compare with the timestamp column
+		QVariant timestamp(const qint64 msecs) const;
+		/// Milliseconds since the epoch, from what the timestamp column holds
+		qint64 timestamp(const QVariant &value) const;
+	};
+	/// Cheap, see Sql::record
+	static Shape shape(const QSqlDatabase &db, const QString &table);
+
+	/// Creates chat_partitions, with chat_messages as the partition for everything up to now
+	static void createRegistry(const QSqlDatabase &db);
+	/// Creates a table for messages, with the indices that all of them have unless withIndex is false
+	static void createTable(const QSqlDatabase &db, const QString &table, const bool withIndex = true);
+	static void createIndex(const QSqlDatabase &db, const QString &table);
+	/// All tables of messages in the database, for migrations that have to change every one of them
+	static QStringList allTables(const QSqlDatabase &db);
+
+	void load(const QSqlDatabase &db, const BacklogSearch::Engine engine);
+
+	/// The table that messages with timestamp go into, which gets created if needed (and then put into created). Empty if creating it fails
+	QString tableFor(const QSqlDatabase &db, const qint64 timestamp, Partition *created = nullptr);
+	/// A partition that has been created elsewhere, see BacklogWriter::partitionCreated
+	void add(const Partition &partition);
+	/// Tables that can have messages in [min, max), newest first. 0 means no bound
+	QStringList tables(const qint64 min = 0, const qint64 max = 0) const;
+
+	/**
+	 * Forgets about the partitions that only have messages older than cutoff and returns their tables, which are then
+	 * dropped using drop. That is left to BacklogWriter, which might still have rows for them queued
+	 */
+	QStringList takeOlderThan(const qint64 cutoff);
+	/// Drops a partition along with its full-text index
+	static void drop(const QSqlDatabase &db, const BacklogSearch::Engine engine, const QString &table);
+	/// Forgets about a partition that has been dropped
+	void remove(const QString &table);
+	/// A partition that won't get any new messages anymore (barring stragglers) and hasn't been compacted, or an empty string
+	QString nextToCompact(const qint64 now);
+
+private:
+	QList<Partition> m_partitions; ///< Oldest first
+	BacklogSearch::Engine m_engine = BacklogSearch::None;
+};
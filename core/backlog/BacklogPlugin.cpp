@@ -1,14 +1,20 @@
 #include "BacklogPlugin.h"
 
 #include <QSqlDatabase>
+#include <QSqlError>
 #include <QPluginLoader>
 #include <QLibraryInfo>
 #include <QSqlDriverPlugin>
+#include <QSqlDriver>
 #include <QDir>
 #include <QJsonArray>
 #include <QRegularExpression>
 
 #include "BacklogClientConnection.h"
+#include "BacklogBenchmark.h"
+#include "BacklogMigrationCheck.h"
+#include "BacklogCompression.h"
+#include "BacklogTransfer.h"
 
 static const char *libraryEnding =
 		#if defined(Q_OS_OSX)
@@ -54,6 +60,37 @@ static QMap<QString, QPair<QString, QStaticPlugin>> getDrivers()
 	return out;
 }
 
+static QSqlDriver *createDriver(const QString &driver)
+{
+	const QPair<QString, QStaticPlugin> driverPath = getDrivers().value(driver);
+	QSqlDriverPlugin *plugin;
+	if (driverPath.first.isNull())
+	{
+		plugin = qobject_cast<QSqlDriverPlugin *>(driverPath.second.instance());
+	}
+	else
+	{
+		QPluginLoader loader(driverPath.first);
+		if (!loader.load())
+		{
+			qCWarning(Backlog) << "Unable to load" << driverPath.first << ":" << loader.errorString();
+			return nullptr;
+		}
+		plugin = qobject_cast<QSqlDriverPlugin *>(loader.instance());
+	}
+	if (!plugin)
+	{
+		qCWarning(Backlog) << "There was an unknown error while loading" << driver;
+		return nullptr;
+	}
+	QSqlDriver *d = plugin->create(driver.toUpper());
+	if (!d)
+	{
+		qCWarning(Backlog) << "Unable to create the SQL driver for" << driver;
+	}
+	return d;
+}
+
 QList<QCommandLineOption> BacklogPlugin::cliOptions() const
 {
 	return QList<QCommandLineOption>()
@@ -64,14 +101,102 @@ QList<QCommandLineOption> BacklogPlugin::cliOptions() const
 			<< QCommandLineOption("backlog-db-username", "Username to use for connecting to the database", "USERNAME", "talktalk")
 			<< QCommandLineOption("backlog-db-password", "Password to use for connecting to the database", "PASSWORD", "talktalk")
 			<< QCommandLineOption("backlog-db-options", "Options to use for connecting. See QSqlDatabase::setConnectionOptions for possible values", "OPTIONS", "")
+			<< QCommandLineOption("backlog-batch-size", "Maximum number of messages to write in one transaction", "MESSAGES", "200")
+			<< QCommandLineOption("backlog-batch-bytes", "Maximum size of the messages to write in one transaction", "KIB", "256")
+			<< QCommandLineOption("backlog-batch-latency", "Maximum time a message waits before being written", "MSECS", "250")
+			<< QCommandLineOption("backlog-readers", "Number of database connections, each on a thread of its own, for answering history and search requests", "CONNECTIONS", "2")
+			<< QCommandLineOption("backlog-hot-lines", "Number of recent messages per channel to keep in memory for answering history requests", "LINES", "500")
+			<< QCommandLineOption("backlog-retention-days", "Drop messages older than this, a month at a time (0 keeps everything)", "DAYS", "0")
+			<< QCommandLineOption("backlog-engine", "Where to store messages, \"sql\" for the database or \"log\" for append-only files (channels are always kept in the database)", "ENGINE", "sql")
+			<< QCommandLineOption("backlog-log-dir", "Directory for the files of the log engine", "DIR", "talktalk_backlog_log")
+			<< QCommandLineOption("backlog-compression", "Compress stored messages, \"none\" or \"zlib\" (with a dictionary per channel, switches full-text search to the embedded index)", "METHOD", "none")
+			<< QCommandLineOption("backlog-benchmark", "Compare the log engine to QSQLITE by writing and paging through this many messages, and exit", "MESSAGES")
+			<< QCommandLineOption("backlog-check-migrations", "Migrate a backlog in the first schema to the latest one on the configured database, which has to be empty, check that nothing got lost, and exit")
+			<< QCommandLineOption("backlog-export", "Write all messages to FILE as JSON, one per line (gzip compressed if FILE ends in .gz), and exit", "FILE")
+			<< QCommandLineOption("backlog-import", "Add the messages in FILE to the backlog, and exit. The core must not be running on the same database meanwhile", "FILE")
+			<< QCommandLineOption("backlog-import-format", "Format of the file to import, \"talktalk\" (as written by --backlog-export), \"irssi\" or \"weechat\"", "FORMAT", "talktalk")
+			<< QCommandLineOption("backlog-import-channel", "Channel to import into, required for logs of IRC clients", "UUID")
 			<< QCommandLineOption("backlog-list-drivers", "List available drivers and exit");
 }
 
-bool BacklogPlugin::handleArguments(const QCommandLineParser &parser) const
+static Sql::ConnectionSettings connectionSettings(const QCommandLineParser &parser)
+{
+	return Sql::ConnectionSettings{
+			parser.value("backlog-db-host"),
+			parser.value("backlog-db-port").toInt(),
+			parser.value("backlog-db-dbname"),
+			parser.value("backlog-db-username"),
+			parser.value("backlog-db-password"),
+			parser.value("backlog-db-options")
+	};
+}
+
+/// Opens the "backlog" connection from the command line, for --backlog-export and --backlog-import. Returns false on errors
+static bool transfer(const QCommandLineParser &parser)
+{
+	const QString driver = parser.value("backlog-db-driver");
+	QSqlDriver *d = createDriver(driver);
+	if (!d)
+	{
+		return false;
+	}
+	QSqlDatabase db = connectionSettings(parser).addDatabase(d, "backlog");
+	if (!db.open())
+	{
+		qCWarning(Backlog) << "Unable to connect to database:" << db.lastError().text();
+		return false;
+	}
+	if (!BacklogClientConnection::prepareDatabase())
+	{
+		return false;
+	}
+
+	bool ok = true;
+	if (parser.isSet("backlog-export"))
+	{
+		ok = BacklogTransfer::exportTo(parser.value("backlog-export"));
+	}
+	if (ok && parser.isSet("backlog-import"))
+	{
+		QSqlDriver *writerDriver = createDriver(driver);
+		ok = writerDriver
+				&& BacklogTransfer::importFrom(parser.value("backlog-import"), parser.value("backlog-import-format"), parser.value("backlog-import-channel"),
+											   writerDriver, connectionSettings(parser), parser.value("backlog-batch-size").toInt(),
+											   parser.value("backlog-batch-bytes").toInt() * 1024, parser.value("backlog-batch-latency").toInt());
+	}
+	return ok;
+}
+
+bool BacklogPlugin::handleArguments(const QCommandLineParser &parser, int *exitCode) const
 {
 	if (parser.isSet("backlog-list-drivers"))
 	{
 		qCDebug(Backlog) << "Available drivers on this system:" << QStringList(getDrivers().keys()).join(", ").toUtf8().constData();
+		*exitCode = 0;
+		return false;
+	}
+	if (parser.isSet("backlog-benchmark"))
+	{
+		QSqlDriver *d = createDriver("QSQLITE");
+		if (d && BacklogBenchmark::run(d, qMax(1, parser.value("backlog-benchmark").toInt())))
+		{
+			*exitCode = 0;
+		}
+		return false;
+	}
+	if (parser.value("backlog-engine") != "sql" && parser.value("backlog-engine") != "log")
+	{
+		qCWarning(Backlog) << "Unknown engine" << parser.value("backlog-engine");
+		return false;
+	}
+	if (parser.value("backlog-compression") != "none" && parser.value("backlog-compression") != "zlib")
+	{
+		qCWarning(Backlog) << "Unknown compression method" << parser.value("backlog-compression");
+		return false;
+	}
+	if (parser.value("backlog-compression") == "zlib" && !BacklogCompression::available())
+	{
+		qCWarning(Backlog) << "This build doesn't support compression";
 		return false;
 	}
 	if (!getDrivers().contains(parser.value("backlog-db-driver")))
@@ -79,47 +204,61 @@ bool BacklogPlugin::handleArguments(const QCommandLineParser &parser) const
 		qCWarning(Backlog) << "Driver" << parser.value("backlog-db-driver") << "is not available";
 		return false;
 	}
+	if (parser.isSet("backlog-export") || parser.isSet("backlog-import"))
+	{
+		const QString format = parser.value("backlog-import-format");
+		if (format != "talktalk" && format != "irssi" && format != "weechat")
+		{
+			qCWarning(Backlog) << "Unknown import format" << format;
+			return false;
+		}
+		if (parser.isSet("backlog-import") && format != "talktalk" && !parser.isSet("backlog-import-channel"))
+		{
+			qCWarning(Backlog) << "Logs of IRC clients need --backlog-import-channel";
+			return false;
+		}
+		*exitCode = transfer(parser) ? 0 : 1;
+		return false;
+	}
+	if (parser.isSet("backlog-check-migrations"))
+	{
+		QSqlDriver *d = createDriver(parser.value("backlog-db-driver"));
+		*exitCode = d && BacklogMigrationCheck::run(d, connectionSettings(parser)) ? 0 : 1;
+		return false;
+	}
 	return true;
 }
 
 QList<AbstractClientConnection *> BacklogPlugin::clients(const QCommandLineParser &parser) const
 {
 	const QString driver = parser.value("backlog-db-driver");
-	const QPair<QString, QStaticPlugin> driverPath = getDrivers().value(driver);
-	QSqlDriverPlugin *plugin;
-	if (driverPath.first.isNull())
-	{
-		plugin = qobject_cast<QSqlDriverPlugin *>(driverPath.second.instance());
-	}
-	else
-	{
-		QPluginLoader loader(driverPath.first);
-		if (!loader.load())
-		{
-			qCWarning(Backlog) << "Unable to load" << driverPath.first << ":" << loader.errorString();
-			return {};
-		}
-		plugin = qobject_cast<QSqlDriverPlugin *>(loader.instance());
-	}
-	if (!plugin)
+	QSqlDriver *d = createDriver(driver);
+	QSqlDriver *writerDriver = createDriver(driver);
+	QList<QSqlDriver *> readerDrivers;
+	for (int i = 0; i < qMax(1, parser.value("backlog-readers").toInt()); ++i)
 	{
-		qCWarning(Backlog) << "There was an unknown error while loading" << driver;
-		return {};
+		readerDrivers.append(createDriver(driver));
 	}
-	QSqlDriver *d = plugin->create(driver.toUpper());
-	if (!d)
+	if (!d || !writerDriver || readerDrivers.contains(nullptr))
 	{
-		qCWarning(Backlog) << "Unable to create the SQL driver for" << driver;
+		delete d;
+		delete writerDriver;
+		qDeleteAll(readerDrivers);
 		return {};
 	}
 	const auto options = BacklogClientConnection::Options{
 			d,
-			parser.value("backlog-db-host"),
-			parser.value("backlog-db-port").toInt(),
-			parser.value("backlog-db-dbname"),
-			parser.value("backlog-db-username"),
-			parser.value("backlog-db-password"),
-			parser.value("backlog-db-options")
+			writerDriver,
+			readerDrivers,
+			connectionSettings(parser),
+			parser.value("backlog-batch-size").toInt(),
+			parser.value("backlog-batch-bytes").toInt() * 1024,
+			parser.value("backlog-batch-latency").toInt(),
+			parser.value("backlog-hot-lines").toInt(),
+			parser.value("backlog-retention-days").toInt(),
+			parser.value("backlog-engine"),
+			parser.value("backlog-log-dir"),
+			parser.value("backlog-compression") == "zlib"
 	};
 	return QList<AbstractClientConnection *>() << new BacklogClientConnection(options);
 }
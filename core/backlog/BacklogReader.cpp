@@ -0,0 +1,200 @@
+#include "BacklogReader.h"
+
+#include <QSqlDatabase>
+#include <QSqlError>
+#include <QJsonArray>
+
+#include "BacklogClientConnection.h"
+#include "BacklogPartitions.h"
+#include "BacklogSearch.h"
+#include "SqlHelpers.h"
+
+BacklogReader::BacklogReader(QSqlDriver *driver, const Sql::ConnectionSettings &settings, const int index)
+	: QObject(nullptr), m_driver(driver), m_settings(settings), m_connectionName(QString("backlog-reader-%1").arg(index))
+{
+}
+
+void BacklogReader::enqueue(Request &&request)
+{
+	m_queue.push(std::move(request));
+	QMetaObject::invokeMethod(this, "process", Qt::QueuedConnection);
+}
+
+QList<QJsonObject> BacklogReader::pageReplies(const QVector<BacklogRing::Line> &lines, const int amount, const int chunkSize)
+{
+	// newest first, in chunks so that large pages reach the client piece by piece
+	QList<QJsonObject> replies;
+	for (int start = 0; start < lines.size() || start == 0; start += chunkSize)
+	{
+		QJsonArray messages;
+		for (int i = start; i < qMin(start + chunkSize, lines.size()); ++i)
+		{
+			const BacklogRing::Line &line = lines.at(i);
+			messages.append(QJsonObject({
+				{"id", double(line.id)},
+				{"from", line.source},
+				{"type", line.type},
+				{"content", line.content},
+				{"timestamp", QString::number(line.timestamp)}
+			}));
+		}
+		const bool done = start + chunkSize >= lines.size();
+		QJsonObject reply{{"messages", messages}, {"done", done}};
+		if (done && lines.size() == amount)
+		{
+			// there might be more, this is where the next page starts
+			reply.insert("max", QString::number(lines.last().timestamp));
+			reply.insert("beforeId", double(lines.last().id));
+		}
+		replies.append(reply);
+	}
+	return replies;
+}
+QJsonObject BacklogReader::historyReply(const QVector<BacklogRing::Line> &lines, const int amount)
+{
+	return pageReplies(lines, amount, qMax(1, lines.size())).first();
+}
+
+void BacklogReader::open()
+{
+	QSqlDatabase db = m_settings.addDatabase(m_driver, m_connectionName);
+	if (!db.open())
+	{
+		qCWarning(Backlog) << "Unable to connect" << m_connectionName << "to the database:" << db.lastError().text();
+		return;
+	}
+	m_names.load(db);
+	m_open = true;
+	process();
+}
+
+void BacklogReader::process()
+{
+	if (!m_open)
+	{
+		// answered once the connection is open
+		return;
+	}
+	Request request;
+	while (m_queue.pop(&request))
+	{
+		if (request.kind == Request::Page || request.kind == Request::History)
+		{
+			page(request);
+		}
+		else
+		{
+			search(request);
+		}
+	}
+}
+
+QString BacklogReader::sourceName(const int id)
+{
+	QString name = m_names.sourceName(id);
+	if (name.isNull())
+	{
+		m_names.load(QSqlDatabase::database(m_connectionName));
+		name = m_names.sourceName(id);
+	}
+	return name;
+}
+QString BacklogReader::typeName(const int id)
+{
+	QString name = m_names.typeName(id);
+	if (name.isNull())
+	{
+		m_names.load(QSqlDatabase::database(m_connectionName));
+		name = m_names.typeName(id);
+	}
+	return name;
+}
+
+void BacklogReader::page(const Request &request)
+{
+	const QSqlDatabase db = QSqlDatabase::database(m_connectionName);
+	QVector<BacklogRing::Line> lines;
+	// keyset pagination: the page starts right below the last message of the previous one, so that no matter how far
+	// back the client has scrolled this is a seek into the (channel, timestamp, id) index rather than a scan. Partitions
+	// don't overlap, so going through them newest first gives the same order as a single table
+	for (const QString &table : request.tables)
+	{
+		// bounds are converted rather than the column, so that the index still gets used
+		const BacklogPartitions::Shape shape = BacklogPartitions::shape(db, table);
+		const QVariant max = shape.timestamp(request.max);
+		auto query = Sql::SELECT("id", "source", "type", "content", "timestamp", "dictionary", "compressed").FROM(table).WHERE("channel", "=", request.channelId);
+		if (request.max > 0 && request.beforeId > 0)
+		{
+			// messages can share a timestamp, so the id breaks ties. (timestamp, id) < (max, beforeId) spelled out,
+			// since not all databases can use an index for row value comparisons
+			query = query.WHERE("timestamp", "<=", max).WHERE_ANY({{"timestamp", "<", max}, {"id", "<", request.beforeId}});
+		}
+		else if (request.max > 0)
+		{
+			query = query.WHERE("timestamp", "<", max);
+		}
+		if (request.min > 0)
+		{
+			query = query.AND("timestamp", ">=", shape.timestamp(request.min));
+		}
+		if (request.maxId > 0)
+		{
+			query = query.AND("id", "<=", request.maxId);
+		}
+		QSqlQuery q = query.ORDER_BY("timestamp", Sql::DESC).ORDER_BY("id", Sql::DESC).LIMIT(request.amount - lines.size()).exec(db);
+		while (q.next())
+		{
+			// only what is actually sent gets decompressed
+			lines.append({q.value(0).toLongLong(), shape.timestamp(q.value(4)),
+						  shape.names ? q.value(1).toString() : sourceName(q.value(1).toInt()), shape.names ? q.value(2).toString() : typeName(q.value(2).toInt()),
+						  m_dictionaries.content(db, request.channelId, q.value(3).toString(), q.value(5).toInt(), q.value(6).toByteArray())});
+		}
+		if (lines.size() >= request.amount)
+		{
+			break;
+		}
+	}
+
+	if (request.kind == Request::History)
+	{
+		QJsonObject reply = historyReply(lines, request.amount);
+		for (auto it = request.extra.constBegin(); it != request.extra.constEnd(); ++it)
+		{
+			reply.insert(it.key(), it.value());
+		}
+		emit this->reply(request.channel, "history", reply, request.replyTo);
+		return;
+	}
+	for (const QJsonObject &reply : pageReplies(lines, request.amount))
+	{
+		emit this->reply(request.channel, "more", reply, request.replyTo);
+	}
+}
+
+void BacklogReader::search(const Request &request)
+{
+	const QSqlDatabase db = QSqlDatabase::database(m_connectionName);
+	QVector<BacklogSearch::Result> results;
+	if (!BacklogSearch::search(db, BacklogSearch::Engine(request.engine), request.tables, request.query, request.channelId, request.min, request.max,
+							   request.offset, request.amount, &results))
+	{
+		emit reply(request.channel, "search:error", {{"error", "Unable to search the backlog"}}, request.replyTo);
+		return;
+	}
+
+	QJsonArray messages;
+	for (const BacklogSearch::Result &result : results)
+	{
+		messages.append(QJsonObject({
+			{"id", double(result.id)},
+			{"channel", request.uuids.value(result.channel)},
+			{"from", result.source},
+			{"type", result.type},
+			{"content", m_dictionaries.content(db, result.channel, result.content, result.dictionary, result.compressed)},
+			{"timestamp", QString::number(result.timestamp)},
+			{"score", result.score}
+		}));
+	}
+	// ranked results can't be paged by key, the next page simply starts at offset + amount
+	emit reply(request.channel, "search", {{"results", messages}, {"offset", request.offset}, {"more", results.size() == request.amount}}, request.replyTo);
+}
@@ -0,0 +1,91 @@
+#pragma once
+
+#include <QObject>
+#include <QHash>
+#include <QUuid>
+#include <QJsonObject>
+#include <QStringList>
+#include <QVector>
+
+#include "core/MpscQueue.h"
+#include "SqlHelpers.h"
+#include "BacklogRing.h"
+#include "BacklogNames.h"
+#include "BacklogCompression.h"
+
+class QSqlDriver;
+
+/**
+ * Answers history and search requests from the database on a thread of its own, so that large queries neither hold
+ * up BacklogClientConnection nor get held up by it. There can be several, each with its own database connection.
+ *
+ * Requests are queued by BacklogClientConnection together with everything the reader needs to know about them (which
+ * partitions to look in, which channels there are), and answered through reply, which goes out like a broadcast of
+ * BacklogClientConnection.
+ */
+class BacklogReader : public QObject
+{
+	Q_OBJECT
+public:
+	struct Request
+	{
+		enum Kind
+		{
+			Page,
+			History, ///< A page, that is replied to in one piece
+			Search
+		};
+		Kind kind = Page;
+		QString channel;
+		QUuid replyTo;
+		QStringList tables;
+		int channelId = 0;
+		qint64 min = 0;
+		qint64 max = 0;
+		qint64 beforeId = 0; ///< Page only
+		int offset = 0; ///< Search only
+		int amount = 0;
+		QString query; ///< Search only
+		int engine = 0; ///< Search only, a BacklogSearch::Engine
+		QHash<int, QString> uuids; ///< Search only, channel ids to what clients know them by
+		qint64 maxId = 0; ///< History only, the newest message the reply may contain (see lastMsgId)
+		QJsonObject extra; ///< History only, added to the reply
+	};
+
+	/// Takes ownership of driver, which has to be moved to the thread of the reader along with it. index is for telling the connections of several readers apart
+	explicit BacklogReader(QSqlDriver *driver, const Sql::ConnectionSettings &settings, const int index);
+
+	/// Thread safe
+	void enqueue(Request &&request);
+
+	/// Replies to a "more" request with lines, in chunks. amount is what was asked for
+	static QList<QJsonObject> pageReplies(const QVector<BacklogRing::Line> &lines, const int amount, const int chunkSize = 50);
+	/// Replies to a history request with lines, in a single message
+	static QJsonObject historyReply(const QVector<BacklogRing::Line> &lines, const int amount);
+
+public slots:
+	/// Opens the connection to the database
+	void open();
+
+signals:
+	void reply(const QString &channel, const QString &cmd, const QJsonObject &data, const QUuid &replyTo);
+
+private slots:
+	void process();
+
+private:
+	QSqlDriver *m_driver;
+	const Sql::ConnectionSettings m_settings;
+	const QString m_connectionName;
+	bool m_open = false;
+	MpscQueue<Request> m_queue;
+
+	BacklogNames m_names;
+	BacklogCompression::DictionaryCache m_dictionaries;
+	/// Names that have been added since they were loaded are loaded again
+	QString sourceName(const int id);
+	QString typeName(const int id);
+
+	void page(const Request &request);
+	void search(const Request &request);
+};
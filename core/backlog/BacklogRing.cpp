@@ -0,0 +1,104 @@
+#include "BacklogRing.h"
+
+#include <algorithm>
+
+BacklogRing::BacklogRing(const int capacity)
+	: m_capacity(capacity)
+{
+}
+
+void BacklogRing::create(const int channel, const qint64 floor)
+{
+	Channel &ring = m_channels[channel];
+	ring.entries.reserve(m_capacity);
+	ring.floor = floor;
+}
+
+void BacklogRing::append(const int channel, const Line &line)
+{
+	Channel &ring = m_channels[channel];
+	const QByteArray content = line.content.toUtf8();
+	const Entry entry{line.id, line.timestamp, quint32(ring.arena.size()), quint32(content.size()), intern(line.source), intern(line.type)};
+	ring.arena.append(content);
+
+	if (ring.entries.size() < m_capacity)
+	{
+		ring.entries.append(entry);
+		return;
+	}
+
+	// full, so the oldest entry makes room. Everything it had is now only in the database
+	Entry &oldest = ring.entries[ring.start];
+	ring.floor = qMax(ring.floor, oldest.timestamp);
+	oldest = entry;
+	ring.start = (ring.start + 1) % m_capacity;
+
+	// contents are evicted in the order they were added, so everything before the oldest live one is garbage
+	const quint32 garbage = ring.entries.at(ring.start).offset;
+	if (garbage > quint32(ring.arena.size() / 2))
+	{
+		ring.arena.remove(0, int(garbage));
+		for (Entry &e : ring.entries)
+		{
+			e.offset -= garbage;
+		}
+	}
+}
+
+bool BacklogRing::page(const int channel, const qint64 min, const qint64 max, const qint64 beforeId, const int amount, QVector<Line> *lines) const
+{
+	const auto it = m_channels.constFind(channel);
+	if (it == m_channels.constEnd())
+	{
+		return false;
+	}
+	const Channel &ring = it.value();
+
+	QVector<const Entry *> matches;
+	for (const Entry &entry : ring.entries)
+	{
+		const bool belowMax = max <= 0 || entry.timestamp < max || (entry.timestamp == max && entry.id < beforeId);
+		if (belowMax && entry.timestamp >= min)
+		{
+			matches.append(&entry);
+		}
+	}
+	const auto newer = [](const Entry *a, const Entry *b)
+	{
+		return a->timestamp != b->timestamp ? a->timestamp > b->timestamp : a->id > b->id;
+	};
+	const int count = qMin(amount, matches.size());
+	std::partial_sort(matches.begin(), matches.begin() + count, matches.end(), newer);
+
+	// everything outside of the ring has a smaller id than everything in it, so it can only come before the last line
+	// of the page if it has a larger timestamp. If the page isn't full it must not have anything that would match at all
+	if (ring.floor >= 0)
+	{
+		if (count == amount ? ring.floor > matches.at(count - 1)->timestamp : ring.floor >= min)
+		{
+			return false;
+		}
+	}
+
+	lines->reserve(count);
+	for (int i = 0; i < count; ++i)
+	{
+		const Entry *entry = matches.at(i);
+		lines->append({entry->id, entry->timestamp, m_strings.at(int(entry->source)), m_strings.at(int(entry->type)),
+					   QString::fromUtf8(ring.arena.constData() + entry->offset, int(entry->length))});
+	}
+	return true;
+}
+
+quint32 BacklogRing::intern(const QString &string)
+{
+	const auto it = m_stringIds.constFind(string);
+	if (it != m_stringIds.constEnd())
+	{
+		return it.value();
+	}
+	const quint32 id = quint32(m_strings.size());
+	m_strings.append(string);
+	m_stringIds.insert(string, id);
+	return id;
+}
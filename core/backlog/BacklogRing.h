@@ -0,0 +1,67 @@
+#pragma once
+
+#include <QHash>
+#include <QVector>
+#include <QStringList>
+
+/**
+ * The most recent messages of each channel, kept in memory so that the usual history requests don't need the database.
+ *
+ * Every channel has a ring of a fixed number of messages. Messages are stored compactly: sources and types are
+ * interned, and contents are kept as UTF-8 in an arena per channel. A page is only answered from memory if it can be
+ * shown to be complete, that is if nothing outside of the ring could be part of it.
+ */
+class BacklogRing
+{
+public:
+	struct Line
+	{
+		qint64 id;
+		qint64 timestamp;
+		QString source;
+		QString type;
+		QString content;
+	};
+
+	explicit BacklogRing(const int capacity);
+
+	int capacity() const { return m_capacity; }
+
+	bool contains(const int channel) const { return m_channels.contains(channel); }
+	/// floor is the newest timestamp of what the database already has for the channel, or -1 if it has nothing
+	void create(const int channel, const qint64 floor);
+	/// line has to be newer (by id) than everything already in the channel's ring
+	void append(const int channel, const Line &line);
+
+	/**
+	 * The same page BacklogClientConnection would get from the database: up to amount lines with timestamp >= min and
+	 * (timestamp, id) < (max, beforeId), newest first. max 0 means no upper bound, beforeId 0 excludes all of max.
+	 * Returns false if that can't be answered from memory.
+	 */
+	bool page(const int channel, const qint64 min, const qint64 max, const qint64 beforeId, const int amount, QVector<Line> *lines) const;
+
+private:
+	struct Entry
+	{
+		qint64 id;
+		qint64 timestamp;
+		quint32 offset; ///< Into the arena of the channel
+		quint32 length;
+		quint32 source;
+		quint32 type;
+	};
+	struct Channel
+	{
+		QVector<Entry> entries; ///< Circular once full, oldest at start
+		int start = 0;
+		QByteArray arena; ///< Contents in the same order as the entries, evicted ones get compacted away
+		qint64 floor; ///< The newest timestamp of everything that isn't in the ring
+	};
+
+	const int m_capacity;
+	QHash<int, Channel> m_channels;
+	QStringList m_strings;
+	QHash<QString, quint32> m_stringIds;
+
+	quint32 intern(const QString &string);
+};
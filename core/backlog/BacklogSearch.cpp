@@ -0,0 +1,321 @@
+#include "BacklogSearch.h"
+
+#include <QSqlDatabase>
+#include <QSqlQuery>
+#include <QSqlError>
+#include <QVariant>
+#include <QRegularExpression>
+#include <algorithm>
+
+#include "BacklogClientConnection.h"
+#include "BacklogPartitions.h"
+#include "SqlHelpers.h"
+
+// 2 values per row, well below SQLite's limit of 999 bound values per statement
+static constexpr const int TERMS_PER_INSERT = 400;
+static constexpr const int MAX_TERM_LENGTH = 64;
+
+static bool searchTable(const QSqlDatabase &db, const BacklogSearch::Engine engine, const QString &table, const QStringList &words,
+						const int channel, const qint64 min, const qint64 max, const int limit, QVector<BacklogSearch::Result> *results);
+
+static void createTerms(const QSqlDatabase &db);
+
+static bool tryExec(const QSqlDatabase &db, const QString &sql)
+{
+	QSqlQuery q(db);
+	if (!q.exec(sql))
+	{
+		qCDebug(Backlog) << "Full-text search setup failed:" << q.lastError().text();
+		return false;
+	}
+	return true;
+}
+
+QString BacklogSearch::engineName(const Engine engine)
+{
+	switch (engine)
+	{
+	case None:
+		return "none";
+	case Fts5:
+		return "fts5";
+	case MySqlFullText:
+		return "mysql";
+	case PostgresFullText:
+		return "postgres";
+	case Terms:
+		return "terms";
+	}
+	return "none";
+}
+BacklogSearch::Engine BacklogSearch::engineFromName(const QString &name)
+{
+	for (const Engine engine : {Fts5, MySqlFullText, PostgresFullText, Terms})
+	{
+		if (engineName(engine) == name)
+		{
+			return engine;
+		}
+	}
+	return None;
+}
+
+BacklogSearch::Engine BacklogSearch::create(const QSqlDatabase &db)
+{
+	const QString dialect = Sql::dialect(db);
+	const Engine native = dialect.contains("SQLITE") ? Fts5 : dialect.contains("MYSQL") ? MySqlFullText : dialect.contains("PSQL") ? PostgresFullText : Terms;
+	if (native != Terms && addTable(db, native, "chat_messages"))
+	{
+		return native;
+	}
+
+	qCDebug(Backlog) << "Using the embedded full-text index";
+	createTerms(db);
+	return Terms;
+}
+static void createTerms(const QSqlDatabase &db)
+{
+	Sql::CREATE_TABLE("chat_search_terms")
+			.COLUMN("term", Sql::VARCHAR(MAX_TERM_LENGTH)).NOT_NULL()
+			.COLUMN("message", Sql::BIGINT).NOT_NULL()
+			.exec(db);
+	Sql::CREATE_INDEX("chat_search_terms_term").ON("chat_search_terms", "term", "message").exec(db);
+}
+
+bool BacklogSearch::addTable(const QSqlDatabase &db, const Engine engine, const QString &table)
+{
+	switch (engine)
+	{
+	case Fts5:
+		// an external content table, so the contents aren't stored twice. Triggers keep it in sync with the messages
+		if (!tryExec(db, QString("CREATE VIRTUAL TABLE %1_fts USING fts5(content, content='%1', content_rowid='id')").arg(table)))
+		{
+			return false;
+		}
+		tryExec(db, QString("CREATE TRIGGER %1_fts_insert AFTER INSERT ON %1 BEGIN "
+							"INSERT INTO %1_fts(rowid, content) VALUES (new.id, new.content); END").arg(table));
+		tryExec(db, QString("CREATE TRIGGER %1_fts_delete AFTER DELETE ON %1 BEGIN "
+							"INSERT INTO %1_fts(%1_fts, rowid, content) VALUES ('delete', old.id, old.content); END").arg(table));
+		return tryExec(db, QString("INSERT INTO %1_fts(%1_fts) VALUES ('rebuild')").arg(table));
+	case MySqlFullText:
+		return tryExec(db, QString("CREATE FULLTEXT INDEX %1_content ON %1 (content)").arg(table));
+	case PostgresFullText:
+		return tryExec(db, QString("CREATE INDEX %1_content ON %1 USING GIN (to_tsvector('simple', content))").arg(table));
+	case Terms:
+	case None:
+		return true;
+	}
+	return true;
+}
+void BacklogSearch::dropTable(const QSqlDatabase &db, const Engine engine, const QString &table)
+{
+	if (engine == Fts5)
+	{
+		tryExec(db, QString("DROP TABLE %1_fts").arg(table));
+	}
+	else if (engine == Terms)
+	{
+		tryExec(db, QString("DELETE FROM chat_search_terms WHERE message IN (SELECT id FROM %1)").arg(table));
+	}
+}
+
+bool BacklogSearch::switchToTerms(const QSqlDatabase &db, const Engine engine, const QStringList &tables)
+{
+	for (const QString &table : tables)
+	{
+		switch (engine)
+		{
+		case Fts5:
+			// the triggers would keep writing to the index otherwise
+			if (!tryExec(db, QString("DROP TRIGGER %1_fts_insert").arg(table)) || !tryExec(db, QString("DROP TRIGGER %1_fts_delete").arg(table))
+					|| !tryExec(db, QString("DROP TABLE %1_fts").arg(table)))
+			{
+				return false;
+			}
+			break;
+		case MySqlFullText:
+			if (!tryExec(db, QString("DROP INDEX %1_content ON %1").arg(table)))
+			{
+				return false;
+			}
+			break;
+		case PostgresFullText:
+			if (!tryExec(db, QString("DROP INDEX %1_content").arg(table)))
+			{
+				return false;
+			}
+			break;
+		case Terms:
+			return true;
+		case None:
+			break;
+		}
+	}
+	createTerms(db);
+	return true;
+}
+
+QStringList BacklogSearch::terms(const QString &text)
+{
+	static const QRegularExpression separators("[^\\w]+", QRegularExpression::UseUnicodePropertiesOption);
+	QStringList out;
+	for (const QString &word : text.toLower().split(separators, QString::SkipEmptyParts))
+	{
+		const QString term = word.left(MAX_TERM_LENGTH);
+		if (term.size() > 1 && !out.contains(term))
+		{
+			out.append(term);
+		}
+	}
+	return out;
+}
+
+bool BacklogSearch::index(const QSqlDatabase &db, const QList<QPair<qint64, QString>> &messages)
+{
+	QList<QVariantList> rows;
+	for (const auto &message : messages)
+	{
+		for (const QString &term : terms(message.second))
+		{
+			rows.append({term, message.first});
+		}
+	}
+	for (int start = 0; start < rows.size(); start += TERMS_PER_INSERT)
+	{
+		auto insert = Sql::INSERT().INTO("chat_search_terms").COLUMNS("term", "message");
+		for (const QVariantList &row : rows.mid(start, TERMS_PER_INSERT))
+		{
+			insert = insert.VALUES(row);
+		}
+		if (insert.exec(db).lastError().isValid())
+		{
+			return false;
+		}
+	}
+	return true;
+}
+
+bool BacklogSearch::search(const QSqlDatabase &db, const Engine engine, const QStringList &tables, const QString &query, const int channel,
+						   const qint64 min, const qint64 max, const int offset, const int amount, QVector<Result> *results)
+{
+	const QStringList words = terms(query);
+	if (words.isEmpty() || engine == None)
+	{
+		return true;
+	}
+
+	// every table could have all of the best results, so each is asked for as many as we need and the results merged
+	QVector<Result> all;
+	for (const QString &table : tables)
+	{
+		if (!searchTable(db, engine, table, words, channel, min, max, offset + amount, &all))
+		{
+			return false;
+		}
+	}
+	std::sort(all.begin(), all.end(), [](const Result &a, const Result &b)
+	{
+		if (a.score != b.score)
+		{
+			return a.score > b.score;
+		}
+		return a.timestamp != b.timestamp ? a.timestamp > b.timestamp : a.id > b.id;
+	});
+	for (int i = offset; i < qMin(all.size(), offset + amount); ++i)
+	{
+		results->append(all.at(i));
+	}
+	return true;
+}
+
+static bool searchTable(const QSqlDatabase &db, const BacklogSearch::Engine engine, const QString &table, const QStringList &words,
+						const int channel, const qint64 min, const qint64 max, const int limit, QVector<BacklogSearch::Result> *results)
+{
+	using namespace BacklogSearch;
+
+	QString filter;
+	if (channel >= 0)
+	{
+		filter += " AND m.channel = :channel";
+	}
+	if (min > 0)
+	{
+		filter += " AND m.timestamp >= :min";
+	}
+	if (max > 0)
+	{
+		filter += " AND m.timestamp < :max";
+	}
+	// tables that haven't been normalized yet have the names right there
+	const BacklogPartitions::Shape shape = BacklogPartitions::shape(db, table);
+	const QString columns = shape.names ? "m.id, m.channel, m.source, m.type, m.content, m.timestamp, m.dictionary, m.compressed"
+										: "m.id, m.channel, s.name, ty.name, m.content, m.timestamp, m.dictionary, m.compressed";
+	const QString names = shape.names ? QString() : QStringLiteral(" JOIN chat_sources s ON s.id = m.source JOIN chat_types ty ON ty.id = m.type");
+	const QString order = " ORDER BY score DESC, m.timestamp DESC, m.id DESC LIMIT " + QString::number(limit);
+
+	// all of them require every word to be present
+	QString sql;
+	QVariantMap values;
+	switch (engine)
+	{
+	case Fts5:
+		// quoted, so that nothing the user enters gets interpreted as FTS5 query syntax. bm25 is smaller for better matches
+		values.insert(":query", '"' + words.join("\" \"") + '"');
+		sql = "SELECT " + columns + ", -bm25(" + table + "_fts) AS score FROM " + table + "_fts f JOIN " + table + " m ON m.id = f.rowid" + names + " "
+			  "WHERE " + table + "_fts MATCH :query" + filter + order;
+		break;
+	case MySqlFullText:
+		values.insert(":query1", '+' + words.join(" +"));
+		values.insert(":query2", '+' + words.join(" +"));
+		sql = "SELECT " + columns + ", MATCH(m.content) AGAINST(:query1 IN BOOLEAN MODE) AS score FROM " + table + " m" + names + " "
+			  "WHERE MATCH(m.content) AGAINST(:query2 IN BOOLEAN MODE)" + filter + order;
+		break;
+	case PostgresFullText:
+		values.insert(":query1", words.join(' '));
+		values.insert(":query2", words.join(' '));
+		sql = "SELECT " + columns + ", ts_rank(to_tsvector('simple', m.content), plainto_tsquery('simple', :query1)) AS score FROM " + table + " m" + names + " "
+			  "WHERE to_tsvector('simple', m.content) @@ plainto_tsquery('simple', :query2)" + filter + order;
+		break;
+	case Terms:
+	{
+		// every word of a message is indexed only once, so a message matching all of them has one row per word. Without
+		// anything better to rank by, newer is better
+		QStringList placeholders;
+		for (int i = 0; i < words.size(); ++i)
+		{
+			placeholders.append(":term" + QString::number(i));
+			values.insert(placeholders.last(), words.at(i));
+		}
+		sql = "SELECT " + columns + ", 1 AS score FROM chat_search_terms t JOIN " + table + " m ON m.id = t.message" + names + " "
+			  "WHERE t.term IN (" + placeholders.join(',') + ")" + filter + " GROUP BY " + columns +
+			  " HAVING COUNT(*) = " + QString::number(words.size()) + order;
+		break;
+	}
+	case None:
+		return true;
+	}
+	values.insert(":channel", channel);
+	values.insert(":min", shape.timestamp(min));
+	values.insert(":max", shape.timestamp(max));
+
+	QSqlQuery q(db);
+	q.prepare(sql);
+	for (auto it = values.constBegin(); it != values.constEnd(); ++it)
+	{
+		if (sql.contains(it.key()))
+		{
+			q.bindValue(it.key(), it.value());
+		}
+	}
+	if (!q.exec())
+	{
+		qCWarning(Backlog) << "Unable to search for" << words << "in" << table << ":" << q.lastError().text();
+		return false;
+	}
+	while (q.next())
+	{
+		results->append({q.value(0).toLongLong(), q.value(1).toInt(), q.value(2).toString(), q.value(3).toString(),
+						 q.value(4).toString(), shape.timestamp(q.value(5)), q.value(8).toDouble(), q.value(6).toInt(), q.value(7).toByteArray()});
+	}
+	return true;
+}
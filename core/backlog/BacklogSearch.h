@@ -0,0 +1,66 @@
+#pragma once
+
+#include <QString>
+#include <QStringList>
+#include <QVector>
+#include <QPair>
+
+class QSqlDatabase;
+
+/**
+ * Full-text search over chat_messages, using whatever the database has to offer.
+ *
+ * SQLite gets an FTS5 table, MySQL a FULLTEXT index and PostgreSQL a GIN index. Where none of that is available
+ * (including SQLite builds without FTS5) messages are indexed into chat_search_terms, an inverted index that the
+ * writer keeps up to date.
+ */
+namespace BacklogSearch
+{
+enum Engine
+{
+	None,
+	Fts5,
+	MySqlFullText,
+	PostgresFullText,
+	Terms
+};
+QString engineName(const Engine engine);
+Engine engineFromName(const QString &name);
+
+/// Sets up the best engine the database supports for chat_messages. Native ones index what's there already, for Terms see BacklogMigration::scheduleIndexing
+Engine create(const QSqlDatabase &db);
+/// Sets up search for another table of messages, see BacklogPartitions
+bool addTable(const QSqlDatabase &db, const Engine engine, const QString &table);
+/// Removes what addTable has set up, and what has been indexed for table. Has to be called before dropping it
+void dropTable(const QSqlDatabase &db, const Engine engine, const QString &table);
+/**
+ * Replaces engine with Terms for tables. Terms doesn't rely on the content column, so unlike the native engines it
+ * keeps working once messages get compressed (see BacklogCompression). What is in tables has to be indexed using
+ * BacklogMigration::scheduleIndexing. Returns false on errors
+ */
+bool switchToTerms(const QSqlDatabase &db, const Engine engine, const QStringList &tables);
+
+/// Lower cased words of text, each only once, for indexing and searching with the Terms engine
+QStringList terms(const QString &text);
+/// For the Terms engine, adds (id, content) pairs to the index. Returns false if that failed
+bool index(const QSqlDatabase &db, const QList<QPair<qint64, QString>> &messages);
+
+struct Result
+{
+	qint64 id;
+	int channel;
+	QString source;
+	QString type;
+	QString content;
+	qint64 timestamp;
+	double score; ///< Larger is better
+	int dictionary; ///< If content is compressed, see BacklogCompression
+	QByteArray compressed;
+};
+/**
+ * Messages in tables that match all words of query, best first. channel -1 searches all channels, min and max
+ * (exclusive) limit the time range if they are > 0. Returns false if the query failed.
+ */
+bool search(const QSqlDatabase &db, const Engine engine, const QStringList &tables, const QString &query, const int channel,
+			const qint64 min, const qint64 max, const int offset, const int amount, QVector<Result> *results);
+}
@@ -0,0 +1,421 @@
+#include "BacklogTransfer.h"
+
+#include <QCoreApplication>
+#include <QSqlDatabase>
+#include <QFile>
+#include <QThread>
+#include <QElapsedTimer>
+#include <QJsonDocument>
+#include <QJsonObject>
+#include <QRegularExpression>
+#include <QDateTime>
+#include <QLocale>
+#include <QHash>
+#include <QPair>
+
+#ifdef TALKTALK_CORE_BACKLOG_ZLIB
+# include <zlib.h>
+#endif
+
+#include "BacklogClientConnection.h"
+#include "BacklogWriter.h"
+#include "BacklogPartitions.h"
+#include "BacklogNames.h"
+#include "BacklogCompression.h"
+#include "SqlHelpers.h"
+
+static constexpr const int EXPORT_BATCH = 1000;
+static constexpr const int READ_BUFFER_SIZE = 64 * 1024;
+static constexpr const int PROGRESS_INTERVAL = 100000;
+
+namespace
+{
+/// A file of lines, optionally gzip compressed
+class LineFile
+{
+public:
+	~LineFile()
+	{
+		close();
+	}
+
+	bool open(const QString &name, const bool write)
+	{
+#ifdef TALKTALK_CORE_BACKLOG_ZLIB
+		// reading works for uncompressed files too, "T" writes them uncompressed
+		const char *mode = !write ? "rb" : name.endsWith(".gz") ? "wb6" : "wbT";
+		m_file = gzopen(QFile::encodeName(name).constData(), mode);
+		if (!m_file)
+		{
+			return false;
+		}
+		gzbuffer(m_file, READ_BUFFER_SIZE);
+		m_buffer.resize(READ_BUFFER_SIZE);
+		return true;
+#else
+		if (name.endsWith(".gz"))
+		{
+			qCWarning(Backlog) << "This build can't read or write compressed files";
+			return false;
+		}
+		m_file.setFileName(name);
+		return m_file.open(write ? QFile::WriteOnly : QFile::ReadOnly);
+#endif
+	}
+	/// The next line, without line ending. Returns false at the end of the file
+	bool readLine(QByteArray *line)
+	{
+#ifdef TALKTALK_CORE_BACKLOG_ZLIB
+		line->clear();
+		// lines longer than the buffer come in several pieces
+		while (gzgets(m_file, m_buffer.data(), m_buffer.size()))
+		{
+			line->append(m_buffer.constData());
+			if (line->endsWith('\n'))
+			{
+				break;
+			}
+		}
+		if (line->isEmpty())
+		{
+			return false;
+		}
+#else
+		if (m_file.atEnd())
+		{
+			return false;
+		}
+		*line = m_file.readLine();
+#endif
+		while (line->endsWith('\n') || line->endsWith('\r'))
+		{
+			line->chop(1);
+		}
+		return true;
+	}
+	bool write(const QByteArray &data)
+	{
+#ifdef TALKTALK_CORE_BACKLOG_ZLIB
+		return gzwrite(m_file, data.constData(), unsigned(data.size())) == data.size();
+#else
+		return m_file.write(data) == data.size();
+#endif
+	}
+	bool close()
+	{
+#ifdef TALKTALK_CORE_BACKLOG_ZLIB
+		if (!m_file)
+		{
+			return true;
+		}
+		const bool ok = gzclose(m_file) == Z_OK;
+		m_file = nullptr;
+		return ok;
+#else
+		const bool ok = !m_file.isOpen() || m_file.flush();
+		m_file.close();
+		return ok;
+#endif
+	}
+
+private:
+#ifdef TALKTALK_CORE_BACKLOG_ZLIB
+	gzFile m_file = nullptr;
+	QByteArray m_buffer;
+#else
+	QFile m_file;
+#endif
+};
+
+struct Message
+{
+	QString channel;
+	QString channelName;
+	QString source;
+	QString type;
+	QString content;
+	qint64 timestamp;
+};
+}
+
+static QString searchEngine(const QSqlDatabase &db)
+{
+	return Sql::SELECT("value").FROM("settings").WHERE("category", "=", "backlog").AND("key", "=", "search_engine").execAndNext(db).value(0).toString();
+}
+
+static double rate(const quint64 rows, const QElapsedTimer &timer)
+{
+	return rows * 1000.0 / qMax(qint64(1), timer.elapsed());
+}
+
+bool BacklogTransfer::exportTo(const QString &file)
+{
+	const QSqlDatabase db = QSqlDatabase::database(QStringLiteral("backlog"), false);
+	LineFile out;
+	if (!out.open(file, true))
+	{
+		qCWarning(Backlog) << "Unable to open" << file << "for writing";
+		return false;
+	}
+
+	QHash<int, QPair<QString, QString>> channels; ///< Id -> (uuid, name)
+	QSqlQuery channelQuery = Sql::SELECT("id", "uuid", "name").FROM("chat_channels").exec(db);
+	while (channelQuery.next())
+	{
+		channels.insert(channelQuery.value(0).toInt(), qMakePair(channelQuery.value(1).toString(), channelQuery.value(2).toString()));
+	}
+	BacklogNames names;
+	names.load(db);
+	BacklogCompression::DictionaryCache dictionaries;
+
+	QElapsedTimer timer;
+	timer.start();
+	quint64 rows = 0;
+	for (const QString &table : BacklogPartitions::allTables(db))
+	{
+		// by id rather than through a single query, since some drivers fetch all of the result at once
+		const BacklogPartitions::Shape shape = BacklogPartitions::shape(db, table);
+		qint64 lastId = 0;
+		int fetched = EXPORT_BATCH;
+		while (fetched == EXPORT_BATCH)
+		{
+			fetched = 0;
+			QSqlQuery q = Sql::SELECT("id", "channel", "source", "type", "content", "timestamp", "dictionary", "compressed").FROM(table)
+					.WHERE("id", ">", lastId).ORDER_BY("id").LIMIT(EXPORT_BATCH).exec(db);
+			while (q.next())
+			{
+				++fetched;
+				lastId = q.value(0).toLongLong();
+				const int channel = q.value(1).toInt();
+				const QJsonObject message{
+					{"id", double(lastId)},
+					{"channel", channels.value(channel).first},
+					{"channelName", channels.value(channel).second},
+					{"from", shape.names ? q.value(2).toString() : names.sourceName(q.value(2).toInt())},
+					{"type", shape.names ? q.value(3).toString() : names.typeName(q.value(3).toInt())},
+					{"content", dictionaries.content(db, channel, q.value(4).toString(), q.value(6).toInt(), q.value(7).toByteArray())},
+					{"timestamp", QString::number(shape.timestamp(q.value(5)))}
+				};
+				if (!out.write(QJsonDocument(message).toJson(QJsonDocument::Compact) + '\n'))
+				{
+					qCWarning(Backlog) << "Unable to write to" << file;
+					return false;
+				}
+				if (++rows % PROGRESS_INTERVAL == 0)
+				{
+					qCDebug(Backlog) << "Exported" << rows << "messages," << rate(rows, timer) << "rows/s";
+				}
+			}
+			// there is no event loop yet, which the statement cache needs for finishing the queries it has handed out
+			Sql::finishStatements();
+		}
+	}
+	if (!out.close())
+	{
+		qCWarning(Backlog) << "Unable to write to" << file;
+		return false;
+	}
+	qCDebug(Backlog) << "Exported" << rows << "messages to" << file << "in" << timer.elapsed() << "ms," << rate(rows, timer) << "rows/s";
+	return true;
+}
+
+static bool parseTalkTalk(const QByteArray &line, Message *message)
+{
+	const QJsonObject obj = QJsonDocument::fromJson(line).object();
+	if (!obj.value("content").isString() || !obj.value("timestamp").isString())
+	{
+		return false;
+	}
+	*message = {obj.value("channel").toString(), obj.value("channelName").toString(), obj.value("from").toString(), obj.value("type").toString("normal"),
+				obj.value("content").toString(), obj.value("timestamp").toString().toLongLong()};
+	return true;
+}
+
+/// Strips the mode that IRC clients show in front of nicks
+static QString nick(const QString &prefixed)
+{
+	static const QRegularExpression modes("^[ @+%~&]+");
+	return QString(prefixed).remove(modes);
+}
+
+/// The default format of irssi, where lines only have the time and the date is in separate lines
+static bool parseIrssi(const QByteArray &data, QDate *day, Message *message)
+{
+	static const QRegularExpression line("^(\\d\\d):(\\d\\d)(?::(\\d\\d))? (.*)$");
+	static const QRegularExpression normal("^<([^>]+)> ?(.*)$");
+	static const QRegularExpression notice("^-([^\\s(]+)(?:\\([^)]*\\))?- ?(.*)$");
+	const QString text = QString::fromUtf8(data);
+	if (text.startsWith("--- Log opened "))
+	{
+		*day = QLocale::c().toDateTime(text.mid(15), "ddd MMM dd HH:mm:ss yyyy").date();
+		return false;
+	}
+	else if (text.startsWith("--- Day changed "))
+	{
+		*day = QLocale::c().toDate(text.mid(16), "ddd MMM dd yyyy");
+		return false;
+	}
+	const QRegularExpressionMatch match = line.match(text);
+	if (!match.hasMatch() || !day->isValid())
+	{
+		return false;
+	}
+	const QString rest = match.captured(4);
+	const qint64 timestamp = QDateTime(*day, QTime(match.captured(1).toInt(), match.captured(2).toInt(), match.captured(3).toInt())).toMSecsSinceEpoch();
+	QRegularExpressionMatch part;
+	if ((part = normal.match(rest)).hasMatch())
+	{
+		*message = {QString(), QString(), nick(part.captured(1)), "normal", part.captured(2), timestamp};
+	}
+	else if (rest.startsWith(" * "))
+	{
+		const QString action = rest.mid(3);
+		*message = {QString(), QString(), action.section(' ', 0, 0), "action", action.section(' ', 1), timestamp};
+	}
+	else if (rest.startsWith("-!- "))
+	{
+		*message = {QString(), QString(), QString(), "special", rest.mid(4), timestamp};
+	}
+	else if ((part = notice.match(rest)).hasMatch())
+	{
+		*message = {QString(), QString(), part.captured(1), "notice", part.captured(2), timestamp};
+	}
+	else
+	{
+		return false;
+	}
+	return true;
+}
+
+/// The default format of WeeChat, "date time<tab>prefix<tab>message"
+static bool parseWeechat(const QByteArray &data, Message *message)
+{
+	const QStringList parts = QString::fromUtf8(data).split('\t');
+	if (parts.size() < 3)
+	{
+		return false;
+	}
+	const QDateTime time = QDateTime::fromString(parts.at(0), "yyyy-MM-dd HH:mm:ss");
+	if (!time.isValid())
+	{
+		return false;
+	}
+	const QString prefix = parts.at(1).trimmed();
+	// tabs within the message are kept
+	const QString content = QStringList(parts.mid(2)).join('\t');
+	if (prefix == "*")
+	{
+		*message = {QString(), QString(), content.section(' ', 0, 0), "action", content.section(' ', 1), time.toMSecsSinceEpoch()};
+	}
+	else if (prefix == "-->" || prefix == "<--" || prefix == "--" || prefix == "=!=")
+	{
+		*message = {QString(), QString(), QString(), "special", content, time.toMSecsSinceEpoch()};
+	}
+	else
+	{
+		*message = {QString(), QString(), nick(prefix), "normal", content, time.toMSecsSinceEpoch()};
+	}
+	return true;
+}
+
+bool BacklogTransfer::importFrom(const QString &file, const QString &format, const QString &channel, QSqlDriver *writerDriver,
+								 const Sql::ConnectionSettings &settings, const int batchSize, const int batchBytes, const int batchLatency)
+{
+	const QSqlDatabase db = QSqlDatabase::database(QStringLiteral("backlog"), false);
+	LineFile in;
+	if (!in.open(file, false))
+	{
+		qCWarning(Backlog) << "Unable to open" << file << "for reading";
+		delete writerDriver;
+		return false;
+	}
+
+	const BacklogSearch::Engine engine = BacklogSearch::engineFromName(searchEngine(db));
+	QHash<QString, int> channels;
+	QSqlQuery channelQuery = Sql::SELECT("id", "uuid").FROM("chat_channels").exec(db);
+	while (channelQuery.next())
+	{
+		channels.insert(channelQuery.value(1).toString(), channelQuery.value(0).toInt());
+	}
+	// the backlog might not be empty, so everything gets a new id after what is there already
+	qint64 lastId = 0;
+	for (const QString &table : BacklogPartitions::allTables(db))
+	{
+		lastId = qMax(lastId, Sql::SELECT("MAX(id)").FROM(table).execAndNext(db).value(0).toLongLong());
+	}
+
+	QThread writerThread;
+	writerThread.setObjectName("BacklogWriter");
+	BacklogWriter *writer = new BacklogWriter(writerDriver, settings, batchSize, batchBytes, batchLatency);
+	writer->moveToThread(&writerThread);
+	writerDriver->moveToThread(&writerThread);
+	QObject::connect(&writerThread, &QThread::finished, writer, &BacklogWriter::deleteLater);
+	writerThread.start();
+	QMetaObject::invokeMethod(writer, "open", Qt::BlockingQueuedConnection, Q_ARG(int, engine));
+
+	QElapsedTimer timer;
+	timer.start();
+	quint64 rows = 0;
+	quint64 skipped = 0;
+	QByteArray line;
+	QDate day;
+	Message message;
+	while (in.readLine(&line))
+	{
+		const bool ok = format == "irssi" ? parseIrssi(line, &day, &message)
+										  : format == "weechat" ? parseWeechat(line, &message) : parseTalkTalk(line, &message);
+		if (!channel.isEmpty())
+		{
+			message.channel = channel;
+		}
+		if (!ok || message.channel.isEmpty())
+		{
+			if (!line.trimmed().isEmpty() && !line.startsWith("---"))
+			{
+				++skipped;
+			}
+			continue;
+		}
+
+		auto channelId = channels.constFind(message.channel);
+		if (channelId == channels.constEnd())
+		{
+			Sql::INSERT().INTO("chat_channels").COLUMNS("uuid", "name").VALUES(message.channel, message.channelName).exec(db);
+			channelId = channels.insert(message.channel, Sql::SELECT("id").FROM("chat_channels").WHERE("uuid", "=", message.channel).execAndNext(db).value(0).toInt());
+		}
+		const int size = message.content.size() * int(sizeof(QChar)) + 3 * int(sizeof(int)) + 2 * int(sizeof(qint64));
+		writer->enqueue({++lastId, channelId.value(), message.source, message.type, message.content, message.timestamp}, size);
+
+		if (++rows % PROGRESS_INTERVAL == 0)
+		{
+			qCDebug(Backlog) << "Read" << rows << "messages," << rate(rows, timer) << "rows/s";
+		}
+		if (rows % batchSize == 0)
+		{
+			QCoreApplication::processEvents();
+			// files are read a lot faster than they can be written, so a few batches ahead is as far as we go
+			while (writer->stats().value("queueDepth").toInt() >= 4 * batchSize)
+			{
+				QThread::msleep(1);
+			}
+		}
+	}
+
+	QMetaObject::invokeMethod(writer, "flush", Qt::BlockingQueuedConnection);
+	const QJsonObject stats = writer->stats();
+	writerThread.quit();
+	writerThread.wait();
+
+	const quint64 written = quint64(stats.value("written").toDouble());
+	const quint64 failed = quint64(stats.value("failed").toDouble());
+	qCDebug(Backlog) << "Imported" << written << "messages from" << file << "in" << timer.elapsed() << "ms," << rate(written, timer) << "rows/s";
+	if (skipped > 0)
+	{
+		qCWarning(Backlog) << "Skipped" << skipped << "lines that aren't messages in the" << format << "format";
+	}
+	if (failed > 0)
+	{
+		qCWarning(Backlog) << "Unable to write" << failed << "messages";
+	}
+	return failed == 0;
+}
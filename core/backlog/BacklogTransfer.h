@@ -0,0 +1,35 @@
+#pragma once
+
+#include <QString>
+
+#include "SqlHelpers.h"
+
+class QSqlDriver;
+
+/**
+ * Moving messages into and out of the database, for switching servers or drivers and for bringing in history from
+ * IRC clients.
+ *
+ * Messages are exported as JSON objects, one per line (the "talktalk" format), which is gzip compressed if the file
+ * name ends in .gz. Both directions stream, a batch of rows at a time, so that memory use doesn't depend on how large
+ * the backlog is. Imports go through a BacklogWriter, and so are written in batched transactions just like live
+ * messages. Both work on the "backlog" connection, which has to be open and up to date (see
+ * BacklogClientConnection::prepareDatabase).
+ */
+namespace BacklogTransfer
+{
+/// Writes every message to file. Returns false if that wasn't possible
+bool exportTo(const QString &file);
+
+/**
+ * Adds the messages in file, in format ("talktalk", "irssi" or "weechat"), with new ids. Logs of IRC clients don't
+ * say which channel they are of, so they go into channel, which is also used instead of what "talktalk" files say if
+ * it isn't empty. Takes ownership of writerDriver, which gets connected with settings. batchSize, batchBytes and
+ * batchLatency are for the BacklogWriter. Returns false if the file couldn't be read or some messages couldn't be written.
+ *
+ * New ids continue from the largest one in the database, which a core running on the same database at the same time
+ * would be handing out as well, so the core has to be stopped during an import
+ */
+bool importFrom(const QString &file, const QString &format, const QString &channel, QSqlDriver *writerDriver,
+				const Sql::ConnectionSettings &settings, const int batchSize, const int batchBytes, const int batchLatency);
+}
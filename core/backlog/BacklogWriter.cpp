@@ -0,0 +1,466 @@
+#include "BacklogWriter.h"
+
+#include <QCoreApplication>
+#include <QDateTime>
+#include <QSqlDatabase>
+#include <QSqlError>
+#include <QTimer>
+
+#include "BacklogClientConnection.h"
+#include "BacklogSearch.h"
+#include "BacklogMigration.h"
+#include "BacklogPartitions.h"
+#include "SqlHelpers.h"
+
+// SQLite only allows 999 bound values per statement by default, so larger batches get split into several inserts of
+// 8 values per row
+static constexpr const int ROWS_PER_INSERT = 120;
+static constexpr const int MIN_RETRY_DELAY = 100;
+static constexpr const int MAX_RETRY_DELAY = 30 * 1000;
+static constexpr const int DICTIONARY_SIZE = 16 * 1024;
+static constexpr const int TRAINING_SAMPLES = 2000;
+static constexpr const int MIN_TRAINING_SAMPLES = 200;
+static constexpr const qint64 RETRAINING_INTERVAL = qint64(30) * 24 * 60 * 60 * 1000;
+
+BacklogWriter::BacklogWriter(QSqlDriver *driver, const Sql::ConnectionSettings &settings, const int batchSize, const int batchBytes, const int batchLatency)
+	: QObject(nullptr), m_driver(driver), m_settings(settings), m_batchSize(qMax(1, batchSize)), m_batchBytes(batchBytes),
+	  m_timer(new QTimer(this)), m_retryTimer(new QTimer(this))
+{
+	m_clock.start();
+
+	m_timer->setSingleShot(true);
+	m_timer->setInterval(batchLatency);
+	connect(m_timer, &QTimer::timeout, this, &BacklogWriter::flush);
+	m_retryTimer->setSingleShot(true);
+	connect(m_retryTimer, &QTimer::timeout, this, &BacklogWriter::flush);
+	// we live on a different thread than the application, so block it until everything has been written
+	connect(qApp, &QCoreApplication::aboutToQuit, this, &BacklogWriter::flush, Qt::BlockingQueuedConnection);
+}
+BacklogWriter::~BacklogWriter()
+{
+	// one last try
+	m_retryTimer->stop();
+	flush();
+}
+
+void BacklogWriter::enqueue(QVariantList &&row, const int size)
+{
+	m_queue.push({std::move(row), size, m_clock.elapsed()});
+	const int depth = m_depth.fetchAndAddOrdered(1) + 1;
+	const int bytes = m_bytes.fetchAndAddOrdered(size) + size;
+
+	if (depth % m_batchSize == 0 || (bytes >= m_batchBytes && bytes - size < m_batchBytes))
+	{
+		QMetaObject::invokeMethod(this, "flush", Qt::QueuedConnection);
+	}
+	else if (depth == 1)
+	{
+		QMetaObject::invokeMethod(this, "arm", Qt::QueuedConnection);
+	}
+}
+
+QJsonObject BacklogWriter::stats() const
+{
+	return {
+		{"queueDepth", m_depth.load()},
+		{"queueBytes", m_bytes.load()},
+		{"lag", double(m_lastLag.load())},
+		{"maxLag", double(m_maxLag.load())},
+		{"written", double(m_written.load())},
+		{"failed", double(m_failed.load())},
+		{"batches", double(m_batches.load())},
+		{"retries", double(m_retries.load())}
+	};
+}
+
+void BacklogWriter::open(const int engine)
+{
+	m_indexTerms = engine == BacklogSearch::Terms;
+	QSqlDatabase db = m_settings.addDatabase(m_driver, "backlog-writer");
+	if (!db.open())
+	{
+		qCWarning(Backlog) << "Unable to connect the writer to the database:" << db.lastError().text();
+		return;
+	}
+	m_partitions.load(db, BacklogSearch::Engine(engine));
+	m_names.load(db);
+	m_open = true;
+	flush();
+}
+
+void BacklogWriter::flush()
+{
+	m_timer->stop();
+	if (!m_open || m_retryTimer->isActive())
+	{
+		// the queue keeps growing until the database is available again
+		return;
+	}
+	if (!m_retry.isEmpty())
+	{
+		const QList<Row> retry = m_retry;
+		m_retry.clear();
+		if (!write(retry))
+		{
+			retryLater();
+			return;
+		}
+		qCDebug(Backlog) << "The database is available again, writing" << m_depth.load() << "queued messages";
+		m_retryDelay = 0;
+	}
+
+	// only what is queued right now, so that a steady stream of messages can't keep us here forever
+	int remaining = m_depth.load();
+	QList<Row> batch;
+	int batchBytes = 0;
+	Row row;
+	while (remaining > 0 && m_queue.pop(&row))
+	{
+		--remaining;
+		m_depth.fetchAndSubOrdered(1);
+		m_bytes.fetchAndSubOrdered(row.size);
+		batchBytes += row.size;
+		batch.append(std::move(row));
+		if (batch.size() >= m_batchSize || batchBytes >= m_batchBytes)
+		{
+			if (!write(batch))
+			{
+				retryLater();
+				return;
+			}
+			batch.clear();
+			batchBytes = 0;
+		}
+	}
+	if (!batch.isEmpty() && !write(batch))
+	{
+		retryLater();
+		return;
+	}
+
+	// rows that were pushed while we were busy, or that weren't completely pushed yet
+	if (m_depth.load() > 0)
+	{
+		m_timer->start();
+	}
+}
+
+void BacklogWriter::arm()
+{
+	if (!m_timer->isActive())
+	{
+		m_timer->start();
+	}
+}
+
+bool BacklogWriter::write(const QList<Row> &batch)
+{
+	QSqlDatabase db = QSqlDatabase::database(QStringLiteral("backlog-writer"), false);
+	const QSqlError error = writeRows(batch);
+	if (!error.isValid())
+	{
+		const qint64 lag = m_clock.elapsed() - batch.first().enqueued;
+		m_lastLag.store(lag);
+		if (lag > m_maxLag.load())
+		{
+			m_maxLag.store(lag);
+		}
+		m_written.fetchAndAddRelaxed(batch.size());
+		m_batches.fetchAndAddRelaxed(1);
+		return true;
+	}
+	else if (isTransient(db, error))
+	{
+		if (m_retryDelay == 0)
+		{
+			qCWarning(Backlog) << "The database is unavailable, keeping" << batch.size() << "messages to write later:" << error.text();
+		}
+		m_retry.append(batch);
+		return false;
+	}
+	else if (batch.size() > 1)
+	{
+		// some row is at fault, which is found by halving until it's on its own
+		const int half = batch.size() / 2;
+		if (!write(batch.mid(0, half)))
+		{
+			m_retry.append(batch.mid(half));
+			return false;
+		}
+		return write(batch.mid(half));
+	}
+	qCWarning(Backlog) << "Unable to write message" << batch.first().values.value(0).toLongLong() << ":" << error.text();
+	m_failed.fetchAndAddRelaxed(1);
+	return true;
+}
+
+QSqlError BacklogWriter::writeRows(const QList<Row> &batch)
+{
+	QSqlDatabase db = QSqlDatabase::database(QStringLiteral("backlog-writer"), false);
+	// before the transaction, since MySQL commits on DDL and new names don't have to go away with messages that fail.
+	// Almost always all in the same partition, except around the turn of a month
+	QMap<QString, QList<QVariantList>> tables;
+	for (const Row &row : batch)
+	{
+		QVariantList values = row.values;
+		BacklogPartitions::Partition created;
+		const QString table = m_partitions.tableFor(db, values.at(5).toLongLong(), &created);
+		if (!created.table.isEmpty())
+		{
+			emit partitionCreated(created.table, created.start, created.end);
+		}
+		if (table.isEmpty())
+		{
+			return db.lastError().isValid() ? db.lastError() : QSqlError("Unable to add a partition", QString(), QSqlError::StatementError);
+		}
+		// in the shape of the table, which might not have been normalized yet (see BacklogMigration)
+		const BacklogPartitions::Shape shape = BacklogPartitions::shape(db, table);
+		if (!shape.names)
+		{
+			values[2] = m_names.source(db, values.at(2).toString());
+			values[3] = m_names.type(db, values.at(3).toString());
+			if (values.at(2).toInt() == 0 || values.at(3).toInt() == 0)
+			{
+				return db.lastError().isValid() ? db.lastError() : QSqlError("Unable to add a name", QString(), QSqlError::StatementError);
+			}
+		}
+		values[5] = shape.timestamp(values.at(5).toLongLong());
+
+		const auto dictionary = m_dictionaries.constFind(values.at(1).toInt());
+		const QByteArray compressed = dictionary == m_dictionaries.constEnd() ? QByteArray()
+																			  : BacklogCompression::compress(dictionary->second, values.at(4).toString());
+		if (compressed.isEmpty())
+		{
+			values << QVariant(QVariant::Int) << QVariant(QVariant::ByteArray);
+		}
+		else
+		{
+			values[4] = QString("");
+			values << dictionary->first << compressed;
+		}
+		tables[table].append(values);
+	}
+
+	const bool transaction = db.transaction();
+	if (!transaction && db.lastError().isValid() && isTransient(db, db.lastError()))
+	{
+		return db.lastError();
+	}
+	QSqlError error;
+	for (auto it = tables.constBegin(); it != tables.constEnd() && !error.isValid(); ++it)
+	{
+		for (int start = 0; start < it.value().size() && !error.isValid(); start += ROWS_PER_INSERT)
+		{
+			auto insert = Sql::INSERT().INTO(it.key()).COLUMNS("id", "channel", "source", "type", "content", "timestamp", "dictionary", "compressed");
+			for (const QVariantList &row : it.value().mid(start, ROWS_PER_INSERT))
+			{
+				insert = insert.VALUES(row);
+			}
+			error = insert.exec(db).lastError();
+		}
+	}
+	if (!error.isValid() && m_indexTerms)
+	{
+		QList<QPair<qint64, QString>> messages;
+		for (const Row &row : batch)
+		{
+			messages.append(qMakePair(row.values.at(0).toLongLong(), row.values.at(4).toString()));
+		}
+		if (!BacklogSearch::index(db, messages))
+		{
+			error = db.lastError().isValid() ? db.lastError() : QSqlError("Unable to index messages", QString(), QSqlError::StatementError);
+		}
+	}
+	if (transaction && !error.isValid() && !db.commit())
+	{
+		error = db.lastError();
+	}
+	if (transaction && error.isValid())
+	{
+		db.rollback();
+	}
+	return error;
+}
+
+bool BacklogWriter::isTransient(const QSqlDatabase &db, const QSqlError &error)
+{
+	if (error.type() == QSqlError::ConnectionError || !db.isOpen())
+	{
+		return true;
+	}
+	const QString code = error.nativeErrorCode();
+	const QString dialect = Sql::dialect(db);
+	if (dialect.contains("SQLITE"))
+	{
+		// SQLITE_BUSY and SQLITE_LOCKED, when another connection writes at the same time
+		return code == "5" || code == "6";
+	}
+	else if (dialect.contains("MYSQL"))
+	{
+		// lock wait timeout, deadlock, server gone away, lost connection
+		return code == "1205" || code == "1213" || code == "2006" || code == "2013";
+	}
+	else if (dialect.contains("PSQL"))
+	{
+		// serialization failure, deadlock, connection exceptions, shutting down
+		return code == "40001" || code == "40P01" || code.startsWith("08") || code.startsWith("57P");
+	}
+	return false;
+}
+
+void BacklogWriter::retryLater()
+{
+	m_retries.fetchAndAddRelaxed(1);
+	m_retryDelay = qBound(MIN_RETRY_DELAY, m_retryDelay * 2, MAX_RETRY_DELAY);
+	QSqlDatabase db = QSqlDatabase::database(QStringLiteral("backlog-writer"), false);
+	if (!db.isOpen() || db.lastError().type() == QSqlError::ConnectionError)
+	{
+		// the connection might be gone for good. What has been prepared on it goes with it
+		Sql::forgetStatements(db);
+		db.close();
+		db.open();
+	}
+	m_retryTimer->start(m_retryDelay);
+}
+
+void BacklogWriter::compact(const QString &table, const int engine)
+{
+	if (!m_open)
+	{
+		return;
+	}
+	qCDebug(Backlog) << "Compacting partition" << table;
+	QSqlDatabase db = QSqlDatabase::database(QStringLiteral("backlog-writer"), false);
+	const QString dialect = Sql::dialect(db);
+	QStringList statements;
+	if (dialect.contains("SQLITE"))
+	{
+		// the rows are already in id order, which is what matters for SQLite. The full-text index consists of many
+		// small segments though, which get merged into one
+		if (engine == BacklogSearch::Fts5)
+		{
+			statements << QString("INSERT INTO %1_fts(%1_fts) VALUES ('optimize')").arg(table);
+		}
+		statements << "ANALYZE " + table;
+	}
+	else if (dialect.contains("MYSQL"))
+	{
+		// rebuilds the table and its indices, including the FULLTEXT one, without the holes left by writing to it
+		statements << "OPTIMIZE TABLE " + table;
+	}
+	else if (dialect.contains("PSQL"))
+	{
+		// physically orders the rows the way they are read
+		statements << QString("CLUSTER %1 USING %1_channel_timestamp").arg(table) << "ANALYZE " + table;
+	}
+	for (const QString &statement : statements)
+	{
+		QSqlQuery q(db);
+		if (!q.exec(statement))
+		{
+			qCWarning(Backlog) << "Unable to compact" << table << ":" << q.lastError().text();
+			return;
+		}
+	}
+	Sql::UPDATE("chat_partitions").SET("compacted", 1).WHERE("name", "=", table).exec(db);
+}
+
+void BacklogWriter::dropPartitions(const QStringList &tables, const int engine)
+{
+	if (!m_open)
+	{
+		return;
+	}
+	flush();
+	QSqlDatabase db = QSqlDatabase::database(QStringLiteral("backlog-writer"), false);
+	for (const QString &table : tables)
+	{
+		BacklogPartitions::drop(db, BacklogSearch::Engine(engine), table);
+		m_partitions.remove(table);
+	}
+}
+
+void BacklogWriter::loadDictionaries()
+{
+	if (!m_open)
+	{
+		return;
+	}
+	QSqlDatabase db = QSqlDatabase::database(QStringLiteral("backlog-writer"), false);
+	QSqlQuery q = Sql::SELECT("channel", "version", "dictionary", "created").FROM("chat_dictionaries").ORDER_BY("version").exec(db);
+	while (q.next())
+	{
+		m_dictionaries.insert(q.value(0).toInt(), qMakePair(q.value(1).toInt(), q.value(2).toByteArray()));
+		m_trained.insert(q.value(0).toInt(), q.value(3).toLongLong());
+	}
+}
+
+void BacklogWriter::trainDictionaries(const QStringList &tables)
+{
+	if (!m_open)
+	{
+		return;
+	}
+	QSqlDatabase db = QSqlDatabase::database(QStringLiteral("backlog-writer"), false);
+	const qint64 now = QDateTime::currentMSecsSinceEpoch();
+	QList<int> channels;
+	QSqlQuery ids = Sql::SELECT("id").FROM("chat_channels").exec(db);
+	while (ids.next())
+	{
+		channels.append(ids.value(0).toInt());
+	}
+
+	for (const int channelId : channels)
+	{
+		const int current = m_dictionaries.value(channelId).first;
+		if (current > 0 && m_trained.value(channelId) + RETRAINING_INTERVAL > now)
+		{
+			continue;
+		}
+
+		// the most recent messages, since those are the most like what is going to be compressed
+		QStringList samples;
+		for (const QString &table : tables)
+		{
+			QSqlQuery q = Sql::SELECT("content", "dictionary", "compressed").FROM(table).WHERE("channel", "=", channelId)
+					.ORDER_BY("id", Sql::DESC).LIMIT(TRAINING_SAMPLES - samples.size()).exec(db);
+			while (q.next())
+			{
+				samples.append(m_samples.content(db, channelId, q.value(0).toString(), q.value(1).toInt(), q.value(2).toByteArray()));
+			}
+			if (samples.size() >= TRAINING_SAMPLES)
+			{
+				break;
+			}
+		}
+		if (samples.size() < MIN_TRAINING_SAMPLES)
+		{
+			continue;
+		}
+
+		const QByteArray dictionary = BacklogCompression::train(samples, DICTIONARY_SIZE);
+		const int version = current + 1;
+		// readers have to be able to find it before anything compressed with it gets written
+		if (Sql::INSERT().INTO("chat_dictionaries").COLUMNS("channel", "version", "dictionary", "created").VALUES(channelId, version, dictionary, now)
+				.exec(db).lastError().isValid())
+		{
+			qCWarning(Backlog) << "Unable to store a new dictionary for channel" << channelId;
+			continue;
+		}
+		qCDebug(Backlog) << "Trained a dictionary of" << dictionary.size() << "bytes for channel" << channelId << "(version" << version << ")";
+		m_dictionaries.insert(channelId, qMakePair(version, dictionary));
+		m_trained.insert(channelId, now);
+		m_samples.insert(channelId, version, dictionary);
+	}
+}
+
+void BacklogWriter::startMigrations(const int engine)
+{
+	if (!m_open || m_migration)
+	{
+		return;
+	}
+	// on our connection, so that migrating and writing take turns instead of getting in each other's way
+	m_migration = new BacklogMigration(QStringLiteral("backlog-writer"), engine, this);
+	m_migration->start();
+}
@@ -0,0 +1,125 @@
+#pragma once
+
+#include <QObject>
+#include <QVariant>
+#include <QElapsedTimer>
+#include <QJsonObject>
+#include <QAtomicInt>
+#include <QHash>
+#include <QPair>
+
+#include "core/MpscQueue.h"
+#include "BacklogCompression.h"
+#include "BacklogNames.h"
+#include "BacklogPartitions.h"
+#include "SqlHelpers.h"
+
+class QSqlDriver;
+class QSqlError;
+class QTimer;
+class BacklogMigration;
+
+/**
+ * Writes chat messages to the database on a thread of its own, so that a slow database doesn't hold up
+ * BacklogClientConnection.
+ *
+ * Rows are handed over through a lock-free queue and written in batches, one transaction each. A batch is written
+ * once it is full (by count or by size) or its oldest row has waited for the latency limit. The writer has its own
+ * database connection, which is only touched on its thread.
+ *
+ * Sources and types are interned and partitions are created here rather than when enqueuing, so that taking in a
+ * message never has to wait for the database.
+ *
+ * Rows are never given up on because of others: a batch that fails gets split up until the rows that can't be written
+ * are found, and while the database is unavailable (locked, or the connection is gone) batches are kept and tried
+ * again with increasing delays.
+ */
+class BacklogWriter : public QObject
+{
+	Q_OBJECT
+public:
+	/// Takes ownership of driver, which has to be moved to the thread of the writer along with it
+	explicit BacklogWriter(QSqlDriver *driver, const Sql::ConnectionSettings &settings, const int batchSize, const int batchBytes, const int batchLatency);
+	~BacklogWriter();
+
+	/// Thread safe. Writes row (id, channel, source name, type name, content, timestamp) into its partition. size is an estimate of how much the row weighs, for the size limit of batches
+	void enqueue(QVariantList &&row, const int size);
+
+	/// Thread safe. Queue depth and size, how long rows waited to be written and how many have been written
+	QJsonObject stats() const;
+
+signals:
+	/// A partition has been created for a new month, see BacklogPartitions::add
+	void partitionCreated(const QString &table, const qint64 start, const qint64 end);
+
+public slots:
+	/// Opens the connection to the database. engine is a BacklogSearch::Engine
+	void open(const int engine);
+	/// Writes all rows that are queued, in batches
+	void flush();
+	/// Rewrites a partition that doesn't change anymore into a form that is faster to read. engine is a BacklogSearch::Engine
+	void compact(const QString &table, const int engine);
+	/// Drops partitions past retention (see BacklogPartitions::takeOlderThan), once what is queued for them has been written
+	void dropPartitions(const QStringList &tables, const int engine);
+	/// Compresses what is written from now on with the newest dictionary of each channel in chat_dictionaries, see BacklogCompression
+	void loadDictionaries();
+	/**
+	 * Trains dictionaries for channels that don't have one yet or where it's getting old, from their newest messages in
+	 * tables (newest first). Done in between batches, so that it holds up writing rather than taking in messages
+	 */
+	void trainDictionaries(const QStringList &tables);
+	/// Continues with the migrations that rewrite tables in the background, in between writing. engine is a BacklogSearch::Engine
+	void startMigrations(const int engine);
+
+private slots:
+	void arm();
+
+private:
+	struct Row
+	{
+		QVariantList values;
+		int size;
+		qint64 enqueued;
+	};
+
+	QSqlDriver *m_driver;
+	const Sql::ConnectionSettings m_settings;
+	const int m_batchSize;
+	const int m_batchBytes;
+	QTimer *m_timer;
+	/// Rows that couldn't be written because the database was unavailable, they go before anything in the queue
+	QList<Row> m_retry;
+	QTimer *m_retryTimer;
+	int m_retryDelay = 0;
+	bool m_open = false;
+	bool m_indexTerms = false;
+	BacklogNames m_names;
+	BacklogPartitions m_partitions;
+	QHash<int, QPair<int, QByteArray>> m_dictionaries; ///< Channel -> (version, dictionary)
+	QHash<int, qint64> m_trained; ///< Channel -> when its current dictionary was trained
+	BacklogCompression::DictionaryCache m_samples; ///< For reading training samples compressed with older dictionaries
+	BacklogMigration *m_migration = nullptr;
+
+	MpscQueue<Row> m_queue;
+	QAtomicInt m_depth;
+	QAtomicInt m_bytes;
+
+	QElapsedTimer m_clock;
+	QAtomicInteger<qint64> m_lastLag; ///< From enqueuing until commit, of the oldest row of the last batch
+	QAtomicInteger<qint64> m_maxLag;
+	QAtomicInteger<quint64> m_written;
+	QAtomicInteger<quint64> m_failed;
+	QAtomicInteger<quint64> m_batches;
+	QAtomicInteger<quint64> m_retries;
+
+	/**
+	 * Writes batch, splitting it up if some rows can't be written. Returns false if the database is unavailable, in
+	 * which case what hasn't been written is in m_retry
+	 */
+	bool write(const QList<Row> &batch);
+	/// Interns names and creates partitions, then writes batch in one transaction. Returns the error, if any
+	QSqlError writeRows(const QList<Row> &batch);
+	/// Whether error might go away by trying again later
+	static bool isTransient(const QSqlDatabase &db, const QSqlError &error);
+	void retryLater();
+};
@@ -0,0 +1,369 @@
+#include "LogStore.h"
+
+#include <QDir>
+#include <QFile>
+#include <QtEndian>
+#include <algorithm>
+
+#ifdef Q_OS_UNIX
+# include <unistd.h>
+#endif
+
+#include "BacklogClientConnection.h"
+
+// length, id, timestamp, source length, type length, content length
+static constexpr const int HEADER_SIZE = 4 + 8 + 8 + 2 + 2 + 4;
+static constexpr const qint64 SEGMENT_SIZE = 64 * 1024 * 1024;
+static constexpr const qint64 BLOCK_SIZE = 4096;
+
+namespace
+{
+struct Header
+{
+	quint32 length; ///< Of everything after this field
+	qint64 id;
+	qint64 timestamp;
+	quint16 sourceLength;
+	quint16 typeLength;
+	quint32 contentLength;
+};
+}
+
+static Header readHeader(const uchar *data)
+{
+	Header header;
+	header.length = qFromLittleEndian<quint32>(data);
+	header.id = qFromLittleEndian<qint64>(data + 4);
+	header.timestamp = qFromLittleEndian<qint64>(data + 12);
+	header.sourceLength = qFromLittleEndian<quint16>(data + 20);
+	header.typeLength = qFromLittleEndian<quint16>(data + 22);
+	header.contentLength = qFromLittleEndian<quint32>(data + 24);
+	return header;
+}
+static bool isValid(const Header &header)
+{
+	return header.length == quint32(HEADER_SIZE - 4) + header.sourceLength + header.typeLength + header.contentLength;
+}
+
+// channels can be named anything, so they are hex encoded to get something that is safe as a directory name
+static QString directoryName(const QString &channel)
+{
+	return QString::fromLatin1(channel.toUtf8().toHex());
+}
+
+LogStore::LogStore(const QString &directory)
+	: m_directory(directory)
+{
+}
+LogStore::~LogStore()
+{
+	flush();
+	for (Channel *channel : m_channels)
+	{
+		for (Segment *segment : channel->segments)
+		{
+			delete segment->file;
+			delete segment;
+		}
+		delete channel;
+	}
+}
+
+bool LogStore::open()
+{
+	if (!QDir().mkpath(m_directory))
+	{
+		qCWarning(Backlog) << "Unable to create" << m_directory;
+		return false;
+	}
+	for (const QString &entry : QDir(m_directory).entryList(QDir::Dirs | QDir::NoDotAndDotDot))
+	{
+		Channel *c = channel(QString::fromUtf8(QByteArray::fromHex(entry.toLatin1())), true);
+		// named after their first id, padded, so sorting by name sorts them by age
+		for (const QString &name : QDir(c->directory).entryList({"*.log"}, QDir::Files, QDir::Name))
+		{
+			Segment *segment = addSegment(c, c->directory + '/' + name);
+			if (!segment)
+			{
+				return false;
+			}
+			const uchar *data = mapped(segment);
+			qint64 offset = 0;
+			while (offset + HEADER_SIZE <= segment->size)
+			{
+				const Header header = readHeader(data + offset);
+				if (!isValid(header) || offset + 4 + header.length > quint64(segment->size))
+				{
+					break;
+				}
+				index(c, segment, offset, header.timestamp);
+				m_lastId = qMax(m_lastId, header.id);
+				offset += 4 + header.length;
+			}
+			if (offset != segment->size)
+			{
+				// the tail of the last write before a crash
+				qCWarning(Backlog) << "Truncating" << segment->file->fileName() << "from" << segment->size << "to" << offset << "bytes";
+				segment->map = nullptr;
+				segment->file->unmap(const_cast<uchar *>(data));
+				segment->mapped = 0;
+				segment->file->resize(offset);
+				segment->size = segment->written = offset;
+			}
+		}
+	}
+	return true;
+}
+
+qint64 LogStore::newestTimestamp(const QString &channel) const
+{
+	const Channel *c = m_channels.value(channel);
+	return c ? c->newest : -1;
+}
+
+void LogStore::append(const QString &name, const BacklogRing::Line &line)
+{
+	Channel *c = channel(name, true);
+	const QByteArray source = line.source.toUtf8().left(0xffff);
+	const QByteArray type = line.type.toUtf8().left(0xffff);
+	const QByteArray content = line.content.toUtf8();
+	const int size = HEADER_SIZE + source.size() + type.size() + content.size();
+
+	if (c->segments.isEmpty() || c->segments.last()->size + size > SEGMENT_SIZE)
+	{
+		flush(c);
+		addSegment(c, QString("%1/%2.log").arg(c->directory).arg(line.id, 20, 10, QChar('0')));
+	}
+	Segment *segment = c->segments.last();
+	index(c, segment, segment->size, line.timestamp);
+
+	uchar header[HEADER_SIZE];
+	qToLittleEndian<quint32>(quint32(size - 4), header);
+	qToLittleEndian<qint64>(line.id, header + 4);
+	qToLittleEndian<qint64>(line.timestamp, header + 12);
+	qToLittleEndian<quint16>(quint16(source.size()), header + 20);
+	qToLittleEndian<quint16>(quint16(type.size()), header + 22);
+	qToLittleEndian<quint32>(quint32(content.size()), header + 24);
+	c->pending.append(reinterpret_cast<const char *>(header), HEADER_SIZE);
+	c->pending.append(source);
+	c->pending.append(type);
+	c->pending.append(content);
+
+	segment->size += size;
+	m_pendingBytes += size;
+	m_lastId = qMax(m_lastId, line.id);
+}
+
+void LogStore::flush()
+{
+	for (Channel *c : m_channels)
+	{
+		flush(c);
+	}
+}
+
+bool LogStore::page(const QString &name, const qint64 min, const qint64 max, const qint64 beforeId, const int amount, QVector<BacklogRing::Line> *lines)
+{
+	Channel *c = channel(name, false);
+	if (!c)
+	{
+		return true;
+	}
+	flush(c);
+
+	struct Candidate
+	{
+		qint64 timestamp;
+		qint64 id;
+		const uchar *record;
+	};
+	const auto newer = [](const Candidate &a, const Candidate &b)
+	{
+		return a.timestamp != b.timestamp ? a.timestamp > b.timestamp : a.id > b.id;
+	};
+	QVector<Candidate> candidates;
+
+	// newest block first. Once there are enough candidates, older blocks only matter if they have something newer than those
+	for (int s = c->segments.size() - 1; s >= 0; --s)
+	{
+		Segment *segment = c->segments.at(s);
+		const uchar *data = mapped(segment);
+		if (!data)
+		{
+			return false;
+		}
+		for (int b = segment->blocks.size() - 1; b >= 0; --b)
+		{
+			const Block &block = segment->blocks.at(b);
+			if (candidates.size() >= amount && block.maxTimestampSoFar <= candidates.at(amount - 1).timestamp)
+			{
+				s = 0;
+				break;
+			}
+			if ((max > 0 && block.minTimestamp > max) || block.maxTimestamp < min)
+			{
+				continue;
+			}
+			const qint64 end = b + 1 < segment->blocks.size() ? segment->blocks.at(b + 1).offset : segment->size;
+			for (qint64 offset = block.offset; offset < end;)
+			{
+				const Header header = readHeader(data + offset);
+				const bool belowMax = max <= 0 || header.timestamp < max || (header.timestamp == max && header.id < beforeId);
+				if (belowMax && header.timestamp >= min)
+				{
+					candidates.append({header.timestamp, header.id, data + offset});
+				}
+				offset += 4 + header.length;
+			}
+			if (candidates.size() >= amount)
+			{
+				std::partial_sort(candidates.begin(), candidates.begin() + amount, candidates.end(), newer);
+				candidates.resize(amount);
+			}
+		}
+	}
+	std::sort(candidates.begin(), candidates.end(), newer);
+
+	// the strings are decoded straight from the mapping
+	lines->reserve(candidates.size());
+	for (const Candidate &candidate : candidates)
+	{
+		const Header header = readHeader(candidate.record);
+		const char *strings = reinterpret_cast<const char *>(candidate.record) + HEADER_SIZE;
+		lines->append({header.id, header.timestamp,
+					   QString::fromUtf8(strings, header.sourceLength),
+					   QString::fromUtf8(strings + header.sourceLength, header.typeLength),
+					   QString::fromUtf8(strings + header.sourceLength + header.typeLength, int(header.contentLength))});
+	}
+	return true;
+}
+
+void LogStore::dropOlderThan(const qint64 cutoff)
+{
+	for (Channel *c : m_channels)
+	{
+		while (c->segments.size() > 1)
+		{
+			Segment *segment = c->segments.first();
+			qint64 newest = -1;
+			for (const Block &block : segment->blocks)
+			{
+				newest = qMax(newest, block.maxTimestamp);
+			}
+			if (newest >= cutoff)
+			{
+				break;
+			}
+			qCDebug(Backlog) << "Removing segment" << segment->file->fileName();
+			segment->file->remove();
+			delete segment->file;
+			delete segment;
+			c->segments.removeFirst();
+		}
+	}
+}
+
+LogStore::Channel *LogStore::channel(const QString &name, const bool create)
+{
+	Channel *c = m_channels.value(name);
+	if (!c && create)
+	{
+		c = new Channel;
+		c->directory = m_directory + '/' + directoryName(name);
+		QDir().mkpath(c->directory);
+		m_channels.insert(name, c);
+	}
+	return c;
+}
+
+LogStore::Segment *LogStore::addSegment(Channel *channel, const QString &path)
+{
+	QFile *file = new QFile(path);
+	if (!file->open(QFile::ReadWrite | QFile::Append))
+	{
+		qCWarning(Backlog) << "Unable to open" << path << ":" << file->errorString();
+		delete file;
+		return nullptr;
+	}
+	Segment *segment = new Segment;
+	segment->file = file;
+	segment->size = segment->written = file->size();
+	channel->segments.append(segment);
+	return segment;
+}
+
+void LogStore::index(Channel *channel, Segment *segment, const qint64 offset, const qint64 timestamp)
+{
+	if (segment->blocks.isEmpty() || offset - segment->blocks.last().offset >= BLOCK_SIZE)
+	{
+		qint64 soFar = timestamp;
+		for (int s = channel->segments.size() - 1; s >= 0; --s)
+		{
+			if (!channel->segments.at(s)->blocks.isEmpty())
+			{
+				soFar = qMax(soFar, channel->segments.at(s)->blocks.last().maxTimestampSoFar);
+				break;
+			}
+		}
+		segment->blocks.append({offset, timestamp, timestamp, soFar});
+	}
+	Block &block = segment->blocks.last();
+	block.minTimestamp = qMin(block.minTimestamp, timestamp);
+	block.maxTimestamp = qMax(block.maxTimestamp, timestamp);
+	block.maxTimestampSoFar = qMax(block.maxTimestampSoFar, timestamp);
+	channel->newest = qMax(channel->newest, timestamp);
+}
+
+bool LogStore::flush(Channel *channel)
+{
+	if (channel->pending.isEmpty())
+	{
+		return true;
+	}
+	Segment *segment = channel->segments.last();
+	const qint64 written = segment->file->write(channel->pending);
+	segment->file->flush();
+#ifdef Q_OS_UNIX
+	::fsync(segment->file->handle());
+#endif
+	m_pendingBytes -= channel->pending.size();
+	if (written != channel->pending.size())
+	{
+		qCWarning(Backlog) << "Unable to write to" << segment->file->fileName() << ":" << segment->file->errorString();
+		// everything that was pending is lost, including what made it to the file, so that later appends don't end up
+		// behind a partial record
+		if (!segment->file->resize(segment->written))
+		{
+			qCWarning(Backlog) << "Unable to truncate" << segment->file->fileName() << ":" << segment->file->errorString();
+		}
+		segment->size = segment->written;
+		while (!segment->blocks.isEmpty() && segment->blocks.last().offset >= segment->written)
+		{
+			segment->blocks.removeLast();
+		}
+		channel->pending.clear();
+		return false;
+	}
+	segment->written += written;
+	channel->pending.clear();
+	return true;
+}
+
+const uchar *LogStore::mapped(Segment *segment)
+{
+	// mappings can't grow, so segments that have been written to since are mapped again
+	if (segment->mapped != segment->written)
+	{
+		if (segment->map)
+		{
+			segment->file->unmap(segment->map);
+			segment->map = nullptr;
+		}
+		if (segment->written > 0)
+		{
+			segment->map = segment->file->map(0, segment->written);
+		}
+		segment->mapped = segment->map ? segment->written : 0;
+	}
+	return segment->map;
+}
@@ -0,0 +1,80 @@
+#pragma once
+
+#include <QHash>
+#include <QVector>
+#include <QByteArray>
+
+#include "BacklogRing.h"
+
+class QFile;
+
+/**
+ * An append-only store for the backlog, as an alternative to a SQL database on single node setups.
+ *
+ * Every channel has a directory of segment files, which records get appended to. Appends are buffered and written
+ * (and fsynced) in batches using flush. Segments are read through mmap, and each has a sparse index of blocks with
+ * their timestamp range, so that pages can be found without reading everything.
+ *
+ * A record is a header (length, id, timestamp and string lengths) followed by source, type and content as UTF-8.
+ */
+class LogStore
+{
+public:
+	explicit LogStore(const QString &directory);
+	~LogStore();
+
+	/// Loads what is on disk, truncating records that haven't been written completely. Returns false on errors
+	bool open();
+
+	qint64 lastId() const { return m_lastId; }
+	/// The newest timestamp in channel, or -1 if it has nothing
+	qint64 newestTimestamp(const QString &channel) const;
+
+	void append(const QString &channel, const BacklogRing::Line &line);
+	/// Bytes that have been appended but not written yet
+	qint64 pendingBytes() const { return m_pendingBytes; }
+	/// Writes and fsyncs everything that has been appended
+	void flush();
+
+	/// The same as BacklogRing::page, except that this can always answer
+	bool page(const QString &channel, const qint64 min, const qint64 max, const qint64 beforeId, const int amount, QVector<BacklogRing::Line> *lines);
+
+	/// Removes segments that only have messages older than cutoff. The newest segment of a channel is always kept
+	void dropOlderThan(const qint64 cutoff);
+
+private:
+	struct Block
+	{
+		qint64 offset;
+		qint64 minTimestamp;
+		qint64 maxTimestamp;
+		qint64 maxTimestampSoFar; ///< Of this and all blocks before it in the channel, for knowing when to stop looking
+	};
+	struct Segment
+	{
+		QFile *file;
+		uchar *map = nullptr;
+		qint64 mapped = 0;
+		qint64 size = 0; ///< Including what is still pending
+		qint64 written = 0;
+		QVector<Block> blocks;
+	};
+	struct Channel
+	{
+		QString directory;
+		QVector<Segment *> segments;
+		QByteArray pending; ///< Belongs at the end of the last segment
+		qint64 newest = -1;
+	};
+
+	const QString m_directory;
+	QHash<QString, Channel *> m_channels;
+	qint64 m_lastId = 0;
+	qint64 m_pendingBytes = 0;
+
+	Channel *channel(const QString &name, const bool create);
+	Segment *addSegment(Channel *channel, const QString &path);
+	void index(Channel *channel, Segment *segment, const qint64 offset, const qint64 timestamp);
+	bool flush(Channel *channel);
+	const uchar *mapped(Segment *segment);
+};
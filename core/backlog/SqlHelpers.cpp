@@ -1,13 +1,134 @@
 #include "SqlHelpers.h"
 
 #include <QSqlError>
+#include <QSqlDriver>
+#include <QCache>
+#include <QHash>
+#include <QThreadStorage>
+#include <QTimer>
+#include <QObject>
 
 Q_LOGGING_CATEGORY(SqlLog, "core.sql")
 
+namespace
+{
+/// Connections may only be used on the thread that created them, so one cache per thread is one cache per connection
+struct StatementCache
+{
+	StatementCache() : statements(64) {}
+
+	QCache<QString, QSqlQuery> statements;
+	QHash<QString, QSqlRecord> records; ///< See Sql::record
+	QList<QSqlQuery> handedOut; ///< Get finished once control returns to the event loop, see finishStatements
+	QObject context; ///< For finishing them, so that nothing is left pending once the thread and its cache are gone
+	int generation = 0; ///< Of statementGeneration, when the statements were prepared
+	quint64 hits = 0;
+	quint64 misses = 0;
+};
+}
+Q_GLOBAL_STATIC(QThreadStorage<StatementCache *>, statementCaches)
+static QAtomicInt statementGeneration;
+
+static StatementCache *statementCache()
+{
+	if (!statementCaches->hasLocalData())
+	{
+		statementCaches->setLocalData(new StatementCache);
+	}
+	StatementCache *cache = statementCaches->localData();
+	const int generation = statementGeneration.loadAcquire();
+	if (cache->generation != generation)
+	{
+		cache->statements.clear();
+		cache->records.clear();
+		cache->generation = generation;
+	}
+	return cache;
+}
+
 QString Sql::VARCHAR(int size)
 {
 	return QString("VARCHAR(%1)").arg(size);
 }
+
+QString Sql::dialect(const QSqlDatabase &db)
+{
+	// connections added with a driver instance, as ConnectionSettings::addDatabase does, don't know their driver's name
+	switch (db.driver() ? db.driver()->dbmsType() : QSqlDriver::UnknownDbms)
+	{
+	case QSqlDriver::SQLite:
+		return "QSQLITE";
+	case QSqlDriver::PostgreSQL:
+		return "QPSQL";
+	case QSqlDriver::MySqlServer:
+		return "QMYSQL";
+	default:
+		return db.driverName();
+	}
+}
+void Sql::invalidateStatements()
+{
+	statementGeneration.fetchAndAddOrdered(1);
+}
+void Sql::forgetStatements(const QSqlDatabase &db)
+{
+	StatementCache *cache = statementCache();
+	const QString prefix = db.connectionName() + '\n';
+	for (const QString &key : cache->statements.keys())
+	{
+		if (key.startsWith(prefix))
+		{
+			cache->statements.remove(key);
+		}
+	}
+	for (const QString &key : cache->records.keys())
+	{
+		if (key.startsWith(prefix))
+		{
+			cache->records.remove(key);
+		}
+	}
+	for (int i = cache->handedOut.size() - 1; i >= 0; --i)
+	{
+		if (cache->handedOut.at(i).driver() == db.driver())
+		{
+			cache->handedOut[i].finish();
+			cache->handedOut.removeAt(i);
+		}
+	}
+}
+void Sql::finishStatements()
+{
+	StatementCache *cache = statementCache();
+	for (QSqlQuery &query : cache->handedOut)
+	{
+		query.finish();
+	}
+	cache->handedOut.clear();
+}
+QSqlRecord Sql::record(const QSqlDatabase &db, const QString &table)
+{
+	StatementCache *cache = statementCache();
+	const QString key = db.connectionName() + '\n' + table;
+	auto it = cache->records.find(key);
+	if (it == cache->records.end())
+	{
+		it = cache->records.insert(key, db.record(table));
+	}
+	return it.value();
+}
+
+QSqlDatabase Sql::ConnectionSettings::addDatabase(QSqlDriver *driver, const QString &name) const
+{
+	QSqlDatabase db = QSqlDatabase::addDatabase(driver, name);
+	db.setHostName(host);
+	db.setPort(port);
+	db.setDatabaseName(dbName);
+	db.setUserName(userName);
+	db.setPassword(password);
+	db.setConnectOptions(options);
+	return db;
+}
 QString Sql::type(const Sql::Type type)
 {
 	switch (type)
@@ -46,9 +167,47 @@ QString Sql::type(const Sql::Type type)
 
 QSqlQuery SqlHelpers::BaseQueryBuilder::prepare(const QSqlDatabase &db)
 {
-	QSqlQuery q(db);
-	q.prepare(stringify(db.driverName()));
-	checkError(q, "prepare");
+	const QString sql = stringify(Sql::dialect(db));
+	if (!cacheable())
+	{
+		QSqlQuery q(db);
+		q.prepare(sql);
+		checkError(q, "prepare");
+		return q;
+	}
+
+	StatementCache *cache = statementCache();
+	// all values are bound, so the SQL is the same for every execution of a statement
+	const QString key = db.connectionName() + '\n' + sql;
+	const QSqlQuery *cached = cache->statements.object(key);
+	QSqlQuery q = cached ? *cached : QSqlQuery(db);
+	if (cached)
+	{
+		++cache->hits;
+		q.finish();
+	}
+	else
+	{
+		++cache->misses;
+		q.prepare(sql);
+		checkError(q, "prepare");
+		if (!q.lastError().isValid())
+		{
+			cache->statements.insert(key, new QSqlQuery(q));
+		}
+	}
+
+	if (cache->handedOut.isEmpty())
+	{
+		QTimer::singleShot(0, &cache->context, &Sql::finishStatements);
+	}
+	cache->handedOut.append(q);
+
+	if ((cache->hits + cache->misses) % 1024 == 0)
+	{
+		qCDebug(SqlLog) << "Statement cache hit rate:" << (double(cache->hits) / (cache->hits + cache->misses))
+						<< "(" << cache->hits << "hits," << cache->misses << "misses)";
+	}
 	return q;
 }
 QSqlQuery SqlHelpers::BaseQueryBuilder::exec(const QSqlDatabase &db)
@@ -89,6 +248,33 @@ QString SqlHelpers::SelectQueryBuilder::stringify(const QString &dialect) const
 	out += " FROM ";
 	out += m_table;
 	out += ' ' + stringifyWhere(dialect);
+	if (!m_orderBy.isEmpty())
+	{
+		out += " ORDER BY " + m_orderBy.join(',');
+	}
+	if (m_limit >= 0)
+	{
+		// LIMIT n is understood by SQLite, MySQL and PostgreSQL alike
+		out += " LIMIT " + QString::number(m_limit);
+	}
+	return out;
+}
+
+
+QString SqlHelpers::DropTableQueryBuilder::stringify(const QString &dialect) const
+{
+	return "DROP TABLE " + m_name;
+}
+
+
+QString SqlHelpers::CreateIndexQueryBuilder::stringify(const QString &dialect) const
+{
+	QString out = "CREATE ";
+	if (m_unique)
+	{
+		out += "UNIQUE ";
+	}
+	out += "INDEX " + m_name + " ON " + m_table + " (" + m_columns.join(',') + ")";
 	return out;
 }
 
@@ -118,7 +304,10 @@ QString SqlHelpers::CreateTableQueryBuilder::stringify(const QString &dialect) c
 	out += " (";
 	for (const Column &col : m_columns)
 	{
-		out += col.name + ' ' + col.type + ' ';
+		// PostgreSQL has no AUTOINCREMENT, auto incrementing columns are of their own type instead. It has no BLOB either
+		const bool serial = col.primaryKey && col.autoIncrement && dialect.contains("PSQL");
+		const QString type = dialect.contains("PSQL") && col.type.endsWith("BLOB") ? "BYTEA" : col.type;
+		out += col.name + ' ' + (serial ? (col.type == "BIGINT" ? "BIGSERIAL" : "SERIAL") : type) + ' ';
 		if (col.notNull)
 		{
 			out += "NOT NULL ";
@@ -130,7 +319,7 @@ QString SqlHelpers::CreateTableQueryBuilder::stringify(const QString &dialect) c
 		if (col.primaryKey)
 		{
 			out += "PRIMARY KEY ";
-			if (col.autoIncrement)
+			if (col.autoIncrement && !serial)
 			{
 				if (dialect.contains("MYSQL"))
 				{
@@ -231,3 +420,9 @@ QString SqlHelpers::UpdateQueryBuilder::stringify(const QString &dialect) const
 	out += ' ' + stringifyWhere(dialect);
 	return out;
 }
+
+
+QString SqlHelpers::DeleteQueryBuilder::stringify(const QString &dialect) const
+{
+	return "DELETE FROM " + m_table + ' ' + stringifyWhere(dialect);
+}
@@ -4,8 +4,12 @@
 #include <QMap>
 #include <QVariant>
 #include <QSqlQuery>
+#include <QSqlDatabase>
+#include <QSqlRecord>
 #include <QLoggingCategory>
 
+class QSqlDriver;
+
 namespace Sql
 {
 enum Type
@@ -27,10 +31,58 @@ enum Type
 };
 QString type(const Type type);
 QString VARCHAR(int size);
+
+/// "QSQLITE", "QPSQL" or "QMYSQL", or the driver name for anything else
+QString dialect(const QSqlDatabase &db);
+/**
+ * Drops the cached prepared statements of every thread (see BaseQueryBuilder) before they are used the next time. For
+ * after a table has been replaced, since PostgreSQL refuses to run statements whose result types would change. Thread safe
+ */
+void invalidateStatements();
+/// Drops the statements this thread has cached for db. Has to be called before db gets closed, reopened or removed
+void forgetStatements(const QSqlDatabase &db);
+/**
+ * Finishes the queries this thread has been handed by BaseQueryBuilder, so that their cursors are closed. That happens
+ * once control returns to the event loop, code that runs for long without one should call this in between
+ */
+void finishStatements();
+/// db.record(table), cached along with the statements of this thread (so until they get invalidated or forgotten)
+QSqlRecord record(const QSqlDatabase &db, const QString &table);
+
+/// What connections get opened with. Connections belong to the thread of their driver, so each thread opens its own
+struct ConnectionSettings
+{
+	QString host;
+	int port;
+	QString dbName;
+	QString userName;
+	QString password;
+	QString options;
+
+	/// Adds (but doesn't open) a connection called name. Takes ownership of driver, which has to live on the calling thread
+	QSqlDatabase addDatabase(QSqlDriver *driver, const QString &name) const;
+};
 }
 
 namespace SqlHelpers
 {
+struct Condition
+{
+	QString left;
+	QString op;
+	QVariant right;
+};
+enum Order
+{
+	ASC,
+	DESC
+};
+
+/**
+ * Prepared statements are cached per thread, keyed by connection and SQL, and reused with new values bound. This
+ * means that the QSqlQuery returned by prepare, exec and execAndNext is only valid until control returns to the
+ * event loop, after which it gets finished so that it doesn't hold on to locks or cursors.
+ */
 class BaseQueryBuilder
 {
 public:
@@ -42,6 +94,8 @@ public:
 
 protected:
 	void checkError(const QSqlQuery &query, const QString &verb);
+	/// Statements that are only run once, like schema changes, aren't worth a place in the cache
+	virtual bool cacheable() const { return true; }
 };
 template<typename Super>
 class ConditionalQueryBuilder : public BaseQueryBuilder
@@ -53,7 +107,14 @@ public:
 	}
 	Super WHERE(const QString &left, const QString &op, const QVariant right)
 	{
-		m_wheres.append(Where{left, op, right});
+		m_wheres.append(QList<Condition>({Condition{left, op, right}}));
+		return *static_cast<Super *>(this);
+	}
+	/// Matches if any of the conditions is true
+	Super WHERE_ANY(const QList<Condition> &conditions)
+	{
+		Q_ASSERT(!conditions.isEmpty());
+		m_wheres.append(conditions);
 		return *static_cast<Super *>(this);
 	}
 
@@ -71,10 +132,15 @@ protected:
 	QString stringifyWhere(const QString &dialect) const
 	{
 		QStringList wheres;
-		for (const Where &where : m_wheres)
+		for (const QList<Condition> &where : m_wheres)
 		{
-			wheres.append(where.left + ' ' + where.op + " :val_" + QString::number(m_valuesToBind.size()));
-			m_valuesToBind.append(where.right);
+			QStringList alternatives;
+			for (const Condition &condition : where)
+			{
+				alternatives.append(condition.left + ' ' + condition.op + " :val_" + QString::number(m_valuesToBind.size()));
+				m_valuesToBind.append(condition.right);
+			}
+			wheres.append(alternatives.size() == 1 ? alternatives.first() : ('(' + alternatives.join(" OR ") + ')'));
 		}
 		if (!wheres.isEmpty())
 		{
@@ -87,13 +153,7 @@ protected:
 	}
 
 private:
-	struct Where
-	{
-		QString left;
-		QString op;
-		QVariant right;
-	};
-	QList<Where> m_wheres;
+	QList<QList<Condition>> m_wheres;
 	mutable QVariantList m_valuesToBind;
 };
 
@@ -110,11 +170,23 @@ public:
 		m_table = table;
 		return *this;
 	}
+	SelectQueryBuilder ORDER_BY(const QString &column, const Order order = ASC)
+	{
+		m_orderBy.append(column + (order == DESC ? " DESC" : " ASC"));
+		return *this;
+	}
+	SelectQueryBuilder LIMIT(const int limit)
+	{
+		m_limit = limit;
+		return *this;
+	}
 
 private:
 	QString stringify(const QString &dialect) const override;
 	QStringList m_fields;
 	QString m_table;
+	QStringList m_orderBy;
+	int m_limit = -1;
 };
 class InsertQueryBuilder : public BaseQueryBuilder
 {
@@ -138,6 +210,12 @@ public:
 		m_values.append(QVariantList({values...}));
 		return *this;
 	}
+	/// Adds a row at once, for building inserts of many rows
+	InsertQueryBuilder VALUES(const QVariantList &values)
+	{
+		m_values.append(values);
+		return *this;
+	}
 
 private:
 	QString stringify(const QString &dialect) const override;
@@ -169,6 +247,21 @@ private:
 	QVariantMap m_values;
 };
 
+class DeleteQueryBuilder : public ConditionalQueryBuilder<DeleteQueryBuilder>
+{
+public:
+	DeleteQueryBuilder FROM(const QString &table)
+	{
+		m_table = table;
+		return *this;
+	}
+
+private:
+	QString stringify(const QString &dialect) const override;
+
+	QString m_table;
+};
+
 class CreateTableQueryBuilder : public BaseQueryBuilder
 {
 public:
@@ -229,6 +322,7 @@ public:
 
 private:
 	QString stringify(const QString &dialect) const override;
+	bool cacheable() const override { return false; }
 	bool m_temporary = false;
 	bool m_ifNotExists = false;
 	QString m_name;
@@ -244,10 +338,57 @@ private:
 	};
 	QList<Column> m_columns;
 };
+class DropTableQueryBuilder : public BaseQueryBuilder
+{
+public:
+	DropTableQueryBuilder named(const QString &name)
+	{
+		m_name = name;
+		return *this;
+	}
+
+private:
+	QString stringify(const QString &dialect) const override;
+	bool cacheable() const override { return false; }
+	QString m_name;
+};
+
+class CreateIndexQueryBuilder : public BaseQueryBuilder
+{
+public:
+	CreateIndexQueryBuilder named(const QString &name)
+	{
+		m_name = name;
+		return *this;
+	}
+	CreateIndexQueryBuilder UNIQUE()
+	{
+		m_unique = true;
+		return *this;
+	}
+	template<typename... Cols>
+	CreateIndexQueryBuilder ON(const QString &table, Cols... cols)
+	{
+		m_table = table;
+		m_columns = QStringList({cols...});
+		return *this;
+	}
+
+private:
+	QString stringify(const QString &dialect) const override;
+	bool cacheable() const override { return false; }
+	QString m_name;
+	bool m_unique = false;
+	QString m_table;
+	QStringList m_columns;
+};
 }
 
 namespace Sql
 {
+using SqlHelpers::ASC;
+using SqlHelpers::DESC;
+
 template<typename... Fields>
 inline SqlHelpers::SelectQueryBuilder SELECT(Fields... f)
 {
@@ -261,6 +402,14 @@ inline SqlHelpers::CreateTableQueryBuilder CREATE_TEMPORARY_TABLE(const QString
 {
 	return SqlHelpers::CreateTableQueryBuilder().temporary().named(name);
 }
+inline SqlHelpers::DropTableQueryBuilder DROP_TABLE(const QString &name)
+{
+	return SqlHelpers::DropTableQueryBuilder().named(name);
+}
+inline SqlHelpers::CreateIndexQueryBuilder CREATE_INDEX(const QString &name)
+{
+	return SqlHelpers::CreateIndexQueryBuilder().named(name);
+}
 inline SqlHelpers::InsertQueryBuilder INSERT()
 {
 	return SqlHelpers::InsertQueryBuilder();
@@ -269,6 +418,10 @@ inline SqlHelpers::UpdateQueryBuilder UPDATE(const QString &table)
 {
 	return SqlHelpers::UpdateQueryBuilder().table(table);
 }
+inline SqlHelpers::DeleteQueryBuilder DELETE_FROM(const QString &table)
+{
+	return SqlHelpers::DeleteQueryBuilder().FROM(table);
+}
 
 }
 
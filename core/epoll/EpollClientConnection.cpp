@@ -0,0 +1,254 @@
+#include "EpollClientConnection.h"
+
+#include <QHostAddress>
+
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <unistd.h>
+#include <errno.h>
+#include <string.h>
+
+#include "common/Json.h"
+#include "common/JsonReader.h"
+#include "common/TcpUtils.h"
+#include "EpollWorker.h"
+#include "EpollServer.h"
+
+static constexpr int initialBufferSize = 16 * 1024;
+static constexpr qint64 maxPacketSize = 16 * 1024 * 1024;
+// for clients that don't read what they get, the session replays what they missed once they reconnect
+static constexpr int maxWriteBacklog = 64 * 1024 * 1024;
+
+EpollClientConnection::EpollClientConnection(int descriptor)
+	: AbstractClientConnection(nullptr), m_descriptor(descriptor)
+{
+	m_readBuffer.resize(initialBufferSize);
+	m_writeBuffer.reserve(initialBufferSize);
+}
+EpollClientConnection::~EpollClientConnection()
+{
+	if (m_descriptor != -1)
+	{
+		::close(m_descriptor);
+	}
+}
+
+void EpollClientConnection::setup()
+{
+	sockaddr_storage address;
+	socklen_t length = sizeof(address);
+	if (getpeername(m_descriptor, reinterpret_cast<sockaddr *>(&address), &length) == 0)
+	{
+		QHostAddress host(reinterpret_cast<sockaddr *>(&address));
+		const quint16 port = address.ss_family == AF_INET6 ? ntohs(reinterpret_cast<sockaddr_in6 *>(&address)->sin6_port)
+															: ntohs(reinterpret_cast<sockaddr_in *>(&address)->sin_port);
+		m_peer = EpollServer::formatAddress(host, port);
+	}
+
+	if (!m_worker->add(this))
+	{
+		close();
+		return;
+	}
+	qCDebug(Epoll) << "New TCP connection from" << m_peer;
+	enableKeepalive();
+	enableSessions();
+}
+
+void EpollClientConnection::toClient(const QJsonObject &obj)
+{
+	if (m_descriptor == -1)
+	{
+		return;
+	}
+	QByteArray packet;
+	TcpUtils::appendPacket(packet, Json::toBinary(obj));
+	queueData(packet.constData(), packet.size());
+	writable();
+}
+void EpollClientConnection::messageToClient(const Message &message)
+{
+	if (m_descriptor == -1)
+	{
+		return;
+	}
+	const QByteArray packet = message.encoded(Message::Packet);
+	if (m_writeStart < m_writeBuffer.size())
+	{
+		queueData(packet.constData(), packet.size());
+		writable();
+		return;
+	}
+	// nothing is queued, so the shared buffer is handed to the kernel as it is, only what doesn't fit gets copied
+	const int sent = sendData(packet.constData(), packet.size());
+	if (m_descriptor != -1 && sent < packet.size())
+	{
+		queueData(packet.constData() + sent, packet.size() - sent);
+	}
+}
+
+void EpollClientConnection::readable()
+{
+	while (m_descriptor != -1)
+	{
+		if (m_readEnd == m_readBuffer.size() && !makeRoom())
+		{
+			return;
+		}
+
+		const ssize_t received = ::recv(m_descriptor, m_readBuffer.data() + m_readEnd, m_readBuffer.size() - m_readEnd, 0);
+		if (received > 0)
+		{
+			m_readEnd += received;
+			// right away, so that the buffer only ever has to hold one packet
+			if (!handlePackets())
+			{
+				return;
+			}
+		}
+		else if (received == 0)
+		{
+			close();
+		}
+		else if (errno == EAGAIN || errno == EWOULDBLOCK)
+		{
+			break;
+		}
+		else if (errno != EINTR)
+		{
+			qCDebug(Epoll) << "Error reading from" << m_peer << ":" << strerror(errno);
+			close();
+		}
+	}
+}
+bool EpollClientConnection::makeRoom()
+{
+	if (m_readStart > 0)
+	{
+		memmove(m_readBuffer.data(), m_readBuffer.constData() + m_readStart, m_readEnd - m_readStart);
+		m_readEnd -= m_readStart;
+		m_readStart = 0;
+		return true;
+	}
+	// the buffer is full with the start of one packet, whose size handlePackets has already checked
+	const qint64 size = TcpUtils::announcedPacketSize(m_readBuffer.constData(), m_readEnd);
+	if (size == -1 || size > maxPacketSize)
+	{
+		close();
+		return false;
+	}
+	m_readBuffer.resize(int(qMin(qint64(m_readBuffer.size()) * 2, TcpUtils::headerSize + size)));
+	return true;
+}
+bool EpollClientConnection::handlePackets()
+{
+	while (m_descriptor != -1 && m_readStart < m_readEnd)
+	{
+		const char *start = m_readBuffer.constData() + m_readStart;
+		const qint64 available = m_readEnd - m_readStart;
+		const qint64 size = TcpUtils::announcedPacketSize(start, available);
+		if (size > maxPacketSize)
+		{
+			qCWarning(Epoll) << m_peer << "announced a packet of" << size << "bytes, closing connection";
+			close();
+			return false;
+		}
+		else if (size == -1 || available - TcpUtils::headerSize < size)
+		{
+			break;
+		}
+		m_readStart += TcpUtils::headerSize + size;
+		handlePacket(QByteArray(start + TcpUtils::headerSize, size));
+	}
+	if (m_readStart == m_readEnd)
+	{
+		m_readStart = m_readEnd = 0;
+		// don't hold on to what a large packet needed
+		if (m_readBuffer.size() > initialBufferSize)
+		{
+			m_readBuffer.resize(initialBufferSize);
+			m_readBuffer.squeeze();
+		}
+	}
+	return m_descriptor != -1;
+}
+void EpollClientConnection::writable()
+{
+	m_writeStart += sendData(m_writeBuffer.constData() + m_writeStart, m_writeBuffer.size() - m_writeStart);
+	if (m_writeStart == m_writeBuffer.size())
+	{
+		// the capacity is reserved, so this keeps the allocation around
+		m_writeBuffer.resize(0);
+		m_writeStart = 0;
+	}
+	else if (m_writeStart > m_writeBuffer.size() / 2)
+	{
+		m_writeBuffer.remove(0, m_writeStart);
+		m_writeStart = 0;
+	}
+}
+
+void EpollClientConnection::queueData(const char *data, const int size)
+{
+	if (m_writeBuffer.size() - m_writeStart + size > maxWriteBacklog)
+	{
+		qCWarning(Epoll) << m_peer << "is not keeping up with what it gets, closing connection";
+		close();
+		return;
+	}
+	m_writeBuffer.append(data, size);
+}
+
+int EpollClientConnection::sendData(const char *data, const int size)
+{
+	int sent = 0;
+	while (m_descriptor != -1 && sent < size)
+	{
+		const ssize_t result = ::send(m_descriptor, data + sent, size - sent, MSG_NOSIGNAL);
+		if (result >= 0)
+		{
+			sent += result;
+		}
+		else if (errno == EAGAIN || errno == EWOULDBLOCK)
+		{
+			// we'll get an EPOLLOUT once there is room again
+			break;
+		}
+		else if (errno != EINTR)
+		{
+			qCDebug(Epoll) << "Error writing to" << m_peer << ":" << strerror(errno);
+			close();
+		}
+	}
+	return sent;
+}
+
+void EpollClientConnection::handlePacket(const QByteArray &packet)
+{
+	QString channel;
+	QUuid messageId;
+	try
+	{
+		const Json::LazyObject message(packet);
+		channel = Json::ensureString(message.value("channel"), Json::Required, "'channel'");
+		messageId = Json::ensureUuid(message.value("msgId"), Json::Required, "'msgId'");
+		fromClient(message);
+	}
+	catch (Exception &e)
+	{
+		receive(channel, "error", {{"error", e.message()}}, messageId);
+	}
+}
+
+void EpollClientConnection::close()
+{
+	if (m_descriptor == -1)
+	{
+		return;
+	}
+	qCDebug(Epoll) << m_peer << "disconnected";
+	m_worker->remove(this);
+	::close(m_descriptor);
+	m_descriptor = -1;
+	detach();
+}
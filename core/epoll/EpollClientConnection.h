@@ -0,0 +1,49 @@
+#pragma once
+
+#include "core/AbstractClientConnection.h"
+
+class EpollWorker;
+
+class EpollClientConnection : public AbstractClientConnection
+{
+	Q_OBJECT
+public:
+	explicit EpollClientConnection(int descriptor);
+	~EpollClientConnection();
+
+	void setWorker(EpollWorker *worker) { m_worker = worker; }
+	Q_INVOKABLE void setup();
+
+	int descriptor() const { return m_descriptor; }
+
+	/// Called by EpollWorker. Since the socket is edge-triggered these keep going until the kernel has nothing more for us
+	void readable();
+	void writable();
+
+protected:
+	void toClient(const QJsonObject &obj) override;
+	void messageToClient(const Message &message) override;
+	void disconnectClient() override { close(); }
+
+private:
+	int m_descriptor;
+	EpollWorker *m_worker = nullptr;
+	QString m_peer;
+
+	QByteArray m_readBuffer;
+	int m_readStart = 0;
+	int m_readEnd = 0;
+	QByteArray m_writeBuffer;
+	int m_writeStart = 0;
+
+	/// Returns how much of data the kernel took
+	int sendData(const char *data, const int size);
+	/// Queues what the kernel didn't take, closes the connection if the client has fallen too far behind
+	void queueData(const char *data, const int size);
+	/// Makes room at the end of the read buffer. Returns false if the connection has been closed
+	bool makeRoom();
+	/// Handles the packets that have been received completely. Returns false if the connection has been closed
+	bool handlePackets();
+	void handlePacket(const QByteArray &packet);
+	void close();
+};
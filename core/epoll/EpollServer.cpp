@@ -0,0 +1,75 @@
+#include "EpollServer.h"
+
+#include <QTcpServer>
+#include <QThread>
+
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <fcntl.h>
+
+#include "core/WorkerPool.h"
+#include "EpollWorker.h"
+#include "EpollClientConnection.h"
+
+Q_LOGGING_CATEGORY(Epoll, "core.epoll")
+
+class EpollServerImpl : public QTcpServer
+{
+public:
+	explicit EpollServerImpl(EpollServer *server, WorkerPool *workers, const QVector<EpollWorker *> &epollWorkers, QObject *parent = nullptr)
+		: QTcpServer(parent), m_server(server), m_workers(workers), m_epollWorkers(epollWorkers) {}
+
+protected:
+	void incomingConnection(qintptr handle)
+	{
+		fcntl(handle, F_SETFL, fcntl(handle, F_GETFL) | O_NONBLOCK);
+		const int noDelay = 1;
+		setsockopt(handle, IPPROTO_TCP, TCP_NODELAY, &noDelay, sizeof(noDelay));
+
+		EpollClientConnection *connection = new EpollClientConnection(handle);
+		connection->setWorker(m_epollWorkers.at(m_workers->assign(connection)));
+		QMetaObject::invokeMethod(connection, "setup", Qt::QueuedConnection);
+
+		emit m_server->newConnection(connection);
+	}
+
+private:
+	EpollServer *m_server;
+	WorkerPool *m_workers;
+	QVector<EpollWorker *> m_epollWorkers;
+};
+
+EpollServer::EpollServer(const QHostAddress &address, const quint16 port, const int threads, QObject *parent)
+	: AbstractClientConnection(parent), m_address(address), m_port(port), m_threads(threads)
+{
+}
+
+void EpollServer::ready()
+{
+	m_workers = new WorkerPool("tcp-epoll", m_threads, this);
+	for (int i = 0; i < m_workers->size(); ++i)
+	{
+		EpollWorker *worker = new EpollWorker;
+		worker->moveToThread(m_workers->thread(i));
+		connect(m_workers->thread(i), &QThread::finished, worker, &EpollWorker::deleteLater);
+		QMetaObject::invokeMethod(worker, "setup", Qt::QueuedConnection);
+		m_epollWorkers.append(worker);
+	}
+
+	m_server = new EpollServerImpl(this, m_workers, m_epollWorkers, this);
+	if (!m_server->listen(m_address, m_port))
+	{
+		qWarning(Epoll) << "Unable to start TCP server:" << m_server->errorString();
+		thread()->exit(1);
+	}
+	else
+	{
+		qCDebug(Epoll) << "TCP server (epoll) started on" << formatAddress(m_server->serverAddress(), m_server->serverPort()) << "with" << m_workers->size() << "worker threads";
+	}
+}
+
+QString EpollServer::formatAddress(const QHostAddress &address, const quint16 port)
+{
+	return QString("%1:%2").arg(address.toString()).arg(port);
+}
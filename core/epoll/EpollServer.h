@@ -0,0 +1,33 @@
+#pragma once
+
+#include <QHostAddress>
+#include "core/AbstractClientConnection.h"
+
+class EpollWorker;
+class WorkerPool;
+
+/// Alternative to TcpServer that multiplexes many connections per thread using edge-triggered epoll
+class EpollServer : public AbstractClientConnection
+{
+	Q_OBJECT
+public:
+	explicit EpollServer(const QHostAddress &address, const quint16 port, const int threads, QObject *parent = nullptr);
+
+	void ready() override;
+
+	static QString formatAddress(const QHostAddress &address, const quint16 port);
+
+protected:
+	void toClient(const QJsonObject &obj) override {}
+
+private:
+	QHostAddress m_address;
+	quint16 m_port;
+	int m_threads;
+
+	class EpollServerImpl *m_server;
+	WorkerPool *m_workers;
+	QVector<EpollWorker *> m_epollWorkers;
+};
+
+Q_DECLARE_LOGGING_CATEGORY(Epoll)
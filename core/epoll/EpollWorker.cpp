@@ -0,0 +1,78 @@
+#include "EpollWorker.h"
+
+#include <QSocketNotifier>
+
+#include <unistd.h>
+#include <errno.h>
+#include <string.h>
+
+#include "EpollClientConnection.h"
+#include "EpollServer.h"
+
+static constexpr int maxEventsPerWait = 256;
+
+EpollWorker::EpollWorker(QObject *parent)
+	: QObject(parent), m_events(maxEventsPerWait)
+{
+	m_epoll = epoll_create1(EPOLL_CLOEXEC);
+	if (m_epoll == -1)
+	{
+		qCCritical(Epoll) << "Unable to create epoll instance:" << strerror(errno);
+	}
+}
+EpollWorker::~EpollWorker()
+{
+	if (m_epoll != -1)
+	{
+		::close(m_epoll);
+	}
+}
+
+void EpollWorker::setup()
+{
+	// the epoll descriptor becomes readable as soon as any of the registered sockets has an event,
+	// so a single notifier is enough to hook all of them into the event loop of this thread
+	m_notifier = new QSocketNotifier(m_epoll, QSocketNotifier::Read, this);
+	connect(m_notifier, &QSocketNotifier::activated, this, &EpollWorker::activated);
+}
+
+bool EpollWorker::add(EpollClientConnection *connection)
+{
+	epoll_event event;
+	event.events = EPOLLIN | EPOLLOUT | EPOLLRDHUP | EPOLLET;
+	event.data.ptr = connection;
+	if (epoll_ctl(m_epoll, EPOLL_CTL_ADD, connection->descriptor(), &event) == -1)
+	{
+		qCWarning(Epoll) << "Unable to add socket to epoll instance:" << strerror(errno);
+		return false;
+	}
+	return true;
+}
+void EpollWorker::remove(EpollClientConnection *connection)
+{
+	epoll_ctl(m_epoll, EPOLL_CTL_DEL, connection->descriptor(), nullptr);
+}
+
+void EpollWorker::activated()
+{
+	int count;
+	do
+	{
+		count = epoll_wait(m_epoll, m_events.data(), m_events.size(), 0);
+		for (int i = 0; i < count; ++i)
+		{
+			const epoll_event &event = m_events.at(i);
+			EpollClientConnection *connection = static_cast<EpollClientConnection *>(event.data.ptr);
+			if (event.events & EPOLLOUT)
+			{
+				connection->writable();
+			}
+			if (event.events & (EPOLLIN | EPOLLRDHUP | EPOLLHUP | EPOLLERR))
+			{
+				// readable() also takes care of closing the connection if the peer is gone
+				connection->readable();
+			}
+		}
+	}
+	while (count == m_events.size());
+}
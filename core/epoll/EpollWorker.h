@@ -0,0 +1,31 @@
+#pragma once
+
+#include <QObject>
+#include <QVector>
+
+#include <sys/epoll.h>
+
+class QSocketNotifier;
+class EpollClientConnection;
+
+/// Owns one edge-triggered epoll set and dispatches its events from the event loop of the thread it lives in
+class EpollWorker : public QObject
+{
+	Q_OBJECT
+public:
+	explicit EpollWorker(QObject *parent = nullptr);
+	~EpollWorker();
+
+	Q_INVOKABLE void setup();
+
+	bool add(EpollClientConnection *connection);
+	void remove(EpollClientConnection *connection);
+
+private slots:
+	void activated();
+
+private:
+	int m_epoll = -1;
+	QSocketNotifier *m_notifier = nullptr;
+	QVector<epoll_event> m_events;
+};
@@ -10,6 +10,7 @@
 
 #include "IrcMessageFormatter.h"
 #include "common/Json.h"
+#include "common/JsonWriter.h"
 #include "core/SyncableList.h"
 
 IrcWrappedChannel::IrcWrappedChannel(IrcBuffer *buffer, const QString &parentId, QObject *parent)
@@ -288,14 +289,20 @@ void IrcServer::messageReceived(IrcMessage *msg)
 	{
 		return;
 	}
+	static const Json::Key contentKey("content");
+	static const Json::Key fromKey("from");
+	static const Json::Key typeKey("type");
+	static const Json::Key timestampKey("timestamp");
+	const QString channel = "chat:channel:" + m_bufferIds[buffer];
 	for (const QString &line : lines)
 	{
-		emit broadcast("chat:channel:" + m_bufferIds[buffer], "message", {
-						   {"content", line},
-						   {"from", from},
-						   {"type", type},
-						   {"timestamp", timestamp}
-					   });
+		emit route(Message::encode(channel, "message", [&](Json::Writer &writer)
+		{
+			writer.value(contentKey, line)
+					.value(fromKey, from)
+					.value(typeKey, type)
+					.value(timestampKey, timestamp);
+		}));
 	}
 }
 
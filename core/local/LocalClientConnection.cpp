@@ -0,0 +1,107 @@
+#include "LocalClientConnection.h"
+
+#include <QLocalSocket>
+
+#include <sys/types.h>
+#include <sys/socket.h>
+
+#include "common/Json.h"
+#include "common/JsonReader.h"
+#include "common/TcpUtils.h"
+#include "LocalServer.h"
+
+LocalClientConnection::LocalClientConnection(quintptr handle, const QSet<uint> &allowedUids)
+	: AbstractClientConnection(nullptr), m_handle(handle), m_allowedUids(allowedUids)
+{
+}
+
+void LocalClientConnection::setup()
+{
+	m_socket = new QLocalSocket(this);
+	connect(m_socket, &QLocalSocket::readyRead, this, &LocalClientConnection::readyRead);
+	connect(m_socket, &QLocalSocket::disconnected, this, &LocalClientConnection::disconnected);
+	m_socket->setSocketDescriptor(m_handle);
+
+	if (!checkCredentials())
+	{
+		m_socket->abort();
+		return;
+	}
+	qCDebug(Local) << "New local connection from" << m_peer;
+	enableKeepalive();
+	enableSessions();
+}
+
+bool LocalClientConnection::checkCredentials()
+{
+#ifdef SO_PEERCRED
+	// the kernel vouches for the identity of the peer, so this replaces any password based authentication
+	ucred credentials;
+	socklen_t length = sizeof(credentials);
+	if (getsockopt(m_handle, SOL_SOCKET, SO_PEERCRED, &credentials, &length) != 0)
+	{
+		qCWarning(Local) << "Unable to get credentials of local peer, rejecting";
+		return false;
+	}
+	m_peer = QString("pid %1 (uid %2)").arg(credentials.pid).arg(credentials.uid);
+	if (!m_allowedUids.isEmpty() && !m_allowedUids.contains(credentials.uid))
+	{
+		qCWarning(Local) << "Rejecting local connection from" << m_peer;
+		return false;
+	}
+	return true;
+#else
+	m_peer = QString("socket %1").arg(m_handle);
+	return m_allowedUids.isEmpty();
+#endif
+}
+
+void LocalClientConnection::toClient(const QJsonObject &obj)
+{
+	if (m_socket && m_socket->state() == QLocalSocket::ConnectedState)
+	{
+		TcpUtils::writePacket(m_socket, Json::toBinary(obj));
+	}
+}
+void LocalClientConnection::messageToClient(const Message &message)
+{
+	if (m_socket && m_socket->state() == QLocalSocket::ConnectedState)
+	{
+		m_socket->write(message.encoded(Message::Packet));
+	}
+}
+
+void LocalClientConnection::disconnectClient()
+{
+	if (m_socket)
+	{
+		m_socket->abort();
+	}
+}
+
+void LocalClientConnection::readyRead()
+{
+	while (m_socket->bytesAvailable() > 0)
+	{
+		QString channel;
+		QUuid messageId;
+		try
+		{
+			const Json::LazyObject message(TcpUtils::readPacket(m_socket));
+			channel = Json::ensureString(message.value("channel"), Json::Required, "'channel'");
+			messageId = Json::ensureUuid(message.value("msgId"), Json::Required, "'msgId'");
+			fromClient(message);
+		}
+		catch (Exception &e)
+		{
+			receive(channel, "error", {{"error", e.message()}}, messageId);
+		}
+	}
+}
+
+void LocalClientConnection::disconnected()
+{
+	qCDebug(Local) << m_peer << "disconnected";
+	m_socket = nullptr;
+	detach();
+}
@@ -0,0 +1,32 @@
+#pragma once
+
+#include <QSet>
+#include "core/AbstractClientConnection.h"
+
+class QLocalSocket;
+
+class LocalClientConnection : public AbstractClientConnection
+{
+	Q_OBJECT
+public:
+	explicit LocalClientConnection(quintptr handle, const QSet<uint> &allowedUids);
+
+	Q_INVOKABLE void setup();
+
+protected:
+	void toClient(const QJsonObject &obj) override;
+	void messageToClient(const Message &message) override;
+	void disconnectClient() override;
+
+private slots:
+	void readyRead();
+	void disconnected();
+
+private:
+	quintptr m_handle;
+	QSet<uint> m_allowedUids;
+	QLocalSocket *m_socket = nullptr;
+	QString m_peer;
+
+	bool checkCredentials();
+};
@@ -0,0 +1,55 @@
+#include "LocalPlugin.h"
+
+#include <QDebug>
+
+#include <unistd.h>
+
+#include "LocalServer.h"
+
+static bool parseUids(const QString &value, QSet<uint> *uids)
+{
+	if (value == "*")
+	{
+		return true;
+	}
+	for (const QString &item : value.split(',', QString::SkipEmptyParts))
+	{
+		bool ok = false;
+		const uint uid = item.trimmed().toUInt(&ok);
+		if (!ok)
+		{
+			return false;
+		}
+		uids->insert(uid);
+	}
+	return true;
+}
+
+QList<QCommandLineOption> LocalPlugin::cliOptions() const
+{
+	return QList<QCommandLineOption>()
+			<< QCommandLineOption("local-socket", "The name or path of the local socket to listen on, empty to disable", "PATH", "talktalk-core")
+			<< QCommandLineOption("local-allowed-uids", "Comma separated list of user ids that may connect through the local socket, * for everyone", "UIDS", QString::number(getuid()));
+}
+
+bool LocalPlugin::handleArguments(const QCommandLineParser &parser, int *exitCode) const
+{
+	QSet<uint> uids;
+	if (!parseUids(parser.value("local-allowed-uids"), &uids))
+	{
+		qWarning() << "Invalid value for --local-allowed-uids:" << parser.value("local-allowed-uids");
+		return false;
+	}
+	return true;
+}
+
+QList<AbstractClientConnection *> LocalPlugin::clients(const QCommandLineParser &parser) const
+{
+	if (parser.value("local-socket").isEmpty())
+	{
+		return {};
+	}
+	QSet<uint> uids;
+	parseUids(parser.value("local-allowed-uids"), &uids);
+	return QList<AbstractClientConnection *>() << new LocalServer(parser.value("local-socket"), uids);
+}
@@ -0,0 +1,58 @@
+#include "LocalServer.h"
+
+#include <QLocalServer>
+#include <QThread>
+
+#include <unistd.h>
+
+#include "LocalClientConnection.h"
+
+Q_LOGGING_CATEGORY(Local, "core.local")
+
+class LocalServerImpl : public QLocalServer
+{
+public:
+	explicit LocalServerImpl(LocalServer *server, const QSet<uint> &allowedUids, QObject *parent = nullptr)
+		: QLocalServer(parent), m_server(server), m_allowedUids(allowedUids) {}
+
+protected:
+	void incomingConnection(quintptr handle) override
+	{
+		LocalClientConnection *connection = new LocalClientConnection(handle, m_allowedUids);
+		QThread *thread = new QThread;
+		connection->moveToThread(thread);
+		connect(connection, &LocalClientConnection::destroyed, thread, [thread](){thread->exit();});
+		QMetaObject::invokeMethod(connection, "setup", Qt::QueuedConnection);
+		thread->start();
+
+		emit m_server->newConnection(connection);
+	}
+
+private:
+	LocalServer *m_server;
+	QSet<uint> m_allowedUids;
+};
+
+LocalServer::LocalServer(const QString &name, const QSet<uint> &allowedUids, QObject *parent)
+	: AbstractClientConnection(parent), m_name(name), m_allowedUids(allowedUids), m_server(new LocalServerImpl(this, allowedUids, this))
+{
+}
+
+void LocalServer::ready()
+{
+	// if only we may connect nobody else needs to be able to reach the socket. Other users that are allowed need
+	// access to it, so for them it is left to LocalClientConnection to check the credentials of the peer
+	const bool onlyUs = m_allowedUids == QSet<uint>{uint(getuid())};
+	m_server->setSocketOptions(onlyUs ? QLocalServer::UserAccessOption : QLocalServer::WorldAccessOption);
+	// clean up after a previous instance that didn't exit cleanly
+	QLocalServer::removeServer(m_name);
+	if (!m_server->listen(m_name))
+	{
+		qWarning(Local) << "Unable to start local server:" << m_server->errorString();
+		thread()->exit(1);
+	}
+	else
+	{
+		qCDebug(Local) << "Local server started on" << m_server->fullServerName();
+	}
+}
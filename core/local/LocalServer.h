@@ -0,0 +1,25 @@
+#pragma once
+
+#include <QSet>
+#include "core/AbstractClientConnection.h"
+
+class LocalServer : public AbstractClientConnection
+{
+	Q_OBJECT
+public:
+	/// An empty allowedUids means that everyone may connect
+	explicit LocalServer(const QString &name, const QSet<uint> &allowedUids, QObject *parent = nullptr);
+
+	void ready() override;
+
+protected:
+	void toClient(const QJsonObject &obj) override {}
+
+private:
+	QString m_name;
+	QSet<uint> m_allowedUids;
+
+	class LocalServerImpl *m_server;
+};
+
+Q_DECLARE_LOGGING_CATEGORY(Local)
@@ -3,15 +3,25 @@
 #include <QDebug>
 #include <QJsonArray>
 #include <QThread>
+#include <QSocketNotifier>
 #include <QtPlugin>
 
 #include "ConnectionManager.h"
 #include "AbstractClientConnection.h"
+#include "Session.h"
 
 #ifdef TALKTALK_CORE_TCP
 # include "tcp/TcpPlugin.h"
 #endif
 
+#ifdef TALKTALK_CORE_LOCAL
+# include "local/LocalPlugin.h"
+#endif
+
+#ifdef TALKTALK_CORE_SHM
+# include "shm/ShmPlugin.h"
+#endif
+
 #ifdef TALKTALK_CORE_WEBSOCKETS
 # include "websockets/WebSocketsPlugin.h"
 #endif
@@ -26,6 +36,7 @@
 
 #ifdef Q_OS_UNIX
 #include <signal.h>
+#include <unistd.h>
 
 static void handleSignal(int sig, siginfo_t *si, void *unused)
 {
@@ -35,6 +46,15 @@ static void handleSignal(int sig, siginfo_t *si, void *unused)
 	}
 	abort();
 }
+
+// quitting isn't safe from within a signal handler, so it's forwarded to the event loop through a pipe
+static int quitPipe[2];
+static void handleQuitSignal(int)
+{
+	const char c = 1;
+	ssize_t ret = ::write(quitPipe[1], &c, sizeof(c));
+	Q_UNUSED(ret)
+}
 #endif
 
 static void setupMainClient(ConnectionManager *mngr, AbstractClientConnection *client)
@@ -66,6 +86,21 @@ int main(int argc, char **argv)
 	app.setApplicationName("TalkTalkCore");
 	app.setOrganizationName("Jan Dalheimer");
 
+#ifdef Q_OS_UNIX
+	// shut down cleanly on SIGINT and SIGTERM, so that for example the backlog gets written
+	if (::pipe(quitPipe) == 0)
+	{
+		QSocketNotifier *notifier = new QSocketNotifier(quitPipe[0], QSocketNotifier::Read, &app);
+		QObject::connect(notifier, &QSocketNotifier::activated, &app, &QCoreApplication::quit);
+		struct sigaction quitAction;
+		memset(&quitAction, 0, sizeof(struct sigaction));
+		quitAction.sa_handler = handleQuitSignal;
+		sigemptyset(&quitAction.sa_mask);
+		sigaction(SIGINT, &quitAction, NULL);
+		sigaction(SIGTERM, &quitAction, NULL);
+	}
+#endif
+
 	QList<Plugin *> plugins;
 	plugins
 		#ifdef TALKTALK_CORE_WEBSOCKETS
@@ -74,6 +109,12 @@ int main(int argc, char **argv)
 		   #ifdef TALKTALK_CORE_TCP
 			<< new TcpPlugin
 		   #endif
+		   #ifdef TALKTALK_CORE_LOCAL
+			<< new LocalPlugin
+		   #endif
+		   #ifdef TALKTALK_CORE_SHM
+			<< new ShmPlugin
+		   #endif
 		   #ifdef TALKTALK_CORE_IRC
 			<< new IrcPlugin
 		   #endif
@@ -85,17 +126,25 @@ int main(int argc, char **argv)
 	QCommandLineParser parser;
 	parser.addHelpOption();
 	parser.addVersionOption();
+	parser.addOption(QCommandLineOption("idle-timeout", "Disconnect clients that have not sent anything for this many seconds (0 to disable)", "SECONDS", "120"));
+	parser.addOption(QCommandLineOption("heartbeat-interval", "Ping clients that have not sent anything for this many seconds (0 to disable)", "SECONDS", "30"));
+	parser.addOption(QCommandLineOption("session-replay-time", "Keep sessions of disconnected clients, and messages for them to catch up on, for this many seconds (0 to disable)", "SECONDS", "120"));
+	parser.addOption(QCommandLineOption("session-replay-size", "Maximum size of the messages kept per session", "KIB", "1024"));
 	for (const Plugin *plugin : plugins)
 	{
 		parser.addOptions(plugin->cliOptions());
 	}
 	parser.process(app);
 
+	AbstractClientConnection::setKeepalive(parser.value("idle-timeout").toInt() * 1000, parser.value("heartbeat-interval").toInt() * 1000);
+	Session::setLimits(parser.value("session-replay-size").toLongLong() * 1024, parser.value("session-replay-time").toInt() * 1000);
+
 	for (const Plugin *plugin : plugins)
 	{
-		if (!plugin->handleArguments(parser))
+		int exitCode = 1;
+		if (!plugin->handleArguments(parser, &exitCode))
 		{
-			return 0;
+			return exitCode;
 		}
 	}
 
@@ -0,0 +1,107 @@
+#include "ShmClientConnection.h"
+
+#include "common/Json.h"
+#include "common/JsonReader.h"
+#include "common/ShmChannel.h"
+#include "ShmServer.h"
+
+ShmClientConnection::ShmClientConnection(quintptr handle, const quint32 ringSize)
+	: AbstractClientConnection(nullptr), m_handle(handle), m_ringSize(ringSize)
+{
+}
+
+void ShmClientConnection::setup()
+{
+	try
+	{
+		m_channel = ShmChannel::accept(m_handle, m_ringSize, this);
+	}
+	catch (Exception &e)
+	{
+		qCWarning(Shm) << "Unable to set up shared memory connection:" << e.message();
+		deleteLater();
+		return;
+	}
+	connect(m_channel, &ShmChannel::readyRead, this, &ShmClientConnection::readyRead);
+	connect(m_channel, &ShmChannel::disconnected, this, &ShmClientConnection::disconnected);
+	qCDebug(Shm) << "New shared memory connection";
+	enableKeepalive();
+	enableSessions();
+}
+
+void ShmClientConnection::toClient(const QJsonObject &obj)
+{
+	if (!m_channel)
+	{
+		return;
+	}
+	try
+	{
+		m_channel->send(Json::toBinary(obj));
+	}
+	catch (ShmException &e)
+	{
+		qCWarning(Shm) << "Dropping message:" << e.message();
+	}
+}
+void ShmClientConnection::messageToClient(const Message &message)
+{
+	if (!m_channel)
+	{
+		return;
+	}
+	try
+	{
+		m_channel->send(message.encoded(Message::Text));
+	}
+	catch (ShmException &e)
+	{
+		qCWarning(Shm) << "Dropping message:" << e.message();
+	}
+}
+
+void ShmClientConnection::readyRead()
+{
+	if (!m_channel)
+	{
+		return;
+	}
+	QByteArray packet;
+	try
+	{
+		while (m_channel->receive(&packet))
+		{
+			QString channel;
+			QUuid messageId;
+			try
+			{
+				const Json::LazyObject message(packet);
+				channel = Json::ensureString(message.value("channel"), Json::Required, "'channel'");
+				messageId = Json::ensureUuid(message.value("msgId"), Json::Required, "'msgId'");
+				fromClient(message);
+			}
+			catch (Exception &e)
+			{
+				receive(channel, "error", {{"error", e.message()}}, messageId);
+			}
+		}
+	}
+	catch (ShmException &e)
+	{
+		qCWarning(Shm) << "Closing shared memory connection:" << e.message();
+		disconnected();
+	}
+}
+
+void ShmClientConnection::disconnected()
+{
+	if (!m_channel)
+	{
+		return;
+	}
+	qCDebug(Shm) << "Shared memory connection closed";
+	// we might be inside one of its signals
+	m_channel->deleteLater();
+	m_channel = nullptr;
+	detach();
+}
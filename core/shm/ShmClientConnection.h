@@ -0,0 +1,28 @@
+#pragma once
+
+#include "core/AbstractClientConnection.h"
+
+class ShmChannel;
+
+class ShmClientConnection : public AbstractClientConnection
+{
+	Q_OBJECT
+public:
+	explicit ShmClientConnection(quintptr handle, const quint32 ringSize);
+
+	Q_INVOKABLE void setup();
+
+protected:
+	void toClient(const QJsonObject &obj) override;
+	void messageToClient(const Message &message) override;
+	void disconnectClient() override { disconnected(); }
+
+private slots:
+	void readyRead();
+	void disconnected();
+
+private:
+	quintptr m_handle;
+	quint32 m_ringSize;
+	ShmChannel *m_channel = nullptr;
+};
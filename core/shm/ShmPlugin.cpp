@@ -0,0 +1,19 @@
+#include "ShmPlugin.h"
+
+#include "ShmServer.h"
+
+QList<QCommandLineOption> ShmPlugin::cliOptions() const
+{
+	return QList<QCommandLineOption>()
+			<< QCommandLineOption("shm-socket", "The name or path of the socket shared memory clients rendezvous on, empty to disable", "PATH", "talktalk-core-shm")
+			<< QCommandLineOption("shm-ring-size", "The size in KiB of each of the two rings of a shared memory connection", "KIB", "1024");
+}
+
+QList<AbstractClientConnection *> ShmPlugin::clients(const QCommandLineParser &parser) const
+{
+	if (parser.value("shm-socket").isEmpty())
+	{
+		return {};
+	}
+	return QList<AbstractClientConnection *>() << new ShmServer(parser.value("shm-socket"), parser.value("shm-ring-size").toUInt() * 1024);
+}
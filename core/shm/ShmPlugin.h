@@ -0,0 +1,11 @@
+#pragma once
+
+#include "core/Plugin.h"
+
+class ShmPlugin : public Plugin
+{
+public:
+	QList<QCommandLineOption> cliOptions() const override;
+	bool handleArguments(const QCommandLineParser &parser, int *exitCode) const override { return true; }
+	QList<AbstractClientConnection *> clients(const QCommandLineParser &parser) const override;
+};
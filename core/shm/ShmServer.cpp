@@ -0,0 +1,54 @@
+#include "ShmServer.h"
+
+#include <QLocalServer>
+#include <QThread>
+
+#include "ShmClientConnection.h"
+
+Q_LOGGING_CATEGORY(Shm, "core.shm")
+
+class ShmServerImpl : public QLocalServer
+{
+public:
+	explicit ShmServerImpl(ShmServer *server, const quint32 ringSize, QObject *parent = nullptr)
+		: QLocalServer(parent), m_server(server), m_ringSize(ringSize) {}
+
+protected:
+	// the socket is only used for handing over the segment, so we take the raw descriptor instead of a QLocalSocket
+	void incomingConnection(quintptr handle) override
+	{
+		ShmClientConnection *connection = new ShmClientConnection(handle, m_ringSize);
+		QThread *thread = new QThread;
+		connection->moveToThread(thread);
+		connect(connection, &ShmClientConnection::destroyed, thread, [thread](){thread->exit();});
+		QMetaObject::invokeMethod(connection, "setup", Qt::QueuedConnection);
+		thread->start();
+
+		emit m_server->newConnection(connection);
+	}
+
+private:
+	ShmServer *m_server;
+	quint32 m_ringSize;
+};
+
+ShmServer::ShmServer(const QString &name, const quint32 ringSize, QObject *parent)
+	: AbstractClientConnection(parent), m_name(name), m_ringSize(ringSize), m_server(new ShmServerImpl(this, ringSize, this))
+{
+}
+
+void ShmServer::ready()
+{
+	// whoever can connect gets full access to the segment, so keep it to our own user
+	m_server->setSocketOptions(QLocalServer::UserAccessOption);
+	QLocalServer::removeServer(m_name);
+	if (!m_server->listen(m_name))
+	{
+		qWarning(Shm) << "Unable to start shared memory server:" << m_server->errorString();
+		thread()->exit(1);
+	}
+	else
+	{
+		qCDebug(Shm) << "Shared memory server started on" << m_server->fullServerName();
+	}
+}
@@ -0,0 +1,23 @@
+#pragma once
+
+#include "core/AbstractClientConnection.h"
+
+class ShmServer : public AbstractClientConnection
+{
+	Q_OBJECT
+public:
+	explicit ShmServer(const QString &name, const quint32 ringSize, QObject *parent = nullptr);
+
+	void ready() override;
+
+protected:
+	void toClient(const QJsonObject &obj) override {}
+
+private:
+	QString m_name;
+	quint32 m_ringSize;
+
+	class ShmServerImpl *m_server;
+};
+
+Q_DECLARE_LOGGING_CATEGORY(Shm)
@@ -3,6 +3,7 @@
 #include <QTcpSocket>
 
 #include "common/Json.h"
+#include "common/JsonReader.h"
 #include "common/TcpUtils.h"
 #include "TcpServer.h"
 
@@ -18,11 +19,31 @@ void TcpClientConnection::setup()
 	connect(m_socket, &QTcpSocket::disconnected, this, &TcpClientConnection::disconnected);
 	m_socket->setSocketDescriptor(m_handle);
 	qCDebug(Tcp) << "New TCP connection from" << TcpServer::formatAddress(m_socket->peerAddress(), m_socket->peerPort());
+	enableKeepalive();
+	enableSessions();
 }
 
 void TcpClientConnection::toClient(const QJsonObject &obj)
 {
-	TcpUtils::writePacket(m_socket, Json::toBinary(obj));
+	if (m_socket && m_socket->state() == QAbstractSocket::ConnectedState)
+	{
+		TcpUtils::writePacket(m_socket, Json::toBinary(obj));
+	}
+}
+void TcpClientConnection::messageToClient(const Message &message)
+{
+	if (m_socket && m_socket->state() == QAbstractSocket::ConnectedState)
+	{
+		m_socket->write(message.encoded(Message::Packet));
+	}
+}
+
+void TcpClientConnection::disconnectClient()
+{
+	if (m_socket)
+	{
+		m_socket->abort();
+	}
 }
 
 void TcpClientConnection::readyRead()
@@ -33,10 +54,10 @@ void TcpClientConnection::readyRead()
 		QUuid messageId;
 		try
 		{
-			const QJsonObject obj = Json::ensureObject(Json::ensureDocument(TcpUtils::readPacket(m_socket)));
-			channel = Json::ensureString(obj, "channel");
-			messageId = Json::ensureUuid(obj, "msgId");
-			fromClient(obj);
+			const Json::LazyObject message(TcpUtils::readPacket(m_socket));
+			channel = Json::ensureString(message.value("channel"), Json::Required, "'channel'");
+			messageId = Json::ensureUuid(message.value("msgId"), Json::Required, "'msgId'");
+			fromClient(message);
 		}
 		catch (Exception &e)
 		{
@@ -49,5 +70,5 @@ void TcpClientConnection::disconnected()
 {
 	qCDebug(Tcp) << TcpServer::formatAddress(m_socket->peerAddress(), m_socket->peerPort()) << "disconnected";
 	m_socket = nullptr;
-	deleteLater();
+	detach();
 }
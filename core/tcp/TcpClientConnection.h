@@ -14,6 +14,8 @@ public:
 
 protected:
 	void toClient(const QJsonObject &obj) override;
+	void messageToClient(const Message &message) override;
+	void disconnectClient() override;
 
 private slots:
 	void readyRead();
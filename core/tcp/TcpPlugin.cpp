@@ -1,15 +1,50 @@
 #include "TcpPlugin.h"
 
+#include <QThread>
+#include <QDebug>
+
 #include "TcpServer.h"
+#ifdef TALKTALK_CORE_EPOLL
+# include "core/epoll/EpollServer.h"
+#endif
+
+static QStringList engines()
+{
+	return QStringList() << "qt"
+					 #ifdef TALKTALK_CORE_EPOLL
+						 << "epoll"
+					 #endif
+						 ;
+}
 
 QList<QCommandLineOption> TcpPlugin::cliOptions() const
 {
 	return QList<QCommandLineOption>()
 			<< QCommandLineOption("tcp-listen", "The IP address to listen on for TCP connections, 0.0.0.0 for all", "IP", "0.0.0.0")
-			<< QCommandLineOption("tcp-port", "The port to listen on for TCP connections", "PORT", "11101");
+			<< QCommandLineOption("tcp-port", "The port to listen on for TCP connections", "PORT", "11101")
+			<< QCommandLineOption("tcp-engine", "The engine to use for handling TCP connections. Possible values: " + engines().join(", "), "ENGINE", "qt")
+			<< QCommandLineOption("tcp-threads", "The number of worker threads TCP connections are spread across (epoll engine only)", "THREADS", QString::number(QThread::idealThreadCount()));
+}
+
+bool TcpPlugin::handleArguments(const QCommandLineParser &parser, int *exitCode) const
+{
+	if (!engines().contains(parser.value("tcp-engine")))
+	{
+		qWarning() << "TCP engine" << parser.value("tcp-engine") << "is not available";
+		return false;
+	}
+	return true;
 }
 
 QList<AbstractClientConnection *> TcpPlugin::clients(const QCommandLineParser &parser) const
 {
-	return QList<AbstractClientConnection *>() << new TcpServer(QHostAddress(parser.value("tcp-listen")), parser.value("tcp-port").toULong());
+	const QHostAddress address = QHostAddress(parser.value("tcp-listen"));
+	const quint16 port = parser.value("tcp-port").toULong();
+#ifdef TALKTALK_CORE_EPOLL
+	if (parser.value("tcp-engine") == "epoll")
+	{
+		return QList<AbstractClientConnection *>() << new EpollServer(address, port, parser.value("tcp-threads").toInt());
+	}
+#endif
+	return QList<AbstractClientConnection *>() << new TcpServer(address, port);
 }
@@ -6,6 +6,6 @@ class TcpPlugin : public Plugin
 {
 public:
 	QList<QCommandLineOption> cliOptions() const override;
-	bool handleArguments(const QCommandLineParser &parser) const override { return true; }
+	bool handleArguments(const QCommandLineParser &parser, int *exitCode) const override;
 	QList<AbstractClientConnection *> clients(const QCommandLineParser &parser) const override;
 };
@@ -3,6 +3,7 @@
 #include <QWebSocket>
 
 #include "common/Json.h"
+#include "common/JsonReader.h"
 #include "WebSocketServer.h"
 
 WebSocketClientConnection::WebSocketClientConnection(QWebSocket *socket, QObject *parent)
@@ -17,16 +18,30 @@ WebSocketClientConnection::WebSocketClientConnection(QWebSocket *socket, QObject
 	connect(m_socket, &QWebSocket::disconnected, this, &WebSocketClientConnection::disconnected);
 }
 
+void WebSocketClientConnection::ready()
+{
+	// by now we're on the thread of our worker
+	enableKeepalive();
+	enableSessions();
+}
+void WebSocketClientConnection::disconnectClient()
+{
+	if (m_socket)
+	{
+		m_socket->abort();
+	}
+}
+
 void WebSocketClientConnection::binaryReceived(const QByteArray &msg)
 {
 	QString channel;
 	int messageId;
 	try
 	{
-		const QJsonObject obj = Json::ensureObject(Json::ensureDocument(msg));
-		channel = Json::ensureString(obj, "channel");
-		messageId = Json::ensureInteger(obj, "messageId");
-		fromClient(obj);
+		const Json::LazyObject message(msg);
+		channel = Json::ensureString(message.value("channel"), Json::Required, "'channel'");
+		messageId = Json::ensureInteger(message.value("messageId"), Json::Required, "'messageId'");
+		fromClient(message);
 	}
 	catch (Exception &e)
 	{
@@ -42,7 +57,7 @@ void WebSocketClientConnection::disconnected()
 {
 	qCDebug(WebSocket) << WebSocketServer::formatAddress(m_socket->peerAddress(), m_socket->peerPort()) << "disconnected";
 	m_socket = nullptr;
-	deleteLater();
+	detach();
 }
 
 void WebSocketClientConnection::toClient(const QJsonObject &obj)
@@ -52,4 +67,11 @@ void WebSocketClientConnection::toClient(const QJsonObject &obj)
 		m_socket->sendTextMessage(Json::toText(obj));
 	}
 }
+void WebSocketClientConnection::messageToClient(const Message &message)
+{
+	if (m_socket && m_socket->state() == QAbstractSocket::ConnectedState)
+	{
+		m_socket->sendTextMessage(QString::fromUtf8(message.encoded(Message::Text)));
+	}
+}
 
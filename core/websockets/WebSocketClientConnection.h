@@ -12,6 +12,8 @@ class WebSocketClientConnection : public AbstractClientConnection
 public:
 	explicit WebSocketClientConnection(QWebSocket *socket, QObject *parent = nullptr);
 
+	void ready() override;
+
 private slots:
 	void binaryReceived(const QByteArray &msg);
 	void textReceived(const QString &msg);
@@ -19,6 +21,8 @@ private slots:
 
 protected:
 	void toClient(const QJsonObject &obj) override;
+	void messageToClient(const Message &message) override;
+	void disconnectClient() override;
 
 private:
 	QWebSocket *m_socket = nullptr;
@@ -4,6 +4,7 @@
 #include <QWebSocketServer>
 #include <QUrl>
 
+#include "core/WorkerPool.h"
 #include "WebSocketClientConnection.h"
 
 Q_LOGGING_CATEGORY(WebSocket, "core.websocket")
@@ -12,8 +13,8 @@ class WebSocketServerImpl : public QWebSocketServer
 {
 	Q_OBJECT
 public:
-	explicit WebSocketServerImpl(WebSocketServer *server, QObject *parent = nullptr)
-		: QWebSocketServer("", NonSecureMode, parent), m_server(server)
+	explicit WebSocketServerImpl(WebSocketServer *server, WorkerPool *workers, QObject *parent = nullptr)
+		: QWebSocketServer("", NonSecureMode, parent), m_server(server), m_workers(workers)
 	{
 		connect(this, &QWebSocketServer::newConnection, this, &WebSocketServerImpl::newConnectionReceived);
 	}
@@ -23,22 +24,30 @@ private slots:
 	{
 		while (hasPendingConnections())
 		{
-			emit m_server->newConnection(new WebSocketClientConnection(nextPendingConnection()));
+			// the handshake is done at this point, so the socket can be handed over to a worker in one piece
+			QWebSocket *socket = nextPendingConnection();
+			socket->setParent(nullptr);
+			WebSocketClientConnection *connection = new WebSocketClientConnection(socket);
+			const int worker = m_workers->assign(connection);
+			qCDebug(WebSocket) << "Assigned connection to worker" << worker << "now handling" << m_workers->load(worker) << "connections";
+			emit m_server->newConnection(connection);
 		}
 	}
 
 private:
 	WebSocketServer *m_server;
+	WorkerPool *m_workers;
 };
 
-WebSocketServer::WebSocketServer(const QHostAddress &address, const quint16 port, QObject *parent)
-	: AbstractClientConnection(parent), m_address(address), m_port(port)
+WebSocketServer::WebSocketServer(const QHostAddress &address, const quint16 port, const int threads, QObject *parent)
+	: AbstractClientConnection(parent), m_address(address), m_port(port), m_threads(threads)
 {
 }
 
 void WebSocketServer::ready()
 {
-	m_server = new WebSocketServerImpl(this, this);
+	m_workers = new WorkerPool("websocket", m_threads, this);
+	m_server = new WebSocketServerImpl(this, m_workers, this);
 	if (!m_server->listen(m_address, m_port))
 	{
 		qWarning(WebSocket) << "Unable to start WebSocket server:" << m_server->errorString();
@@ -46,7 +55,7 @@ void WebSocketServer::ready()
 	}
 	else
 	{
-		qCDebug(WebSocket) << "WebSocket server started on" << formatAddress(m_server->serverAddress(), m_server->serverPort());
+		qCDebug(WebSocket) << "WebSocket server started on" << formatAddress(m_server->serverAddress(), m_server->serverPort()) << "with" << m_workers->size() << "worker threads";
 	}
 }
 
@@ -7,7 +7,7 @@ class WebSocketServer : public AbstractClientConnection
 {
 	Q_OBJECT
 public:
-	explicit WebSocketServer(const QHostAddress &address, const quint16 port, QObject *parent = nullptr);
+	explicit WebSocketServer(const QHostAddress &address, const quint16 port, const int threads, QObject *parent = nullptr);
 
 	void ready() override;
 
@@ -17,8 +17,10 @@ private:
 	void toClient(const QJsonObject &obj) override {}
 	QHostAddress m_address;
 	quint16 m_port;
+	int m_threads;
 
 	class WebSocketServerImpl *m_server;
+	class WorkerPool *m_workers;
 };
 
 Q_DECLARE_LOGGING_CATEGORY(WebSocket)
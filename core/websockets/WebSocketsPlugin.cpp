@@ -1,15 +1,18 @@
 #include "WebSocketsPlugin.h"
 
+#include <QThread>
+
 #include "WebSocketServer.h"
 
 QList<QCommandLineOption> WebSocketsPlugin::cliOptions() const
 {
 	return QList<QCommandLineOption>()
 			<< QCommandLineOption("ws-listen", "The IP address to listen on for WebSocket connections, 0.0.0.0 for all", "IP", "0.0.0.0")
-			<< QCommandLineOption("ws-port", "The port to listen on for WebSocket connections", "PORT", "11102");
+			<< QCommandLineOption("ws-port", "The port to listen on for WebSocket connections", "PORT", "11102")
+			<< QCommandLineOption("ws-threads", "The number of worker threads WebSocket connections are spread across", "THREADS", QString::number(QThread::idealThreadCount()));
 }
 
 QList<AbstractClientConnection *> WebSocketsPlugin::clients(const QCommandLineParser &parser) const
 {
-	return QList<AbstractClientConnection *>() << new WebSocketServer(QHostAddress(parser.value("ws-listen")), parser.value("ws-port").toULong());
+	return QList<AbstractClientConnection *>() << new WebSocketServer(QHostAddress(parser.value("ws-listen")), parser.value("ws-port").toULong(), parser.value("ws-threads").toInt());
 }
@@ -6,6 +6,6 @@ class WebSocketsPlugin : public Plugin
 {
 public:
 	QList<QCommandLineOption> cliOptions() const override;
-	bool handleArguments(const QCommandLineParser &parser) const override { return true; }
+	bool handleArguments(const QCommandLineParser &parser, int *exitCode) const override { return true; }
 	QList<AbstractClientConnection *> clients(const QCommandLineParser &parser) const override;
 };
@@ -0,0 +1,209 @@
+#include <QTest>
+
+#include "core/backlog/BacklogRing.h"
+
+class BacklogRingTest : public QObject
+{
+	Q_OBJECT
+private slots:
+	void unknownChannel();
+	void newestFirst();
+	void keysetBounds_data();
+	void keysetBounds();
+	void evicted_data();
+	void evicted();
+	void equalTimestampsAcrossFloor();
+	void floorFromDatabase();
+	void contentsAfterCompaction();
+};
+
+static QVector<qint64> ids(const QVector<BacklogRing::Line> &lines)
+{
+	QVector<qint64> out;
+	for (const BacklogRing::Line &entry : lines)
+	{
+		out.append(entry.id);
+	}
+	return out;
+}
+
+static BacklogRing::Line line(const qint64 id, const qint64 timestamp)
+{
+	return {id, timestamp, QStringLiteral("source"), QStringLiteral("type"), QStringLiteral("content %1").arg(id)};
+}
+
+void BacklogRingTest::unknownChannel()
+{
+	BacklogRing ring(4);
+	QVector<BacklogRing::Line> lines;
+	QVERIFY(!ring.page(1, 0, 0, 0, 10, &lines));
+	QVERIFY(lines.isEmpty());
+}
+
+void BacklogRingTest::newestFirst()
+{
+	// ids are increasing but timestamps needn't be, pages are ordered by (timestamp, id)
+	BacklogRing ring(8);
+	ring.create(1, -1);
+	ring.append(1, line(1, 30));
+	ring.append(1, line(2, 10));
+	ring.append(1, line(3, 20));
+	ring.append(1, line(4, 20));
+
+	QVector<BacklogRing::Line> lines;
+	QVERIFY(ring.page(1, 0, 0, 0, 10, &lines));
+	QCOMPARE(ids(lines), QVector<qint64>({1, 4, 3, 2}));
+
+	lines.clear();
+	QVERIFY(ring.page(1, 0, 0, 0, 2, &lines));
+	QCOMPARE(ids(lines), QVector<qint64>({1, 4}));
+}
+
+void BacklogRingTest::keysetBounds_data()
+{
+	QTest::addColumn<qint64>("min");
+	QTest::addColumn<qint64>("max");
+	QTest::addColumn<qint64>("beforeId");
+	QTest::addColumn<QVector<qint64>>("expected");
+
+	// ids 1 to 6 with the timestamps 10, 20, 20, 20, 30 and 40
+	QTest::newRow("unbounded") << qint64(0) << qint64(0) << qint64(0) << QVector<qint64>({6, 5, 4, 3, 2, 1});
+	QTest::newRow("min is inclusive") << qint64(20) << qint64(0) << qint64(0) << QVector<qint64>({6, 5, 4, 3, 2});
+	QTest::newRow("before all of max") << qint64(0) << qint64(20) << qint64(0) << QVector<qint64>({1});
+	QTest::newRow("before an id at max") << qint64(0) << qint64(20) << qint64(4) << QVector<qint64>({3, 2, 1});
+	QTest::newRow("before the first id at max") << qint64(0) << qint64(20) << qint64(2) << QVector<qint64>({1});
+	QTest::newRow("past the last id at max") << qint64(0) << qint64(20) << qint64(100) << QVector<qint64>({4, 3, 2, 1});
+	QTest::newRow("between max values") << qint64(0) << qint64(25) << qint64(0) << QVector<qint64>({4, 3, 2, 1});
+	QTest::newRow("min and max") << qint64(20) << qint64(30) << qint64(0) << QVector<qint64>({4, 3, 2});
+	QTest::newRow("empty range") << qint64(30) << qint64(30) << qint64(0) << QVector<qint64>();
+	QTest::newRow("everything is older") << qint64(50) << qint64(0) << qint64(0) << QVector<qint64>();
+}
+void BacklogRingTest::keysetBounds()
+{
+	QFETCH(qint64, min);
+	QFETCH(qint64, max);
+	QFETCH(qint64, beforeId);
+	QFETCH(QVector<qint64>, expected);
+
+	BacklogRing ring(8);
+	ring.create(1, -1);
+	const qint64 timestamps[] = {10, 20, 20, 20, 30, 40};
+	for (int i = 0; i < 6; ++i)
+	{
+		ring.append(1, line(i + 1, timestamps[i]));
+	}
+
+	QVector<BacklogRing::Line> lines;
+	QVERIFY(ring.page(1, min, max, beforeId, 10, &lines));
+	QCOMPARE(ids(lines), expected);
+}
+
+void BacklogRingTest::evicted_data()
+{
+	QTest::addColumn<qint64>("min");
+	QTest::addColumn<qint64>("max");
+	QTest::addColumn<qint64>("beforeId");
+	QTest::addColumn<int>("amount");
+	QTest::addColumn<bool>("answered");
+	QTest::addColumn<QVector<qint64>>("expected");
+
+	// ids 3 to 6 with the timestamps 30 to 60 are left, the newest evicted timestamp is 20
+	QTest::newRow("full page") << qint64(0) << qint64(0) << qint64(0) << 2 << true << QVector<qint64>({6, 5});
+	QTest::newRow("exactly the ring") << qint64(0) << qint64(0) << qint64(0) << 4 << true << QVector<qint64>({6, 5, 4, 3});
+	QTest::newRow("more than the ring") << qint64(0) << qint64(0) << qint64(0) << 5 << false << QVector<qint64>();
+	QTest::newRow("min above the floor") << qint64(25) << qint64(0) << qint64(0) << 5 << true << QVector<qint64>({6, 5, 4, 3});
+	QTest::newRow("min at the floor") << qint64(20) << qint64(0) << qint64(0) << 5 << false << QVector<qint64>();
+	QTest::newRow("keyset within the ring") << qint64(0) << qint64(50) << qint64(0) << 2 << true << QVector<qint64>({4, 3});
+	QTest::newRow("keyset reaching past the ring") << qint64(0) << qint64(50) << qint64(0) << 3 << false << QVector<qint64>();
+	QTest::newRow("keyset past the ring") << qint64(0) << qint64(30) << qint64(0) << 1 << false << QVector<qint64>();
+	QTest::newRow("keyset past the ring, above min") << qint64(25) << qint64(30) << qint64(0) << 1 << true << QVector<qint64>();
+}
+void BacklogRingTest::evicted()
+{
+	QFETCH(qint64, min);
+	QFETCH(qint64, max);
+	QFETCH(qint64, beforeId);
+	QFETCH(int, amount);
+	QFETCH(bool, answered);
+	QFETCH(QVector<qint64>, expected);
+
+	BacklogRing ring(4);
+	ring.create(1, -1);
+	for (int i = 1; i <= 6; ++i)
+	{
+		ring.append(1, line(i, i * 10));
+	}
+
+	QVector<BacklogRing::Line> lines;
+	QCOMPARE(ring.page(1, min, max, beforeId, amount, &lines), answered);
+	if (answered)
+	{
+		QCOMPARE(ids(lines), expected);
+	}
+}
+
+void BacklogRingTest::equalTimestampsAcrossFloor()
+{
+	// the evicted line has the same timestamp, but a smaller id, so it only comes after what the ring has
+	BacklogRing ring(2);
+	ring.create(1, -1);
+	ring.append(1, line(1, 100));
+	ring.append(1, line(2, 100));
+	ring.append(1, line(3, 100));
+
+	QVector<BacklogRing::Line> lines;
+	QVERIFY(ring.page(1, 0, 0, 0, 2, &lines));
+	QCOMPARE(ids(lines), QVector<qint64>({3, 2}));
+
+	lines.clear();
+	QVERIFY(!ring.page(1, 0, 100, 2, 2, &lines));
+	QVERIFY(!ring.page(1, 0, 0, 0, 3, &lines));
+}
+
+void BacklogRingTest::floorFromDatabase()
+{
+	BacklogRing ring(4);
+	ring.create(1, 50);
+	ring.append(1, line(10, 60));
+	ring.append(1, line(11, 70));
+
+	QVector<BacklogRing::Line> lines;
+	QVERIFY(ring.page(1, 0, 0, 0, 2, &lines));
+	QCOMPARE(ids(lines), QVector<qint64>({11, 10}));
+	lines.clear();
+	QVERIFY(!ring.page(1, 0, 0, 0, 3, &lines));
+	QVERIFY(ring.page(1, 55, 0, 0, 3, &lines));
+	QCOMPARE(ids(lines), QVector<qint64>({11, 10}));
+}
+
+void BacklogRingTest::contentsAfterCompaction()
+{
+	BacklogRing ring(3);
+	ring.create(1, -1);
+	ring.create(2, -1);
+	for (int i = 1; i <= 100; ++i)
+	{
+		ring.append(1, {i, i, QStringLiteral("source %1").arg(i % 2), QStringLiteral("type"), QString::fromUtf8("\xc3\xa4 %1 ").arg(i).repeated(i % 7)});
+	}
+	ring.append(2, line(1000, 1));
+
+	QVector<BacklogRing::Line> lines;
+	QVERIFY(ring.page(1, 0, 0, 0, 3, &lines));
+	QCOMPARE(lines.size(), 3);
+	for (const BacklogRing::Line &entry : lines)
+	{
+		QCOMPARE(entry.timestamp, entry.id);
+		QCOMPARE(entry.source, QStringLiteral("source %1").arg(entry.id % 2));
+		QCOMPARE(entry.type, QStringLiteral("type"));
+		QCOMPARE(entry.content, QString::fromUtf8("\xc3\xa4 %1 ").arg(entry.id).repeated(int(entry.id % 7)));
+	}
+
+	lines.clear();
+	QVERIFY(ring.page(2, 0, 0, 0, 3, &lines));
+	QCOMPARE(ids(lines), QVector<qint64>({1000}));
+	QCOMPARE(lines.first().content, QStringLiteral("content 1000"));
+}
+
+QTEST_GUILESS_MAIN(BacklogRingTest)
+
+#include "BacklogRingTest.moc"
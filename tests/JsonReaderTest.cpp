@@ -0,0 +1,126 @@
+#include <QTest>
+#include <QJsonDocument>
+#include <QJsonObject>
+#include <QJsonArray>
+
+#include "common/JsonReader.h"
+#include "common/Json.h"
+
+class JsonReaderTest : public QObject
+{
+	Q_OBJECT
+private slots:
+	void members_data();
+	void members();
+	void missingMember();
+	void escapedKey();
+	void duplicateKey();
+	void invalid_data();
+	void invalid();
+	void utf8_data();
+	void utf8();
+};
+
+void JsonReaderTest::members_data()
+{
+	QTest::addColumn<QByteArray>("data");
+
+	QTest::newRow("empty") << QByteArray("{}");
+	QTest::newRow("whitespace") << QByteArray(" \r\n{ \"a\" :\t1 , \"b\"\n:\"x\" }\n ");
+	QTest::newRow("scalars") << QByteArray("{\"string\":\"s\",\"int\":-42,\"double\":1.5e3,\"true\":true,\"false\":false,\"null\":null}");
+	QTest::newRow("escapes") << QByteArray("{\"text\":\"a \\\"quoted\\\" \\\\ \\/ \\b\\f\\n\\r\\t \\u00e4 \\ud83d\\ude00\"}");
+	QTest::newRow("structurals in strings") << QByteArray("{\"a\":\"{[,:]}\",\"b\":\"}\",\"c\":\"\\\"}\\\\\"}");
+	// long enough that strings, escapes and nesting cross the 16 byte blocks of the index
+	QTest::newRow("across blocks") << QByteArray("{\"channel\":\"chat:channel:0123456789abcdef\",\"cmd\":\"msgs:get\",\"escaped\":\"0123456789abcd\\\\\\\"\\\\\",\"data\":{\"nested\":[1,{\"deep\":[\"}],\"]}],\"x\":{}},\"last\":[]}");
+	QTest::newRow("nested") << QByteArray("{\"object\":{\"a\":[1,2,{\"b\":null}]},\"array\":[[],[[]],{}],\"after\":1}");
+}
+void JsonReaderTest::members()
+{
+	QFETCH(QByteArray, data);
+
+	const QJsonObject expected = QJsonDocument::fromJson(data).object();
+	const Json::LazyObject lazy(data);
+	for (auto it = expected.constBegin(); it != expected.constEnd(); ++it)
+	{
+		const QByteArray key = it.key().toLatin1();
+		QVERIFY2(lazy.contains(key.constData()), key.constData());
+		QCOMPARE(lazy.value(key.constData()), it.value());
+	}
+	QCOMPARE(lazy.object(), expected);
+}
+
+void JsonReaderTest::missingMember()
+{
+	const Json::LazyObject lazy(QByteArray("{\"channel\":\"x\",\"data\":{\"cmd\":\"nested\"}}"));
+	QVERIFY(!lazy.contains("cmd"));
+	QVERIFY(lazy.value("cmd").isUndefined());
+	// prefixes of present keys don't match either
+	QVERIFY(!lazy.contains("chan"));
+}
+
+void JsonReaderTest::escapedKey()
+{
+	const Json::LazyObject lazy(QByteArray("{\"\\u0063md\":\"escaped\"}"));
+	QVERIFY(lazy.contains("cmd"));
+	QCOMPARE(lazy.value("cmd"), QJsonValue("escaped"));
+}
+
+void JsonReaderTest::duplicateKey()
+{
+	// like QJsonDocument, the last one wins
+	const QByteArray data("{\"cmd\":\"first\",\"cmd\":\"second\"}");
+	QCOMPARE(Json::LazyObject(data).value("cmd"), QJsonDocument::fromJson(data).object().value("cmd"));
+}
+
+void JsonReaderTest::invalid_data()
+{
+	QTest::addColumn<QByteArray>("data");
+
+	QTest::newRow("empty") << QByteArray();
+	QTest::newRow("array") << QByteArray("[1,2]");
+	QTest::newRow("string") << QByteArray("\"{}\"");
+	QTest::newRow("unterminated object") << QByteArray("{\"a\":1");
+	QTest::newRow("unterminated string") << QByteArray("{\"a\":\"1}");
+	QTest::newRow("missing colon") << QByteArray("{\"a\" 1}");
+	QTest::newRow("missing value") << QByteArray("{\"a\":}");
+	QTest::newRow("trailing comma") << QByteArray("{\"a\":1,}");
+	QTest::newRow("trailing garbage") << QByteArray("{\"a\":1} x");
+	QTest::newRow("unquoted key") << QByteArray("{a:1}");
+	QTest::newRow("invalid utf-8") << QByteArray("{\"a\":\"\xff\"}");
+	QTest::newRow("overlong utf-8") << QByteArray("{\"a\":\"\xc0\xaf\"}");
+	QTest::newRow("surrogate utf-8") << QByteArray("{\"a\":\"\xed\xa0\x80\"}");
+}
+void JsonReaderTest::invalid()
+{
+	QFETCH(QByteArray, data);
+
+	QVERIFY_EXCEPTION_THROWN(Json::LazyObject lazy(data), Json::JsonException);
+}
+
+void JsonReaderTest::utf8_data()
+{
+	QTest::addColumn<QByteArray>("data");
+	QTest::addColumn<bool>("valid");
+
+	QTest::newRow("ascii") << QByteArray("plain") << true;
+	QTest::newRow("two bytes") << QByteArray("\xc3\xa4") << true;
+	QTest::newRow("three bytes") << QByteArray("\xe2\x82\xac") << true;
+	QTest::newRow("four bytes") << QByteArray("\xf0\x9f\x98\x80") << true;
+	QTest::newRow("largest") << QByteArray("\xf4\x8f\xbf\xbf") << true;
+	QTest::newRow("above U+10FFFF") << QByteArray("\xf4\x90\x80\x80") << false;
+	QTest::newRow("overlong") << QByteArray("\xe0\x80\xaf") << false;
+	QTest::newRow("surrogate") << QByteArray("\xed\xbf\xbf") << false;
+	QTest::newRow("lone continuation") << QByteArray("a\x80") << false;
+	QTest::newRow("truncated") << QByteArray("\xe2\x82") << false;
+}
+void JsonReaderTest::utf8()
+{
+	QFETCH(QByteArray, data);
+	QFETCH(bool, valid);
+
+	QCOMPARE(Json::isValidUtf8(data.constData(), data.size()), valid);
+}
+
+QTEST_GUILESS_MAIN(JsonReaderTest)
+
+#include "JsonReaderTest.moc"
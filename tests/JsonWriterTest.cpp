@@ -0,0 +1,88 @@
+#include <QTest>
+#include <QJsonDocument>
+#include <QJsonObject>
+#include <QJsonArray>
+#include <QUuid>
+
+#include "common/JsonWriter.h"
+
+class JsonWriterTest : public QObject
+{
+	Q_OBJECT
+private slots:
+	void roundTrip_data();
+	void roundTrip();
+	void writerCalls();
+	void encodeMessage();
+};
+
+void JsonWriterTest::roundTrip_data()
+{
+	QTest::addColumn<QJsonObject>("object");
+
+	QTest::newRow("empty") << QJsonObject();
+	QTest::newRow("scalars") << QJsonObject{{"string", "a \"quoted\"\n\\ line"}, {"int", 42}, {"double", 0.5}, {"bool", true}, {"null", QJsonValue()}};
+	QTest::newRow("unicode") << QJsonObject{{"text", QString::fromUtf8("\xc3\xa4 \xe2\x82\xac \xf0\x9f\x98\x80 \x01")}};
+	QTest::newRow("array") << QJsonObject{{"channels", QJsonArray{"a", "b", "c"}}};
+	QTest::newRow("empty containers") << QJsonObject{{"array", QJsonArray()}, {"object", QJsonObject()}, {"after", 1}};
+	QTest::newRow("nested arrays") << QJsonObject{{"values", QJsonArray{1, QJsonArray{2, QJsonArray{3, 4}}, QJsonArray(), 5}}};
+	QTest::newRow("objects in arrays") << QJsonObject{
+										 {"messages", QJsonArray{QJsonObject{{"id", 1}, {"content", "first"}},
+																 QJsonObject{{"id", 2}, {"content", "second"}, {"tags", QJsonArray{"x"}}}}}};
+	QTest::newRow("nested objects") << QJsonObject{{"outer", QJsonObject{{"inner", QJsonObject{{"deepest", QJsonArray{QJsonObject()}}}}}}, {"last", "x"}};
+}
+void JsonWriterTest::roundTrip()
+{
+	QFETCH(QJsonObject, object);
+
+	// once as members of an object, once as a value of its own in an array
+	QByteArray buffer;
+	Json::Writer writer(buffer);
+	writer.beginArray().beginObject().members(object).endObject().value(QJsonValue(object)).endArray();
+
+	QJsonParseError error;
+	const QJsonDocument document = QJsonDocument::fromJson(buffer, &error);
+	QVERIFY2(error.error == QJsonParseError::NoError, qPrintable(error.errorString() + ": " + QString::fromUtf8(buffer)));
+	QCOMPARE(document.array(), QJsonArray({object, object}));
+}
+
+void JsonWriterTest::writerCalls()
+{
+	QByteArray buffer;
+	Json::Writer writer(buffer);
+	writer.beginObject()
+			.value("string", QStringLiteral("s"))
+			.value("int", 1)
+			.value("nested", QJsonValue(QJsonArray{1, QJsonObject{{"a", 2}}}))
+			.beginArray("array")
+				.value(QStringLiteral("x"))
+				.value(QJsonValue(QJsonArray{2}))
+				.beginObject().value("b", false).endObject()
+				.beginArray().endArray()
+			.endArray()
+			.beginObject("object").value("c", 0.25).endObject()
+			.endObject();
+	QCOMPARE(buffer, QByteArray("{\"string\":\"s\",\"int\":1,\"nested\":[1,{\"a\":2}],\"array\":[\"x\",[2],{\"b\":false},[]],\"object\":{\"c\":0.25}}"));
+}
+
+void JsonWriterTest::encodeMessage()
+{
+	const QUuid msgId = QUuid::createUuid();
+	const QUuid replyTo = QUuid::createUuid();
+	const QJsonObject data{{"messages", QJsonArray{QJsonObject{{"id", 1}}, QJsonObject{{"id", 2}}}}, {"cmd", "ignored"}};
+	QByteArray buffer;
+	Json::encodeMessage(buffer, "chat:channel:x", "more:reply", data, msgId, replyTo);
+
+	QJsonParseError error;
+	const QJsonObject object = QJsonDocument::fromJson(buffer, &error).object();
+	QVERIFY2(error.error == QJsonParseError::NoError, buffer.constData());
+	QCOMPARE(object.value("channel").toString(), QStringLiteral("chat:channel:x"));
+	QCOMPARE(object.value("cmd").toString(), QStringLiteral("more:reply"));
+	QCOMPARE(QUuid(object.value("msgId").toString()), msgId);
+	QCOMPARE(QUuid(object.value("replyTo").toString()), replyTo);
+	QCOMPARE(object.value("messages"), data.value("messages"));
+}
+
+QTEST_GUILESS_MAIN(JsonWriterTest)
+
+#include "JsonWriterTest.moc"
@@ -0,0 +1,152 @@
+#include <QTest>
+#include <QThread>
+#include <QVector>
+#include <QAtomicInt>
+#include <QElapsedTimer>
+#include <memory>
+
+#include "core/MpscQueue.h"
+
+namespace
+{
+class Producer : public QThread
+{
+public:
+	Producer(MpscQueue<qint64> *queue, const int producer, const int count)
+		: m_queue(queue), m_producer(producer), m_count(count)
+	{
+	}
+
+protected:
+	void run() override
+	{
+		for (int i = 0; i < m_count; ++i)
+		{
+			m_queue->push((qint64(m_producer) << 32) | i);
+		}
+	}
+
+private:
+	MpscQueue<qint64> *m_queue;
+	const int m_producer;
+	const int m_count;
+};
+
+QAtomicInt alive;
+struct Counted
+{
+	Counted() { alive.ref(); }
+	Counted(const Counted &) { alive.ref(); }
+	~Counted() { alive.deref(); }
+	Counted &operator=(const Counted &) = default;
+};
+}
+
+class MpscQueueTest : public QObject
+{
+	Q_OBJECT
+private slots:
+	void fifo();
+	void moveOnly();
+	void destroyUnpopped();
+	void producers();
+};
+
+void MpscQueueTest::fifo()
+{
+	MpscQueue<int> queue;
+	int value = -1;
+	QVERIFY(!queue.pop(&value));
+
+	queue.push(1);
+	queue.push(2);
+	QVERIFY(queue.pop(&value));
+	QCOMPARE(value, 1);
+	queue.push(3);
+	QVERIFY(queue.pop(&value));
+	QCOMPARE(value, 2);
+	QVERIFY(queue.pop(&value));
+	QCOMPARE(value, 3);
+	QVERIFY(!queue.pop(&value));
+	QCOMPARE(value, 3);
+}
+
+void MpscQueueTest::moveOnly()
+{
+	MpscQueue<std::unique_ptr<int>> queue;
+	queue.push(std::unique_ptr<int>(new int(42)));
+	std::unique_ptr<int> value;
+	QVERIFY(queue.pop(&value));
+	QVERIFY(value);
+	QCOMPARE(*value, 42);
+}
+
+void MpscQueueTest::destroyUnpopped()
+{
+	{
+		MpscQueue<Counted> queue;
+		for (int i = 0; i < 10; ++i)
+		{
+			queue.push(Counted());
+		}
+		Counted value;
+		QVERIFY(queue.pop(&value));
+	}
+	QCOMPARE(alive.load(), 0);
+}
+
+void MpscQueueTest::producers()
+{
+	const int producerCount = 4;
+	const int perProducer = 100000;
+
+	MpscQueue<qint64> queue;
+	QVector<Producer *> threads;
+	for (int i = 0; i < producerCount; ++i)
+	{
+		threads.append(new Producer(&queue, i, perProducer));
+	}
+	for (Producer *thread : threads)
+	{
+		thread->start();
+	}
+
+	// every producer's values have to come out complete and in the order it pushed them
+	QVector<int> next(producerCount, 0);
+	int received = 0;
+	bool ordered = true;
+	QElapsedTimer timer;
+	timer.start();
+	while (received < producerCount * perProducer && timer.elapsed() < 60000)
+	{
+		qint64 value;
+		if (!queue.pop(&value))
+		{
+			QThread::yieldCurrentThread();
+			continue;
+		}
+		const int producer = int(value >> 32);
+		const int index = int(value & 0xffffffff);
+		if (producer < 0 || producer >= producerCount || index != next[producer])
+		{
+			ordered = false;
+			break;
+		}
+		++next[producer];
+		++received;
+	}
+
+	for (Producer *thread : threads)
+	{
+		thread->wait();
+		delete thread;
+	}
+	QVERIFY(ordered);
+	QCOMPARE(received, producerCount * perProducer);
+	qint64 value;
+	QVERIFY(!queue.pop(&value));
+}
+
+QTEST_GUILESS_MAIN(MpscQueueTest)
+
+#include "MpscQueueTest.moc"
@@ -0,0 +1,132 @@
+#include <QTest>
+#include <QElapsedTimer>
+#include <QThread>
+
+#include "core/TimerWheel.h"
+
+class WheelThread : public QThread
+{
+public:
+	TimerWheel *wheel = nullptr;
+
+protected:
+	void run() override
+	{
+		wheel = TimerWheel::forCurrentThread();
+	}
+};
+
+class TimerWheelTest : public QObject
+{
+	Q_OBJECT
+private slots:
+	void perThread();
+	void notEarly();
+	void order();
+	void cancel();
+	void cancelFromCallback();
+	void scheduleFromCallback();
+	void cascade();
+};
+
+void TimerWheelTest::perThread()
+{
+	TimerWheel *wheel = TimerWheel::forCurrentThread();
+	QCOMPARE(TimerWheel::forCurrentThread(), wheel);
+
+	WheelThread thread;
+	thread.start();
+	QVERIFY(thread.wait(5000));
+	QVERIFY(thread.wheel);
+	QVERIFY(thread.wheel != wheel);
+}
+
+void TimerWheelTest::notEarly()
+{
+	TimerWheel *wheel = TimerWheel::forCurrentThread();
+	QElapsedTimer timer;
+	timer.start();
+	qint64 elapsed = -1;
+	wheel->schedule(250, [&elapsed, &timer]() { elapsed = timer.elapsed(); });
+	QTRY_VERIFY_WITH_TIMEOUT(elapsed >= 0, 5000);
+	QVERIFY2(elapsed >= 250, qPrintable(QString::number(elapsed)));
+}
+
+void TimerWheelTest::order()
+{
+	TimerWheel *wheel = TimerWheel::forCurrentThread();
+	QVector<int> fired;
+	wheel->schedule(450, [&fired]() { fired.append(3); });
+	wheel->schedule(0, [&fired]() { fired.append(0); });
+	wheel->schedule(250, [&fired]() { fired.append(2); });
+	wheel->schedule(100, [&fired]() { fired.append(1); });
+	QTRY_COMPARE_WITH_TIMEOUT(fired.size(), 4, 5000);
+	QCOMPARE(fired, QVector<int>({0, 1, 2, 3}));
+}
+
+void TimerWheelTest::cancel()
+{
+	TimerWheel *wheel = TimerWheel::forCurrentThread();
+	bool cancelled = false;
+	bool kept = false;
+	const TimerWheel::Id id = wheel->schedule(100, [&cancelled]() { cancelled = true; });
+	wheel->schedule(300, [&kept]() { kept = true; });
+	wheel->cancel(id);
+	QTRY_VERIFY_WITH_TIMEOUT(kept, 5000);
+	QVERIFY(!cancelled);
+
+	// cancelling something that already fired is harmless
+	wheel->cancel(id);
+}
+
+void TimerWheelTest::cancelFromCallback()
+{
+	// both are due on the same tick, whichever comes first cancels the other
+	TimerWheel *wheel = TimerWheel::forCurrentThread();
+	int fired = 0;
+	TimerWheel::Id first = 0;
+	TimerWheel::Id second = 0;
+	first = wheel->schedule(200, [&]() { ++fired; wheel->cancel(second); });
+	second = wheel->schedule(200, [&]() { ++fired; wheel->cancel(first); });
+	QTRY_COMPARE_WITH_TIMEOUT(fired, 1, 5000);
+	QTest::qWait(3 * TimerWheel::tickInterval);
+	QCOMPARE(fired, 1);
+}
+
+void TimerWheelTest::scheduleFromCallback()
+{
+	// the way a keepalive reschedules itself
+	TimerWheel *wheel = TimerWheel::forCurrentThread();
+	int fired = 0;
+	std::function<void()> again = [&]()
+	{
+		if (++fired < 3)
+		{
+			wheel->schedule(100, again);
+		}
+	};
+	wheel->schedule(100, again);
+	QTRY_COMPARE_WITH_TIMEOUT(fired, 3, 5000);
+	QTest::qWait(3 * TimerWheel::tickInterval);
+	QCOMPARE(fired, 3);
+}
+
+void TimerWheelTest::cascade()
+{
+	// past the end of the innermost level, so this one has to be moved down a level before it fires
+	TimerWheel *wheel = TimerWheel::forCurrentThread();
+	const qint64 msecs = 70 * TimerWheel::tickInterval;
+	QElapsedTimer timer;
+	timer.start();
+	qint64 elapsed = -1;
+	bool near = false;
+	wheel->schedule(msecs, [&elapsed, &timer]() { elapsed = timer.elapsed(); });
+	wheel->schedule(TimerWheel::tickInterval, [&near]() { near = true; });
+	QTRY_VERIFY_WITH_TIMEOUT(elapsed >= 0, int(msecs) + 5000);
+	QVERIFY(near);
+	QVERIFY2(elapsed >= msecs, qPrintable(QString::number(elapsed)));
+}
+
+QTEST_GUILESS_MAIN(TimerWheelTest)
+
+#include "TimerWheelTest.moc"